@@ -0,0 +1,577 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+/*
+ * Benchmarks of the hot paths of the core library and of the page painter.
+ *
+ * All the inputs are generated from fixed seeds, so the numbers of two runs
+ * can be compared. To get them in a machine readable form, use the output
+ * options of QTestLib, e.g.
+ *     corebenchmark -o corebenchmark.xml,xml
+ * or build the corebenchmark_results target, which does just that.
+ */
+
+#include <QtTest>
+
+#include <QImage>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QTemporaryDir>
+
+#include "../core/area.h"
+#include "../core/document.h"
+#include "../core/generator.h"
+#include "../core/observer.h"
+#include "../core/page.h"
+#include "../core/textpage.h"
+#include "../core/tile.h"
+#include "../core/tilesmanager_p.h"
+#include "../settings.h"
+#include "../ui/imageoperations.h"
+#include "../ui/pagepainter.h"
+
+Q_DECLARE_METATYPE( Okular::NormalizedRect )
+
+namespace
+{
+
+/**
+ * Reproducible sequence of pseudo random numbers, the same on every platform.
+ */
+class RandomSequence
+{
+    public:
+        explicit RandomSequence( quint32 seed )
+            : m_state( seed )
+        {
+        }
+
+        int next( int max )
+        {
+            m_state = m_state * 1103515245u + 12345u;
+            return ( m_state >> 16 ) % max;
+        }
+
+    private:
+        quint32 m_state;
+};
+
+static const char * const s_words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "document", "viewer", "page",
+    "render", "search", "Okular", "pixmap", "annotation", "text", "selection", "hyphen-",
+    "generator", "thread", "memory", "tile", "zoom", "rotation", "index", "layout"
+};
+static const int s_wordCount = sizeof( s_words ) / sizeof( s_words[0] );
+
+QStringList makeLines( int lineCount, int wordsPerLine, quint32 seed )
+{
+    RandomSequence random( seed );
+    QStringList lines;
+    for ( int l = 0; l < lineCount; ++l )
+    {
+        QStringList words;
+        for ( int w = 0; w < wordsPerLine; ++w )
+            words << QLatin1String( s_words[ random.next( s_wordCount ) ] );
+        lines << words.join( QLatin1Char( ' ' ) );
+    }
+    return lines;
+}
+
+/**
+ * A text page with one entity per character, laid out in lines like the
+ * text layer of a PDF page.
+ */
+Okular::TextPage *makeTextPage( const QStringList &lines )
+{
+    Okular::TextPage *textPage = new Okular::TextPage();
+    const double lineHeight = 1.0 / ( lines.count() + 1 );
+    for ( int l = 0; l < lines.count(); ++l )
+    {
+        const QString &line = lines.at( l );
+        const double charWidth = 0.9 / line.length();
+        for ( int c = 0; c < line.length(); ++c )
+        {
+            const double left = 0.05 + c * charWidth;
+            const double top = l * lineHeight;
+            textPage->append( line.mid( c, 1 ), new Okular::NormalizedRect( left, top, left + charWidth, top + lineHeight * 0.8 ) );
+        }
+    }
+    return textPage;
+}
+
+/**
+ * A 4K image with some text on it, the kind PagePainter works on.
+ */
+QImage makeImage( QImage::Format format )
+{
+    QImage image( 3840, 2160, format );
+    image.fill( Qt::white );
+    QPainter painter( &image );
+    const QStringList lines = makeLines( 60, 30, 5 );
+    for ( int l = 0; l < lines.count(); ++l )
+    {
+        painter.setPen( QColor::fromHsv( ( l * 37 ) % 360, 200, 120 + l ) );
+        painter.drawText( 20, ( l + 1 ) * 35, lines.at( l ) );
+    }
+    painter.end();
+    return image;
+}
+
+enum ImageOperation { Recolor, BlackWhite, Multiply, ScaleAlpha, ScaleNearest };
+
+// the plain loops PagePainter used before ImageOperations, to compare with
+void plainImageOperation( ImageOperation operation, QImage &image, QImage &scaled )
+{
+    switch ( operation )
+    {
+        case Recolor:
+        {
+            const QColor foreground( 255, 200, 0 ), background( 20, 20, 60 );
+            const float scaleRed = background.redF() - foreground.redF();
+            const float scaleGreen = background.greenF() - foreground.greenF();
+            const float scaleBlue = background.blueF() - foreground.blueF();
+            for ( int y = 0; y < image.height(); y++ )
+            {
+                QRgb *pixels = reinterpret_cast<QRgb*>( image.scanLine( y ) );
+                for ( int x = 0; x < image.width(); x++ )
+                {
+                    const int lightness = qGray( pixels[x] );
+                    pixels[x] = qRgba( scaleRed * lightness + foreground.red(),
+                                       scaleGreen * lightness + foreground.green(),
+                                       scaleBlue * lightness + foreground.blue(),
+                                       qAlpha( pixels[x] ) );
+                }
+            }
+            break;
+        }
+        case BlackWhite:
+        {
+            unsigned int * data = (unsigned int *)image.bits();
+            int val, pixels = image.width() * image.height(), con = 4, thr = 127;
+            for ( int i = 0; i < pixels; ++i )
+            {
+                val = qGray( data[i] );
+                if ( val > thr )
+                    val = 128 + (127 * (val - thr)) / (255 - thr);
+                else if ( val < thr )
+                    val = (128 * val) / thr;
+                if ( con > 2 )
+                {
+                    val = con * ( val - thr ) / 2 + thr;
+                    if ( val > 255 )
+                        val = 255;
+                    else if ( val < 0 )
+                        val = 0;
+                }
+                data[i] = qRgba( val, val, val, 255 );
+            }
+            break;
+        }
+        case Multiply:
+        {
+            unsigned int * data = (unsigned int *)image.bits();
+            const int rh = 255, gh = 255, bh = 0;
+            for ( int i = 0; i < image.width() * image.height(); ++i )
+            {
+                const int val = data[i];
+                data[i] = qRgba( (qRed(val) * rh) / 255, (qGreen(val) * gh) / 255, (qBlue(val) * bh) / 255, 255 );
+            }
+            break;
+        }
+        case ScaleAlpha:
+        {
+            unsigned int * data = (unsigned int *)image.bits();
+            const unsigned int destAlpha = 100;
+            for ( int i = 0; i < image.width() * image.height(); ++i )
+            {
+                const int source = data[i];
+                int sourceAlpha = qAlpha( source );
+                if ( sourceAlpha == 255 )
+                    sourceAlpha = destAlpha;
+                else
+                    sourceAlpha = ( destAlpha * sourceAlpha + ( ( destAlpha * sourceAlpha ) >> 8 ) + 0x80 ) >> 8;
+                data[i] = qRgba( qRed(source), qGreen(source), qBlue(source), sourceAlpha );
+            }
+            break;
+        }
+        case ScaleNearest:
+        {
+            // the whole source was converted every time
+            const QImage srcImage = image.convertToFormat( QImage::Format_ARGB32_Premultiplied );
+            const unsigned int * srcData = (const unsigned int *)srcImage.bits();
+            scaled = QImage( 2560, 1440, QImage::Format_ARGB32_Premultiplied );
+            unsigned int * destData = (unsigned int *)scaled.bits();
+            for ( int y = 0; y < scaled.height(); y++ )
+            {
+                const unsigned int srcOffset = image.width() * ( ( y * image.height() ) / 1440 );
+                for ( int x = 0; x < scaled.width(); x++ )
+                    (*destData++) = srcData[ srcOffset + ( x * image.width() ) / 2560 ];
+            }
+            break;
+        }
+    }
+}
+
+void imageOperation( ImageOperation operation, QImage &image, QImage &scaled )
+{
+    switch ( operation )
+    {
+        case Recolor:
+            ImageOperations::recolor( image, QColor( 255, 200, 0 ), QColor( 20, 20, 60 ) );
+            break;
+        case BlackWhite:
+            ImageOperations::blackWhite( image, 4, 127 );
+            break;
+        case Multiply:
+            ImageOperations::multiply( image, image.rect(), QColor( 255, 255, 0 ), false );
+            break;
+        case ScaleAlpha:
+            ImageOperations::scaleAlpha( image, 100 );
+            break;
+        case ScaleNearest:
+            ImageOperations::scaleNearest( scaled, image, 2560, 1440, QRect( 0, 0, 2560, 1440 ), QImage::Format_ARGB32_Premultiplied );
+            break;
+    }
+}
+
+}
+
+class CoreBenchmark : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+
+        void benchmarkOpenDocument_data();
+        void benchmarkOpenDocument();
+        void benchmarkTextPageConstruction_data();
+        void benchmarkTextPageConstruction();
+        void benchmarkCorrectTextOrder_data();
+        void benchmarkCorrectTextOrder();
+        void benchmarkFindText_data();
+        void benchmarkFindText();
+        void benchmarkRequestPixmaps_data();
+        void benchmarkRequestPixmaps();
+        void benchmarkTilesSetPixmap();
+        void benchmarkTilesAt_data();
+        void benchmarkTilesAt();
+        void benchmarkPaintCroppedPage_data();
+        void benchmarkPaintCroppedPage();
+        void benchmarkImageOperations_data();
+        void benchmarkImageOperations();
+
+    private:
+        QString writePdf( const QString &name, int pageCount );
+
+        QTemporaryDir m_dataDir;
+        QString m_textFile;
+        QString m_pdfFile;
+        QString m_largePdfFile;
+};
+
+void CoreBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled( true );
+    // Don't pollute people's okular settings
+    Okular::Settings::instance( QStringLiteral("corebenchmark") );
+    // only measure opening the documents
+    Okular::SettingsCore::setTextIndex( false );
+
+    QVERIFY( m_dataDir.isValid() );
+
+    m_textFile = m_dataDir.path() + QStringLiteral("/synthetic.txt");
+    QFile textFile( m_textFile );
+    QVERIFY( textFile.open( QIODevice::WriteOnly ) );
+    textFile.write( makeLines( 20000, 12, 1 ).join( QLatin1Char( '\n' ) ).toUtf8() );
+    textFile.close();
+
+    m_pdfFile = writePdf( QStringLiteral("synthetic.pdf"), 50 );
+    m_largePdfFile = writePdf( QStringLiteral("large.pdf"), 2000 );
+}
+
+QString CoreBenchmark::writePdf( const QString &name, int pageCount )
+{
+    const QString fileName = m_dataDir.path() + QLatin1Char( '/' ) + name;
+    QPdfWriter writer( fileName );
+    writer.setCreator( QStringLiteral("corebenchmark") );
+    QPainter painter( &writer );
+    const QStringList lines = makeLines( 40, 10, 2 );
+    const int lineHeight = painter.viewport().height() / ( lines.count() + 1 );
+    for ( int p = 0; p < pageCount; ++p )
+    {
+        if ( p > 0 )
+            writer.newPage();
+        for ( int l = 0; l < lines.count(); ++l )
+            painter.drawText( 0, ( l + 1 ) * lineHeight, lines.at( ( l + p ) % lines.count() ) );
+    }
+    painter.end();
+    return fileName;
+}
+
+void CoreBenchmark::benchmarkOpenDocument_data()
+{
+    QTest::addColumn<QString>( "fileName" );
+
+    QTest::newRow( "txt" ) << m_textFile;
+    QTest::newRow( "pdf" ) << m_pdfFile;
+    QTest::newRow( "pdf, 2000 pages" ) << m_largePdfFile;
+    QTest::newRow( "epub" ) << QStringLiteral(KDESRCDIR "data/contents.epub");
+}
+
+void CoreBenchmark::benchmarkOpenDocument()
+{
+    QFETCH( QString, fileName );
+
+    QMimeDatabase db;
+    const QMimeType mime = db.mimeTypeForFile( fileName );
+    Okular::Document document( 0 );
+
+    if ( document.openDocument( fileName, QUrl::fromLocalFile( fileName ), mime ) != Okular::Document::OpenSuccess )
+        QSKIP( "No generator available for this document" );
+    document.closeDocument();
+
+    QBENCHMARK
+    {
+        document.openDocument( fileName, QUrl::fromLocalFile( fileName ), mime );
+        document.closeDocument();
+    }
+}
+
+void CoreBenchmark::benchmarkTextPageConstruction_data()
+{
+    QTest::addColumn<int>( "lineCount" );
+
+    QTest::newRow( "10 lines" ) << 10;
+    QTest::newRow( "60 lines" ) << 60;
+    QTest::newRow( "200 lines" ) << 200;
+}
+
+void CoreBenchmark::benchmarkTextPageConstruction()
+{
+    QFETCH( int, lineCount );
+
+    const QStringList lines = makeLines( lineCount, 12, 3 );
+    QBENCHMARK
+    {
+        delete makeTextPage( lines );
+    }
+}
+
+void CoreBenchmark::benchmarkCorrectTextOrder_data()
+{
+    benchmarkTextPageConstruction_data();
+}
+
+void CoreBenchmark::benchmarkCorrectTextOrder()
+{
+    QFETCH( int, lineCount );
+
+    // setTextPage() corrects the text order, the construction of the text
+    // page is included, see benchmarkTextPageConstruction() for its cost
+    const QStringList lines = makeLines( lineCount, 12, 3 );
+    QBENCHMARK
+    {
+        Okular::Page page( 0, 1000, 1414, Okular::Rotation0 );
+        page.setTextPage( makeTextPage( lines ) );
+    }
+}
+
+void CoreBenchmark::benchmarkFindText_data()
+{
+    QTest::addColumn<QString>( "query" );
+    QTest::addColumn<bool>( "caseSensitive" );
+
+    QTest::newRow( "frequent word" ) << QStringLiteral("page") << true;
+    QTest::newRow( "frequent word, any case" ) << QStringLiteral("OKULAR") << false;
+    QTest::newRow( "phrase" ) << QStringLiteral("memory tile") << true;
+    QTest::newRow( "no match" ) << QStringLiteral("okular2") << false;
+}
+
+void CoreBenchmark::benchmarkFindText()
+{
+    QFETCH( QString, query );
+    QFETCH( bool, caseSensitive );
+
+    Okular::Page page( 0, 1000, 1414, Okular::Rotation0 );
+    page.setTextPage( makeTextPage( makeLines( 60, 12, 4 ) ) );
+    const Qt::CaseSensitivity cs = caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive;
+
+    // highlight all the matches, as the 'all document' search does
+    QBENCHMARK
+    {
+        Okular::RegularAreaRect *match = page.findText( 0, query, Okular::FromTop, cs );
+        while ( match )
+        {
+            Okular::RegularAreaRect *next = page.findText( 0, query, Okular::NextResult, cs, match );
+            delete match;
+            match = next;
+        }
+    }
+}
+
+void CoreBenchmark::benchmarkRequestPixmaps_data()
+{
+    QTest::addColumn<int>( "requestCount" );
+
+    QTest::newRow( "100 requests" ) << 100;
+    QTest::newRow( "2000 requests" ) << 2000;
+}
+
+void CoreBenchmark::benchmarkRequestPixmaps()
+{
+    QFETCH( int, requestCount );
+
+    QMimeDatabase db;
+    Okular::Document document( 0 );
+    if ( document.openDocument( m_largePdfFile, QUrl::fromLocalFile( m_largePdfFile ), db.mimeTypeForFile( m_largePdfFile ) ) != Okular::Document::OpenSuccess )
+        QSKIP( "No generator available for PDF documents" );
+
+    Okular::DocumentObserver observer;
+    document.addObserver( &observer );
+
+    // queueing the requests, replacing the ones of the previous iteration,
+    // and starting the first one is measured, not the rendering
+    QBENCHMARK
+    {
+        QLinkedList< Okular::PixmapRequest * > requests;
+        for ( int i = 0; i < requestCount; ++i )
+            requests << new Okular::PixmapRequest( &observer, i % document.pages(), 100, 141, ( i * 7 ) % 10, Okular::PixmapRequest::Asynchronous );
+        document.requestPixmaps( requests, Okular::Document::RemoveAllPrevious );
+    }
+
+    document.removeObserver( &observer );
+    document.closeDocument();
+}
+
+void CoreBenchmark::benchmarkTilesSetPixmap()
+{
+    const int width = 4000, height = 5656;
+    const Okular::NormalizedRect wholePage( 0, 0, 1, 1 );
+    Okular::TilesManager tilesManager( 0, width, height );
+    QPixmap pixmap( width, height );
+    pixmap.fill( Qt::white );
+
+    QBENCHMARK
+    {
+        tilesManager.setRequest( wholePage, width, height );
+        tilesManager.setPixmap( &pixmap, wholePage );
+    }
+}
+
+void CoreBenchmark::benchmarkTilesAt_data()
+{
+    QTest::addColumn<Okular::NormalizedRect>( "rect" );
+
+    QTest::newRow( "whole page" ) << Okular::NormalizedRect( 0, 0, 1, 1 );
+    QTest::newRow( "viewport" ) << Okular::NormalizedRect( 0.2, 0.3, 0.7, 0.6 );
+}
+
+void CoreBenchmark::benchmarkTilesAt()
+{
+    QFETCH( Okular::NormalizedRect, rect );
+
+    const int width = 4000, height = 5656;
+    const Okular::NormalizedRect wholePage( 0, 0, 1, 1 );
+    Okular::TilesManager tilesManager( 0, width, height );
+    QPixmap pixmap( width, height );
+    pixmap.fill( Qt::white );
+    tilesManager.setRequest( wholePage, width, height );
+    tilesManager.setPixmap( &pixmap, wholePage );
+
+    QBENCHMARK
+    {
+        const QList< Okular::Tile > tiles = tilesManager.tilesAt( rect, Okular::TilesManager::PixmapTile );
+        QVERIFY( !tiles.isEmpty() );
+    }
+}
+
+void CoreBenchmark::benchmarkPaintCroppedPage_data()
+{
+    QTest::addColumn<int>( "scaledWidth" );
+    QTest::addColumn<int>( "scaledHeight" );
+    QTest::addColumn<Okular::NormalizedRect>( "crop" );
+    QTest::addColumn<int>( "flags" );
+
+    const Okular::NormalizedRect wholePage( 0, 0, 1, 1 );
+    QTest::newRow( "pixmap size" ) << 1000 << 1414 << wholePage << 0;
+    QTest::newRow( "scaled" ) << 1500 << 2121 << wholePage << 0;
+    QTest::newRow( "cropped" ) << 1000 << 1414 << Okular::NormalizedRect( 0.1, 0.1, 0.9, 0.9 ) << 0;
+    QTest::newRow( "accessibility" ) << 1000 << 1414 << wholePage << (int)PagePainter::Accessibility;
+}
+
+void CoreBenchmark::benchmarkPaintCroppedPage()
+{
+    QFETCH( int, scaledWidth );
+    QFETCH( int, scaledHeight );
+    QFETCH( Okular::NormalizedRect, crop );
+    QFETCH( int, flags );
+
+    Okular::DocumentObserver observer;
+    Okular::Page page( 0, 1000, 1414, Okular::Rotation0 );
+    QPixmap *pixmap = new QPixmap( 1000, 1414 );
+    pixmap->fill( Qt::white );
+    page.setPixmap( &observer, pixmap );
+
+    const QRect limits = crop.geometry( scaledWidth, scaledHeight ).translated( -crop.geometry( scaledWidth, scaledHeight ).topLeft() );
+    QImage target( limits.size(), QImage::Format_ARGB32_Premultiplied );
+
+    QBENCHMARK
+    {
+        QPainter painter( &target );
+        PagePainter::paintCroppedPageOnPainter( &painter, &page, &observer, flags, scaledWidth, scaledHeight, limits, crop, 0 );
+    }
+
+    page.deletePixmap( &observer );
+}
+
+void CoreBenchmark::benchmarkImageOperations_data()
+{
+    QTest::addColumn<int>( "operation" );
+    QTest::addColumn<int>( "format" );
+    QTest::addColumn<bool>( "plain" );
+
+    const char * const names[] = { "recolor", "black and white", "multiply", "scale alpha", "scale nearest" };
+    const QImage::Format formats[] = { QImage::Format_ARGB32_Premultiplied, QImage::Format_ARGB32_Premultiplied,
+                                       QImage::Format_ARGB32_Premultiplied, QImage::Format_ARGB32, QImage::Format_RGB32 };
+    for ( int op = Recolor; op <= ScaleNearest; ++op )
+    {
+        QTest::newRow( QByteArray( QByteArray( names[op] ) + ", plain loop" ).constData() ) << op << (int)formats[op] << true;
+        QTest::newRow( QByteArray( QByteArray( names[op] ) + ", ImageOperations" ).constData() ) << op << (int)formats[op] << false;
+    }
+}
+
+void CoreBenchmark::benchmarkImageOperations()
+{
+    QFETCH( int, operation );
+    QFETCH( int, format );
+    QFETCH( bool, plain );
+
+    const QImage original = makeImage( (QImage::Format)format );
+
+    // both give the same result
+    QImage plainImage = original, plainScaled;
+    plainImageOperation( (ImageOperation)operation, plainImage, plainScaled );
+    QImage image = original, scaled;
+    imageOperation( (ImageOperation)operation, image, scaled );
+    QCOMPARE( image, plainImage );
+    QCOMPARE( scaled, plainScaled );
+
+    QBENCHMARK
+    {
+        image = original;
+        if ( plain )
+            plainImageOperation( (ImageOperation)operation, image, scaled );
+        else
+            imageOperation( (ImageOperation)operation, image, scaled );
+    }
+}
+
+QTEST_MAIN( CoreBenchmark )
+#include "corebenchmark.moc"
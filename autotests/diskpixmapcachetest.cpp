@@ -0,0 +1,220 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QPainter>
+#include <QPixmap>
+#include <QTemporaryDir>
+
+#include "../core/diskpixmapcache_p.h"
+#include "../core/generator.h"
+
+// enough for a few of the test pixmaps
+#define CACHE_SIZE ( 1024 * 1024 )
+
+class DiskPixmapCacheTest
+: public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void init();
+        void testRoundTrip();
+        void testKey();
+        void testRemovePage();
+        void testChangedDocument();
+        void testMaximumSize();
+
+    private:
+        static QPixmap testPixmap( const QColor &color );
+        static QImage load( Okular::DiskPixmapCache *cache, int page, int width, int height );
+
+        QTemporaryDir m_dir;
+        QString m_fileName;
+};
+
+QPixmap DiskPixmapCacheTest::testPixmap( const QColor &color )
+{
+    QImage image( 64, 32, QImage::Format_ARGB32_Premultiplied );
+    image.fill( color );
+    QPainter p( &image );
+    p.fillRect( 0, 0, 16, 16, Qt::black );
+    p.end();
+    return QPixmap::fromImage( image );
+}
+
+// Reads back the image of the page, null if there is none
+QImage DiskPixmapCacheTest::load( Okular::DiskPixmapCache *cache, int page, int width, int height )
+{
+    Okular::PixmapRequest request( 0, page, width, height, 1, Okular::PixmapRequest::NoFeature );
+
+    bool loaded = false;
+    QImage image;
+    QMetaObject::Connection connection = QObject::connect( cache, &Okular::DiskPixmapCache::pixmapLoaded,
+        [&]( Okular::PixmapRequest *r, const QPixmap &pixmap ) {
+            if ( r != &request )
+                return;
+            loaded = true;
+            image = pixmap.toImage();
+        } );
+
+    cache->load( &request, Okular::Rotation0 );
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while ( !loaded && elapsed.elapsed() < 5000 )
+        QTest::qWait( 10 );
+    QObject::disconnect( connection );
+
+    return image;
+}
+
+void DiskPixmapCacheTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled( true );
+
+    m_fileName = m_dir.path() + QStringLiteral( "/document.txt" );
+    QFile file( m_fileName );
+    QVERIFY( file.open( QIODevice::WriteOnly ) );
+    file.write( "document" );
+}
+
+void DiskPixmapCacheTest::init()
+{
+    QDir( QStandardPaths::writableLocation( QStandardPaths::GenericCacheLocation ) + QStringLiteral( "/okular/pixmaps" ) ).removeRecursively();
+}
+
+// Test that the pixmaps stored in a session are read back in the next one
+void DiskPixmapCacheTest::testRoundTrip()
+{
+    const QPixmap pixmap = testPixmap( Qt::red );
+
+    Okular::DiskPixmapCache cache;
+    cache.setMaximumSize( CACHE_SIZE );
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    QVERIFY( cache.isOpen() );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+
+    cache.store( 0, Okular::Rotation0, pixmap );
+    QVERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+    cache.close();
+    QVERIFY( !cache.isOpen() );
+
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    QTRY_VERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+
+    const QImage image = load( &cache, 0, 64, 32 );
+    QCOMPARE( image.convertToFormat( QImage::Format_ARGB32 ), pixmap.toImage().convertToFormat( QImage::Format_ARGB32 ) );
+
+    // there is nothing at other sizes
+    QVERIFY( load( &cache, 0, 32, 16 ).isNull() );
+}
+
+// Test that the images are told apart by everything they are rendered with
+void DiskPixmapCacheTest::testKey()
+{
+    Okular::DiskPixmapCache cache;
+    cache.setMaximumSize( CACHE_SIZE );
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    cache.store( 0, Okular::Rotation0, testPixmap( Qt::red ) );
+
+    QVERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+    QVERIFY( !cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+    QVERIFY( !cache.contains( 0, 32, 64, Okular::Rotation0 ) );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation90 ) );
+
+    cache.setRenderHints( 1 );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+    cache.setRenderHints( 0 );
+    QVERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+
+    // the same document rendered by another generator
+    cache.close();
+    cache.open( m_fileName, QStringLiteral( "other" ) );
+    QTest::qWait( 500 );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+}
+
+void DiskPixmapCacheTest::testRemovePage()
+{
+    Okular::DiskPixmapCache cache;
+    cache.setMaximumSize( CACHE_SIZE );
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    cache.store( 0, Okular::Rotation0, testPixmap( Qt::red ) );
+    cache.store( 1, Okular::Rotation0, testPixmap( Qt::green ) );
+    cache.close();
+
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    QTRY_VERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) && cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+    cache.removePage( 0 );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+    cache.close();
+
+    // the files are gone too
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    QTRY_VERIFY( cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+
+    cache.clear();
+    QVERIFY( !cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+}
+
+// Test that the images of a document are not used once it changes
+void DiskPixmapCacheTest::testChangedDocument()
+{
+    const QString fileName = m_dir.path() + QStringLiteral( "/changed.txt" );
+    QFile file( fileName );
+    QVERIFY( file.open( QIODevice::WriteOnly ) );
+    file.write( "document" );
+    file.close();
+
+    Okular::DiskPixmapCache cache;
+    cache.setMaximumSize( CACHE_SIZE );
+    cache.open( fileName, QStringLiteral( "test" ) );
+    cache.store( 0, Okular::Rotation0, testPixmap( Qt::red ) );
+    cache.close();
+
+    QVERIFY( file.open( QIODevice::Append ) );
+    file.write( " changed" );
+    file.close();
+
+    cache.open( fileName, QStringLiteral( "test" ) );
+    QTest::qWait( 500 );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+}
+
+// Test that the least recently used images are removed to fit the maximum size
+void DiskPixmapCacheTest::testMaximumSize()
+{
+    Okular::DiskPixmapCache cache;
+    cache.setMaximumSize( CACHE_SIZE );
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    cache.store( 0, Okular::Rotation0, testPixmap( Qt::red ) );
+    cache.store( 1, Okular::Rotation0, testPixmap( Qt::green ) );
+    cache.close();
+
+    cache.open( m_fileName, QStringLiteral( "test" ) );
+    QTRY_VERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) && cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+
+    // reading it back makes the first one the most recently used
+    QVERIFY( !load( &cache, 0, 64, 32 ).isNull() );
+
+    // room for one image only
+    const qulonglong imageSize = 64 * 32 * 4;
+    cache.setMaximumSize( imageSize + imageSize / 2 );
+    QVERIFY( cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+    QVERIFY( !cache.contains( 1, 64, 32, Okular::Rotation0 ) );
+
+    cache.setMaximumSize( 0 );
+    QVERIFY( !cache.contains( 0, 64, 32, Okular::Rotation0 ) );
+}
+
+QTEST_MAIN( DiskPixmapCacheTest )
+#include "diskpixmapcachetest.moc"
@@ -11,9 +11,11 @@
 
 #include <threadweaver/queue.h>
 
+#include "../core/annotations.h"
 #include "../core/document.h"
 #include "../core/generator.h"
 #include "../core/observer.h"
+#include "../core/page.h"
 #include "../core/rotationjob_p.h"
 #include "../settings_core.h"
 
@@ -24,8 +26,21 @@ class DocumentTest
 
     private slots:
         void testCloseDuringRotationJob();
+        void testAnnotationOnAppendedPage();
 };
 
+// Waits for the generator to stop adding pages to the document
+static void waitForAppendedPages( Okular::Document *document )
+{
+    int pages;
+    do
+    {
+        pages = document->pages();
+        QTest::qWait( 1000 );
+    }
+    while ( document->pages() != pages );
+}
+
 // Test that we don't crash if the document is closed while a RotationJob
 // is enqueued/running
 void DocumentTest::testCloseDuringRotationJob()
@@ -59,5 +74,47 @@ void DocumentTest::testCloseDuringRotationJob()
     qApp->processEvents();
 }
 
+// Test that the annotations of a page added by the generator after opening
+// the document are restored when the page is added
+void DocumentTest::testAnnotationOnAppendedPage()
+{
+    QStandardPaths::setTestModeEnabled( true );
+    Okular::SettingsCore::instance( QStringLiteral("documenttest") );
+
+    // plain text is laid out a few pages at a time
+    QTemporaryDir dir;
+    const QString testFile = dir.path() + QStringLiteral("/long.txt");
+    QFile file( testFile );
+    QVERIFY( file.open( QIODevice::WriteOnly ) );
+    for ( int i = 0; i < 20000; ++i )
+        file.write( QStringLiteral("Line %1 of a long text document\n").arg( i ).toLatin1() );
+    file.close();
+
+    QMimeDatabase db;
+    const QMimeType mime = db.mimeTypeForName( QStringLiteral("text/plain") );
+
+    Okular::Document *m_document = new Okular::Document( 0 );
+    QCOMPARE( m_document->openDocument( testFile, QUrl(), mime ), Okular::Document::OpenSuccess );
+    const uint openedPages = m_document->pages();
+    waitForAppendedPages( m_document );
+    const int lastPage = m_document->pages() - 1;
+    QVERIFY( lastPage >= (int)openedPages );
+
+    Okular::Annotation *annot = new Okular::TextAnnotation();
+    annot->setBoundingRectangle( Okular::NormalizedRect( 0.1, 0.1, 0.15, 0.15 ) );
+    annot->setContents( QStringLiteral("annot contents") );
+    m_document->addPageAnnotation( lastPage, annot );
+    m_document->closeDocument();
+
+    QCOMPARE( m_document->openDocument( testFile, QUrl(), mime ), Okular::Document::OpenSuccess );
+    QVERIFY( lastPage >= (int)m_document->pages() );
+    waitForAppendedPages( m_document );
+    QCOMPARE( (int)m_document->pages(), lastPage + 1 );
+    QCOMPARE( m_document->page( lastPage )->annotations().count(), 1 );
+    QCOMPARE( m_document->page( lastPage )->annotations().first()->contents(), QStringLiteral("annot contents") );
+
+    delete m_document;
+}
+
 QTEST_MAIN( DocumentTest )
 #include "documenttest.moc"
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include "../core/observer.h"
+#include "../core/pixmapcache_p.h"
+
+// An observer that doesn't let the given pages be unloaded, like the
+// visible ones of a view
+class PinningObserver : public Okular::DocumentObserver
+{
+    public:
+        bool canUnloadPixmap( int page ) const override
+        {
+            return !pinnedPages.contains( page );
+        }
+
+        QSet< int > pinnedPages;
+};
+
+class PixmapCacheTest
+: public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testMemory();
+        void testLeastRecentlyUsed();
+        void testEvictionCandidate();
+        void testEvictionWindow();
+        void testBudget();
+};
+
+void PixmapCacheTest::testMemory()
+{
+    PinningObserver first, second;
+    Okular::PixmapCache cache;
+    QVERIFY( cache.isEmpty() );
+
+    cache.insert( &first, 0, 100 );
+    cache.insert( &first, 1, 200 );
+    cache.insert( &second, 0, 50 );
+    QCOMPARE( cache.totalMemory(), 350ull );
+
+    // a new pixmap for the same page replaces the old one
+    cache.insert( &first, 1, 20 );
+    QCOMPARE( cache.totalMemory(), 170ull );
+
+    cache.setMemory( cache.leastRecentlyUsed( &second ), 10 );
+    QCOMPARE( cache.totalMemory(), 130ull );
+
+    cache.remove( &first, 0 );
+    QCOMPARE( cache.totalMemory(), 30ull );
+
+    // removing what isn't there does nothing
+    cache.remove( &first, 5 );
+    QCOMPARE( cache.totalMemory(), 30ull );
+
+    cache.removeObserver( &second );
+    QCOMPARE( cache.totalMemory(), 20ull );
+    QVERIFY( !cache.leastRecentlyUsed( &second ) );
+
+    cache.clear();
+    QVERIFY( cache.isEmpty() );
+    QCOMPARE( cache.totalMemory(), 0ull );
+}
+
+void PixmapCacheTest::testLeastRecentlyUsed()
+{
+    PinningObserver observer;
+    Okular::PixmapCache cache;
+
+    cache.insert( &observer, 1, 10 );
+    cache.insert( &observer, 2, 10 );
+    cache.insert( &observer, 3, 10 );
+    cache.touch( &observer, 1 );
+    // touching what isn't there does nothing
+    cache.touch( &observer, 4 );
+
+    QList< int > pages;
+    for ( Okular::PixmapCache::Entry *entry = cache.leastRecentlyUsed( &observer ); entry; entry = entry->newer )
+        pages << entry->page;
+    QCOMPARE( pages, QList< int >() << 2 << 3 << 1 );
+
+    // inserting again makes it the most recently used too
+    cache.insert( &observer, 2, 10 );
+    QCOMPARE( cache.leastRecentlyUsed( &observer )->page, 3 );
+}
+
+void PixmapCacheTest::testEvictionCandidate()
+{
+    PinningObserver first, second;
+    Okular::PixmapCache cache;
+    QVERIFY( !cache.evictionCandidate( 0, false ) );
+
+    for ( int page = 0; page < 6; ++page )
+        cache.insert( &first, page, 10 );
+    cache.insert( &second, 8, 10 );
+
+    // the farthest from the viewport among the observers
+    Okular::PixmapCache::Entry *entry = cache.evictionCandidate( 0, false );
+    QVERIFY( entry );
+    QCOMPARE( entry->observer, static_cast< Okular::DocumentObserver * >( &second ) );
+    QCOMPARE( entry->page, 8 );
+
+    entry = cache.evictionCandidate( 0, false, &first );
+    QVERIFY( entry );
+    QCOMPARE( entry->page, 5 );
+
+    entry = cache.evictionCandidate( 7, false );
+    QVERIFY( entry );
+    QCOMPARE( entry->page, 0 );
+
+    // the pages the observer holds on to are skipped, if asked to
+    first.pinnedPages << 5 << 4;
+    entry = cache.evictionCandidate( 0, true, &first );
+    QVERIFY( entry );
+    QCOMPARE( entry->page, 3 );
+
+    entry = cache.evictionCandidate( 0, false, &first );
+    QVERIFY( entry );
+    QCOMPARE( entry->page, 5 );
+
+    first.pinnedPages << 0 << 1 << 2 << 3;
+    QVERIFY( !cache.evictionCandidate( 0, true, &first ) );
+}
+
+void PixmapCacheTest::testEvictionWindow()
+{
+    PinningObserver observer;
+    Okular::PixmapCache cache;
+
+    for ( int page = 0; page < 20; ++page )
+        cache.insert( &observer, page, 10 );
+
+    // only the least recently used entries are candidates, so the most
+    // recently used ones are kept even if they are far from the viewport
+    Okular::PixmapCache::Entry *entry = cache.evictionCandidate( 0, false );
+    QVERIFY( entry );
+    QVERIFY( entry->page < 10 );
+    QVERIFY( entry->page > 0 );
+
+    entry = cache.evictionCandidate( 19, false );
+    QVERIFY( entry );
+    QCOMPARE( entry->page, 0 );
+
+    // the pages that can't be unloaded don't take the place of others
+    for ( int page = 0; page < 10; ++page )
+        observer.pinnedPages << page;
+    entry = cache.evictionCandidate( 0, true );
+    QVERIFY( entry );
+    QVERIFY( entry->page >= 10 );
+}
+
+void PixmapCacheTest::testBudget()
+{
+    PinningObserver observer;
+    Okular::PixmapCache cache;
+
+    // no budget until the document computes one
+    cache.insert( &observer, 0, 100 );
+    cache.insert( &observer, 1, 50 );
+    QCOMPARE( cache.excess(), 0ull );
+
+    cache.setBudget( 100 );
+    QCOMPARE( cache.budget(), 100ull );
+    QCOMPARE( cache.excess(), 50ull );
+
+    cache.remove( &observer, 1 );
+    QCOMPARE( cache.excess(), 0ull );
+
+    cache.setBudget( 0 );
+    QCOMPARE( cache.excess(), 100ull );
+}
+
+QTEST_MAIN( PixmapCacheTest )
+#include "pixmapcachetest.moc"
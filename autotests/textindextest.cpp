@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <QtTest>
+
+#include <QFontDatabase>
+#include <QMimeDatabase>
+#include <QTemporaryDir>
+
+#include "../core/document.h"
+#include "../settings_core.h"
+
+Q_DECLARE_METATYPE(Okular::Document::SearchStatus)
+
+// The TextIndex is internal to okularcore, so its lookups are tested through
+// the searches of a document once the index has been built and saved
+class TextIndexTest
+: public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+        void init();
+        void cleanup();
+        void testSearch_data();
+        void testSearch();
+
+    private:
+        QString docDataDir() const;
+
+        QTemporaryDir m_dir;
+        Okular::Document *m_document;
+};
+
+QString TextIndexTest::docDataDir() const
+{
+    return QStandardPaths::writableLocation( QStandardPaths::GenericDataLocation ) + QStringLiteral( "/okular/docdata" );
+}
+
+void TextIndexTest::initTestCase()
+{
+    // the text documents can only be indexed while they are read if their
+    // text can be extracted from several threads
+    if ( !QFontDatabase::supportsThreadedFontRendering() )
+        QSKIP( "The text documents are not threaded on this platform" );
+
+    qRegisterMetaType<Okular::Document::SearchStatus>();
+    QStandardPaths::setTestModeEnabled( true );
+    Okular::SettingsCore::instance( QStringLiteral("textindextest") );
+    Okular::SettingsCore::setTextIndex( true );
+
+    // the words far enough from each other to be on different pages
+    QFile file( m_dir.path() + QStringLiteral( "/textindextest.txt" ) );
+    QVERIFY( file.open( QIODevice::WriteOnly ) );
+    QTextStream stream( &file );
+    stream << "Alpha first\n";
+    for ( int i = 0; i < 300; ++i )
+        stream << "filler\n";
+    stream << "bravo second\n";
+}
+
+void TextIndexTest::init()
+{
+    QDir( docDataDir() ).removeRecursively();
+
+    const QString fileName = m_dir.path() + QStringLiteral( "/textindextest.txt" );
+    QMimeDatabase db;
+    m_document = new Okular::Document( 0 );
+    QCOMPARE( m_document->openDocument( fileName, QUrl::fromLocalFile( fileName ), db.mimeTypeForFile( fileName ) ), Okular::Document::OpenSuccess );
+    QVERIFY( m_document->pages() > 1 );
+
+    // the index is saved once it is ready
+    QTRY_VERIFY_WITH_TIMEOUT( !QDir( docDataDir() ).entryList( QStringList() << QStringLiteral( "*.index" ), QDir::Files ).isEmpty(), 20000 );
+}
+
+void TextIndexTest::cleanup()
+{
+    m_document->closeDocument();
+    delete m_document;
+}
+
+void TextIndexTest::testSearch_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<int>("status");
+
+    QTest::newRow("word") << QStringLiteral("bravo") << (int)Okular::Document::GoogleAll << (int)Okular::Document::MatchFound;
+    QTest::newRow("case folded") << QStringLiteral("ALPHA") << (int)Okular::Document::GoogleAll << (int)Okular::Document::MatchFound;
+    QTest::newRow("part of a word") << QStringLiteral("lph") << (int)Okular::Document::GoogleAll << (int)Okular::Document::MatchFound;
+    QTest::newRow("missing word") << QStringLiteral("charlie") << (int)Okular::Document::GoogleAll << (int)Okular::Document::NoMatchFound;
+    QTest::newRow("words of a page") << QStringLiteral("alpha first") << (int)Okular::Document::GoogleAll << (int)Okular::Document::MatchFound;
+    QTest::newRow("all words of different pages") << QStringLiteral("alpha second") << (int)Okular::Document::GoogleAll << (int)Okular::Document::NoMatchFound;
+    QTest::newRow("any word of different pages") << QStringLiteral("charlie second") << (int)Okular::Document::GoogleAny << (int)Okular::Document::MatchFound;
+}
+
+void TextIndexTest::testSearch()
+{
+    QFETCH(QString, text);
+    QFETCH(int, type);
+    QFETCH(int, status);
+
+    QSignalSpy spy( m_document, SIGNAL(searchFinished(int,Okular::Document::SearchStatus)) );
+    m_document->searchText( 0, text, true, Qt::CaseInsensitive, (Okular::Document::SearchType)type, false, Qt::yellow );
+    QTRY_COMPARE( spy.count(), 1 );
+    QCOMPARE( (int)spy.at( 0 ).at( 1 ).value<Okular::Document::SearchStatus>(), status );
+}
+
+QTEST_MAIN( TextIndexTest )
+#include "textindextest.moc"
@@ -36,6 +36,7 @@ DlgPerformance::DlgPerformance( QWidget * parent )
     m_dlg->memoryLevelGroup->setId(m_dlg->normalRadio, 1);
     m_dlg->memoryLevelGroup->setId(m_dlg->aggressiveRadio, 2);
     m_dlg->memoryLevelGroup->setId(m_dlg->greedyRadio, 3);
+    m_dlg->memoryLevelGroup->setId(m_dlg->adaptiveRadio, 4);
 
 
     connect(m_dlg->memoryLevelGroup, static_cast<void(QButtonGroup::*)(int)>(&QButtonGroup::buttonClicked),
@@ -64,6 +65,9 @@ void DlgPerformance::radioGroup_changed( int which )
 	    // xgettext: no-c-format
             m_dlg->descLabel->setText( i18n("Loads and keeps everything in memory. Preload all pages. (Will use at maximum 50% of your total memory or your free memory, whatever is bigger.)"));
             break;
+        case 4:
+            m_dlg->descLabel->setText( i18n("Grows and shrinks the memory used following the memory available, honoring container limits and reacting to memory pressure. Preload next pages.") );
+            break;
     }
 }
 
@@ -0,0 +1,536 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "diskpixmapcache_p.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+#include <threadweaver/job.h>
+#include <threadweaver/queue.h>
+
+#include "debug_p.h"
+#include "generator.h"
+
+#define CACHE_FILE_MAGIC 0x58504b4f // "OKPX"
+#define CACHE_FILE_VERSION 1
+
+using namespace Okular;
+
+namespace {
+
+struct CacheFileHeader
+{
+    quint32 magic;
+    quint32 version;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+};
+
+QString cacheRoot()
+{
+    return QStandardPaths::writableLocation( QStandardPaths::GenericCacheLocation ) + QStringLiteral("/okular/pixmaps");
+}
+
+qulonglong directorySize( const QString &path )
+{
+    qulonglong size = 0;
+    const QFileInfoList files = QDir( path ).entryInfoList( QDir::Files );
+    foreach ( const QFileInfo &file, files )
+        size += file.size();
+    return size;
+}
+
+QImage readImage( const QString &fileName, int width, int height )
+{
+    QImage image;
+    QFile file( fileName );
+    if ( file.open( QIODevice::ReadOnly ) && file.size() >= (qint64)sizeof( CacheFileHeader ) )
+    {
+        uchar *data = file.map( 0, file.size() );
+        if ( data )
+        {
+            CacheFileHeader header;
+            memcpy( &header, data, sizeof( header ) );
+
+            if ( header.magic == CACHE_FILE_MAGIC && header.version == CACHE_FILE_VERSION &&
+                 header.width == width && header.height == height &&
+                 header.format > QImage::Format_Invalid && header.format < QImage::NImageFormats &&
+                 header.bytesPerLine > 0 &&
+                 file.size() >= (qint64)sizeof( header ) + (qint64)header.bytesPerLine * header.height )
+            {
+                // the image only wraps the mapped pixels, detach it before unmapping
+                image = QImage( data + sizeof( header ), header.width, header.height, header.bytesPerLine, (QImage::Format)header.format ).copy();
+            }
+
+            file.unmap( data );
+        }
+    }
+    return image;
+}
+
+}
+
+class DiskPixmapCache::StoreJob : public ThreadWeaver::Job
+{
+    public:
+        StoreJob( DiskPixmapCache *cache, const Key &key, const QString &fileName, const QImage &image )
+            : m_cache( cache ), m_key( key ), m_fileName( fileName ), m_image( image )
+        {
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            qulonglong size = 0;
+
+            QSaveFile file( m_fileName );
+            if ( file.open( QIODevice::WriteOnly ) )
+            {
+                CacheFileHeader header;
+                header.magic = CACHE_FILE_MAGIC;
+                header.version = CACHE_FILE_VERSION;
+                header.width = m_image.width();
+                header.height = m_image.height();
+                header.bytesPerLine = m_image.bytesPerLine();
+                header.format = m_image.format();
+
+                const qint64 dataSize = (qint64)m_image.bytesPerLine() * m_image.height();
+                if ( file.write( reinterpret_cast< const char * >( &header ), sizeof( header ) ) == sizeof( header ) &&
+                     file.write( reinterpret_cast< const char * >( m_image.constBits() ), dataSize ) == dataSize &&
+                     file.commit() )
+                {
+                    size = sizeof( header ) + dataSize;
+                }
+            }
+
+            if ( !size )
+                qCDebug(OkularCoreDebug) << "Could not write the cached pixmap" << m_fileName;
+
+            m_cache->stored( m_key, size );
+        }
+
+    private:
+        DiskPixmapCache *m_cache;
+        Key m_key;
+        QString m_fileName;
+        QImage m_image;
+};
+
+class DiskPixmapCache::LoadJob : public ThreadWeaver::Job
+{
+    public:
+        LoadJob( DiskPixmapCache *cache, PixmapRequest *request, const Key &key, const QString &fileName )
+            : m_cache( cache ), m_request( request ), m_key( key ), m_fileName( fileName )
+        {
+        }
+
+        // someone is waiting for it, unlike for the images to write
+        int priority() const override
+        {
+            return 1;
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            m_cache->loaded( m_request, m_key, readImage( m_fileName, m_key.width, m_key.height ) );
+        }
+
+    private:
+        DiskPixmapCache *m_cache;
+        PixmapRequest *m_request;
+        Key m_key;
+        QString m_fileName;
+};
+
+class DiskPixmapCache::ScanJob : public ThreadWeaver::Job
+{
+    public:
+        ScanJob( DiskPixmapCache *cache, const QString &directory )
+            : m_cache( cache ), m_directory( directory )
+        {
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            m_cache->scan( m_directory );
+        }
+
+    private:
+        DiskPixmapCache *m_cache;
+        QString m_directory;
+};
+
+bool DiskPixmapCache::Key::operator==( const Key &other ) const
+{
+    return page == other.page && width == other.width && height == other.height &&
+           rotation == other.rotation && hints == other.hints;
+}
+
+namespace Okular {
+
+uint qHash( const DiskPixmapCache::Key &key, uint seed )
+{
+    return ::qHash( key.page, seed ) ^ ::qHash( ( key.width << 16 ) ^ key.height, seed ) ^
+           ::qHash( ( (uint)key.rotation << 30 ) ^ key.hints, seed );
+}
+
+}
+
+DiskPixmapCache::DiskPixmapCache()
+    : m_hints( 0 ), m_maximumSize( 0 ), m_otherSize( 0 ), m_totalSize( 0 ), m_useCounter( 0 ),
+      m_queue( new ThreadWeaver::Queue )
+{
+    // one writer is enough to keep up with the evictions
+    m_queue->setMaximumNumberOfThreads( 1 );
+}
+
+DiskPixmapCache::~DiskPixmapCache()
+{
+    close();
+    delete m_queue;
+}
+
+void DiskPixmapCache::open( const QString &fileName, const QString &generatorName )
+{
+    close();
+
+    const QFileInfo info( fileName );
+    if ( !info.exists() )
+        return;
+
+    // any change to the document gives it a new directory
+    QCryptographicHash hash( QCryptographicHash::Sha1 );
+    hash.addData( info.canonicalFilePath().toUtf8() );
+    hash.addData( QByteArray::number( info.size() ) );
+    hash.addData( QByteArray::number( info.lastModified().toMSecsSinceEpoch() ) );
+    hash.addData( generatorName.toUtf8() );
+
+    const QString directory = cacheRoot() + QLatin1Char('/') + QString::fromLatin1( hash.result().toHex() );
+    if ( !QDir().mkpath( directory ) )
+    {
+        qCWarning(OkularCoreDebug) << "Could not create the pixmap cache directory" << directory;
+        return;
+    }
+
+    m_mutex.lock();
+    m_directory = directory;
+    m_mutex.unlock();
+
+    // pick up the previous sessions in the background
+    m_queue->enqueue( ThreadWeaver::JobPointer( new ScanJob( this, directory ) ) );
+}
+
+void DiskPixmapCache::close()
+{
+    m_queue->dequeue();
+    m_queue->finish();
+
+    QMutexLocker locker( &m_mutex );
+
+    // the requests whose job was dequeued still get their answer
+    foreach ( PixmapRequest *request, m_loading )
+    {
+        Loaded loaded = { request, QImage() };
+        m_loaded.append( loaded );
+    }
+    if ( !m_loading.isEmpty() )
+        QMetaObject::invokeMethod( this, "announceLoaded", Qt::QueuedConnection );
+    m_loading.clear();
+
+    m_directory.clear();
+    m_entries.clear();
+    m_pending.clear();
+    m_otherSize = 0;
+    m_totalSize = 0;
+}
+
+bool DiskPixmapCache::isOpen() const
+{
+    QMutexLocker locker( &m_mutex );
+    return !m_directory.isEmpty();
+}
+
+void DiskPixmapCache::setMaximumSize( qulonglong bytes )
+{
+    QMutexLocker locker( &m_mutex );
+    m_maximumSize = bytes;
+    trim();
+}
+
+void DiskPixmapCache::setRenderHints( uint hints )
+{
+    QMutexLocker locker( &m_mutex );
+    m_hints = hints;
+}
+
+bool DiskPixmapCache::contains( int page, int width, int height, Rotation rotation ) const
+{
+    QMutexLocker locker( &m_mutex );
+    const Key key = { page, width, height, rotation, m_hints };
+    return m_pending.contains( key ) || m_entries.contains( key );
+}
+
+void DiskPixmapCache::store( int page, Rotation rotation, const QPixmap &pixmap )
+{
+    if ( pixmap.isNull() )
+        return;
+
+    QMutexLocker locker( &m_mutex );
+    if ( m_directory.isEmpty() )
+        return;
+
+    const Key key = { page, pixmap.width(), pixmap.height(), rotation, m_hints };
+    if ( m_pending.contains( key ) )
+        return;
+
+    QHash< Key, Entry >::iterator it = m_entries.find( key );
+    if ( it != m_entries.end() )
+    {
+        // the same image is already on disk
+        it.value().lastUse = ++m_useCounter;
+        return;
+    }
+
+    // pixmaps can only be used in the GUI thread, with the raster paint
+    // engine this shares the pixels rather than copying them
+    const QImage image = pixmap.toImage();
+    m_pending.insert( key, image );
+    m_queue->enqueue( ThreadWeaver::JobPointer( new StoreJob( this, key, filePath( key ), image ) ) );
+}
+
+void DiskPixmapCache::load( PixmapRequest *request, Rotation rotation )
+{
+    QMutexLocker locker( &m_mutex );
+    const Key key = { request->pageNumber(), request->width(), request->height(), rotation, m_hints };
+
+    QHash< Key, Entry >::iterator it = m_entries.find( key );
+    if ( it != m_entries.end() && !m_pending.contains( key ) )
+    {
+        it.value().lastUse = ++m_useCounter;
+        m_loading.append( request );
+        m_queue->enqueue( ThreadWeaver::JobPointer( new LoadJob( this, request, key, filePath( key ) ) ) );
+        return;
+    }
+
+    // not written yet, but we have the image at hand, or there is none
+    Loaded loaded = { request, m_pending.value( key ) };
+    m_loaded.append( loaded );
+    QMetaObject::invokeMethod( this, "announceLoaded", Qt::QueuedConnection );
+}
+
+void DiskPixmapCache::removePage( int page )
+{
+    QList< Key > keys;
+    {
+        QMutexLocker locker( &m_mutex );
+
+        QHash< Key, QImage >::iterator pIt = m_pending.begin();
+        while ( pIt != m_pending.end() )
+        {
+            if ( pIt.key().page == page )
+                pIt = m_pending.erase( pIt );
+            else
+                ++pIt;
+        }
+
+        QHash< Key, Entry >::const_iterator it = m_entries.constBegin(), itEnd = m_entries.constEnd();
+        for ( ; it != itEnd; ++it )
+        {
+            if ( it.key().page == page )
+                keys.append( it.key() );
+        }
+    }
+
+    removeFiles( keys );
+}
+
+void DiskPixmapCache::clear()
+{
+    QMutexLocker locker( &m_mutex );
+    if ( m_directory.isEmpty() )
+        return;
+
+    // images being written are discarded once stored
+    m_pending.clear();
+    m_entries.clear();
+    m_totalSize = 0;
+
+    const QFileInfoList files = QDir( m_directory ).entryInfoList( QDir::Files );
+    foreach ( const QFileInfo &file, files )
+        QFile::remove( file.absoluteFilePath() );
+}
+
+QString DiskPixmapCache::filePath( const Key &key ) const
+{
+    return m_directory + QStringLiteral("/%1-%2x%3-%4-%5.okpx")
+        .arg( key.page ).arg( key.width ).arg( key.height ).arg( (int)key.rotation )
+        .arg( key.hints, 8, 16, QLatin1Char('0') );
+}
+
+void DiskPixmapCache::stored( const Key &key, qulonglong size )
+{
+    QMutexLocker locker( &m_mutex );
+
+    // removed (or the cache cleared) while we were writing it
+    if ( !m_pending.remove( key ) )
+    {
+        if ( size )
+            QFile::remove( filePath( key ) );
+        return;
+    }
+
+    if ( !size )
+        return;
+
+    Entry entry;
+    entry.size = size;
+    entry.lastUse = ++m_useCounter;
+    m_entries.insert( key, entry );
+    m_totalSize += size;
+
+    trim();
+}
+
+void DiskPixmapCache::loaded( PixmapRequest *request, const Key &key, const QImage &image )
+{
+    if ( image.isNull() )
+    {
+        qCDebug(OkularCoreDebug) << "Discarding the unreadable cached pixmap of page" << key.page;
+        removeFiles( QList< Key >() << key );
+    }
+
+    QMutexLocker locker( &m_mutex );
+    m_loading.removeOne( request );
+    Loaded loaded = { request, image };
+    m_loaded.append( loaded );
+
+    QMetaObject::invokeMethod( this, "announceLoaded", Qt::QueuedConnection );
+}
+
+void DiskPixmapCache::announceLoaded()
+{
+    m_mutex.lock();
+    QList< Loaded > loaded;
+    loaded.swap( m_loaded );
+    m_mutex.unlock();
+
+    // pixmaps can only be created in the GUI thread
+    foreach ( const Loaded &l, loaded )
+        emit pixmapLoaded( l.request, QPixmap::fromImage( l.image ) );
+}
+
+void DiskPixmapCache::scan( const QString &directory )
+{
+    // our own images, least recently written first
+    QList< QPair< Key, qulonglong > > found;
+    const QFileInfoList files = QDir( directory ).entryInfoList( QStringList() << QStringLiteral("*.okpx"), QDir::Files, QDir::Time | QDir::Reversed );
+    foreach ( const QFileInfo &file, files )
+    {
+        // <page>-<width>x<height>-<rotation>-<hints>.okpx
+        const QStringList parts = file.completeBaseName().split( QLatin1Char('-') );
+        const QStringList size = parts.value( 1 ).split( QLatin1Char('x') );
+        bool ok[5];
+        const Key key = { parts.value( 0 ).toInt( &ok[0] ),
+                          size.value( 0 ).toInt( &ok[1] ),
+                          size.value( 1 ).toInt( &ok[2] ),
+                          (Rotation)parts.value( 2 ).toInt( &ok[3] ),
+                          parts.value( 3 ).toUInt( &ok[4], 16 ) };
+        if ( parts.count() != 4 || size.count() != 2 || !ok[0] || !ok[1] || !ok[2] || !ok[3] || !ok[4] ||
+             key.rotation < Rotation0 || key.rotation > Rotation270 )
+        {
+            QFile::remove( file.absoluteFilePath() );
+            continue;
+        }
+        found.append( qMakePair( key, (qulonglong)file.size() ) );
+    }
+
+    // the other documents, least recently used first
+    QList< QPair< QString, qulonglong > > others;
+    qulonglong otherSize = 0;
+    const QFileInfoList directories = QDir( cacheRoot() ).entryInfoList( QDir::Dirs | QDir::NoDotAndDotDot, QDir::Time | QDir::Reversed );
+    foreach ( const QFileInfo &dir, directories )
+    {
+        if ( dir.absoluteFilePath() == QFileInfo( directory ).absoluteFilePath() )
+            continue;
+        const qulonglong size = directorySize( dir.absoluteFilePath() );
+        others.append( qMakePair( dir.absoluteFilePath(), size ) );
+        otherSize += size;
+    }
+
+    QMutexLocker locker( &m_mutex );
+    if ( m_directory != directory )
+        return;
+
+    for ( int i = 0; i < found.count(); ++i )
+    {
+        if ( m_entries.contains( found.at( i ).first ) )
+            continue;
+
+        Entry entry;
+        entry.size = found.at( i ).second;
+        entry.lastUse = ++m_useCounter;
+        m_entries.insert( found.at( i ).first, entry );
+        m_totalSize += entry.size;
+    }
+
+    // make room by dropping whole documents first
+    for ( int i = 0; i < others.count() && otherSize + m_totalSize > m_maximumSize; ++i )
+    {
+        QDir( others.at( i ).first ).removeRecursively();
+        otherSize -= others.at( i ).second;
+    }
+    m_otherSize = otherSize;
+
+    trim();
+}
+
+void DiskPixmapCache::removeFiles( const QList< Key > &keys )
+{
+    QMutexLocker locker( &m_mutex );
+    foreach ( const Key &key, keys )
+    {
+        QHash< Key, Entry >::iterator it = m_entries.find( key );
+        if ( it == m_entries.end() )
+            continue;
+
+        m_totalSize -= it.value().size;
+        m_entries.erase( it );
+        QFile::remove( filePath( key ) );
+    }
+}
+
+void DiskPixmapCache::trim()
+{
+    while ( m_otherSize + m_totalSize > m_maximumSize && !m_entries.isEmpty() )
+    {
+        QHash< Key, Entry >::iterator oldest = m_entries.begin();
+        for ( QHash< Key, Entry >::iterator it = m_entries.begin(); it != m_entries.end(); ++it )
+        {
+            if ( it.value().lastUse < oldest.value().lastUse )
+                oldest = it;
+        }
+
+        QFile::remove( filePath( oldest.key() ) );
+        m_totalSize -= oldest.value().size;
+        m_entries.erase( oldest );
+    }
+}
+
+#include "moc_diskpixmapcache_p.cpp"
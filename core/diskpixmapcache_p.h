@@ -0,0 +1,181 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_DISKPIXMAPCACHE_P_H_
+#define _OKULAR_DISKPIXMAPCACHE_P_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+#include <QtGui/QPixmap>
+
+#include "global.h"
+
+namespace ThreadWeaver {
+class Queue;
+}
+
+namespace Okular {
+
+class PixmapRequest;
+
+/**
+ * @short Second level cache of the rendered pages, on disk.
+ *
+ * When the document evicts a page pixmap from memory, its image is handed
+ * to this cache and written to disk by a background job; when the
+ * same page is requested again at the same size, the image is read back by
+ * a background job too, instead of asking the generator to render it again.
+ *
+ * Every document gets its own directory below the cache location, named
+ * after the document file, its size and modification time and the
+ * generator rendering it, so stale entries are never used after the file
+ * changes. Each image is a small header followed by the raw pixels, which
+ * are mapped in memory when loading.
+ *
+ * Entries are identified by page, size, rotation and the render hints
+ * (antialiasing, paper color, ...) they were rendered with. When the cache
+ * grows over its maximum size, the least recently used images are removed.
+ */
+class DiskPixmapCache : public QObject
+{
+    Q_OBJECT
+
+    public:
+        DiskPixmapCache();
+        ~DiskPixmapCache();
+
+        /**
+         * Opens the cache for the document @p fileName rendered by the
+         * generator @p generatorName, picking up the images stored by
+         * previous sessions.
+         */
+        void open( const QString &fileName, const QString &generatorName );
+
+        /**
+         * Waits for the pending writes and closes the cache.
+         */
+        void close();
+
+        bool isOpen() const;
+
+        /**
+         * Sets the number of bytes the cache may use on disk, for all the
+         * documents.
+         */
+        void setMaximumSize( qulonglong bytes );
+
+        /**
+         * Sets the render hints the images are looked up and stored with.
+         */
+        void setRenderHints( uint hints );
+
+        /**
+         * Returns whether an image of @p page with the given size and
+         * @p rotation is available.
+         */
+        bool contains( int page, int width, int height, Rotation rotation ) const;
+
+        /**
+         * Stores asynchronously the @p pixmap of @p page, rendered with the
+         * given @p rotation.
+         */
+        void store( int page, Rotation rotation, const QPixmap &pixmap );
+
+        /**
+         * Reads back asynchronously the image of the page of @p request,
+         * with its size and the given @p rotation. pixmapLoaded() is
+         * emitted for it in any case, even if the cache is closed meanwhile.
+         */
+        void load( PixmapRequest *request, Rotation rotation );
+
+        /**
+         * Removes the images of @p page, e.g. because its contents changed.
+         */
+        void removePage( int page );
+
+        /**
+         * Removes all the images of the document.
+         */
+        void clear();
+
+    Q_SIGNALS:
+        /**
+         * The image of @p request was read back, @p pixmap is null if there
+         * is none or it can't be read (in which case it is forgotten).
+         */
+        void pixmapLoaded( Okular::PixmapRequest *request, const QPixmap &pixmap );
+
+    private Q_SLOTS:
+        void announceLoaded();
+
+    private:
+        struct Key
+        {
+            int page;
+            int width;
+            int height;
+            Rotation rotation;
+            uint hints;
+
+            bool operator==( const Key &other ) const;
+        };
+        friend uint qHash( const Key &key, uint seed );
+
+        class StoreJob;
+        class LoadJob;
+        class ScanJob;
+
+        struct Loaded
+        {
+            PixmapRequest *request;
+            QImage image;           ///< read by a job, or one still to write
+        };
+
+        QString filePath( const Key &key ) const;
+        void stored( const Key &key, qulonglong size );
+        void loaded( PixmapRequest *request, const Key &key, const QImage &image );
+        void scan( const QString &directory );
+        void removeFiles( const QList< Key > &keys );
+        void trim();
+
+        // the cache directory of the current document, empty if not open
+        QString m_directory;
+        uint m_hints;
+        qulonglong m_maximumSize;
+        // what the other documents use on disk, measured when opening
+        qulonglong m_otherSize;
+        qulonglong m_totalSize;
+
+        // images on disk, with the value of m_useCounter when last used
+        struct Entry
+        {
+            qulonglong size;
+            quint64 lastUse;
+        };
+        QHash< Key, Entry > m_entries;
+        // images handed to store() whose job did not finish yet
+        QHash< Key, QImage > m_pending;
+        // requests handed to load(), and the ones to announce
+        QList< PixmapRequest * > m_loading;
+        QList< Loaded > m_loaded;
+        quint64 m_useCounter;
+        mutable QMutex m_mutex;
+
+        ThreadWeaver::Queue *m_queue;
+
+        Q_DISABLE_COPY( DiskPixmapCache )
+};
+
+}
+
+#endif
@@ -67,6 +67,8 @@
 #include "chooseenginedialog_p.h"
 #include "debug_p.h"
 #include "generator_p.h"
+#include "memorybudget_p.h"
+#include "parallelsearch_p.h"
 #include "interfaces/configinterface.h"
 #include "interfaces/guiinterface.h"
 #include "interfaces/printinterface.h"
@@ -81,6 +83,7 @@
 #include "sourcereference.h"
 #include "sourcereference_p.h"
 #include "texteditors_p.h"
+#include "textpagescheduler_p.h"
 #include "tile.h"
 #include "tilesmanager_p.h"
 #include "utils_p.h"
@@ -95,16 +98,6 @@
 
 using namespace Okular;
 
-struct AllocatedPixmap
-{
-    // owner of the page
-    DocumentObserver *observer;
-    int page;
-    qulonglong memory;
-    // public constructor: initialize data
-    AllocatedPixmap( DocumentObserver *o, int p, qulonglong m ) : observer( o ), page( p ), memory( m ) {}
-};
-
 struct ArchiveData
 {
     ArchiveData()
@@ -130,6 +123,14 @@ struct RunningSearch
     bool isCurrentlySearching : 1;
     QColor cachedColor;
     int pagesDone;
+    // the pages the text index says may match, null if unknown
+    QBitArray candidatePages;
+
+    // the pages added after the search started are unknown too
+    bool isCandidatePage( int page ) const
+    {
+        return candidatePages.isNull() || page >= candidatePages.size() || candidatePages.testBit( page );
+    }
 };
 
 #define foreachObserver( cmd ) {\
@@ -143,6 +144,24 @@ struct RunningSearch
 #define OKULAR_HISTORY_MAXSTEPS 100
 #define OKULAR_HISTORY_SAVEDSTEPS 10
 
+// the text extraction threads of the generators extracting text concurrently
+#define TEXT_EXTRACTION_THREADS 2
+// the pages ahead a 'next/previous match' search extracts the text of
+#define SEARCH_PREFETCH_PAGES 4
+
+// the color of the @p word -th of @p wordCount words of a google search
+static QColor googleWordColor( const QColor &baseColor, int word, int wordCount )
+{
+    const int hueStep = (wordCount > 1) ? (60 / (wordCount - 1)) : 60;
+    int baseHue, baseSat, baseVal;
+    baseColor.getHsv( &baseHue, &baseSat, &baseVal );
+
+    int newHue = baseHue - word * hueStep;
+    if ( newHue < 0 )
+        newHue += 360;
+    return QColor::fromHsv( newHue, baseSat, baseVal );
+}
+
 /***** Document ******/
 
 QString DocumentPrivate::pagesSizeString() const
@@ -210,28 +229,29 @@ QString DocumentPrivate::localizedSize(const QSizeF &size) const
 qulonglong DocumentPrivate::calculateMemoryToFree()
 {
     // [MEM] choose memory parameters based on configuration profile
+    const qulonglong allocatedMemory = m_pixmapCache.totalMemory();
     qulonglong clipValue = 0;
     qulonglong memoryToFree = 0;
 
     switch ( SettingsCore::memoryLevel() )
     {
         case SettingsCore::EnumMemoryLevel::Low:
-            memoryToFree = m_allocatedPixmapsTotalMemory;
+            memoryToFree = allocatedMemory;
             break;
 
         case SettingsCore::EnumMemoryLevel::Normal:
         {
             qulonglong thirdTotalMemory = getTotalMemory() / 3;
             qulonglong freeMemory = getFreeMemory();
-            if (m_allocatedPixmapsTotalMemory > thirdTotalMemory) memoryToFree = m_allocatedPixmapsTotalMemory - thirdTotalMemory;
-            if (m_allocatedPixmapsTotalMemory > freeMemory) clipValue = (m_allocatedPixmapsTotalMemory - freeMemory) / 2;
+            if (allocatedMemory > thirdTotalMemory) memoryToFree = allocatedMemory - thirdTotalMemory;
+            if (allocatedMemory > freeMemory) clipValue = (allocatedMemory - freeMemory) / 2;
         }
         break;
 
         case SettingsCore::EnumMemoryLevel::Aggressive:
         {
             qulonglong freeMemory = getFreeMemory();
-            if (m_allocatedPixmapsTotalMemory > freeMemory) clipValue = (m_allocatedPixmapsTotalMemory - freeMemory) / 2;
+            if (allocatedMemory > freeMemory) clipValue = (allocatedMemory - freeMemory) / 2;
         }
         break;
         case SettingsCore::EnumMemoryLevel::Greedy:
@@ -239,7 +259,19 @@ qulonglong DocumentPrivate::calculateMemoryToFree()
             qulonglong freeSwap;
             qulonglong freeMemory = getFreeMemory( &freeSwap );
             const qulonglong memoryLimit = qMin( qMax( freeMemory, getTotalMemory()/2 ), freeMemory+freeSwap );
-            if (m_allocatedPixmapsTotalMemory > memoryLimit) clipValue = (m_allocatedPixmapsTotalMemory - memoryLimit) / 2;
+            if (allocatedMemory > memoryLimit) clipValue = (allocatedMemory - memoryLimit) / 2;
+        }
+        break;
+        case SettingsCore::EnumMemoryLevel::Adaptive:
+        {
+            // keep at most half of what we use plus what is still available
+            // to us (the free memory already honors cgroup limits), and a
+            // quarter of it while the kernel reports memory stalls
+            const qulonglong freeMemory = getFreeMemory();
+            qulonglong budget = ( allocatedMemory + freeMemory ) / 2;
+            if ( m_memoryBudget && m_memoryBudget->isUnderPressure() )
+                budget /= 2;
+            if (allocatedMemory > budget) memoryToFree = allocatedMemory - budget;
         }
         break;
     }
@@ -247,17 +279,21 @@ qulonglong DocumentPrivate::calculateMemoryToFree()
     if ( clipValue > memoryToFree )
         memoryToFree = clipValue;
 
+    // what is left is what the cache may keep in the current memory situation
+    m_pixmapCache.setBudget( allocatedMemory - memoryToFree );
+
     return memoryToFree;
 }
 
 void DocumentPrivate::cleanupPixmapMemory()
 {
-    cleanupPixmapMemory( calculateMemoryToFree() );
+    calculateMemoryToFree();
+    evictPixmapsOverBudget();
 }
 
-void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
+void DocumentPrivate::evictPixmapsOverBudget()
 {
-    if ( memoryToFree < 1 )
+    if ( m_pixmapCache.excess() == 0 )
         return;
 
     const int currentViewportPage = (*m_viewportIterator).pageNumber;
@@ -268,117 +304,61 @@ void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
     for ( ; vIt != vEnd; ++vIt )
         visibleRects.insert( (*vIt)->pageNumber, (*vIt) );
 
-    // Free memory starting from pages that are farthest from the current one
-    int pagesFreed = 0;
-    while ( memoryToFree > 0 )
+    // Free memory starting from the least recently used pages, farthest
+    // from the current one first
+    while ( m_pixmapCache.excess() > 0 )
     {
-        AllocatedPixmap * p = searchLowestPriorityPixmap( true, true );
+        PixmapCache::Entry * p = m_pixmapCache.evictionCandidate( currentViewportPage, true );
         if ( !p ) // No pixmap to remove
             break;
 
         qCDebug(OkularCoreDebug).nospace() << "Evicting cache pixmap observer=" << p->observer << " page=" << p->page;
 
-        // m_allocatedPixmapsTotalMemory can't underflow because we always add or remove
-        // the memory used by the AllocatedPixmap so at most it can reach zero
-        m_allocatedPixmapsTotalMemory -= p->memory;
-        // Make sure memoryToFree does not underflow
-        if ( p->memory > memoryToFree )
-            memoryToFree = 0;
-        else
-            memoryToFree -= p->memory;
-        pagesFreed++;
+        // [MEM] reading it back from disk is cheaper than rendering it again
+        if ( m_diskPixmapCache.isOpen() )
+        {
+            const PagePrivate *page = m_pagesVector.at( p->page )->d;
+            QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator it = page->m_pixmaps.constFind( p->observer );
+            if ( it != page->m_pixmaps.constEnd() && !page->tilesManager( p->observer ) )
+                m_diskPixmapCache.store( p->page, it.value().m_rotation, *it.value().m_pixmap );
+        }
         // delete pixmap
         m_pagesVector.at( p->page )->deletePixmap( p->observer );
         // delete allocation descriptor
-        delete p;
+        m_pixmapCache.remove( p );
     }
 
     // If we're still on low memory, try to free individual tiles
-
-    // Store pages that weren't completely removed
-
-    QLinkedList< AllocatedPixmap * > pixmapsToKeep;
-    while (memoryToFree > 0)
+    foreach (DocumentObserver *observer, m_observers)
     {
-        int clean_hits = 0;
-        foreach (DocumentObserver *observer, m_observers)
+        PixmapCache::Entry * p = m_pixmapCache.leastRecentlyUsed( observer );
+        while ( p && m_pixmapCache.excess() > 0 )
         {
-            AllocatedPixmap * p = searchLowestPriorityPixmap( false, true, observer );
-            if ( !p ) // No pixmap to remove
-                continue;
-
-            clean_hits++;
+            PixmapCache::Entry * newer = p->newer;
 
             TilesManager *tilesManager = m_pagesVector.at( p->page )->d->tilesManager( observer );
             if ( tilesManager && tilesManager->totalMemory() > 0 )
             {
-                qulonglong memoryDiff = p->memory;
                 NormalizedRect visibleRect;
                 if ( visibleRects.contains( p->page ) )
                     visibleRect = visibleRects[ p->page ]->rect;
 
                 // Free non visible tiles
-                tilesManager->cleanupPixmapMemory( memoryToFree, visibleRect, currentViewportPage );
+                tilesManager->cleanupPixmapMemory( m_pixmapCache.excess(), visibleRect, currentViewportPage );
 
-                p->memory = tilesManager->totalMemory();
-                memoryDiff -= p->memory;
-                memoryToFree = (memoryDiff < memoryToFree) ? (memoryToFree - memoryDiff) : 0;
-                m_allocatedPixmapsTotalMemory -= memoryDiff;
-
-                if ( p->memory > 0 )
-                    pixmapsToKeep.append( p );
+                const qulonglong memory = tilesManager->totalMemory();
+                if ( memory > 0 )
+                    m_pixmapCache.setMemory( p, memory );
                 else
-                    delete p;
+                    m_pixmapCache.remove( p );
             }
-            else
-                pixmapsToKeep.append( p );
-        }
-
-        if (clean_hits == 0) break;
-    }
-
-    m_allocatedPixmaps += pixmapsToKeep;
-    //p--rintf("freeMemory A:[%d -%d = %d] \n", m_allocatedPixmaps.count() + pagesFreed, pagesFreed, m_allocatedPixmaps.count() );
-}
 
-/* Returns the next pixmap to evict from cache, or NULL if no suitable pixmap
- * if found. If unloadableOnly is set, only unloadable pixmaps are returned. If
- * thenRemoveIt is set, the pixmap is removed from m_allocatedPixmaps before
- * returning it
- */
-AllocatedPixmap * DocumentPrivate::searchLowestPriorityPixmap( bool unloadableOnly, bool thenRemoveIt, DocumentObserver *observer )
-{
-    QLinkedList< AllocatedPixmap * >::iterator pIt = m_allocatedPixmaps.begin();
-    QLinkedList< AllocatedPixmap * >::iterator pEnd = m_allocatedPixmaps.end();
-    QLinkedList< AllocatedPixmap * >::iterator farthestPixmap = pEnd;
-    const int currentViewportPage = (*m_viewportIterator).pageNumber;
-
-    /* Find the pixmap that is farthest from the current viewport */
-    int maxDistance = -1;
-    while ( pIt != pEnd )
-    {
-        const AllocatedPixmap * p = *pIt;
-        // Filter by observer
-        if ( observer == 0 || p->observer == observer )
-        {
-            const int distance = qAbs( p->page - currentViewportPage );
-            if ( maxDistance < distance && ( !unloadableOnly || p->observer->canUnloadPixmap( p->page ) ) )
-            {
-                maxDistance = distance;
-                farthestPixmap = pIt;
-            }
+            p = newer;
         }
-        ++pIt;
-    }
 
-    /* No pixmap to remove */
-    if ( farthestPixmap == pEnd )
-        return 0;
-
-    AllocatedPixmap * selectedPixmap = *farthestPixmap;
-    if ( thenRemoveIt )
-        m_allocatedPixmaps.erase( farthestPixmap );
-    return selectedPixmap;
+        if ( m_pixmapCache.excess() == 0 )
+            break;
+    }
 }
 
 qulonglong DocumentPrivate::getTotalMemory()
@@ -393,13 +373,21 @@ qulonglong DocumentPrivate::getTotalMemory()
     if ( !memFile.open( QIODevice::ReadOnly ) )
         return (cachedValue = 134217728);
 
+    // in a container the cgroup limit may be well below the host memory
+    const qulonglong cgroupLimit = MemoryBudgetProvider::cgroupMemoryLimit();
+
     QTextStream readStream( &memFile );
     while ( true )
     {
         QString entry = readStream.readLine();
         if ( entry.isNull() ) break;
         if ( entry.startsWith( QLatin1String("MemTotal:") ) )
-            return (cachedValue = (Q_UINT64_C(1024) * entry.section( QLatin1Char ( ' ' ), -2, -2 ).toULongLong()));
+        {
+            cachedValue = Q_UINT64_C(1024) * entry.section( QLatin1Char ( ' ' ), -2, -2 ).toULongLong();
+            if ( cgroupLimit && cgroupLimit < cachedValue )
+                cachedValue = cgroupLimit;
+            return cachedValue;
+        }
     }
 #elif defined(Q_OS_FREEBSD)
     qulonglong physmem;
@@ -484,9 +472,21 @@ qulonglong DocumentPrivate::getFreeMemory( qulonglong *freeSwap )
 
     lastUpdate = QTime::currentTime();
 
+    cachedValue = Q_UINT64_C(1024) * memoryFree;
+
+    // don't count on memory our cgroup won't let us use
+    const qulonglong cgroupLimit = MemoryBudgetProvider::cgroupMemoryLimit();
+    if ( cgroupLimit )
+    {
+        const qulonglong cgroupUsage = MemoryBudgetProvider::cgroupMemoryUsage();
+        const qulonglong cgroupFree = cgroupLimit > cgroupUsage ? cgroupLimit - cgroupUsage : 0;
+        if ( cgroupFree < cachedValue )
+            cachedValue = cgroupFree;
+    }
+
     if (freeSwap)
         *freeSwap = ( cachedFreeSwap = (Q_UINT64_C(1024) * values[3]) );
-    return ( cachedValue = (Q_UINT64_C(1024) * memoryFree) );
+    return cachedValue;
 #elif defined(Q_OS_FREEBSD)
     qulonglong cache, inact, free, psize;
     size_t cachelen, inactlen, freelen, psizelen;
@@ -573,9 +573,12 @@ void DocumentPrivate::loadDocumentInfo( QFile &infoFile )
                     bool ok;
                     int pageNumber = pageElement.attribute( QStringLiteral("number") ).toInt( &ok );
 
-                    // pass the domElement to the right page, to read config data from
+                    // pass the domElement to the right page, to read config data from,
+                    // or keep it until the generator adds the page
                     if ( ok && pageNumber >= 0 && pageNumber < (int)m_pagesVector.count() )
                         m_pagesVector[ pageNumber ]->d->restoreLocalContents( pageElement );
+                    else if ( ok && pageNumber >= 0 )
+                        m_pendingPageContents.insert( pageNumber, pageElement );
                 }
                 pageNode = pageNode.nextSibling();
             }
@@ -1186,6 +1189,9 @@ void DocumentPrivate::saveDocumentInfo() const
     QVector< Page * >::const_iterator pIt = m_pagesVector.constBegin(), pEnd = m_pagesVector.constEnd();
     for ( ; pIt != pEnd; ++pIt )
         (*pIt)->d->saveLocalContents( pageList, doc, saveWhat );
+    // the pages not added by the generator yet keep what was restored
+    foreach ( const QDomElement &pageElement, m_pendingPageContents )
+        pageList.appendChild( doc.importNode( pageElement, true ) );
 
     // 2.2. Save document info (current viewport, history, ... ) to DOM
     QDomElement generalInfo = doc.createElement( QStringLiteral("generalInfo") );
@@ -1245,7 +1251,15 @@ void DocumentPrivate::slotTimedMemoryCheck()
 {
     // [MEM] clean memory (for 'free mem dependant' profiles only)
     if ( SettingsCore::memoryLevel() != SettingsCore::EnumMemoryLevel::Low &&
-         m_allocatedPixmapsTotalMemory > 1024*1024 )
+         m_pixmapCache.totalMemory() > 1024*1024 )
+        cleanupPixmapMemory();
+}
+
+void DocumentPrivate::slotMemoryPressure()
+{
+    // [MEM] the system is stalling on memory, shrink the cache right away
+    if ( SettingsCore::memoryLevel() == SettingsCore::EnumMemoryLevel::Adaptive &&
+         !m_pixmapCache.isEmpty() && !m_pagesVector.isEmpty() )
         cleanupPixmapMemory();
 }
 
@@ -1260,22 +1274,18 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
     int maxDistance = INT_MAX; // Default: No maximum
     if ( memoryToFree )
     {
-        AllocatedPixmap *pixmapToReplace = searchLowestPriorityPixmap( true );
+        const PixmapCache::Entry *pixmapToReplace = m_pixmapCache.evictionCandidate( currentViewportPage, true );
         if ( pixmapToReplace )
             maxDistance = qAbs( pixmapToReplace->page - currentViewportPage );
     }
 
     // find a request
     PixmapRequest * request = 0;
+    bool onDisk = false;
     m_pixmapRequestsMutex.lock();
-    while ( !m_pixmapRequestsStack.isEmpty() && !request )
+    while ( !m_pixmapRequestsQueue.isEmpty() && !request )
     {
-        PixmapRequest * r = m_pixmapRequestsStack.last();
-        if (!r)
-        {
-            m_pixmapRequestsStack.pop_back();
-            continue;
-        }
+        PixmapRequest * r = m_pixmapRequestsQueue.top();
 
         QRect requestRect = r->isTile() ? r->normalizedRect().geometry( r->width(), r->height() ) : QRect( 0, 0, r->width(), r->height() );
         TilesManager *tilesManager = r->d->tilesManager();
@@ -1283,27 +1293,36 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         // If it's a preload but the generator is not threaded no point in trying to preload
         if ( r->preload() && !m_generator->hasFeature( Generator::Threaded ) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            delete m_pixmapRequestsQueue.takeTop();
         }
         // request only if page isn't already present and request has valid id
-        // request only if page isn't already present and request has valid id
-        else if ( ( !r->d->mForce && r->page()->hasPixmap( r->observer(), r->width(), r->height(), r->normalizedRect() ) ) || !m_observers.contains(r->observer()) )
+        else if ( !m_observers.contains(r->observer()) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            delete m_pixmapRequestsQueue.takeTop();
+        }
+        else if ( !r->d->mForce && r->page()->hasPixmap( r->observer(), r->width(), r->height(), r->normalizedRect() ) )
+        {
+            // the observer still wants this pixmap, keep it in the cache
+            m_pixmapCache.touch( r->observer(), r->pageNumber() );
+            delete m_pixmapRequestsQueue.takeTop();
         }
         else if ( !r->d->mForce && r->preload() && qAbs( r->pageNumber() - currentViewportPage ) >= maxDistance )
         {
-            m_pixmapRequestsStack.pop_back();
             //qCDebug(OkularCoreDebug) << "Ignoring request that doesn't fit in cache";
-            delete r;
+            delete m_pixmapRequestsQueue.takeTop();
+        }
+        // pixmaps evicted to disk are read back in the background instead of
+        // rendered, unless the observer waits for them
+        else if ( !r->d->mForce && r->asynchronous() && !r->isTile() && !tilesManager &&
+                  m_diskPixmapCache.contains( r->pageNumber(), r->width(), r->height(), m_rotation ) )
+        {
+            request = r;
+            onDisk = true;
         }
         // Ignore requests for pixmaps that are already being generated
         else if ( tilesManager && tilesManager->isRequesting( r->normalizedRect(), r->width(), r->height() ) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            delete m_pixmapRequestsQueue.takeTop();
         }
         // If the requested area is above 8000000 pixels, switch on the tile manager
         else if ( !tilesManager && m_generator->hasFeature( Generator::TiledRendering ) && (long)r->width() * (long)r->height() > 8000000L )
@@ -1357,8 +1376,7 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
                 // preload requests issued by PageView if the requested page is
                 // not visible and the user has just switched from a non-tiled
                 // zoom level to a tiled one
-                m_pixmapRequestsStack.pop_back();
-                delete r;
+                delete m_pixmapRequestsQueue.takeTop();
             }
         }
         // If the requested area is below 6000000 pixels, switch off the tile manager
@@ -1375,7 +1393,7 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         }
         else if ( (long)requestRect.width() * (long)requestRect.height() > 200000000L && (SettingsCore::memoryLevel() != SettingsCore::EnumMemoryLevel::Greedy ) )
         {
-            m_pixmapRequestsStack.pop_back();
+            m_pixmapRequestsQueue.takeTop();
             if ( !m_warnedOutOfMemory )
             {
                 qCWarning(OkularCoreDebug).nospace() << "Running out of memory on page " << r->pageNumber()
@@ -1407,14 +1425,28 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         pixmapBytes = 4 * request->width() * request->height();
 
     if ( pixmapBytes > (1024 * 1024) )
-        cleanupPixmapMemory( memoryToFree /* previously calculated value */ );
+        evictPixmapsOverBudget(); // with the budget calculated above
+
+    if ( onDisk )
+    {
+        m_pixmapRequestsQueue.take( request );
+        m_executingPixmapRequests.push_back( request );
+        const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+        m_pixmapRequestsMutex.unlock();
+
+        // answered by diskPixmapLoaded(), the generator can go on meanwhile
+        m_diskPixmapCache.load( request, m_rotation );
+        if ( hasPixmaps )
+            QMetaObject::invokeMethod( m_parent, "sendGeneratorPixmapRequest", Qt::QueuedConnection );
+        return;
+    }
 
     // submit the request to the generator
     if ( m_generator->canGeneratePixmap() )
     {
         QRect requestRect = !request->isTile() ? QRect(0, 0, request->width(), request->height() ) : request->normalizedRect().geometry( request->width(), request->height() );
         qCDebug(OkularCoreDebug).nospace() << "sending request observer=" << request->observer() << " " <<requestRect.width() << "x" << requestRect.height() << "@" << request->pageNumber() << " async == " << request->asynchronous() << " isTile == " << request->isTile();
-        m_pixmapRequestsStack.removeAll ( request );
+        m_pixmapRequestsQueue.take( request );
 
         if ( tm )
             tm->setRequest( request->normalizedRect(), request->width(), request->height() );
@@ -1431,7 +1463,24 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         // we can not really know if the generator can do async requests
         m_executingPixmapRequests.push_back( request );
         m_pixmapRequestsMutex.unlock();
+
+        // extract the text of the pages while they are rendered, so it can
+        // be selected without a delay
+        if ( m_textPageScheduler && request->asynchronous() && !request->page()->hasTextPage() )
+            m_textPageScheduler->request( request->page(), request->preload() ? TextPageScheduler::BackgroundPriority : TextPageScheduler::VisiblePriority );
+
         m_generator->generatePixmap( request );
+
+        // generators rendering concurrently may still have idle workers,
+        // so keep feeding them while there are pending requests
+        if ( m_generator->hasFeature( Generator::ConcurrentRendering ) && m_generator->canGeneratePixmap() )
+        {
+            m_pixmapRequestsMutex.lock();
+            const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+            m_pixmapRequestsMutex.unlock();
+            if ( hasPixmaps )
+                sendGeneratorPixmapRequest();
+        }
     }
     else
     {
@@ -1500,9 +1549,8 @@ void DocumentPrivate::slotGeneratorConfigChanged( const QString& )
         }
 
         // [MEM] remove allocation descriptors
-        qDeleteAll( m_allocatedPixmaps );
-        m_allocatedPixmaps.clear();
-        m_allocatedPixmapsTotalMemory = 0;
+        m_pixmapCache.clear();
+        m_diskPixmapCache.clear();
 
         // send reload signals to observers
         foreachObserverD( notifyContentsCleared( DocumentObserver::Pixmap ) );
@@ -1510,7 +1558,7 @@ void DocumentPrivate::slotGeneratorConfigChanged( const QString& )
 
     // free memory if in 'low' profile
     if ( SettingsCore::memoryLevel() == SettingsCore::EnumMemoryLevel::Low &&
-         !m_allocatedPixmaps.isEmpty() && !m_pagesVector.isEmpty() )
+         !m_pixmapCache.isEmpty() && !m_pagesVector.isEmpty() )
         cleanupPixmapMemory();
 }
 
@@ -1520,6 +1568,9 @@ void DocumentPrivate::refreshPixmaps( int pageNumber )
     if ( !page )
         return;
 
+    // what is on disk is outdated too
+    m_diskPixmapCache.removePage( pageNumber );
+
     QLinkedList< Okular::PixmapRequest * > requestedPixmaps;
     QMap< DocumentObserver*, PagePrivate::PixmapObject >::ConstIterator it = page->d->m_pixmaps.constBegin(), itEnd = page->d->m_pixmaps.constEnd();
     for ( ; it != itEnd; ++it )
@@ -1573,12 +1624,25 @@ void DocumentPrivate::refreshPixmaps( int pageNumber )
 
 void DocumentPrivate::_o_configChanged()
 {
+    // listen to memory pressure only when it drives the cache size
+    m_memoryBudget->setMonitoring( SettingsCore::memoryLevel() == SettingsCore::EnumMemoryLevel::Adaptive );
+
+    // the disk cache and the text index may have been enabled or disabled,
+    // and the disk cache resized or made obsolete
+    if ( m_generator )
+    {
+        setupDiskPixmapCache();
+        setupTextIndex();
+    }
+
     // free text pages if needed
     calculateMaxTextPages();
-    while (m_allocatedTextPagesFifo.count() > m_maxAllocatedTextPages)
+    for ( int i = 0; i < m_allocatedTextPagesFifo.count() && m_allocatedTextPagesFifo.count() > m_maxAllocatedTextPages; )
     {
-        int pageToKick = m_allocatedTextPagesFifo.takeFirst();
-        m_pagesVector.at(pageToKick)->setTextPage( 0 ); // deletes the textpage
+        if ( unloadTextPage( m_allocatedTextPagesFifo.at( i ) ) )
+            m_allocatedTextPagesFifo.removeAt( i );
+        else
+            ++i;
     }
 }
 
@@ -1624,12 +1688,33 @@ void DocumentPrivate::doContinueDirectionMatchSearch(void *doContinueDirectionMa
     {
         // get page
         Page * page = m_pagesVector[ searchStruct->currentPage ];
-        // request search page if needed
-        if ( !page->hasTextPage() )
-            m_parent->requestTextPage( page->number() );
+        // no need to look at the pages the text index rules out
+        if ( search->isCandidatePage( searchStruct->currentPage ) )
+        {
+            // request search page if needed, unless it was extracted without text
+            if ( !page->hasTextPage() && searchStruct->extractedPage != searchStruct->currentPage )
+            {
+                // wait for it in the background, together with the next pages
+                if ( m_textPageScheduler )
+                {
+                    int prefetchPage = searchStruct->currentPage;
+                    for ( int i = 0; i < SEARCH_PREFETCH_PAGES && prefetchPage >= 0 && prefetchPage < m_pagesVector.count(); ++i )
+                    {
+                        Page *nextPage = m_pagesVector.at( prefetchPage );
+                        if ( !nextPage->hasTextPage() && search->isCandidatePage( prefetchPage ) )
+                            m_textPageScheduler->request( nextPage, TextPageScheduler::SearchPriority );
+                        prefetchPage += forward ? 1 : -1;
+                    }
+                    searchStruct->extractedPage = searchStruct->currentPage;
+                    m_textPageSearch = searchStruct;
+                    return;
+                }
+                m_parent->requestTextPage( page->number() );
+            }
 
-        // if found a match on the current page, end the loop
-        searchStruct->match = page->findText( searchStruct->searchID, search->cachedString, forward ? FromTop : FromBottom, search->cachedCaseSensitivity );
+            // if found a match on the current page, end the loop
+            searchStruct->match = page->findText( searchStruct->searchID, search->cachedString, forward ? FromTop : FromBottom, search->cachedCaseSensitivity );
+        }
         if ( !searchStruct->match )
         {
             if (forward) searchStruct->currentPage++;
@@ -1733,12 +1818,13 @@ void DocumentPrivate::doContinueAllDocumentSearch(void *pagesToNotifySet, void *
         int pageNumber = page->number(); // redundant? is it == currentPage ?
 
         // request search page if needed
-        if ( !page->hasTextPage() )
+        const bool candidate = search->isCandidatePage( currentPage );
+        if ( candidate && !page->hasTextPage() )
             m_parent->requestTextPage( pageNumber );
 
         // loop on a page adding highlights for all found items
         RegularAreaRect * lastMatch = 0;
-        while ( 1 )
+        while ( candidate )
         {
             if ( lastMatch )
                 lastMatch = page->findText( searchID, search->cachedString, NextResult, search->cachedCaseSensitivity, lastMatch );
@@ -1819,9 +1905,6 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
     }
 
     const int wordCount = words.count();
-    const int hueStep = (wordCount > 1) ? (60 / (wordCount - 1)) : 60;
-    int baseHue, baseSat, baseVal;
-    search->cachedColor.getHsv( &baseHue, &baseSat, &baseVal );
 
     if (currentPage < m_pagesVector.count())
     {
@@ -1830,19 +1913,17 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
         int pageNumber = page->number(); // redundant? is it == currentPage ?
 
         // request search page if needed
-        if ( !page->hasTextPage() )
+        const bool candidate = search->isCandidatePage( currentPage );
+        if ( candidate && !page->hasTextPage() )
             m_parent->requestTextPage( pageNumber );
 
         // loop on a page adding highlights for all found items
         bool allMatched = wordCount > 0,
              anyMatched = false;
-        for ( int w = 0; w < wordCount; w++ )
+        for ( int w = 0; candidate && w < wordCount; w++ )
         {
             const QString &word = words[ w ];
-            int newHue = baseHue - w * hueStep;
-            if ( newHue < 0 )
-                newHue += 360;
-            QColor wordColor = QColor::fromHsv( newHue, baseSat, baseVal );
+            const QColor wordColor = googleWordColor( search->cachedColor, w, wordCount );
             RegularAreaRect * lastMatch = 0;
             // add all highlights for current word
             bool wordMatched = false;
@@ -1913,6 +1994,162 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
     }
 }
 
+void DocumentPrivate::startParallelSearch( int searchID, const QStringList &words, QSet< int > *pagesToNotify )
+{
+    RunningSearch *search = m_searches.value( searchID );
+
+    m_parallelSearch = new ParallelSearch( m_generator, m_pagesVector, searchID, words,
+                                           search->cachedCaseSensitivity, search->cachedType == Document::GoogleAll );
+    m_parallelSearch->setCandidatePages( search->candidatePages );
+    m_parallelSearchPagesToNotify = pagesToNotify;
+    m_parallelSearchFoundMatch = false;
+
+    QObject::connect( m_parallelSearch, SIGNAL(pageSearched(int)), m_parent, SLOT(parallelSearchPageDone(int)) );
+    QObject::connect( m_parallelSearch, SIGNAL(finished()), m_parent, SLOT(parallelSearchFinished()) );
+    m_parallelSearch->start();
+}
+
+void DocumentPrivate::parallelSearchPageDone( int pageNumber )
+{
+    Page *page = m_pagesVector.at( pageNumber );
+
+    // keep the text extracted by the search, unless the page got one meanwhile
+    TextPage *textPage = m_parallelSearch->takeTextPage( pageNumber );
+    if ( textPage )
+    {
+        if ( page->hasTextPage() )
+        {
+            delete textPage;
+        }
+        else
+        {
+            page->d->adoptTextPage( textPage );
+            textGenerationDone( page );
+        }
+    }
+
+    const QVector< ParallelSearch::Match > matches = m_parallelSearch->takeMatches( pageNumber );
+    if ( matches.isEmpty() )
+        return;
+
+    const int searchID = m_parallelSearch->searchID();
+    RunningSearch *search = m_searches.value( searchID );
+    const int wordCount = m_parallelSearch->wordCount();
+    foreach ( const ParallelSearch::Match &match, matches )
+    {
+        if ( search )
+        {
+            const QColor color = search->cachedType == Document::AllDocument ? search->cachedColor : googleWordColor( search->cachedColor, match.word, wordCount );
+            page->d->setHighlight( searchID, match.area, color );
+        }
+        delete match.area;
+    }
+
+    if ( !search )
+        return;
+
+    // show the matches of the page right away
+    search->highlightedPages.insert( pageNumber );
+    m_parallelSearchPagesToNotify->remove( pageNumber );
+    m_parallelSearchFoundMatch = true;
+    foreachObserverD( notifyPageChanged( pageNumber, DocumentObserver::Highlights ) );
+}
+
+void DocumentPrivate::parallelSearchFinished()
+{
+    finishParallelSearch( false );
+}
+
+void DocumentPrivate::finishParallelSearch( bool cancelled )
+{
+    const int searchID = m_parallelSearch->searchID();
+
+    // a finished search has no job left, but we are called from its signal
+    if ( cancelled )
+        delete m_parallelSearch; // waits for the pages being searched
+    else
+        m_parallelSearch->deleteLater();
+    m_parallelSearch = 0;
+
+    // reset cursor to previous shape
+    QApplication::restoreOverrideCursor();
+
+    RunningSearch *search = m_searches.value( searchID );
+    if ( search )
+        search->isCurrentlySearching = false;
+
+    // send page lists to update observers (since some filter on bookmarks)
+    foreach(DocumentObserver *observer, m_observers)
+        observer->notifySetup( m_pagesVector, 0 );
+
+    // notify observers about the highlights removed when the search started
+    foreach(int pageNumber, *m_parallelSearchPagesToNotify)
+        foreach(DocumentObserver *observer, m_observers)
+            observer->notifyPageChanged( pageNumber, DocumentObserver::Highlights );
+    delete m_parallelSearchPagesToNotify;
+    m_parallelSearchPagesToNotify = 0;
+
+    if ( cancelled ) emit m_parent->searchFinished( searchID, Document::SearchCancelled );
+    else if ( m_parallelSearchFoundMatch ) emit m_parent->searchFinished( searchID, Document::MatchFound );
+    else emit m_parent->searchFinished( searchID, Document::NoMatchFound );
+}
+
+bool DocumentPrivate::unloadTextPage( int page )
+{
+    // a running search may be reading it
+    if ( m_parallelSearch )
+        return m_parallelSearch->unloadTextPage( m_pagesVector.at( page ) );
+
+    m_pagesVector.at( page )->setTextPage( 0 ); // deletes the textpage
+    return true;
+}
+
+void DocumentPrivate::textPageExtracted( int pageNumber )
+{
+    // the scheduler may be gone with the document
+    if ( !m_textPageScheduler || pageNumber >= m_pagesVector.count() )
+        return;
+
+    // it may have been taken by requestTextPage() already
+    TextPage *textPage = m_textPageScheduler->takeTextPage( pageNumber );
+    if ( textPage )
+    {
+        Page *page = m_pagesVector.at( pageNumber );
+        if ( page->hasTextPage() )
+        {
+            delete textPage;
+        }
+        else
+        {
+            page->d->adoptTextPage( textPage );
+            textGenerationDone( page );
+        }
+    }
+
+    if ( m_textPageSearch && m_textPageSearch->currentPage == pageNumber )
+    {
+        DoContinueDirectionMatchSearchStruct *searchStruct = m_textPageSearch;
+        m_textPageSearch = 0;
+        QMetaObject::invokeMethod( m_parent, "doContinueDirectionMatchSearch", Qt::QueuedConnection, Q_ARG( void *, searchStruct ) );
+    }
+}
+
+void DocumentPrivate::cancelTextPageSearch()
+{
+    if ( !m_textPageSearch )
+        return;
+
+    DoContinueDirectionMatchSearchStruct *searchStruct = m_textPageSearch;
+    m_textPageSearch = 0;
+    m_textPageScheduler->cancel( TextPageScheduler::SearchPriority );
+
+    // let the search end as cancelled, as usual
+    const bool searchCancelled = m_searchCancelled;
+    m_searchCancelled = true;
+    doContinueDirectionMatchSearch( searchStruct );
+    m_searchCancelled = searchCancelled;
+}
+
 QVariant DocumentPrivate::documentMetaData( const Generator::DocumentMetaDataKey key, const QVariant &option ) const
 {
     switch ( key )
@@ -2131,8 +2368,12 @@ Document::Document( QWidget *widget )
     d->m_bookmarkManager = new BookmarkManager( d );
     d->m_viewportIterator = d->m_viewportHistory.insert( d->m_viewportHistory.end(), DocumentViewport() );
     d->m_undoStack = new QUndoStack(this);
+    d->m_memoryBudget = new MemoryBudgetProvider( this );
+    d->m_memoryBudget->setMonitoring( SettingsCore::memoryLevel() == SettingsCore::EnumMemoryLevel::Adaptive );
 
     connect( SettingsCore::self(), SIGNAL(configChanged()), this, SLOT(_o_configChanged()) );
+    connect( d->m_memoryBudget, SIGNAL(memoryPressure()), this, SLOT(slotMemoryPressure()) );
+    connect( &d->m_diskPixmapCache, SIGNAL(pixmapLoaded(Okular::PixmapRequest*,QPixmap)), this, SLOT(diskPixmapLoaded(Okular::PixmapRequest*,QPixmap)) );
     connect(d->m_undoStack, &QUndoStack::canUndoChanged, this, &Document::canUndoChanged);
     connect(d->m_undoStack, &QUndoStack::canRedoChanged, this, &Document::canRedoChanged);
 
@@ -2421,6 +2662,14 @@ Document::OpenResult Document::openDocument(const QString & docFile, const QUrl
     connect( d->m_pageController, SIGNAL(rotationFinished(int,Okular::Page*)),
              this, SLOT(rotationFinished(int,Okular::Page*)) );
 
+    // the generators that can extract the text outside the main thread do it
+    // in the background
+    if ( d->m_generator->hasFeature( Generator::TextExtraction ) && d->m_generator->hasFeature( Generator::Threaded ) )
+    {
+        d->m_textPageScheduler = new TextPageScheduler( d->m_generator, d->m_generator->hasFeature( Generator::ConcurrentTextExtraction ) ? TEXT_EXTRACTION_THREADS : 1 );
+        connect( d->m_textPageScheduler, SIGNAL(textPageReady(int)), this, SLOT(textPageExtracted(int)) );
+    }
+
     bool containsExternalAnnotations = false;
     foreach ( Page * p, d->m_pagesVector )
     {
@@ -2457,7 +2706,12 @@ Document::OpenResult Document::openDocument(const QString & docFile, const QUrl
     {
         (*d->m_viewportIterator) = DocumentViewport();
         if ( loadedViewport.pageNumber >= (int)d->m_pagesVector.size() )
+        {
+            // the generator may add the page later
+            d->m_pendingViewport = loadedViewport;
             loadedViewport.pageNumber = d->m_pagesVector.size() - 1;
+            d->m_pendingViewportFallback = loadedViewport;
+        }
     }
     else
         loadedViewport.pageNumber = 0;
@@ -2490,6 +2744,9 @@ Document::OpenResult Document::openDocument(const QString & docFile, const QUrl
     AudioPlayer::instance()->d->m_currentDocument = isstdin ? QUrl() : d->m_url;
     d->m_docSize = document_size;
 
+    d->setupDiskPixmapCache();
+    d->setupTextIndex();
+
     const QStringList docScripts = d->m_generator->metaData( QStringLiteral("DocumentScripts"), QStringLiteral ( "JavaScript" ) ).toStringList();
     if ( !docScripts.isEmpty() )
     {
@@ -2527,13 +2784,17 @@ void Document::closeDocument()
     delete d->m_scripter;
     d->m_scripter = 0;
 
+    // stop searching, the pages are going away
+    if ( d->m_parallelSearch )
+        d->finishParallelSearch( true );
+    d->cancelTextPageSearch();
+    d->m_textIndex.close();
+    delete d->m_textPageScheduler; // waits for the pages being extracted
+    d->m_textPageScheduler = 0;
+
      // remove requests left in queue
     d->m_pixmapRequestsMutex.lock();
-    QLinkedList< PixmapRequest * >::const_iterator sIt = d->m_pixmapRequestsStack.constBegin();
-    QLinkedList< PixmapRequest * >::const_iterator sEnd = d->m_pixmapRequestsStack.constEnd();
-    for ( ; sIt != sEnd; ++sIt )
-        delete *sIt;
-    d->m_pixmapRequestsStack.clear();
+    d->m_pixmapRequestsQueue.clear();
     d->m_pixmapRequestsMutex.unlock();
 
     QEventLoop loop;
@@ -2552,6 +2813,8 @@ void Document::closeDocument()
     }
     while ( startEventLoop );
 
+    d->m_diskPixmapCache.close();
+
     if ( d->m_fontThread )
     {
         disconnect( d->m_fontThread, 0, this, 0 );
@@ -2621,8 +2884,7 @@ void Document::closeDocument()
     d->m_pagesVector.clear();
 
     // clear 'memory allocation' descriptors
-    qDeleteAll( d->m_allocatedPixmaps );
-    d->m_allocatedPixmaps.clear();
+    d->m_pixmapCache.clear();
 
     // clear 'running searches' descriptors
     QMap< int, RunningSearch * >::const_iterator rIt = d->m_searches.constBegin();
@@ -2644,7 +2906,9 @@ void Document::closeDocument()
     d->m_viewportHistory.clear();
     d->m_viewportHistory.append( DocumentViewport() );
     d->m_viewportIterator = d->m_viewportHistory.begin();
-    d->m_allocatedPixmapsTotalMemory = 0;
+    d->m_pendingViewport = DocumentViewport();
+    d->m_pendingViewportFallback = DocumentViewport();
+    d->m_pendingPageContents.clear();
     d->m_allocatedTextPagesFifo.clear();
     d->m_pageSize = PageSize();
     d->m_pageSizes.clear();
@@ -2681,19 +2945,7 @@ void Document::removeObserver( DocumentObserver * pObserver )
             (*it)->deletePixmap( pObserver );
 
         // [MEM] free observer's allocation descriptors
-        QLinkedList< AllocatedPixmap * >::iterator aIt = d->m_allocatedPixmaps.begin();
-        QLinkedList< AllocatedPixmap * >::iterator aEnd = d->m_allocatedPixmaps.end();
-        while ( aIt != aEnd )
-        {
-            AllocatedPixmap * p = *aIt;
-            if ( p->observer == pObserver )
-            {
-                aIt = d->m_allocatedPixmaps.erase( aIt );
-                delete p;
-            }
-            else
-                ++aIt;
-        }
+        d->m_pixmapCache.removeObserver( pObserver );
 
         // delete observer entry from the map
         d->m_observers.remove( pObserver );
@@ -2719,9 +2971,8 @@ void Document::reparseConfig()
         }
 
         // [MEM] remove allocation descriptors
-        qDeleteAll( d->m_allocatedPixmaps );
-        d->m_allocatedPixmaps.clear();
-        d->m_allocatedPixmapsTotalMemory = 0;
+        d->m_pixmapCache.clear();
+        d->m_diskPixmapCache.clear();
 
         // send reload signals to observers
         foreachObserver( notifyContentsCleared( DocumentObserver::Pixmap ) );
@@ -2729,7 +2980,7 @@ void Document::reparseConfig()
 
     // free memory if in 'low' profile
     if ( SettingsCore::memoryLevel() == SettingsCore::EnumMemoryLevel::Low &&
-         !d->m_allocatedPixmaps.isEmpty() && !d->m_pagesVector.isEmpty() )
+         !d->m_pixmapCache.isEmpty() && !d->m_pagesVector.isEmpty() )
         d->cleanupPixmapMemory();
 }
 
@@ -2928,6 +3179,11 @@ bool Document::supportsTiles() const
     return d->m_generator ? d->m_generator->hasFeature( Generator::TiledRendering ) : false;
 }
 
+qulonglong Document::pixmapCacheBudget() const
+{
+    return d->m_pixmapCache.budget();
+}
+
 PageSize::List Document::pageSizes() const
 {
     if ( d->m_generator )
@@ -3107,7 +3363,7 @@ void Document::requestPixmaps( const QLinkedList< PixmapRequest * > & requests,
         return;
     }
 
-    // 1. [CLEAN STACK] remove previous requests of requesterID
+    // 1. [CLEAN QUEUE] remove previous requests of requesterID
     // FIXME This assumes all requests come from the same observer, that is true atm but not enforced anywhere
     DocumentObserver *requesterObserver = requests.first()->observer();
     QSet< int > requestedPages;
@@ -3118,21 +3374,24 @@ void Document::requestPixmaps( const QLinkedList< PixmapRequest * > & requests,
     }
     const bool removeAllPrevious = reqOptions & RemoveAllPrevious;
     d->m_pixmapRequestsMutex.lock();
-    QLinkedList< PixmapRequest * >::iterator sIt = d->m_pixmapRequestsStack.begin(), sEnd = d->m_pixmapRequestsStack.end();
-    while ( sIt != sEnd )
+    d->m_pixmapRequestsQueue.deleteRequests( requesterObserver, removeAllPrevious ? 0 : &requestedPages );
+
+    // 1.1 [CANCEL STALE] preloads of pages the observer is not interested in
+    // anymore are still rendering: tell the generator to drop them
+    if ( removeAllPrevious )
     {
-        if ( (*sIt)->observer() == requesterObserver
-             && ( removeAllPrevious || requestedPages.contains( (*sIt)->pageNumber() ) ) )
+        QLinkedList< PixmapRequest * >::const_iterator eIt = d->m_executingPixmapRequests.constBegin(), eEnd = d->m_executingPixmapRequests.constEnd();
+        for ( ; eIt != eEnd; ++eIt )
         {
-            // delete request and remove it from stack
-            delete *sIt;
-            sIt = d->m_pixmapRequestsStack.erase( sIt );
+            PixmapRequest *executing = *eIt;
+            if ( executing->observer() == requesterObserver && executing->preload() && !executing->isTile()
+                 && !requestedPages.contains( executing->pageNumber() ) )
+                executing->d->mShouldAbortRender = 1;
         }
-        else
-            ++sIt;
     }
 
-    // 2. [ADD TO STACK] add requests to stack
+    // 2. [ADD TO QUEUE] add requests to the queue
+    const int currentViewportPage = (*d->m_viewportIterator).pageNumber;
     QLinkedList< PixmapRequest * >::const_iterator rIt = requests.constBegin(), rEnd = requests.constEnd();
     for ( ; rIt != rEnd; ++rIt )
     {
@@ -3175,19 +3434,8 @@ void Document::requestPixmaps( const QLinkedList< PixmapRequest * > & requests,
         if ( !request->asynchronous() )
             request->d->mPriority = 0;
 
-        // add request to the 'stack' at the right place
-        if ( !request->priority() )
-            // add priority zero requests to the top of the stack
-            d->m_pixmapRequestsStack.append( request );
-        else
-        {
-            // insert in stack sorted by priority
-            sIt = d->m_pixmapRequestsStack.begin();
-            sEnd = d->m_pixmapRequestsStack.end();
-            while ( sIt != sEnd && (*sIt)->priority() > request->priority() )
-                ++sIt;
-            d->m_pixmapRequestsStack.insert( sIt, request );
-        }
+        // add request to the queue, sorted by priority and viewport distance
+        d->m_pixmapRequestsQueue.push( request, qAbs( request->pageNumber() - currentViewportPage ) );
     }
     d->m_pixmapRequestsMutex.unlock();
 
@@ -3207,6 +3455,18 @@ void Document::requestTextPage( uint page )
 
     // Memory management for TextPages
 
+    // don't extract it twice if the scheduler is at it already
+    if ( d->m_textPageScheduler && d->m_textPageScheduler->isPending( page ) )
+    {
+        TextPage *textPage = d->m_textPageScheduler->waitForTextPage( page );
+        if ( textPage )
+        {
+            kp->d->adoptTextPage( textPage );
+            d->textGenerationDone( kp );
+            return;
+        }
+    }
+
     d->m_generator->generateTextPage( kp );
 }
 
@@ -3549,6 +3809,11 @@ void Document::setNextDocumentDestination( const QString &namedDestination )
 void Document::searchText( int searchID, const QString & text, bool fromStart, Qt::CaseSensitivity caseSensitivity,
                                SearchType type, bool moveViewport, const QColor & color )
 {
+    // only one search runs on the worker threads
+    if ( d->m_parallelSearch )
+        d->finishParallelSearch( true );
+    d->cancelTextPageSearch();
+
     d->m_searchCancelled = false;
 
     // safety checks: don't perform searches on empty or unsearchable docs
@@ -3577,6 +3842,12 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     s->cachedColor = color;
     s->isCurrentlySearching = true;
 
+    // ask the text index which pages may contain the text, if it knows
+    if ( type == GoogleAll || type == GoogleAny )
+        s->candidatePages = d->m_textIndex.candidatePages( text.split( QLatin1Char ( ' ' ), QString::SkipEmptyParts ), type == GoogleAll );
+    else
+        s->candidatePages = d->m_textIndex.candidatePages( QStringList() << text, true );
+
     // global data for search
     QSet< int > *pagesToNotify = new QSet< int >;
 
@@ -3590,7 +3861,12 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     QApplication::setOverrideCursor( Qt::WaitCursor );
 
     // 1. ALLDOC - proces all document marking pages
-    if ( type == AllDocument )
+    if ( type == AllDocument && d->m_generator->hasFeature( Generator::Threaded ) )
+    {
+        // search 'text' on all pages at once
+        d->startParallelSearch( searchID, QStringList() << text, pagesToNotify );
+    }
+    else if ( type == AllDocument )
     {
         QMap< Page *, QVector<RegularAreaRect *> > *pageMatches = new QMap< Page *, QVector<RegularAreaRect *> >;
 
@@ -3632,10 +3908,16 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
         searchStruct->match = match;
         searchStruct->currentPage = currentPage;
         searchStruct->searchID = searchID;
+        searchStruct->extractedPage = -1;
 
         QMetaObject::invokeMethod(this, "doContinueDirectionMatchSearch", Qt::QueuedConnection, Q_ARG(void *, searchStruct));
     }
     // 4. GOOGLE* - process all document marking pages
+    else if ( ( type == GoogleAll || type == GoogleAny ) && d->m_generator->hasFeature( Generator::Threaded ) )
+    {
+        // search every word in 'text' on all pages at once
+        d->startParallelSearch( searchID, text.split( QLatin1Char ( ' ' ), QString::SkipEmptyParts ), pagesToNotify );
+    }
     else if ( type == GoogleAll || type == GoogleAny )
     {
         QMap< Page *, QVector< QPair<RegularAreaRect *, QColor> > > *pageMatches = new QMap< Page *, QVector<QPair<RegularAreaRect *, QColor> > >;
@@ -3691,6 +3973,12 @@ void Document::resetSearch( int searchID )
     if ( searchIt == d->m_searches.end() )
         return;
 
+    // stop it if it is still searching all the pages
+    if ( d->m_parallelSearch && d->m_parallelSearch->searchID() == searchID )
+        d->finishParallelSearch( true );
+    if ( d->m_textPageSearch && d->m_textPageSearch->searchID == searchID )
+        d->cancelTextPageSearch();
+
     // get previous parameters for search
     RunningSearch * s = *searchIt;
 
@@ -3712,6 +4000,10 @@ void Document::resetSearch( int searchID )
 void Document::cancelSearch()
 {
     d->m_searchCancelled = true;
+
+    if ( d->m_parallelSearch )
+        d->finishParallelSearch( true );
+    d->cancelTextPageSearch();
 }
 
 void Document::undo()
@@ -4660,23 +4952,24 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
         qCDebug(OkularCoreDebug) << "requestDone with generator not in READY state.";
 #endif
 
-    // [MEM] 1.1 find and remove a previous entry for the same page and id
-    QLinkedList< AllocatedPixmap * >::iterator aIt = m_allocatedPixmaps.begin();
-    QLinkedList< AllocatedPixmap * >::iterator aEnd = m_allocatedPixmaps.end();
-    for ( ; aIt != aEnd; ++aIt )
-        if ( (*aIt)->page == req->pageNumber() && (*aIt)->observer == req->observer() )
-        {
-            AllocatedPixmap * p = *aIt;
-            m_allocatedPixmaps.erase( aIt );
-            m_allocatedPixmapsTotalMemory -= p->memory;
-            delete p;
-            break;
-        }
+    // cancelled requests produced no pixmap, there is nothing to account for
+    if ( req->shouldAbortRender() )
+    {
+        m_pixmapRequestsMutex.lock();
+        m_executingPixmapRequests.removeAll( req );
+        const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+        m_pixmapRequestsMutex.unlock();
+        delete req;
+        if ( hasPixmaps )
+            sendGeneratorPixmapRequest();
+        return;
+    }
 
     DocumentObserver *observer = req->observer();
     if ( m_observers.contains(observer) )
     {
-        // [MEM] 1.2 append memory allocation descriptor to the FIFO
+        // [MEM] 1. record the memory allocation as the most recently used,
+        // replacing a previous entry for the same page and observer
         qulonglong memoryBytes = 0;
         const TilesManager *tm = req->d->tilesManager();
         if ( tm )
@@ -4684,9 +4977,7 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
         else
             memoryBytes = 4 * req->width() * req->height();
 
-        AllocatedPixmap * memoryPage = new AllocatedPixmap( req->observer(), req->pageNumber(), memoryBytes );
-        m_allocatedPixmaps.append( memoryPage );
-        m_allocatedPixmapsTotalMemory += memoryBytes;
+        m_pixmapCache.insert( observer, req->pageNumber(), memoryBytes );
 
         // 2. notify an observer that its pixmap changed
         observer->notifyPageChanged( req->pageNumber(), DocumentObserver::Pixmap );
@@ -4704,12 +4995,79 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
 
     // 4. start a new generation if some is pending
     m_pixmapRequestsMutex.lock();
-    bool hasPixmaps = !m_pixmapRequestsStack.isEmpty();
+    bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
     m_pixmapRequestsMutex.unlock();
     if ( hasPixmaps )
         sendGeneratorPixmapRequest();
 }
 
+void DocumentPrivate::setupDiskPixmapCache()
+{
+    // only local files are worth it, other documents are temporary copies
+    if ( !SettingsCore::diskPixmapCache() || m_docFileName.isEmpty() || !m_url.isLocalFile() || m_archiveData )
+    {
+        m_diskPixmapCache.close();
+        return;
+    }
+
+    if ( !m_diskPixmapCache.isOpen() )
+        m_diskPixmapCache.open( m_docFileName, m_generatorName );
+
+    m_diskPixmapCache.setMaximumSize( Q_UINT64_C(1048576) * SettingsCore::diskPixmapCacheSize() );
+
+    // the pixmaps depend on how the generator is asked to render them
+    const QColor paperColor = documentMetaData( Generator::PaperColorMetaData, true ).value< QColor >();
+    const uint flags = ( documentMetaData( Generator::TextAntialiasMetaData, QVariant() ).toBool() ? 1 : 0 ) |
+                       ( documentMetaData( Generator::GraphicsAntialiasMetaData, QVariant() ).toBool() ? 2 : 0 ) |
+                       ( documentMetaData( Generator::TextHintingMetaData, QVariant() ).toBool() ? 4 : 0 );
+    m_diskPixmapCache.setRenderHints( qHash( qMakePair( paperColor.rgba(), flags ) ) );
+}
+
+void DocumentPrivate::setupTextIndex()
+{
+    // the index is saved along with the document info, and built by
+    // extracting the text of the pages while the user reads the document,
+    // so textPage() must be safe to call from several threads at once
+    if ( !SettingsCore::textIndex() || m_xmlFileName.isEmpty() ||
+         !m_generator->hasFeature( Generator::TextExtraction ) || !m_generator->hasFeature( Generator::Threaded ) ||
+         !m_generator->hasFeature( Generator::ConcurrentTextExtraction ) )
+    {
+        m_textIndex.close();
+        return;
+    }
+
+    if ( m_textIndex.isOpen() )
+        return;
+
+    QString indexFileName = m_xmlFileName;
+    if ( indexFileName.endsWith( QLatin1String( ".xml" ) ) )
+        indexFileName.chop( 4 );
+    indexFileName += QStringLiteral( ".index" );
+    m_textIndex.open( indexFileName, m_docFileName, m_generatorName, m_generator, m_pagesVector );
+}
+
+void DocumentPrivate::diskPixmapLoaded( PixmapRequest *request, const QPixmap &pixmap )
+{
+    const bool wanted = m_generator && !m_closingLoop && !request->shouldAbortRender();
+
+    // unreadable, queue it again to render it as usual
+    if ( wanted && pixmap.isNull() )
+    {
+        const int currentViewportPage = (*m_viewportIterator).pageNumber;
+        m_pixmapRequestsMutex.lock();
+        m_executingPixmapRequests.removeAll( request );
+        m_pixmapRequestsQueue.push( request, qAbs( request->pageNumber() - currentViewportPage ) );
+        m_pixmapRequestsMutex.unlock();
+
+        sendGeneratorPixmapRequest();
+        return;
+    }
+
+    if ( wanted )
+        request->page()->d->setRotatedPixmap( request->observer(), new QPixmap( pixmap ) );
+    requestDone( request );
+}
+
 void DocumentPrivate::setPageBoundingBox( int page, const NormalizedRect& boundingBox )
 {
     Page * kp = m_pagesVector[ page ];
@@ -4730,25 +5088,108 @@ void DocumentPrivate::setPageBoundingBox( int page, const NormalizedRect& boundi
 
 }
 
+void DocumentPrivate::appendPages( const QVector< Page * > &pages )
+{
+    if ( !m_generator )
+    {
+        qDeleteAll( pages );
+        return;
+    }
+
+    foreach ( Page *page, pages )
+    {
+        page->d->m_doc = this;
+        page->d->rotateAt( m_rotation );
+        m_pagesVector.append( page );
+    }
+
+    // index the new pages along with the others; the generator may also
+    // have just become able to extract the text in a thread
+    if ( m_textIndex.isOpen() )
+        m_textIndex.appendPages( pages );
+    else
+        setupTextIndex();
+
+    if ( !pages.isEmpty() )
+        foreachObserverD( notifySetup( m_pagesVector, DocumentObserver::PagesAppended ) );
+
+    // restore the annotations and forms stored in the document info for
+    // the new pages, now that the observers know them
+    if ( !m_pendingPageContents.isEmpty() )
+    {
+        const bool showWarningLimitedAnnotSupport = m_showWarningLimitedAnnotSupport;
+        m_showWarningLimitedAnnotSupport = false;
+        foreach ( Page *page, pages )
+        {
+            const QDomElement pageElement = m_pendingPageContents.take( page->number() );
+            if ( !pageElement.isNull() )
+                page->d->restoreLocalContents( pageElement );
+        }
+        m_showWarningLimitedAnnotSupport = showWarningLimitedAnnotSupport;
+    }
+
+    // go to the viewport restored when opening the document, unless the
+    // user moved away meanwhile
+    if ( m_pendingViewport.isValid() && m_pendingViewport.pageNumber < m_pagesVector.count() )
+    {
+        if ( *m_viewportIterator == m_pendingViewportFallback )
+            m_parent->setViewport( m_pendingViewport );
+        m_pendingViewport = DocumentViewport();
+    }
+}
+
+void DocumentPrivate::updatePageSizes( const QHash< int, QSizeF > &sizes )
+{
+    bool changed = false;
+    for ( QHash< int, QSizeF >::const_iterator it = sizes.constBegin(), itEnd = sizes.constEnd(); it != itEnd; ++it )
+    {
+        if ( it.key() < 0 || it.key() >= m_pagesVector.count() || it.value().isEmpty() )
+            continue;
+
+        Page *page = m_pagesVector.at( it.key() );
+        const QSizeF size = page->rotation() % 2 ? QSizeF( page->height(), page->width() ) : QSizeF( page->width(), page->height() );
+        if ( size == it.value() )
+            continue;
+
+        // the pixmaps of the page are deleted with the old size, and so are
+        // the text and the links, normalized to it
+        foreach ( DocumentObserver *observer, m_observers )
+            m_pixmapCache.remove( observer, it.key() );
+        if ( page->hasTextPage() && unloadTextPage( it.key() ) )
+            m_allocatedTextPagesFifo.removeAll( it.key() );
+        page->setObjectRects( QLinkedList< ObjectRect * >() );
+        page->d->changeSize( PageSize( it.value().width(), it.value().height(), QString() ) );
+        changed = true;
+    }
+
+    if ( changed )
+        foreachObserverD( notifySetup( m_pagesVector, DocumentObserver::NewLayoutForPages ) );
+}
+
 void DocumentPrivate::calculateMaxTextPages()
 {
+    // text pages are stored compactly, about 22 bytes per character
     int multipliers = qMax(1, qRound(getTotalMemory() / 536870912.0)); // 512 MB
     switch (SettingsCore::memoryLevel())
     {
         case SettingsCore::EnumMemoryLevel::Low:
-            m_maxAllocatedTextPages = multipliers * 2;
+            m_maxAllocatedTextPages = multipliers * 6;
         break;
 
         case SettingsCore::EnumMemoryLevel::Normal:
-            m_maxAllocatedTextPages = multipliers * 50;
+            m_maxAllocatedTextPages = multipliers * 150;
         break;
 
         case SettingsCore::EnumMemoryLevel::Aggressive:
-            m_maxAllocatedTextPages = multipliers * 250;
+            m_maxAllocatedTextPages = multipliers * 750;
         break;
 
         case SettingsCore::EnumMemoryLevel::Greedy:
-            m_maxAllocatedTextPages = multipliers * 1250;
+            m_maxAllocatedTextPages = multipliers * 3750;
+        break;
+
+        case SettingsCore::EnumMemoryLevel::Adaptive:
+            m_maxAllocatedTextPages = multipliers * 750;
         break;
     }
 }
@@ -4758,12 +5199,18 @@ void DocumentPrivate::textGenerationDone( Page *page )
     if ( !m_pageController ) return;
 
     // 1. If we reached the cache limit, delete the first text page from the fifo
-    if (m_allocatedTextPagesFifo.size() == m_maxAllocatedTextPages)
+    // that is not being searched
+    if (m_allocatedTextPagesFifo.size() >= m_maxAllocatedTextPages)
     {
-        int pageToKick = m_allocatedTextPagesFifo.takeFirst();
-        if (pageToKick != page->number()) // this should never happen but better be safe than sorry
+        for ( int i = 0; i < m_allocatedTextPagesFifo.size(); ++i )
         {
-            m_pagesVector.at(pageToKick)->setTextPage( 0 ); // deletes the textpage
+            const int pageToKick = m_allocatedTextPagesFifo.at( i );
+            // pageToKick == page->number() should never happen but better be safe than sorry
+            if ( pageToKick == page->number() || unloadTextPage( pageToKick ) )
+            {
+                m_allocatedTextPagesFifo.removeAt( i );
+                break;
+            }
         }
     }
 
@@ -4820,9 +5267,8 @@ void Document::setPageSize( const PageSize &size )
     for ( ; pIt != pEnd; ++pIt )
         (*pIt)->d->changeSize( size );
     // clear 'memory allocation' descriptors
-    qDeleteAll( d->m_allocatedPixmaps );
-    d->m_allocatedPixmaps.clear();
-    d->m_allocatedPixmapsTotalMemory = 0;
+    d->m_pixmapCache.clear();
+    d->m_diskPixmapCache.clear();
     // notify the generator that the current page size has changed
     d->m_generator->pageSizeChanged( size, d->m_pageSize );
     // set the new page size
@@ -347,6 +347,15 @@ class OKULARCORE_EXPORT Document : public QObject
          */
         bool supportsTiles() const;
 
+        /**
+         * Returns how much memory, in bytes, the pixmaps of the pages may
+         * take according to the memory level and the memory left in the
+         * system, as computed the last time the memory was checked.
+         *
+         * @since 1.2
+         */
+        qulonglong pixmapCacheBudget() const;
+
         /**
          * Returns the list of supported page sizes or an empty list if this
          * feature is not available.
@@ -1128,6 +1137,7 @@ class OKULARCORE_EXPORT Document : public QObject
 
         Q_PRIVATE_SLOT( d, void saveDocumentInfo() const )
         Q_PRIVATE_SLOT( d, void slotTimedMemoryCheck() )
+        Q_PRIVATE_SLOT( d, void slotMemoryPressure() )
         Q_PRIVATE_SLOT( d, void sendGeneratorPixmapRequest() )
         Q_PRIVATE_SLOT( d, void rotationFinished( int page, Okular::Page *okularPage ) )
         Q_PRIVATE_SLOT( d, void slotFontReadingProgress( int page ) )
@@ -1140,6 +1150,10 @@ class OKULARCORE_EXPORT Document : public QObject
         Q_PRIVATE_SLOT( d, void doContinueDirectionMatchSearch(void *doContinueDirectionMatchSearchStruct) )
         Q_PRIVATE_SLOT( d, void doContinueAllDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID) )
         Q_PRIVATE_SLOT( d, void doContinueGooglesDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID, const QStringList & words) )
+        Q_PRIVATE_SLOT( d, void parallelSearchPageDone( int page ) )
+        Q_PRIVATE_SLOT( d, void parallelSearchFinished() )
+        Q_PRIVATE_SLOT( d, void textPageExtracted( int page ) )
+        Q_PRIVATE_SLOT( d, void diskPixmapLoaded( Okular::PixmapRequest *request, const QPixmap &pixmap ) )
 };
 
 
@@ -25,8 +25,12 @@
 #include <KPluginMetaData>
 
 // local includes
+#include "diskpixmapcache_p.h"
 #include "fontinfo.h"
 #include "generator.h"
+#include "pixmapcache_p.h"
+#include "pixmaprequestqueue_p.h"
+#include "textindex_p.h"
 
 class QUndoStack;
 class QEventLoop;
@@ -35,15 +39,17 @@ class QTimer;
 class QTemporaryFile;
 class KPluginMetaData;
 
-struct AllocatedPixmap;
 struct ArchiveData;
 struct RunningSearch;
 
 namespace Okular {
 class ConfigInterface;
+class MemoryBudgetProvider;
 class PageController;
+class ParallelSearch;
 class SaveInterface;
 class Scripter;
+class TextPageScheduler;
 class View;
 }
 
@@ -72,6 +78,8 @@ struct DoContinueDirectionMatchSearchStruct
     RegularAreaRect *match;
     int currentPage;
     int searchID;
+    // the page last waited for the text page scheduler to extract
+    int extractedPage;
 };
 
 class DocumentPrivate
@@ -79,15 +87,20 @@ class DocumentPrivate
     public:
         DocumentPrivate( Document *parent )
           : m_parent( parent ),
+            m_parallelSearch( 0 ),
+            m_parallelSearchPagesToNotify( 0 ),
+            m_parallelSearchFoundMatch( false ),
+            m_textPageScheduler( 0 ),
+            m_textPageSearch( 0 ),
             m_tempFile( 0 ),
             m_docSize( -1 ),
-            m_allocatedPixmapsTotalMemory( 0 ),
             m_maxAllocatedTextPages( 0 ),
             m_warnedOutOfMemory( false ),
             m_rotation( Rotation0 ),
             m_exportCached( false ),
             m_bookmarkManager( 0 ),
             m_memCheckTimer( 0 ),
+            m_memoryBudget( 0 ),
             m_saveBookmarksTimer( 0 ),
             m_generator( 0 ),
             m_walletGenerator( 0 ),
@@ -110,9 +123,11 @@ class DocumentPrivate
         QString localizedSize(const QSizeF &size) const;
         qulonglong calculateMemoryToFree();
         void cleanupPixmapMemory();
-        void cleanupPixmapMemory( qulonglong memoryToFree );
-        AllocatedPixmap * searchLowestPriorityPixmap( bool unloadableOnly = false, bool thenRemoveIt = false, DocumentObserver *observer = 0 /* any */ );
+        void evictPixmapsOverBudget();
         void calculateMaxTextPages();
+        void setupDiskPixmapCache();
+        void diskPixmapLoaded( PixmapRequest *request, const QPixmap &pixmap );
+        void setupTextIndex();
         qulonglong getTotalMemory();
         qulonglong getFreeMemory( qulonglong *freeSwap = 0 );
         void loadDocumentInfo();
@@ -150,6 +165,7 @@ class DocumentPrivate
         // private slots
         void saveDocumentInfo() const;
         void slotTimedMemoryCheck();
+        void slotMemoryPressure();
         void sendGeneratorPixmapRequest();
         void rotationFinished( int page, Okular::Page *okularPage );
         void slotFontReadingProgress( int page );
@@ -162,6 +178,13 @@ class DocumentPrivate
         void doContinueGooglesDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID, const QStringList & words);
 
         void doProcessSearchMatch( RegularAreaRect *match, RunningSearch *search, QSet< int > *pagesToNotify, int currentPage, int searchID, bool moveViewport, const QColor & color );
+        void startParallelSearch( int searchID, const QStringList &words, QSet< int > *pagesToNotify );
+        void parallelSearchPageDone( int page );
+        void parallelSearchFinished();
+        void finishParallelSearch( bool cancelled );
+        bool unloadTextPage( int page );
+        void textPageExtracted( int page );
+        void cancelTextPageSearch();
 
         // generators stuff
         /**
@@ -174,6 +197,17 @@ class DocumentPrivate
          * Sets the bounding box of the given @p page (in terms of upright orientation, i.e., Rotation0).
          */
         void setPageBoundingBox( int page, const NormalizedRect& boundingBox );
+        /**
+         * Adds the @p pages found by the generator after loading the document
+         * at the end of the document.
+         */
+        void appendPages( const QVector< Page * > &pages );
+
+        /**
+         * Changes the size of the pages in @p sizes to the one the generator
+         * found after loading the document.
+         */
+        void updatePageSizes( const QHash< int, QSizeF > &sizes );
 
         /**
          * Request a particular metadata of the Document itself (ie, not something
@@ -197,6 +231,16 @@ class DocumentPrivate
         // find descriptors, mapped by ID (we handle multiple searches)
         QMap< int, RunningSearch * > m_searches;
         bool m_searchCancelled;
+        // the 'all document' search running on worker threads, if any
+        ParallelSearch *m_parallelSearch;
+        QSet< int > *m_parallelSearchPagesToNotify;
+        bool m_parallelSearchFoundMatch;
+        // the words of the document, to skip the pages not worth searching
+        TextIndex m_textIndex;
+        // extracts the text pages in the background, for threaded generators
+        TextPageScheduler *m_textPageScheduler;
+        // the 'next/previous match' search waiting for a page to be extracted
+        DoContinueDirectionMatchSearchStruct *m_textPageSearch;
 
         // needed because for remote documents docFileName is a local file and
         // we want the remote url when the document refers to relativeNames
@@ -212,15 +256,18 @@ class DocumentPrivate
         QLinkedList< DocumentViewport > m_viewportHistory;
         QLinkedList< DocumentViewport >::iterator m_viewportIterator;
         DocumentViewport m_nextDocumentViewport; // see Link::Goto for an explanation
+        DocumentViewport m_pendingViewport; // the restored viewport, until the generator adds its page
+        DocumentViewport m_pendingViewportFallback; // the viewport shown meanwhile
+        QMap< int, QDomElement > m_pendingPageContents; // the restored pages contents, until the generator adds their page
         QString m_nextDocumentDestination;
 
         // observers / requests / allocator stuff
         QSet< DocumentObserver * > m_observers;
-        QLinkedList< PixmapRequest * > m_pixmapRequestsStack;
+        PixmapRequestQueue m_pixmapRequestsQueue;
         QLinkedList< PixmapRequest * > m_executingPixmapRequests;
         QMutex m_pixmapRequestsMutex;
-        QLinkedList< AllocatedPixmap * > m_allocatedPixmaps;
-        qulonglong m_allocatedPixmapsTotalMemory;
+        PixmapCache m_pixmapCache;
+        DiskPixmapCache m_diskPixmapCache;
         QList< int > m_allocatedTextPagesFifo;
         int m_maxAllocatedTextPages;
         bool m_warnedOutOfMemory;
@@ -245,6 +292,9 @@ class DocumentPrivate
         QTimer *m_memCheckTimer;
         QTimer *m_saveBookmarksTimer;
 
+        // cgroup limits and memory pressure, for the 'adaptive' memory level
+        MemoryBudgetProvider *m_memoryBudget;
+
         QHash<QString, GeneratorInfo> m_loadedGenerators;
         Generator * m_generator;
         QString m_generatorName;
@@ -23,8 +23,10 @@
 
 #include "document.h"
 #include "document_p.h"
+#include "memorybudget_p.h"
 #include "page.h"
 #include "page_p.h"
+#include "settings_core.h"
 #include "textpage.h"
 #include "utils.h"
 
@@ -32,8 +34,7 @@ using namespace Okular;
 
 GeneratorPrivate::GeneratorPrivate()
     : m_document( 0 ),
-      mPixmapGenerationThread( 0 ), mTextPageGenerationThread( 0 ),
-      m_mutex( 0 ), m_threadsMutex( 0 ), mPixmapReady( true ), mTextPageReady( true ),
+      m_mutex( 0 ), m_threadsMutex( 0 ), mRunningPixmapGenerations( 0 ),
       m_closing( false ), m_closingLoop( 0 ),
       m_dpi(72.0, 72.0)
 {
@@ -41,15 +42,10 @@ GeneratorPrivate::GeneratorPrivate()
 
 GeneratorPrivate::~GeneratorPrivate()
 {
-    if ( mPixmapGenerationThread )
-        mPixmapGenerationThread->wait();
+    foreach ( PixmapGenerationThread *thread, mPixmapGenerationThreads )
+        thread->wait();
 
-    delete mPixmapGenerationThread;
-
-    if ( mTextPageGenerationThread )
-        mTextPageGenerationThread->wait();
-
-    delete mTextPageGenerationThread;
+    qDeleteAll( mPixmapGenerationThreads );
 
     delete m_mutex;
     delete m_threadsMutex;
@@ -57,43 +53,51 @@ GeneratorPrivate::~GeneratorPrivate()
 
 PixmapGenerationThread* GeneratorPrivate::pixmapGenerationThread()
 {
-    if ( mPixmapGenerationThread )
-        return mPixmapGenerationThread;
+    // reuse an idle worker, if any
+    foreach ( PixmapGenerationThread *thread, mPixmapGenerationThreads )
+    {
+        if ( !thread->request() )
+            return thread;
+    }
 
     Q_Q( Generator );
-    mPixmapGenerationThread = new PixmapGenerationThread( q );
-    QObject::connect( mPixmapGenerationThread, SIGNAL(finished()), q, SLOT(pixmapGenerationFinished()),
+    PixmapGenerationThread *thread = new PixmapGenerationThread( q );
+    QObject::connect( thread, SIGNAL(finished()), q, SLOT(pixmapGenerationFinished()),
                       Qt::QueuedConnection );
+    mPixmapGenerationThreads.append( thread );
 
-    return mPixmapGenerationThread;
+    return thread;
 }
 
-TextPageGenerationThread* GeneratorPrivate::textPageGenerationThread()
+int GeneratorPrivate::maxPixmapGenerationThreads() const
 {
-    if ( mTextPageGenerationThread )
-        return mTextPageGenerationThread;
+    if ( !m_features.contains( Generator::Threaded ) || !m_features.contains( Generator::ConcurrentRendering ) )
+        return 1;
 
-    Q_Q( Generator );
-    mTextPageGenerationThread = new TextPageGenerationThread( q );
-    QObject::connect( mTextPageGenerationThread, SIGNAL(finished()), q, SLOT(textpageGenerationFinished()),
-                      Qt::QueuedConnection );
+    const int configured = SettingsCore::renderThreads();
+    if ( configured > 0 )
+        return configured;
 
-    return mTextPageGenerationThread;
+    return qMax( 1, QThread::idealThreadCount() );
 }
 
 void GeneratorPrivate::pixmapGenerationFinished()
 {
     Q_Q( Generator );
-    PixmapRequest *request = mPixmapGenerationThread->request();
-    mPixmapGenerationThread->endGeneration();
+    PixmapGenerationThread *thread = qobject_cast< PixmapGenerationThread * >( q->sender() );
+    if ( !thread || !thread->request() )
+        return;
+
+    PixmapRequest *request = thread->request();
+    thread->endGeneration();
 
     QMutexLocker locker( threadsLock() );
-    mPixmapReady = true;
+    --mRunningPixmapGenerations;
 
     if ( m_closing )
     {
         delete request;
-        if ( mTextPageReady )
+        if ( mRunningPixmapGenerations == 0 )
         {
             locker.unlock();
             m_closingLoop->quit();
@@ -101,41 +105,19 @@ void GeneratorPrivate::pixmapGenerationFinished()
         return;
     }
 
-    const QImage& img = mPixmapGenerationThread->image();
-    request->page()->setPixmap( request->observer(), new QPixmap( QPixmap::fromImage( img ) ), request->normalizedRect() );
-    const int pageNumber = request->page()->number();
-
-    if ( mPixmapGenerationThread->calcBoundingBox() )
-        q->updatePageBoundingBox( pageNumber, mPixmapGenerationThread->boundingBox() );
-    q->signalPixmapRequestDone( request );
-}
-
-void GeneratorPrivate::textpageGenerationFinished()
-{
-    Q_Q( Generator );
-    Page *page = mTextPageGenerationThread->page();
-    mTextPageGenerationThread->endGeneration();
-
-    QMutexLocker locker( threadsLock() );
-    mTextPageReady = true;
-
-    if ( m_closing )
+    // a cancelled request has nothing worth keeping, just let the document know
+    if ( request->shouldAbortRender() )
     {
-        delete mTextPageGenerationThread->textPage();
-        if ( mPixmapReady )
-        {
-            locker.unlock();
-            m_closingLoop->quit();
-        }
+        q->signalPixmapRequestDone( request );
         return;
     }
 
-    if ( mTextPageGenerationThread->textPage() )
-    {
-        TextPage *tp = mTextPageGenerationThread->textPage();
-        page->setTextPage( tp );
-        q->signalTextGenerationDone( page, tp );
-    }
+    PagePrivate::get( request->page() )->setImage( request->observer(), thread->image(), request->normalizedRect(), thread->rotation() );
+    const int pageNumber = request->page()->number();
+
+    if ( thread->calcBoundingBox() )
+        q->updatePageBoundingBox( pageNumber, thread->boundingBox() );
+    q->signalPixmapRequestDone( request );
 }
 
 QMutex* GeneratorPrivate::threadsLock()
@@ -205,7 +187,7 @@ bool Generator::closeDocument()
     d->m_closing = true;
 
     d->threadsLock()->lock();
-    if ( !( d->mPixmapReady && d->mTextPageReady ) )
+    if ( d->mRunningPixmapGenerations > 0 )
     {
         QEventLoop loop;
         d->m_closingLoop = &loop;
@@ -231,37 +213,27 @@ bool Generator::closeDocument()
 bool Generator::canGeneratePixmap() const
 {
     Q_D( const Generator );
-    return d->mPixmapReady;
+    return d->mRunningPixmapGenerations < d->maxPixmapGenerationThreads();
 }
 
 void Generator::generatePixmap( PixmapRequest *request )
 {
     Q_D( Generator );
-    d->mPixmapReady = false;
+    ++d->mRunningPixmapGenerations;
 
     const bool calcBoundingBox = !request->isTile() && !request->page()->isBoundingBoxKnown();
 
     if ( request->asynchronous() && hasFeature( Threaded ) )
     {
         d->pixmapGenerationThread()->startGeneration( request, calcBoundingBox );
-
-        /**
-         * We create the text page for every page that is visible to the
-         * user, so he can use the text extraction tools without a delay.
-         */
-        if ( hasFeature( TextExtraction ) && !request->page()->hasTextPage() && canGenerateTextPage() && !d->m_closing ) {
-            d->mTextPageReady = false;
-            d->textPageGenerationThread()->startGeneration( request->page() );
-        }
-
         return;
     }
 
     const QImage& img = image( request );
-    request->page()->setPixmap( request->observer(), new QPixmap( QPixmap::fromImage( img ) ), request->normalizedRect() );
+    PagePrivate::get( request->page() )->setImage( request->observer(), img, request->normalizedRect(), Rotation0 );
     const int pageNumber = request->page()->number();
 
-    d->mPixmapReady = true;
+    --d->mRunningPixmapGenerations;
 
     signalPixmapRequestDone( request );
     if ( calcBoundingBox )
@@ -270,8 +242,7 @@ void Generator::generatePixmap( PixmapRequest *request )
 
 bool Generator::canGenerateTextPage() const
 {
-    Q_D( const Generator );
-    return d->mTextPageReady;
+    return true;
 }
 
 void Generator::generateTextPage( Page *page )
@@ -463,6 +434,22 @@ void Generator::updatePageBoundingBox( int page, const NormalizedRect & bounding
         d->m_document->setPageBoundingBox( page, boundingBox );
 }
 
+void Generator::appendPages( const QVector< Page * > &pages )
+{
+    Q_D( Generator );
+    if ( d->m_document ) // still connected to document?
+        d->m_document->appendPages( pages );
+    else
+        qDeleteAll( pages );
+}
+
+void Generator::updatePageSizes( const QHash< int, QSizeF > &sizes )
+{
+    Q_D( Generator );
+    if ( d->m_document ) // still connected to document?
+        d->m_document->updatePageSizes( sizes );
+}
+
 void Generator::requestFontData(const Okular::FontInfo & /*font*/, QByteArray * /*data*/)
 {
 
@@ -480,6 +467,42 @@ QSizeF Generator::dpi() const
      return d->m_dpi;
 }
 
+qulonglong Generator::cacheMemory() const
+{
+    Q_D( const Generator );
+
+    switch ( SettingsCore::memoryLevel() )
+    {
+        case SettingsCore::EnumMemoryLevel::Low:
+            return 0;
+
+        case SettingsCore::EnumMemoryLevel::Normal:
+            return 32 * 1024 * 1024;
+
+        case SettingsCore::EnumMemoryLevel::Adaptive:
+        {
+            if ( !d->m_document )
+                return 32 * 1024 * 1024;
+
+            // follow the memory still available like the page pixmaps do:
+            // a small share of it, halved while the kernel reports memory
+            // stalls, and never more than at the Aggressive level
+            qulonglong memory = qMin( d->m_document->getFreeMemory() / 16, (qulonglong)128 * 1024 * 1024 );
+            if ( d->m_document->m_memoryBudget && d->m_document->m_memoryBudget->isUnderPressure() )
+                memory /= 2;
+            return memory;
+        }
+
+        case SettingsCore::EnumMemoryLevel::Aggressive:
+            return 128 * 1024 * 1024;
+
+        case SettingsCore::EnumMemoryLevel::Greedy:
+            return 256 * 1024 * 1024;
+    }
+
+    return 32 * 1024 * 1024;
+}
+
 QAbstractItemModel * Generator::layersModel() const
 {
     return 0;
@@ -497,6 +520,7 @@ PixmapRequest::PixmapRequest( DocumentObserver *observer, int pageNumber, int wi
     d->mForce = false;
     d->mTile = false;
     d->mNormalizedRect = NormalizedRect();
+    d->mShouldAbortRender = 0;
 }
 
 PixmapRequest::~PixmapRequest()
@@ -567,6 +591,11 @@ const NormalizedRect& PixmapRequest::normalizedRect() const
     return d->mNormalizedRect;
 }
 
+bool PixmapRequest::shouldAbortRender() const
+{
+    return d->mShouldAbortRender.load() != 0;
+}
+
 Okular::TilesManager* PixmapRequestPrivate::tilesManager() const
 {
     return mPage->d->tilesManager(mObserver);
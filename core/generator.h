@@ -18,6 +18,7 @@
 #include "global.h"
 #include "pagesize.h"
 
+#include <QtCore/QHash>
 #include <QtCore/QList>
 #include <QtCore/QObject>
 #include <QtCore/QSharedDataPointer>
@@ -188,7 +189,9 @@ class OKULARCORE_EXPORT Generator : public QObject
 {
     /// @cond PRIVATE
     friend class PixmapGenerationThread;
-    friend class TextPageGenerationThread;
+    friend class ParallelSearch;
+    friend class TextIndex;
+    friend class TextPageScheduler;
     /// @endcond
 
     Q_OBJECT
@@ -208,7 +211,9 @@ class OKULARCORE_EXPORT Generator : public QObject
             PrintNative,       ///< Whether the Generator supports native cross-platform printing (QPainter-based).
             PrintPostscript,   ///< Whether the Generator supports postscript-based file printing.
             PrintToFile,       ///< Whether the Generator supports export to PDF & PS through the Print Dialog
-            TiledRendering     ///< Whether the Generator can render tiles @since 0.16 (KDE 4.10)
+            TiledRendering,    ///< Whether the Generator can render tiles @since 0.16 (KDE 4.10)
+            ConcurrentRendering, ///< Whether image() can run for several requests at the same time in different threads; only meaningful together with @ref Threaded @since 1.2
+            ConcurrentTextExtraction ///< Whether textPage() can run for several pages at the same time in different threads; only meaningful together with @ref Threaded @since 1.2
         };
 
         /**
@@ -281,6 +286,9 @@ class OKULARCORE_EXPORT Generator : public QObject
         /**
          * This method returns whether the generator is ready to
          * handle a new pixmap request.
+         *
+         * Generators with the @ref ConcurrentRendering feature stay ready
+         * until all the workers of their rendering pool are busy.
          */
         virtual bool canGeneratePixmap() const;
 
@@ -497,6 +505,9 @@ class OKULARCORE_EXPORT Generator : public QObject
          *
          * @warning this method may be executed in its own separated thread if the
          * @ref Threaded is enabled!
+         *
+         * @warning if @ref ConcurrentRendering is enabled too, this method may
+         * be executed by several threads at the same time for different requests!
          */
         virtual QImage image( PixmapRequest *page );
 
@@ -505,6 +516,9 @@ class OKULARCORE_EXPORT Generator : public QObject
          *
          * @warning this method may be executed in its own separated thread if the
          * @ref Threaded is enabled!
+         *
+         * @warning if @ref ConcurrentTextExtraction is enabled too, this method may
+         * be executed by several threads at the same time for different pages!
          */
         virtual TextPage* textPage( Page *page );
 
@@ -556,12 +570,47 @@ class OKULARCORE_EXPORT Generator : public QObject
          */
         void updatePageBoundingBox( int page, const NormalizedRect & boundingBox );
 
+        /**
+         * Adds @p pages at the end of the document, after the document has been
+         * loaded. Generators that lay out the document progressively can return
+         * the first pages from loadDocument() and add the others with this method
+         * as they are ready. The Document takes ownership of the pages, and the
+         * numbers of the pages must follow the ones of the current last page.
+         * The observers are set up again with DocumentObserver::PagesAppended.
+         *
+         * @since 1.2
+         */
+        void appendPages( const QVector< Page * > &pages );
+
+        /**
+         * Changes the size of the pages in @p sizes, indexed by page number.
+         * Generators that don't know the size of all the pages when loading
+         * the document can create them with a provisional size and correct it
+         * later with this method. The pixmaps, the text page and the object rects
+         * of the resized pages are discarded, the generator has to provide them
+         * again.
+         *
+         * @since 1.2
+         */
+        void updatePageSizes( const QHash< int, QSizeF > &sizes );
+
         /**
          * Returns DPI, previously set via setDPI()
          * @since 0.19 (KDE 4.13)
          */
         QSizeF dpi() const;
 
+        /**
+         * Returns how much memory, in bytes, the generator may use to cache
+         * data of its own, like decoded pages, according to the memory level
+         * chosen by the user and, at the adaptive level, to the memory still
+         * available. It is 0 when the user wants to save memory, so it
+         * should be asked again when the cache is filled rather than once.
+         *
+         * @since 1.2
+         */
+        qulonglong cacheMemory() const;
+
     protected Q_SLOTS:
         /**
          * Gets the font data for the given font
@@ -590,7 +639,6 @@ class OKULARCORE_EXPORT Generator : public QObject
         Q_DISABLE_COPY( Generator )
 
         Q_PRIVATE_SLOT( d_func(), void pixmapGenerationFinished() )
-        Q_PRIVATE_SLOT( d_func(), void textpageGenerationFinished() )
 };
 
 /**
@@ -703,6 +751,18 @@ class OKULARCORE_EXPORT PixmapRequest
          */
         const NormalizedRect& normalizedRect() const;
 
+        /**
+         * Returns whether the result of the request is not needed anymore,
+         * e.g. because it was a preload for a page that went out of the
+         * preload window.
+         *
+         * Generators doing long renderings may poll this from image() and
+         * return early; the result of an aborted request is discarded.
+         *
+         * @since 1.2
+         */
+        bool shouldAbortRender() const;
+
     private:
         Q_DISABLE_COPY( PixmapRequest )
 
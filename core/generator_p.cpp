@@ -13,12 +13,14 @@
 
 #include "fontinfo.h"
 #include "generator.h"
+#include "page.h"
+#include "rotationjob_p.h"
 #include "utils.h"
 
 using namespace Okular;
 
 PixmapGenerationThread::PixmapGenerationThread( Generator *generator )
-    : mGenerator( generator ), mRequest( 0 ), mCalcBoundingBox( false )
+    : mGenerator( generator ), mRequest( 0 ), mRotation( Rotation0 ), mCalcBoundingBox( false )
 {
 }
 
@@ -26,6 +28,7 @@ void PixmapGenerationThread::startGeneration( PixmapRequest *request, bool calcB
 {
     mRequest = request;
     mCalcBoundingBox = calcBoundingBox;
+    mRotation = request->page()->rotation();
 
     start( QThread::InheritPriority );
 }
@@ -55,52 +58,26 @@ NormalizedRect PixmapGenerationThread::boundingBox() const
     return mBoundingBox;
 }
 
+Rotation PixmapGenerationThread::rotation() const
+{
+    return mRotation;
+}
+
 void PixmapGenerationThread::run()
 {
     mImage = QImage();
 
-    if ( mRequest )
+    // the request may have been cancelled while waiting for the thread to start
+    if ( mRequest && !mRequest->shouldAbortRender() )
     {
         mImage = mGenerator->image( mRequest );
         if ( mCalcBoundingBox )
             mBoundingBox = Utils::imageBoundingBox( &mImage );
-    }
-}
-
-
-TextPageGenerationThread::TextPageGenerationThread( Generator *generator )
-    : mGenerator( generator ), mPage( 0 )
-{
-}
-
-void TextPageGenerationThread::startGeneration( Page *page )
-{
-    mPage = page;
-
-    start( QThread::InheritPriority );
-}
-
-void TextPageGenerationThread::endGeneration()
-{
-    mPage = 0;
-}
-
-Page *TextPageGenerationThread::page() const
-{
-    return mPage;
-}
 
-TextPage* TextPageGenerationThread::textPage() const
-{
-    return mTextPage;
-}
-
-void TextPageGenerationThread::run()
-{
-    mTextPage = 0;
-
-    if ( mPage )
-        mTextPage = mGenerator->textPage( mPage );
+        // turn the image here rather than in a RotationJob after a trip
+        // through the GUI thread
+        mImage = RotationJob::rotatedImage( mImage, Rotation0, mRotation );
+    }
 }
 
 
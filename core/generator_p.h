@@ -12,6 +12,8 @@
 
 #include "area.h"
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
 #include <QtCore/QSet>
 #include <QtCore/QThread>
 #include <QtGui/QImage>
@@ -29,7 +31,6 @@ class Page;
 class PixmapGenerationThread;
 class PixmapRequest;
 class TextPage;
-class TextPageGenerationThread;
 class TilesManager;
 
 class GeneratorPrivate
@@ -43,10 +44,15 @@ class GeneratorPrivate
         Generator *q_ptr;
 
         PixmapGenerationThread* pixmapGenerationThread();
-        TextPageGenerationThread* textPageGenerationThread();
+
+        /**
+         * Returns how many pixmap requests the generator may render at the
+         * same time: 1 unless the generator is both Threaded and
+         * ConcurrentRendering, the configured pool size otherwise.
+         */
+        int maxPixmapGenerationThreads() const;
 
         void pixmapGenerationFinished();
-        void textpageGenerationFinished();
 
         QMutex* threadsLock();
 
@@ -57,12 +63,13 @@ class GeneratorPrivate
         // NOTE: the following should be a QSet< GeneratorFeature >,
         // but it is not to avoid #include'ing generator.h
         QSet< int > m_features;
-        PixmapGenerationThread *mPixmapGenerationThread;
-        TextPageGenerationThread *mTextPageGenerationThread;
+        // the pool of pixmap workers; it holds one thread unless the
+        // generator supports concurrent rendering
+        QList< PixmapGenerationThread * > mPixmapGenerationThreads;
         mutable QMutex *m_mutex;
         QMutex *m_threadsMutex;
-        bool mPixmapReady : 1;
-        bool mTextPageReady : 1;
+        // number of pixmap requests currently being rendered
+        int mRunningPixmapGenerations;
         bool m_closing : 1;
         QEventLoop *m_closingLoop;
         QSizeF m_dpi;
@@ -85,6 +92,9 @@ class PixmapRequestPrivate
         bool mTile : 1;
         Page *mPage;
         NormalizedRect mNormalizedRect;
+        // set by the document when the result is not wanted anymore,
+        // read by the rendering thread
+        QAtomicInt mShouldAbortRender;
 };
 
 
@@ -105,6 +115,12 @@ class PixmapGenerationThread : public QThread
         bool calcBoundingBox() const;
         NormalizedRect boundingBox() const;
 
+        /**
+         * The rotation the image was turned to, the one of the page when
+         * the generation started.
+         */
+        Rotation rotation() const;
+
     protected:
         void run() override;
 
@@ -113,34 +129,11 @@ class PixmapGenerationThread : public QThread
         PixmapRequest *mRequest;
         QImage mImage;
         NormalizedRect mBoundingBox;
+        Rotation mRotation;
         bool mCalcBoundingBox : 1;
 };
 
 
-class TextPageGenerationThread : public QThread
-{
-    Q_OBJECT
-
-    public:
-        TextPageGenerationThread( Generator *generator );
-
-        void startGeneration( Page *page );
-
-        void endGeneration();
-
-        Page *page() const;
-
-        TextPage* textPage() const;
-
-    protected:
-        void run() override;
-
-    private:
-        Generator *mGenerator;
-        Page *mPage;
-        TextPage *mTextPage;
-};
-
 class FontExtractionThread : public QThread
 {
     Q_OBJECT
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "memorybudget_p.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QSocketNotifier>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "debug_p.h"
+
+// ask the kernel to notify us when tasks stalled on memory for more than
+// 150ms over a 2s window (the smallest window unprivileged users may use)
+#define PRESSURE_TRIGGER "some 150000 2000000"
+// how long the last pressure event keeps us in the 'under pressure' state
+#define PRESSURE_HOLD_MSECS 10000
+// without triggers, the 10s stall average (in %) above which we are under pressure
+#define PRESSURE_AVG10_THRESHOLD 10.0
+
+using namespace Okular;
+
+#if defined(Q_OS_LINUX)
+static const QString &cgroupDirectory()
+{
+    static QString directory;
+    static bool initialized = false;
+    if ( initialized )
+        return directory;
+
+    initialized = true;
+
+    // cgroup v2 processes have a single '0::<path>' entry
+    QFile cgroupFile( QStringLiteral("/proc/self/cgroup") );
+    if ( !cgroupFile.open( QIODevice::ReadOnly ) )
+        return directory;
+
+    while ( !cgroupFile.atEnd() )
+    {
+        const QString entry = QString::fromLatin1( cgroupFile.readLine() ).trimmed();
+        if ( entry.startsWith( QLatin1String("0::") ) )
+        {
+            directory = QDir::cleanPath( QStringLiteral("/sys/fs/cgroup/") + entry.mid( 3 ) );
+            break;
+        }
+    }
+
+    return directory;
+}
+
+// returns 0 if the file is missing or holds "max"
+static qulonglong readCgroupValue( const QString &fileName )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return 0;
+
+    bool ok = false;
+    const qulonglong value = file.readLine().trimmed().toULongLong( &ok );
+    return ok ? value : 0;
+}
+
+static double pressureAverage10()
+{
+    QFile pressureFile( QStringLiteral("/proc/pressure/memory") );
+    if ( !pressureFile.open( QIODevice::ReadOnly ) )
+        return 0;
+
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    const QByteArray entry = pressureFile.readLine();
+    if ( !entry.startsWith( "some " ) )
+        return 0;
+
+    const int start = entry.indexOf( "avg10=" );
+    if ( start == -1 )
+        return 0;
+
+    const int end = entry.indexOf( ' ', start );
+    return entry.mid( start + 6, end - start - 6 ).toDouble();
+}
+#endif
+
+MemoryBudgetProvider::MemoryBudgetProvider( QObject *parent )
+    : QObject( parent ), m_pressureFd( -1 ), m_pressureNotifier( nullptr )
+{
+}
+
+MemoryBudgetProvider::~MemoryBudgetProvider()
+{
+    setMonitoring( false );
+}
+
+qulonglong MemoryBudgetProvider::cgroupMemoryLimit()
+{
+#if defined(Q_OS_LINUX)
+    const QString root = QStringLiteral("/sys/fs/cgroup");
+    QString directory = cgroupDirectory();
+    if ( directory.isEmpty() )
+        return 0;
+
+    // the effective limit is the lowest one along the hierarchy
+    qulonglong limit = 0;
+    while ( directory.length() > root.length() && directory.startsWith( root ) )
+    {
+        const qulonglong value = readCgroupValue( directory + QStringLiteral("/memory.max") );
+        if ( value && ( !limit || value < limit ) )
+            limit = value;
+        directory = directory.section( QLatin1Char('/'), 0, -2 );
+    }
+    return limit;
+#else
+    return 0;
+#endif
+}
+
+qulonglong MemoryBudgetProvider::cgroupMemoryUsage()
+{
+#if defined(Q_OS_LINUX)
+    const QString directory = cgroupDirectory();
+    if ( directory.isEmpty() )
+        return 0;
+
+    return readCgroupValue( directory + QStringLiteral("/memory.current") );
+#else
+    return 0;
+#endif
+}
+
+void MemoryBudgetProvider::setMonitoring( bool monitor )
+{
+#if defined(Q_OS_LINUX)
+    if ( monitor == ( m_pressureFd != -1 ) )
+        return;
+
+    if ( !monitor )
+    {
+        delete m_pressureNotifier;
+        m_pressureNotifier = nullptr;
+        ::close( m_pressureFd );
+        m_pressureFd = -1;
+        return;
+    }
+
+    const int fd = ::open( "/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC );
+    if ( fd == -1 )
+        return;
+
+    // the trigger is registered by writing it, terminating zero included
+    const char trigger[] = PRESSURE_TRIGGER;
+    if ( ::write( fd, trigger, sizeof( trigger ) ) < 0 )
+    {
+        qCDebug(OkularCoreDebug) << "Memory pressure notifications not available";
+        ::close( fd );
+        return;
+    }
+
+    // trigger events are reported as POLLPRI
+    m_pressureFd = fd;
+    m_pressureNotifier = new QSocketNotifier( fd, QSocketNotifier::Exception, this );
+    connect( m_pressureNotifier, &QSocketNotifier::activated, this, &MemoryBudgetProvider::slotPressureEvent );
+#else
+    Q_UNUSED( monitor );
+#endif
+}
+
+bool MemoryBudgetProvider::isUnderPressure() const
+{
+    if ( m_lastPressure.isValid() && m_lastPressure.elapsed() < PRESSURE_HOLD_MSECS )
+        return true;
+
+#if defined(Q_OS_LINUX)
+    // no trigger registered: look at the averages instead
+    if ( m_pressureFd == -1 )
+        return pressureAverage10() > PRESSURE_AVG10_THRESHOLD;
+#endif
+    return false;
+}
+
+void MemoryBudgetProvider::slotPressureEvent()
+{
+    m_lastPressure.start();
+    emit memoryPressure();
+}
+
+#include "moc_memorybudget_p.cpp"
@@ -0,0 +1,78 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_MEMORYBUDGET_P_H_
+#define _OKULAR_MEMORYBUDGET_P_H_
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QObject>
+
+class QSocketNotifier;
+
+namespace Okular {
+
+/**
+ * @short Knows how much memory the process may really use.
+ *
+ * On Linux it reads the limits of the cgroup (v2) the process lives in,
+ * which can be far below the physical memory of the host when running in
+ * a container, and listens to the kernel pressure stall information
+ * (/proc/pressure/memory) to know when the system is struggling.
+ *
+ * On other systems, or when those interfaces are not available, there is
+ * no limit and no pressure is ever reported.
+ */
+class MemoryBudgetProvider : public QObject
+{
+    Q_OBJECT
+
+    public:
+        explicit MemoryBudgetProvider( QObject *parent = nullptr );
+        ~MemoryBudgetProvider();
+
+        /**
+         * Returns the memory limit of the cgroup of the process (the lowest
+         * one along its hierarchy), or 0 if there is no limit.
+         */
+        static qulonglong cgroupMemoryLimit();
+
+        /**
+         * Returns the memory currently charged to the cgroup of the process,
+         * or 0 if unknown.
+         */
+        static qulonglong cgroupMemoryUsage();
+
+        /**
+         * Enables or disables listening to memory pressure events.
+         */
+        void setMonitoring( bool monitor );
+
+        /**
+         * Returns whether the kernel reported memory stalls recently.
+         */
+        bool isUnderPressure() const;
+
+    Q_SIGNALS:
+        /**
+         * Emitted when the kernel reports that tasks stall on memory.
+         */
+        void memoryPressure();
+
+    private Q_SLOTS:
+        void slotPressureEvent();
+
+    private:
+        int m_pressureFd;
+        QSocketNotifier *m_pressureNotifier;
+        QElapsedTimer m_lastPressure;
+};
+
+}
+
+#endif
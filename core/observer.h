@@ -53,7 +53,8 @@ class OKULARCORE_EXPORT DocumentObserver
          */
         enum SetupFlags {
             DocumentChanged = 1,    ///< The document is a new document.
-            NewLayoutForPages = 2   ///< All the pages have
+            NewLayoutForPages = 2,  ///< All the pages have
+            PagesAppended = 4       ///< Pages have been added after the last one, the others did not change @since 1.2
         };
 
         /**
@@ -35,6 +35,7 @@
 #include "pagecontroller_p.h"
 #include "pagesize.h"
 #include "pagetransition.h"
+#include "parallelsearch_p.h"
 #include "rotationjob_p.h"
 #include "textpage.h"
 #include "textpage_p.h"
@@ -97,10 +98,11 @@ PagePrivate *PagePrivate::get( Page * page )
 
 void PagePrivate::imageRotationDone( RotationJob * job )
 {
+    // the image is not shared anymore, it can be converted in place
     TilesManager *tm = tilesManager( job->observer() );
     if ( tm )
     {
-        QPixmap *pixmap = new QPixmap( QPixmap::fromImage( job->image() ) );
+        QPixmap *pixmap = new QPixmap( QPixmap::fromImage( job->takeImage() ) );
         tm->setPixmap( pixmap, job->rect() );
         delete pixmap;
         return;
@@ -110,17 +112,78 @@ void PagePrivate::imageRotationDone( RotationJob * job )
     if ( it != m_pixmaps.end() )
     {
         PixmapObject &object = it.value();
-        (*object.m_pixmap) = QPixmap::fromImage( job->image() );
+        (*object.m_pixmap) = QPixmap::fromImage( job->takeImage() );
         object.m_rotation = job->rotation();
     } else {
         PixmapObject object;
-        object.m_pixmap = new QPixmap( QPixmap::fromImage( job->image() ) );
+        object.m_pixmap = new QPixmap( QPixmap::fromImage( job->takeImage() ) );
         object.m_rotation = job->rotation();
 
         m_pixmaps.insert( job->observer(), object );
     }
 }
 
+void PagePrivate::setRotatedPixmap( DocumentObserver *observer, QPixmap *pixmap )
+{
+    QMap< DocumentObserver*, PixmapObject >::iterator it = m_pixmaps.find( observer );
+    if ( it != m_pixmaps.end() )
+    {
+        delete it.value().m_pixmap;
+    }
+    else
+    {
+        it = m_pixmaps.insert( observer, PixmapObject() );
+    }
+    it.value().m_pixmap = pixmap;
+    it.value().m_rotation = m_rotation;
+}
+
+void PagePrivate::setImage( DocumentObserver *observer, const QImage &image, const NormalizedRect &rect, Rotation rotation )
+{
+    // the page was rotated meanwhile, turn it off the GUI thread
+    if ( rotation != m_rotation )
+    {
+        RotationJob *job = new RotationJob( image, rotation, m_rotation, observer );
+        job->setPage( this );
+        job->setRect( TilesManager::toRotatedRect( rect, m_rotation ) );
+        m_doc->m_pageController->addRotationJob( job );
+        return;
+    }
+
+    QPixmap *pixmap = new QPixmap( QPixmap::fromImage( image ) );
+    TilesManager *tm = tilesManager( observer );
+    if ( tm )
+    {
+        tm->setPixmap( pixmap, TilesManager::toRotatedRect( rect, m_rotation ) );
+        delete pixmap;
+        return;
+    }
+
+    setRotatedPixmap( observer, pixmap );
+}
+
+void PagePrivate::prepareTextPage( TextPage *textPage )
+{
+    textPage->d->m_page = this;
+    /**
+     * Correct text order for before text selection
+     */
+    textPage->d->correctTextOrder();
+}
+
+void PagePrivate::adoptTextPage( TextPage *textPage )
+{
+    // a running search may be reading the current one
+    if ( m_doc && m_doc->m_parallelSearch )
+    {
+        m_doc->m_parallelSearch->replaceTextPage( m_page, textPage );
+        return;
+    }
+
+    delete m_text;
+    m_text = textPage;
+}
+
 QTransform PagePrivate::rotationMatrix() const
 {
     return Okular::buildRotationMatrix( m_rotation );
@@ -367,17 +430,25 @@ void PagePrivate::rotateAt( Rotation orientation )
     m_rotation = orientation;
 
     /**
-     * Rotate the images of the page.
+     * Rotate the images of the page the observers are showing. The other
+     * ones are dropped, rendering them again when they are needed is
+     * cheaper than rotating all the cached pages now.
      */
-    QMapIterator< DocumentObserver*, PagePrivate::PixmapObject > it( m_pixmaps );
-    while ( it.hasNext() ) {
-        it.next();
+    QMap< DocumentObserver*, PagePrivate::PixmapObject >::iterator it = m_pixmaps.begin();
+    while ( it != m_pixmaps.end() ) {
+        if ( it.key()->canUnloadPixmap( m_number ) ) {
+            delete it.value().m_pixmap;
+            m_doc->m_pixmapCache.remove( it.key(), m_number );
+            it = m_pixmaps.erase( it );
+            continue;
+        }
 
         const PagePrivate::PixmapObject &object = it.value();
 
         RotationJob *job = new RotationJob( object.m_pixmap->toImage(), object.m_rotation, m_rotation, it.key() );
         job->setPage( this );
         m_doc->m_pageController->addRotationJob(job);
+        ++it;
     }
 
     /**
@@ -531,28 +602,17 @@ void Page::setPixmap( DocumentObserver *observer, QPixmap *pixmap, const Normali
         it.value().m_pixmap = pixmap;
         it.value().m_rotation = d->m_rotation;
     } else {
-        RotationJob *job = new RotationJob( pixmap->toImage(), Rotation0, d->m_rotation, observer );
-        job->setPage( d );
-        job->setRect( TilesManager::toRotatedRect( rect, d->m_rotation ) );
-        d->m_doc->m_pageController->addRotationJob(job);
-
+        d->setImage( observer, pixmap->toImage(), rect, Rotation0 );
         delete pixmap;
     }
 }
 
 void Page::setTextPage( TextPage * textPage )
 {
-    delete d->m_text;
+    if ( textPage )
+        d->prepareTextPage( textPage );
 
-    d->m_text = textPage;
-    if ( d->m_text )
-    {
-        d->m_text->d->m_page = d;
-        /**
-         * Correct text order for before text selection
-         */
-        d->m_text->d->correctTextOrder();
-    }
+    d->adoptTextPage( textPage );
 }
 
 void Page::setObjectRects( const QLinkedList< ObjectRect * > & rects )
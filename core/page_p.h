@@ -23,6 +23,8 @@
 #include "area.h"
 
 class QColor;
+class QImage;
+class QPixmap;
 
 namespace Okular {
 
@@ -61,6 +63,32 @@ class PagePrivate
         static PagePrivate *get( Page *page );
 
         void imageRotationDone( RotationJob * job );
+
+        /**
+         * Sets the @p pixmap of the @p observer, already rendered with
+         * the current rotation of the page.
+         */
+        void setRotatedPixmap( DocumentObserver *observer, QPixmap *pixmap );
+
+        /**
+         * Sets the pixmap of the @p observer for @p rect (of the page not
+         * rotated) from @p image, rendered with @p rotation. The image is
+         * turned in a RotationJob if the page has a different rotation now.
+         */
+        void setImage( DocumentObserver *observer, const QImage &image, const NormalizedRect &rect, Rotation rotation );
+
+        /**
+         * Binds @p textPage to the page and corrects its text order, without
+         * setting it as the text page of the page yet.
+         */
+        void prepareTextPage( TextPage *textPage );
+
+        /**
+         * Sets the @p textPage of the page, already prepared with
+         * prepareTextPage() (e.g. by a search job). The previous one is
+         * deleted, once no running search reads it anymore.
+         */
+        void adoptTextPage( TextPage *textPage );
         QTransform rotationMatrix() const;
 
         /**
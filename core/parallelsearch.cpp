@@ -0,0 +1,242 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "parallelsearch_p.h"
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <threadweaver/job.h>
+
+#include "generator.h"
+#include "page.h"
+#include "page_p.h"
+#include "textpage.h"
+
+using namespace Okular;
+
+class ParallelSearch::PageJob : public ThreadWeaver::Job
+{
+    public:
+        PageJob( ParallelSearch *search, int page )
+            : m_search( search ), m_page( page )
+        {
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            m_search->searchPage( m_page );
+        }
+
+    private:
+        ParallelSearch *m_search;
+        int m_page;
+};
+
+ParallelSearch::ParallelSearch( Generator *generator, const QVector< Page * > &pages, int searchID,
+                                const QStringList &words, Qt::CaseSensitivity caseSensitivity, bool matchAll )
+    : QObject(), m_generator( generator ), m_pages( pages ), m_searchID( searchID ), m_words( words ),
+      m_caseSensitivity( caseSensitivity ), m_matchAll( matchAll ), m_results( pages.count() ), m_nextResult( 0 )
+{
+    // the generator has to ask for textPage() running for several pages at once
+    m_queue.setMaximumNumberOfThreads( generator->hasFeature( Generator::ConcurrentTextExtraction ) ? QThread::idealThreadCount() : 1 );
+}
+
+ParallelSearch::~ParallelSearch()
+{
+    cancel();
+    m_queue.finish();
+    qDeleteAll( m_replacedTextPages );
+
+    for ( int i = m_nextResult; i < m_results.count(); ++i )
+    {
+        delete m_results.at( i ).textPage;
+        foreach ( const Match &match, m_results.at( i ).matches )
+            delete match.area;
+    }
+}
+
+void ParallelSearch::setCandidatePages( const QBitArray &pages )
+{
+    m_candidatePages = pages;
+}
+
+void ParallelSearch::start()
+{
+    // the jobs start in page order, the first results come early
+    for ( int i = 0; i < m_pages.count(); ++i )
+    {
+        if ( m_candidatePages.size() == m_pages.count() && !m_candidatePages.testBit( i ) )
+        {
+            QMutexLocker locker( &m_resultsMutex );
+            m_results[ i ].done = true;
+        }
+        else
+            m_queue.enqueue( ThreadWeaver::JobPointer( new PageJob( this, i ) ) );
+    }
+
+    // in case no page needs to be searched
+    QMetaObject::invokeMethod( this, "announceResults", Qt::QueuedConnection );
+}
+
+void ParallelSearch::cancel()
+{
+    m_cancelled.store( 1 );
+    m_queue.dequeue();
+}
+
+int ParallelSearch::searchID() const
+{
+    return m_searchID;
+}
+
+int ParallelSearch::wordCount() const
+{
+    return m_words.count();
+}
+
+QVector< ParallelSearch::Match > ParallelSearch::takeMatches( int page )
+{
+    QMutexLocker locker( &m_resultsMutex );
+    QVector< Match > matches;
+    matches.swap( m_results[ page ].matches );
+    return matches;
+}
+
+TextPage *ParallelSearch::takeTextPage( int page )
+{
+    QMutexLocker locker( &m_resultsMutex );
+    TextPage *textPage = m_results.at( page ).textPage;
+    m_results[ page ].textPage = 0;
+    return textPage;
+}
+
+bool ParallelSearch::unloadTextPage( Page *page )
+{
+    QMutexLocker locker( &m_textPagesMutex );
+    if ( m_busyPages.contains( page->number() ) )
+        return false;
+
+    PagePrivate *pagePrivate = PagePrivate::get( page );
+    delete pagePrivate->m_text;
+    pagePrivate->m_text = 0;
+    return true;
+}
+
+void ParallelSearch::replaceTextPage( Page *page, TextPage *textPage )
+{
+    QMutexLocker locker( &m_textPagesMutex );
+    PagePrivate *pagePrivate = PagePrivate::get( page );
+    if ( pagePrivate->m_text && m_busyPages.contains( page->number() ) )
+        m_replacedTextPages.insert( page->number(), pagePrivate->m_text );
+    else
+        delete pagePrivate->m_text;
+
+    pagePrivate->m_text = textPage;
+}
+
+void ParallelSearch::announceResults()
+{
+    while ( !m_cancelled.load() )
+    {
+        if ( m_nextResult == m_pages.count() )
+        {
+            // don't announce it twice
+            m_cancelled.store( 1 );
+            emit finished();
+            return;
+        }
+
+        m_resultsMutex.lock();
+        const bool done = m_results.at( m_nextResult ).done;
+        m_resultsMutex.unlock();
+        if ( !done )
+            return;
+
+        emit pageSearched( m_nextResult++ );
+    }
+}
+
+void ParallelSearch::searchPage( int pageNumber )
+{
+    if ( m_cancelled.load() )
+        return;
+
+    Page *page = m_pages.at( pageNumber );
+    PagePrivate *pagePrivate = PagePrivate::get( page );
+
+    // use the text page of the page if any, so it can't go away meanwhile
+    m_textPagesMutex.lock();
+    m_busyPages.insert( pageNumber );
+    TextPage *text = pagePrivate->m_text;
+    m_textPagesMutex.unlock();
+
+    TextPage *extractedText = 0;
+    if ( !text )
+    {
+        extractedText = m_generator->textPage( page );
+        if ( extractedText )
+            pagePrivate->prepareTextPage( extractedText );
+        text = extractedText;
+    }
+
+    QVector< Match > matches;
+    if ( text )
+    {
+        bool allMatched = !m_words.isEmpty();
+        for ( int w = 0; w < m_words.count() && !m_cancelled.load(); ++w )
+        {
+            bool wordMatched = false;
+            RegularAreaRect *lastMatch = 0;
+            while ( 1 )
+            {
+                if ( lastMatch )
+                    lastMatch = text->findText( m_searchID, m_words.at( w ), NextResult, m_caseSensitivity, lastMatch );
+                else
+                    lastMatch = text->findText( m_searchID, m_words.at( w ), FromTop, m_caseSensitivity, 0 );
+
+                if ( !lastMatch )
+                    break;
+
+                Match match;
+                match.area = lastMatch;
+                match.word = w;
+                matches.append( match );
+                wordMatched = true;
+            }
+            allMatched = allMatched && wordMatched;
+        }
+
+        // if not all words are present in page, remove partial highlights
+        if ( !allMatched && m_matchAll )
+        {
+            foreach ( const Match &match, matches )
+                delete match.area;
+            matches.clear();
+        }
+    }
+
+    m_textPagesMutex.lock();
+    m_busyPages.remove( pageNumber );
+    const QList< TextPage * > replacedTextPages = m_replacedTextPages.values( pageNumber );
+    m_replacedTextPages.remove( pageNumber );
+    m_textPagesMutex.unlock();
+    qDeleteAll( replacedTextPages );
+
+    m_resultsMutex.lock();
+    m_results[ pageNumber ].done = true;
+    m_results[ pageNumber ].textPage = extractedText;
+    m_results[ pageNumber ].matches = matches;
+    m_resultsMutex.unlock();
+
+    QMetaObject::invokeMethod( this, "announceResults", Qt::QueuedConnection );
+}
+
+#include "moc_parallelsearch_p.cpp"
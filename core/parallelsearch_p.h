@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_PARALLELSEARCH_P_H_
+#define _OKULAR_PARALLELSEARCH_P_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QBitArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include <threadweaver/queue.h>
+
+namespace Okular {
+
+class Generator;
+class Page;
+class RegularAreaRect;
+class TextPage;
+
+/**
+ * @short Searches all the pages of a document on a pool of threads.
+ *
+ * Every page is a job: the text of the page is extracted by the generator
+ * if the page does not have it yet, then all the occurrences of each of
+ * the words are looked for. The generator must be threaded, and the pages
+ * are searched one after the other unless it has the
+ * Generator::ConcurrentTextExtraction feature.
+ *
+ * Whatever the order the jobs finish in, the results are announced in page
+ * order with pageSearched(), from the thread the search was created in,
+ * and finished() follows the last page.
+ *
+ * The text pages of the document are read by the jobs, so while a search
+ * runs they must be replaced with replaceTextPage() or unloaded with
+ * unloadTextPage() only, which PagePrivate::adoptTextPage() takes care of.
+ */
+class ParallelSearch : public QObject
+{
+    Q_OBJECT
+
+    public:
+        struct Match
+        {
+            RegularAreaRect *area;
+            int word;               ///< the index of the word that matched
+        };
+
+        /**
+         * Prepares the search of @p words in @p pages. If @p matchAll is
+         * set, the pages where not all the words are found have no matches.
+         */
+        ParallelSearch( Generator *generator, const QVector< Page * > &pages, int searchID,
+                        const QStringList &words, Qt::CaseSensitivity caseSensitivity, bool matchAll );
+
+        /**
+         * Cancels the search and waits for the pages being searched.
+         */
+        ~ParallelSearch();
+
+        /**
+         * Restricts the search to the pages set in @p pages, the other ones
+         * are known to have no matches. Must be called before start().
+         */
+        void setCandidatePages( const QBitArray &pages );
+
+        void start();
+
+        /**
+         * Stops searching the pages not searched yet. No more results are
+         * announced after this call.
+         */
+        void cancel();
+
+        int searchID() const;
+        int wordCount() const;
+
+        /**
+         * Returns the matches of @p page, which are passed to the caller,
+         * once pageSearched() was emitted for it.
+         */
+        QVector< Match > takeMatches( int page );
+
+        /**
+         * Returns the text page extracted for @p page, which is passed to the
+         * caller, or 0 if the page already had one. Its text order is already
+         * corrected.
+         */
+        TextPage *takeTextPage( int page );
+
+        /**
+         * Deletes the text page of @p page, unless it is being searched.
+         * Returns whether it was deleted.
+         */
+        bool unloadTextPage( Page *page );
+
+        /**
+         * Sets the @p textPage of @p page, which must be prepared already.
+         * The previous one is deleted once the page is not being searched.
+         */
+        void replaceTextPage( Page *page, TextPage *textPage );
+
+    Q_SIGNALS:
+        void pageSearched( int page );
+        void finished();
+
+    private Q_SLOTS:
+        void announceResults();
+
+    private:
+        class PageJob;
+
+        struct Result
+        {
+            Result() : done( false ), textPage( 0 ) {}
+
+            bool done;
+            TextPage *textPage;
+            QVector< Match > matches;
+        };
+
+        void searchPage( int page );
+
+        Generator *m_generator;
+        QVector< Page * > m_pages;
+        int m_searchID;
+        QStringList m_words;
+        Qt::CaseSensitivity m_caseSensitivity;
+        bool m_matchAll;
+        QBitArray m_candidatePages;
+
+        QAtomicInt m_cancelled;
+        QVector< Result > m_results;
+        int m_nextResult;
+        QMutex m_resultsMutex;
+
+        // pages whose text page is being read by a job, and the text pages
+        // replaced meanwhile, to delete once the job is done with them
+        QSet< int > m_busyPages;
+        QMultiHash< int, TextPage * > m_replacedTextPages;
+        QMutex m_textPagesMutex;
+
+        ThreadWeaver::Queue m_queue;
+};
+
+}
+
+#endif
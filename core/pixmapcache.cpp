@@ -0,0 +1,212 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "pixmapcache_p.h"
+
+#include <limits.h>
+
+#include "observer.h"
+
+// how many of the least recently used entries of each observer are
+// considered when choosing the pixmap to evict
+#define EVICTION_WINDOW 8
+
+using namespace Okular;
+
+PixmapCache::PixmapCache()
+    : m_totalMemory( 0 ), m_budget( ULLONG_MAX )
+{
+}
+
+PixmapCache::~PixmapCache()
+{
+    clear();
+}
+
+void PixmapCache::insert( DocumentObserver *observer, int page, qulonglong memory )
+{
+    ObserverList &list = m_lists[ observer ];
+
+    Entry *entry = m_entries.value( qMakePair( observer, page ), 0 );
+    if ( entry )
+    {
+        unlink( list, entry );
+        list.memory -= entry->memory;
+        m_totalMemory -= entry->memory;
+    }
+    else
+    {
+        entry = new Entry;
+        entry->observer = observer;
+        entry->page = page;
+        m_entries.insert( qMakePair( observer, page ), entry );
+    }
+
+    entry->memory = memory;
+    list.memory += memory;
+    m_totalMemory += memory;
+    linkAsNewest( list, entry );
+}
+
+void PixmapCache::touch( DocumentObserver *observer, int page )
+{
+    Entry *entry = m_entries.value( qMakePair( observer, page ), 0 );
+    if ( !entry )
+        return;
+
+    ObserverList &list = m_lists[ observer ];
+    if ( list.newest == entry )
+        return;
+
+    unlink( list, entry );
+    linkAsNewest( list, entry );
+}
+
+void PixmapCache::remove( DocumentObserver *observer, int page )
+{
+    Entry *entry = m_entries.value( qMakePair( observer, page ), 0 );
+    if ( entry )
+        remove( entry );
+}
+
+void PixmapCache::remove( Entry *entry )
+{
+    ObserverList &list = m_lists[ entry->observer ];
+    unlink( list, entry );
+    // the counters can't underflow because we always add or remove
+    // the memory of an entry, so at most they reach zero
+    list.memory -= entry->memory;
+    m_totalMemory -= entry->memory;
+    m_entries.remove( qMakePair( entry->observer, entry->page ) );
+    delete entry;
+}
+
+void PixmapCache::removeObserver( DocumentObserver *observer )
+{
+    QHash< DocumentObserver *, ObserverList >::iterator it = m_lists.find( observer );
+    if ( it == m_lists.end() )
+        return;
+
+    Entry *entry = it.value().oldest;
+    while ( entry )
+    {
+        Entry *newer = entry->newer;
+        m_entries.remove( qMakePair( observer, entry->page ) );
+        delete entry;
+        entry = newer;
+    }
+
+    m_totalMemory -= it.value().memory;
+    m_lists.erase( it );
+}
+
+void PixmapCache::clear()
+{
+    qDeleteAll( m_entries );
+    m_entries.clear();
+    m_lists.clear();
+    m_totalMemory = 0;
+}
+
+void PixmapCache::setMemory( Entry *entry, qulonglong memory )
+{
+    ObserverList &list = m_lists[ entry->observer ];
+    list.memory = list.memory - entry->memory + memory;
+    m_totalMemory = m_totalMemory - entry->memory + memory;
+    entry->memory = memory;
+}
+
+PixmapCache::Entry *PixmapCache::leastRecentlyUsed( DocumentObserver *observer ) const
+{
+    return m_lists.value( observer ).oldest;
+}
+
+PixmapCache::Entry *PixmapCache::evictionCandidate( int viewportPage, bool unloadableOnly, DocumentObserver *observer ) const
+{
+    Entry *candidate = 0;
+    int maxDistance = -1;
+
+    QHash< DocumentObserver *, ObserverList >::const_iterator it = m_lists.constBegin(), itEnd = m_lists.constEnd();
+    for ( ; it != itEnd; ++it )
+    {
+        if ( observer && it.key() != observer )
+            continue;
+
+        // pixmaps that can't be unloaded (i.e. visible ones) don't count
+        // against the window, there are only a handful of them anyway
+        int examined = 0;
+        for ( Entry *entry = it.value().oldest; entry && examined < EVICTION_WINDOW; entry = entry->newer )
+        {
+            if ( unloadableOnly && !entry->observer->canUnloadPixmap( entry->page ) )
+                continue;
+
+            ++examined;
+            const int distance = qAbs( entry->page - viewportPage );
+            if ( distance > maxDistance )
+            {
+                maxDistance = distance;
+                candidate = entry;
+            }
+        }
+    }
+
+    return candidate;
+}
+
+bool PixmapCache::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+qulonglong PixmapCache::totalMemory() const
+{
+    return m_totalMemory;
+}
+
+qulonglong PixmapCache::budget() const
+{
+    return m_budget;
+}
+
+void PixmapCache::setBudget( qulonglong budget )
+{
+    m_budget = budget;
+}
+
+qulonglong PixmapCache::excess() const
+{
+    return m_totalMemory > m_budget ? m_totalMemory - m_budget : 0;
+}
+
+void PixmapCache::unlink( ObserverList &list, Entry *entry )
+{
+    if ( entry->newer )
+        entry->newer->older = entry->older;
+    else
+        list.newest = entry->older;
+
+    if ( entry->older )
+        entry->older->newer = entry->newer;
+    else
+        list.oldest = entry->newer;
+
+    entry->newer = 0;
+    entry->older = 0;
+}
+
+void PixmapCache::linkAsNewest( ObserverList &list, Entry *entry )
+{
+    entry->newer = 0;
+    entry->older = list.newest;
+    if ( list.newest )
+        list.newest->newer = entry;
+    list.newest = entry;
+    if ( !list.oldest )
+        list.oldest = entry;
+}
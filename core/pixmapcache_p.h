@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_PIXMAPCACHE_P_H_
+#define _OKULAR_PIXMAPCACHE_P_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QPair>
+
+namespace Okular {
+
+class DocumentObserver;
+
+/**
+ * @short Bookkeeping of the pixmaps the pages hold for the observers.
+ *
+ * The cache does not own the pixmaps (the pages do), it only tracks how
+ * much memory each of them uses and in which order they were last used,
+ * so the document can decide what to evict.
+ *
+ * Every observer has its own intrusive LRU list and byte counter. Picking
+ * the pixmap to evict only looks at the few least recently used entries
+ * of each list and chooses the one farthest from the viewport among them,
+ * so eviction does not depend on the number of cached pixmaps.
+ */
+class PixmapCache
+{
+    public:
+        /**
+         * Allocation descriptor of a cached pixmap.
+         */
+        struct Entry
+        {
+            DocumentObserver *observer;
+            int page;
+            qulonglong memory;
+            Entry *newer;  ///< the next more recently used entry of the same observer
+            Entry *older;  ///< the next less recently used entry of the same observer
+        };
+
+        PixmapCache();
+        ~PixmapCache();
+
+        /**
+         * Records that @p observer has a pixmap of @p memory bytes for
+         * @p page, replacing the previous record if any, and marks it as
+         * the most recently used.
+         */
+        void insert( DocumentObserver *observer, int page, qulonglong memory );
+
+        /**
+         * Marks the pixmap of @p observer for @p page as the most recently
+         * used one, if it is cached.
+         */
+        void touch( DocumentObserver *observer, int page );
+
+        /**
+         * Forgets the pixmap of @p observer for @p page.
+         */
+        void remove( DocumentObserver *observer, int page );
+
+        /**
+         * Forgets @p entry, which is deleted.
+         */
+        void remove( Entry *entry );
+
+        /**
+         * Forgets all the pixmaps of @p observer.
+         */
+        void removeObserver( DocumentObserver *observer );
+
+        /**
+         * Forgets everything.
+         */
+        void clear();
+
+        /**
+         * Updates the memory used by @p entry, e.g. after freeing some tiles.
+         */
+        void setMemory( Entry *entry, qulonglong memory );
+
+        /**
+         * Returns the least recently used entry of @p observer, or 0.
+         * Follow Entry::newer to walk the entries in LRU order.
+         */
+        Entry *leastRecentlyUsed( DocumentObserver *observer ) const;
+
+        /**
+         * Returns the entry to evict first, or 0 if there is none.
+         *
+         * The candidates are the least recently used entries of each
+         * observer (of @p observer only, if not null); among them the one
+         * farthest from @p viewportPage wins. If @p unloadableOnly is set,
+         * entries the observer does not allow to unload are skipped.
+         */
+        Entry *evictionCandidate( int viewportPage, bool unloadableOnly, DocumentObserver *observer = 0 ) const;
+
+        bool isEmpty() const;
+        qulonglong totalMemory() const;
+
+        /**
+         * The number of bytes the cached pixmaps may use, the document
+         * evicts them until the cache is within it.
+         */
+        qulonglong budget() const;
+        void setBudget( qulonglong budget );
+
+        /**
+         * Returns by how many bytes the cache is over budget.
+         */
+        qulonglong excess() const;
+
+    private:
+        struct ObserverList
+        {
+            ObserverList() : newest( 0 ), oldest( 0 ), memory( 0 ) {}
+
+            Entry *newest;
+            Entry *oldest;
+            qulonglong memory;
+        };
+
+        void unlink( ObserverList &list, Entry *entry );
+        void linkAsNewest( ObserverList &list, Entry *entry );
+
+        QHash< DocumentObserver *, ObserverList > m_lists;
+        QHash< QPair< DocumentObserver *, int >, Entry * > m_entries;
+        qulonglong m_totalMemory;
+        qulonglong m_budget;
+
+        Q_DISABLE_COPY( PixmapCache )
+};
+
+}
+
+#endif
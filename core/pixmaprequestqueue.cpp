@@ -0,0 +1,224 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "pixmaprequestqueue_p.h"
+
+#include "generator.h"
+
+using namespace Okular;
+
+namespace Okular {
+
+// the region is left out of the hash on purpose, as NormalizedRect
+// equality is fuzzy
+uint qHash( const PixmapRequestQueue::Key &key, uint seed )
+{
+    return ::qHash( key.observer, seed ) ^ ::qHash( key.page, seed ) ^ ::qHash( ( key.width << 16 ) ^ key.height, seed ) ^ uint( key.tile );
+}
+
+}
+
+bool PixmapRequestQueue::Key::operator==( const Key &other ) const
+{
+    return observer == other.observer && page == other.page
+        && width == other.width && height == other.height
+        && tile == other.tile && rect == other.rect;
+}
+
+PixmapRequestQueue::PixmapRequestQueue()
+    : m_sequence( 0 )
+{
+}
+
+PixmapRequestQueue::~PixmapRequestQueue()
+{
+    clear();
+}
+
+bool PixmapRequestQueue::isEmpty() const
+{
+    return m_heap.isEmpty();
+}
+
+int PixmapRequestQueue::count() const
+{
+    return m_heap.count();
+}
+
+void PixmapRequestQueue::push( PixmapRequest *request, int viewportDistance )
+{
+    const Key key = keyFor( request );
+
+    // coalesce with an equivalent request already waiting
+    PixmapRequest *duplicate = m_keys.value( key, 0 );
+    if ( duplicate )
+        delete removeAt( m_positions.value( duplicate ) );
+
+    Entry entry;
+    entry.request = request;
+    entry.priority = request->priority();
+    entry.distance = viewportDistance;
+    entry.sequence = m_sequence++;
+    entry.key = key;
+
+    m_heap.append( entry );
+    m_positions.insert( request, m_heap.count() - 1 );
+    m_keys.insert( key, request );
+    siftUp( m_heap.count() - 1 );
+}
+
+PixmapRequest *PixmapRequestQueue::top() const
+{
+    return m_heap.isEmpty() ? 0 : m_heap.first().request;
+}
+
+PixmapRequest *PixmapRequestQueue::takeTop()
+{
+    return m_heap.isEmpty() ? 0 : removeAt( 0 );
+}
+
+bool PixmapRequestQueue::take( PixmapRequest *request )
+{
+    QHash< PixmapRequest *, int >::const_iterator it = m_positions.constFind( request );
+    if ( it == m_positions.constEnd() )
+        return false;
+
+    removeAt( it.value() );
+    return true;
+}
+
+void PixmapRequestQueue::deleteRequests( DocumentObserver *observer, const QSet< int > *pages )
+{
+    int kept = 0;
+    for ( int i = 0; i < m_heap.count(); ++i )
+    {
+        const Entry &entry = m_heap.at( i );
+        if ( entry.key.observer == observer && ( !pages || pages->contains( entry.key.page ) ) )
+        {
+            m_positions.remove( entry.request );
+            m_keys.remove( entry.key );
+            delete entry.request;
+        }
+        else
+        {
+            if ( kept != i )
+                m_heap[ kept ] = entry;
+            ++kept;
+        }
+    }
+
+    if ( kept == m_heap.count() )
+        return;
+
+    m_heap.resize( kept );
+    rebuild();
+}
+
+void PixmapRequestQueue::clear()
+{
+    for ( int i = 0; i < m_heap.count(); ++i )
+        delete m_heap.at( i ).request;
+
+    m_heap.clear();
+    m_positions.clear();
+    m_keys.clear();
+}
+
+PixmapRequestQueue::Key PixmapRequestQueue::keyFor( const PixmapRequest *request )
+{
+    Key key;
+    key.observer = request->observer();
+    key.page = request->pageNumber();
+    key.width = request->width();
+    key.height = request->height();
+    key.tile = request->isTile();
+    key.rect = request->normalizedRect();
+    return key;
+}
+
+bool PixmapRequestQueue::isMoreUrgent( const Entry &a, const Entry &b )
+{
+    if ( a.priority != b.priority )
+        return a.priority < b.priority;
+    if ( a.distance != b.distance )
+        return a.distance < b.distance;
+    return a.sequence < b.sequence;
+}
+
+void PixmapRequestQueue::siftUp( int index )
+{
+    while ( index > 0 )
+    {
+        const int parent = ( index - 1 ) / 2;
+        if ( !isMoreUrgent( m_heap.at( index ), m_heap.at( parent ) ) )
+            break;
+        swapEntries( index, parent );
+        index = parent;
+    }
+}
+
+void PixmapRequestQueue::siftDown( int index )
+{
+    const int count = m_heap.count();
+    while ( true )
+    {
+        const int left = 2 * index + 1;
+        const int right = left + 1;
+        int best = index;
+        if ( left < count && isMoreUrgent( m_heap.at( left ), m_heap.at( best ) ) )
+            best = left;
+        if ( right < count && isMoreUrgent( m_heap.at( right ), m_heap.at( best ) ) )
+            best = right;
+        if ( best == index )
+            break;
+        swapEntries( index, best );
+        index = best;
+    }
+}
+
+void PixmapRequestQueue::swapEntries( int i, int j )
+{
+    qSwap( m_heap[ i ], m_heap[ j ] );
+    m_positions[ m_heap.at( i ).request ] = i;
+    m_positions[ m_heap.at( j ).request ] = j;
+}
+
+PixmapRequest *PixmapRequestQueue::removeAt( int index )
+{
+    const Entry removed = m_heap.at( index );
+    m_positions.remove( removed.request );
+    m_keys.remove( removed.key );
+
+    const int last = m_heap.count() - 1;
+    if ( index == last )
+    {
+        m_heap.resize( last );
+        return removed.request;
+    }
+
+    // move the last entry in the hole and restore the heap property
+    PixmapRequest *moved = m_heap.at( last ).request;
+    m_heap[ index ] = m_heap.at( last );
+    m_heap.resize( last );
+    m_positions[ moved ] = index;
+    siftUp( index );
+    siftDown( m_positions.value( moved ) );
+
+    return removed.request;
+}
+
+void PixmapRequestQueue::rebuild()
+{
+    m_positions.clear();
+    for ( int i = 0; i < m_heap.count(); ++i )
+        m_positions.insert( m_heap.at( i ).request, i );
+
+    for ( int i = m_heap.count() / 2 - 1; i >= 0; --i )
+        siftDown( i );
+}
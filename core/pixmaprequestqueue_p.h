@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_PIXMAPREQUESTQUEUE_P_H_
+#define _OKULAR_PIXMAPREQUESTQUEUE_P_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+#include "area.h"
+
+namespace Okular {
+
+class DocumentObserver;
+class PixmapRequest;
+
+/**
+ * @short Scheduler for the pending pixmap requests of a document.
+ *
+ * The queue is an indexed binary heap: requests are ordered by priority
+ * (lower first), then by their distance from the viewport page at the time
+ * they were queued, then by arrival order.
+ *
+ * Queuing a request for the same observer, page, size and region of an
+ * already queued one replaces (and deletes) the old one, so repeated
+ * requests for the same pixmap do not pile up.
+ *
+ * Inserting, removing a given request and taking the top one are O(log n).
+ *
+ * The queue owns the requests it holds.
+ */
+class PixmapRequestQueue
+{
+    public:
+        PixmapRequestQueue();
+        ~PixmapRequestQueue();
+
+        bool isEmpty() const;
+        int count() const;
+
+        /**
+         * Queues @p request, which is @p viewportDistance pages away from
+         * the current viewport. A duplicate already in the queue is deleted.
+         */
+        void push( PixmapRequest *request, int viewportDistance );
+
+        /**
+         * Returns the most urgent request, or 0 if the queue is empty.
+         * The request stays in the queue.
+         */
+        PixmapRequest *top() const;
+
+        /**
+         * Removes the most urgent request from the queue and returns it.
+         * The caller becomes the owner of the request.
+         */
+        PixmapRequest *takeTop();
+
+        /**
+         * Removes @p request from the queue without deleting it.
+         * Returns whether the request was queued.
+         */
+        bool take( PixmapRequest *request );
+
+        /**
+         * Deletes all the queued requests of @p observer; if @p pages is not
+         * null, only the ones for the page numbers it contains.
+         */
+        void deleteRequests( DocumentObserver *observer, const QSet< int > *pages = 0 );
+
+        /**
+         * Deletes all the queued requests.
+         */
+        void clear();
+
+    private:
+        struct Key
+        {
+            DocumentObserver *observer;
+            int page;
+            int width;
+            int height;
+            bool tile;
+            NormalizedRect rect;
+
+            bool operator==( const Key &other ) const;
+        };
+        friend uint qHash( const Key &key, uint seed );
+
+        struct Entry
+        {
+            PixmapRequest *request;
+            int priority;
+            int distance;
+            quint64 sequence;
+            Key key;
+        };
+
+        static Key keyFor( const PixmapRequest *request );
+        static bool isMoreUrgent( const Entry &a, const Entry &b );
+
+        void siftUp( int index );
+        void siftDown( int index );
+        void swapEntries( int i, int j );
+        PixmapRequest *removeAt( int index );
+        void rebuild();
+
+        QVector< Entry > m_heap;
+        QHash< PixmapRequest *, int > m_positions;
+        QHash< Key, PixmapRequest * > m_keys;
+        quint64 m_sequence;
+
+        Q_DISABLE_COPY( PixmapRequestQueue )
+};
+
+}
+
+#endif
@@ -82,6 +82,15 @@ QTransform RotationJob::rotationMatrix( Rotation from, Rotation to )
     return matrix;
 }
 
+QImage RotationJob::rotatedImage( const QImage &image, Rotation from, Rotation to )
+{
+    if ( from == to )
+        return image;
+
+    // quarter turns are transposed in blocks by Qt, not interpolated
+    return image.transformed( rotationMatrix( from, to ) );
+}
+
 RotationJobInternal::RotationJobInternal( const QImage &image, Rotation oldRotation, Rotation newRotation )
     : mImage( image ), mOldRotation( oldRotation ), mNewRotation( newRotation )
 {
@@ -92,6 +101,13 @@ QImage RotationJobInternal::image() const
     return mRotatedImage;
 }
 
+QImage RotationJobInternal::takeImage()
+{
+    QImage image;
+    image.swap( mRotatedImage );
+    return image;
+}
+
 Rotation RotationJobInternal::rotation() const
 {
     return mNewRotation;
@@ -102,14 +118,7 @@ void RotationJobInternal::run(ThreadWeaver::JobPointer self, ThreadWeaver::Threa
     Q_UNUSED(self);
     Q_UNUSED(thread);
 
-    if ( mOldRotation == mNewRotation ) {
-        mRotatedImage = mImage;
-        return;
-    }
-
-    const QTransform matrix = RotationJob::rotationMatrix( mOldRotation, mNewRotation );
-
-    mRotatedImage = mImage.transformed( matrix );
+    mRotatedImage = RotationJob::rotatedImage( mImage, mOldRotation, mNewRotation );
 }
 
 #include "moc_rotationjob_p.cpp"
@@ -30,6 +30,7 @@ class RotationJobInternal : public ThreadWeaver::Job
 
     public:
         QImage image() const;
+        QImage takeImage();
         Rotation rotation() const;
         NormalizedRect rect() const;
 
@@ -55,6 +56,7 @@ class RotationJob : public ThreadWeaver::QObjectDecorator
         void setRect( const NormalizedRect &rect );
 
         QImage image() const { return static_cast<const RotationJobInternal*>(job())->image(); }
+        QImage takeImage() { return static_cast<RotationJobInternal*>(job())->takeImage(); }
         Rotation rotation() const { return static_cast<const RotationJobInternal*>(job())->rotation(); }
         DocumentObserver *observer() const;
         PagePrivate * page() const;
@@ -62,6 +64,12 @@ class RotationJob : public ThreadWeaver::QObjectDecorator
 
         static QTransform rotationMatrix( Rotation from, Rotation to );
 
+        /**
+         * Returns @p image, rendered with the @p from rotation, turned to
+         * the @p to rotation.
+         */
+        static QImage rotatedImage( const QImage &image, Rotation from, Rotation to );
+
     private:
         DocumentObserver *mObserver;
         PagePrivate * m_pd;
@@ -12,12 +12,14 @@
 
 #include <QtCore/QFile>
 #include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QStack>
 #include <QtCore/QTextStream>
 #include <QtCore/QVector>
 #include <QtGui/QFontDatabase>
 #include <QtGui/QImage>
 #include <QtGui/QPainter>
+#include <QtGui/QPicture>
 #include <QtPrintSupport/QPrinter>
 #include <QtGui/QTextDocumentWriter>
 
@@ -28,6 +30,13 @@
 
 #include "document.h"
 
+// characters laid out at every step of the progressive layout
+#define LAYOUT_STEP_SIZE 20000
+// milliseconds between two notifications of new pages to the Document
+#define APPEND_PAGES_INTERVAL 500
+// KiB of recorded pages kept to paint them again
+#define PAGE_PICTURES_CACHE_SIZE 65536
+
 using namespace Okular;
 
 /**
@@ -80,17 +89,13 @@ TextDocumentGenerator* TextDocumentConverter::generator() const
  */
 Okular::TextPage* TextDocumentGeneratorPrivate::createTextPage( int pageNumber ) const
 {
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
     Q_Q( const TextDocumentGenerator );
-#endif
 
     Okular::TextPage *textPage = new Okular::TextPage;
 
     int start, end;
 
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
     q->userMutex()->lock();
-#endif
     TextDocumentUtils::calculatePositions( mDocument, pageNumber, start, end );
 
     {
@@ -110,9 +115,7 @@ Okular::TextPage* TextDocumentGeneratorPrivate::createTextPage( int pageNumber )
         }
     }
     }
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
     q->userMutex()->unlock();
-#endif
 
     return textPage;
 }
@@ -165,10 +168,16 @@ void TextDocumentGeneratorPrivate::addMetaData( DocumentInfo::Key key, const QSt
     mDocumentInfo.set( key, value );
 }
 
-void TextDocumentGeneratorPrivate::generateLinkInfos()
+void TextDocumentGeneratorPrivate::generateLinkInfos( int position )
 {
-    for ( int i = 0; i < mLinkPositions.count(); ++i ) {
-        const LinkPosition &linkPosition = mLinkPositions[ i ];
+    // only the links before position are laid out
+    QList<LinkPosition>::iterator it = mLinkPositions.begin();
+    while ( it != mLinkPositions.end() ) {
+        const LinkPosition &linkPosition = *it;
+        if ( linkPosition.endPosition >= position ) {
+            ++it;
+            continue;
+        }
 
         LinkInfo info;
         info.link = linkPosition.link;
@@ -178,13 +187,21 @@ void TextDocumentGeneratorPrivate::generateLinkInfos()
 
         if ( info.page >= 0 )
             mLinkInfos.append( info );
+
+        it = mLinkPositions.erase( it );
     }
 }
 
-void TextDocumentGeneratorPrivate::generateAnnotationInfos()
+void TextDocumentGeneratorPrivate::generateAnnotationInfos( int position )
 {
-    for ( int i = 0; i < mAnnotationPositions.count(); ++i ) {
-        const AnnotationPosition &annotationPosition = mAnnotationPositions[ i ];
+    // only the annotations before position are laid out
+    QList<AnnotationPosition>::iterator it = mAnnotationPositions.begin();
+    while ( it != mAnnotationPositions.end() ) {
+        const AnnotationPosition &annotationPosition = *it;
+        if ( annotationPosition.endPosition >= position ) {
+            ++it;
+            continue;
+        }
 
         AnnotationInfo info;
         info.annotation = annotationPosition.annotation;
@@ -194,6 +211,8 @@ void TextDocumentGeneratorPrivate::generateAnnotationInfos()
 
         if ( info.page >= 0 )
             mAnnotationInfos.append( info );
+
+        it = mAnnotationPositions.erase( it );
     }
 }
 
@@ -233,6 +252,131 @@ void TextDocumentGeneratorPrivate::generateTitleInfos()
     }
 }
 
+bool TextDocumentGeneratorPrivate::layoutStep()
+{
+    Q_Q( TextDocumentGenerator );
+
+    // lay out the text up to the block after the next step: what is above
+    // that block is on complete pages
+    QTextBlock block = mDocument->findBlock( mLayoutPosition + LAYOUT_STEP_SIZE );
+    if ( block.isValid() && block.position() <= mLayoutPosition )
+        block = block.next();
+
+    const bool finished = !block.isValid();
+    int pageCount;
+    if ( finished ) {
+        pageCount = mDocument->pageCount();
+        mLayoutPosition = mDocument->characterCount();
+    } else {
+        const QRectF rect = mDocument->documentLayout()->blockBoundingRect( block );
+        pageCount = qRound( rect.top() ) / qRound( mDocument->pageSize().height() );
+        mLayoutPosition = block.position();
+    }
+
+    generateLinkInfos( finished ? INT_MAX : mLayoutPosition );
+    generateAnnotationInfos( finished ? INT_MAX : mLayoutPosition );
+    if ( finished ) {
+        generateTitleInfos();
+
+        // the layout doesn't change anymore, the pages can be painted in threads
+        q->setFeature( Generator::Threaded, mThreadedRendering );
+    }
+
+    createPages( pageCount );
+
+    return finished;
+}
+
+void TextDocumentGeneratorPrivate::createPages( int pageCount )
+{
+    if ( pageCount <= mPageCount )
+        return;
+
+    const QSize size = mDocument->pageSize().toSize();
+
+    QVector< QLinkedList<Okular::ObjectRect*> > objects( pageCount - mPageCount );
+    QList<LinkInfo>::iterator linkIt = mLinkInfos.begin();
+    while ( linkIt != mLinkInfos.end() ) {
+        const LinkInfo &info = *linkIt;
+        if ( info.page >= pageCount ) {
+            ++linkIt;
+            continue;
+        }
+
+        // in case that the converter report bogus link info data, do not assert here
+        if ( info.page >= mPageCount ) {
+            const QRectF rect = info.boundingRect;
+            objects[ info.page - mPageCount ].append( new Okular::ObjectRect( rect.left(), rect.top(), rect.right(), rect.bottom(), false,
+                                                                              Okular::ObjectRect::Action, info.link ) );
+        } else {
+            delete info.link;
+        }
+        linkIt = mLinkInfos.erase( linkIt );
+    }
+
+    QVector< QLinkedList<Okular::Annotation*> > annots( pageCount - mPageCount );
+    QList<AnnotationInfo>::iterator annotationIt = mAnnotationInfos.begin();
+    while ( annotationIt != mAnnotationInfos.end() ) {
+        const AnnotationInfo &info = *annotationIt;
+        if ( info.page >= pageCount ) {
+            ++annotationIt;
+            continue;
+        }
+
+        if ( info.page >= mPageCount )
+            annots[ info.page - mPageCount ].append( info.annotation );
+        else
+            delete info.annotation;
+        annotationIt = mAnnotationInfos.erase( annotationIt );
+    }
+
+    for ( int i = mPageCount; i < pageCount; ++i ) {
+        Okular::Page * page = new Okular::Page( i, size.width(), size.height(), Okular::Rotation0 );
+        mPendingPages.append( page );
+
+        if ( !objects.at( i - mPageCount ).isEmpty() ) {
+            page->setObjectRects( objects.at( i - mPageCount ) );
+        }
+        QLinkedList<Okular::Annotation*>::ConstIterator annIt = annots.at( i - mPageCount ).begin(), annEnd = annots.at( i - mPageCount ).end();
+        for ( ; annIt != annEnd; ++annIt ) {
+            page->addAnnotation( *annIt );
+        }
+    }
+    mPageCount = pageCount;
+}
+
+void TextDocumentGeneratorPrivate::layoutNextPages()
+{
+    Q_Q( TextDocumentGenerator );
+    if ( !mDocument )
+        return;
+
+    const bool finished = layoutStep();
+    if ( !finished )
+        mLayoutTimer->start();
+
+    // the views lay out all the pages again when pages are added, so don't
+    // add them too often
+    if ( finished || mLastAppend.elapsed() >= APPEND_PAGES_INTERVAL ) {
+        const QVector<Okular::Page *> pages = mPendingPages;
+        mPendingPages.clear();
+        q->appendPages( pages );
+        mLastAppend.start();
+    }
+}
+
+void TextDocumentGeneratorPrivate::stopLayout()
+{
+    Q_Q( TextDocumentGenerator );
+
+    mLayoutTimer->stop();
+    qDeleteAll( mPendingPages );
+    mPendingPages.clear();
+    mLayoutPosition = 0;
+    mPageCount = 0;
+    q->setFeature( Generator::Threaded, mThreadedRendering );
+}
+
 void TextDocumentGeneratorPrivate::initializeGenerator()
 {
     Q_Q( TextDocumentGenerator );
@@ -246,10 +390,21 @@ void TextDocumentGeneratorPrivate::initializeGenerator()
     q->setFeature( Generator::TextExtraction );
     q->setFeature( Generator::PrintNative );
     q->setFeature( Generator::PrintToFile );
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
-    if ( QFontDatabase::supportsThreadedFontRendering() )
+    // the document is only touched with the user mutex locked, and the
+    // recorded pages are played back by several threads at once
+    if ( QFontDatabase::supportsThreadedFontRendering() ) {
         q->setFeature( Generator::Threaded );
-#endif
+        q->setFeature( Generator::ConcurrentRendering );
+        q->setFeature( Generator::ConcurrentTextExtraction );
+    }
+    mThreadedRendering = q->hasFeature( Generator::Threaded );
+
+    mPagePictures.setMaxCost( PAGE_PICTURES_CACHE_SIZE );
+
+    mLayoutTimer = new QTimer( q );
+    mLayoutTimer->setSingleShot( true );
+    mLayoutTimer->setInterval( 0 );
+    QObject::connect( mLayoutTimer, SIGNAL(timeout()), q, SLOT(layoutNextPages()) );
 
     QObject::connect( mConverter, SIGNAL(addAction(Action*,int,int)),
                       q, SLOT(addAction(Action*,int,int)) );
@@ -308,46 +463,21 @@ Document::OpenResult TextDocumentGenerator::loadDocumentWithPassword( const QStr
         return openResult;
     }
     d->mDocument = d->mConverter->document();
-
-    d->generateTitleInfos();
-    d->generateLinkInfos();
-    d->generateAnnotationInfos();
-
-    pagesVector.resize( d->mDocument->pageCount() );
-
-    const QSize size = d->mDocument->pageSize().toSize();
-
-    QVector< QLinkedList<Okular::ObjectRect*> > objects( d->mDocument->pageCount() );
-    for ( int i = 0; i < d->mLinkInfos.count(); ++i ) {
-        const TextDocumentGeneratorPrivate::LinkInfo &info = d->mLinkInfos.at( i );
-
-        // in case that the converter report bogus link info data, do not assert here
-        if ( info.page >= objects.count() )
-          continue;
-
-        const QRectF rect = info.boundingRect;
-        objects[ info.page ].append( new Okular::ObjectRect( rect.left(), rect.top(), rect.right(), rect.bottom(), false,
-                                                             Okular::ObjectRect::Action, info.link ) );
-    }
-
-    QVector< QLinkedList<Okular::Annotation*> > annots( d->mDocument->pageCount() );
-    for ( int i = 0; i < d->mAnnotationInfos.count(); ++i ) {
-        const TextDocumentGeneratorPrivate::AnnotationInfo &info = d->mAnnotationInfos[ i ];
-        annots[ info.page ].append( info.annotation );
-    }
-
-    for ( int i = 0; i < d->mDocument->pageCount(); ++i ) {
-        Okular::Page * page = new Okular::Page( i, size.width(), size.height(), Okular::Rotation0 );
-        pagesVector[ i ] = page;
-
-        if ( !objects.at( i ).isEmpty() ) {
-            page->setObjectRects( objects.at( i ) );
-        }
-        QLinkedList<Okular::Annotation*>::ConstIterator annIt = annots.at( i ).begin(), annEnd = annots.at( i ).end();
-        for ( ; annIt != annEnd; ++annIt ) {
-            page->addAnnotation( *annIt );
-        }
-    }
+    d->mDocument->setDefaultFont( d->mFont );
+
+    // lay out just the first pages, the others are laid out in small steps
+    // and added to the document later; QTextDocument can't be painted while
+    // it is laid out, so the pages are painted in the main thread meanwhile
+    setFeature( Threaded, false );
+    bool finished = false;
+    while ( !finished && d->mPendingPages.isEmpty() )
+        finished = d->layoutStep();
+
+    pagesVector = d->mPendingPages;
+    d->mPendingPages.clear();
+    d->mLastAppend.start();
+    if ( !finished )
+        d->mLayoutTimer->start();
 
     return openResult;
 }
@@ -355,6 +485,8 @@ Document::OpenResult TextDocumentGenerator::loadDocumentWithPassword( const QStr
 bool TextDocumentGenerator::doCloseDocument()
 {
     Q_D( TextDocumentGenerator );
+    d->stopLayout();
+    d->mPagePictures.clear();
     delete d->mDocument;
     d->mDocument = 0;
 
@@ -380,47 +512,80 @@ void TextDocumentGenerator::generatePixmap( Okular::PixmapRequest * request )
     Generator::generatePixmap( request );
 }
 
+void TextDocumentGeneratorPrivate::drawPage( QPainter *painter, int pageNumber ) const
+{
+    const QSize size = mDocument->pageSize().toSize();
+
+    QRect rect;
+    rect = QRect( 0, pageNumber * size.height(), size.width(), size.height() );
+    painter->translate( QPoint( 0, pageNumber * size.height() * -1 ) );
+    painter->setClipRect( rect );
+    QAbstractTextDocumentLayout::PaintContext context;
+    context.palette.setColor( QPalette::Text, Qt::black );
+//  FIXME Fix Qt, this doesn't work, we have horrible hacks
+//        in the generators that return html, remove that code
+//        if Qt ever gets fixed
+//     context.palette.setColor( QPalette::Link, Qt::blue );
+    context.clip = rect;
+    mDocument->documentLayout()->draw( painter, context );
+}
+
+bool TextDocumentGeneratorPrivate::pageHasImages( int pageNumber ) const
+{
+    int start, end;
+    TextDocumentUtils::calculatePositions( mDocument, pageNumber, start, end );
+
+    for ( QTextBlock block = mDocument->findBlock( start ); block.isValid() && block.position() <= end; block = block.next() ) {
+        for ( QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it ) {
+            if ( it.fragment().charFormat().isImageFormat() )
+                return true;
+        }
+    }
+    return false;
+}
+
 QImage TextDocumentGeneratorPrivate::image( PixmapRequest * request )
 {
+    Q_Q( TextDocumentGenerator );
     if ( !mDocument )
         return QImage();
 
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
-    Q_Q( TextDocumentGenerator );
-#endif
-
     QImage image( request->width(), request->height(), QImage::Format_ARGB32 );
     image.fill( Qt::white );
 
     QPainter p;
     p.begin( &image );
 
+    QMutexLocker locker( q->userMutex() );
+    const QSize size = mDocument->pageSize().toSize();
     qreal width = request->width();
     qreal height = request->height();
-
-    const QSize size = mDocument->pageSize().toSize();
-
     p.scale( width / (qreal)size.width(), height / (qreal)size.height() );
 
-    QRect rect;
-    rect = QRect( 0, request->pageNumber() * size.height(), size.width(), size.height() );
-    p.translate( QPoint( 0, request->pageNumber() * size.height() * -1 ) );
-    p.setClipRect( rect );
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
-    q->userMutex()->lock();
-#endif
-    QAbstractTextDocumentLayout::PaintContext context;
-    context.palette.setColor( QPalette::Text, Qt::black );
-//  FIXME Fix Qt, this doesn't work, we have horrible hacks
-//        in the generators that return html, remove that code
-//        if Qt ever gets fixed
-//     context.palette.setColor( QPalette::Link, Qt::blue );
-    context.clip = rect;
-    mDocument->setDefaultFont( mFont );
-    mDocument->documentLayout()->draw( &p, context );
-#ifdef OKULAR_TEXTDOCUMENT_THREADED_RENDERING
-    q->userMutex()->unlock();
-#endif
+    // the page is drawn from the QTextDocument just the first time, then
+    // a copy of its recording is played back without locking the document;
+    // playing a QPicture changes it, so every request needs its own one
+    QPicture picture;
+    if ( const QPicture *recorded = mPagePictures.object( request->pageNumber() ) ) {
+        picture = *recorded;
+        picture.detach();
+    } else if ( pageHasImages( request->pageNumber() ) ) {
+        drawPage( &p, request->pageNumber() );
+        p.end();
+        return image;
+    } else {
+        QPainter recorder;
+        recorder.begin( &picture );
+        drawPage( &recorder, request->pageNumber() );
+        recorder.end();
+
+        QPicture *recorded = new QPicture( picture );
+        recorded->detach();
+        mPagePictures.insert( request->pageNumber(), recorded, picture.size() / 1024 + 1 );
+    }
+    locker.unlock();
+
+    p.drawPicture( 0, 0, picture );
     p.end();
 
     return image;
@@ -438,6 +603,8 @@ bool TextDocumentGenerator::print( QPrinter& printer )
     if ( !d->mDocument )
         return false;
 
+    // the rendering threads may be painting a page
+    QMutexLocker locker( userMutex() );
     d->mDocument->print( &printer );
 
     return true;
@@ -491,6 +658,8 @@ bool TextDocumentGenerator::exportTo( const QString &fileName, const Okular::Exp
     if ( !d->mDocument )
         return false;
 
+    QMutexLocker locker( userMutex() );
+
     if ( format.mimeType().name() == QLatin1String( "application/pdf" ) ) {
         QFile file( fileName );
         if ( !file.open( QIODevice::WriteOnly ) )
@@ -529,7 +698,11 @@ bool TextDocumentGenerator::reparseConfig()
     const QFont newFont = d->mGeneralSettings->font();
 
     if ( newFont != d->mFont ) {
+        QMutexLocker locker( userMutex() );
         d->mFont = newFont;
+        if ( d->mDocument )
+            d->mDocument->setDefaultFont( d->mFont );
+        d->mPagePictures.clear();
         return true;
     }
 
@@ -10,7 +10,11 @@
 #ifndef _OKULAR_TEXTDOCUMENTGENERATOR_P_H_
 #define _OKULAR_TEXTDOCUMENTGENERATOR_P_H_
 
+#include <QtCore/QCache>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
 #include <QtGui/QAbstractTextDocumentLayout>
+#include <QtGui/QPicture>
 #include <QtGui/QTextBlock>
 #include <QtGui/QTextDocument>
 
@@ -116,12 +120,14 @@ class TextDocumentGeneratorPrivate : public GeneratorPrivate
 
     public:
         TextDocumentGeneratorPrivate( TextDocumentConverter *converter )
-            : mConverter( converter ), mDocument( 0 ), mGeneralSettings( 0 )
+            : mConverter( converter ), mDocument( 0 ), mLayoutPosition( 0 ), mPageCount( 0 ),
+              mThreadedRendering( false ), mLayoutTimer( 0 ), mGeneralSettings( 0 )
         {
         }
 
         virtual ~TextDocumentGeneratorPrivate()
         {
+            qDeleteAll( mPendingPages );
             delete mConverter;
             delete mDocument;
         }
@@ -136,6 +142,8 @@ class TextDocumentGeneratorPrivate : public GeneratorPrivate
         void calculateBoundingRect( int startPosition, int endPosition, QRectF &rect, int &page ) const;
         void calculatePositions( int page, int &start, int &end ) const;
         Okular::TextPage* createTextPage( int ) const;
+        void drawPage( QPainter *painter, int pageNumber ) const;
+        bool pageHasImages( int pageNumber ) const;
 
         void addAction( Action *action, int cursorBegin, int cursorEnd );
         void addAnnotation( Annotation *annotation, int cursorBegin, int cursorEnd );
@@ -143,10 +151,15 @@ class TextDocumentGeneratorPrivate : public GeneratorPrivate
         void addMetaData( const QString &key, const QString &value, const QString &title );
         void addMetaData( DocumentInfo::Key, const QString &value );
 
-        void generateLinkInfos();
-        void generateAnnotationInfos();
+        void generateLinkInfos( int position );
+        void generateAnnotationInfos( int position );
         void generateTitleInfos();
 
+        bool layoutStep();
+        void createPages( int pageCount );
+        void layoutNextPages();
+        void stopLayout();
+
         TextDocumentConverter *mConverter;
 
         QTextDocument *mDocument;
@@ -193,6 +206,27 @@ class TextDocumentGeneratorPrivate : public GeneratorPrivate
         };
         QList<AnnotationInfo> mAnnotationInfos;
 
+        /**
+         * The document is laid out progressively: the first pages are
+         * returned when loading it, the others are laid out in small steps
+         * and added to the Document as they are ready.
+         */
+        int mLayoutPosition;            ///< the text before this position is laid out
+        int mPageCount;                 ///< the number of pages created so far
+        QVector<Okular::Page *> mPendingPages;  ///< pages created but not given to the Document yet
+        QElapsedTimer mLastAppend;
+        bool mThreadedRendering;        ///< whether the generator is threaded once the layout is over
+        QTimer *mLayoutTimer;
+
+        /**
+         * The pages drawn so far, recorded as QPictures (costing their KiB).
+         * They are painted again at any size without touching the
+         * QTextDocument, so several of them can be painted at once in the
+         * rendering threads. Pages with images are not recorded, because a
+         * QPicture keeps them compressed as PNG.
+         */
+        QCache<int, QPicture> mPagePictures;
+
         TextDocumentSettings *mGeneralSettings;
 
         QFont mFont;
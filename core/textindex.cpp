@@ -0,0 +1,382 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "textindex_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSaveFile>
+
+#include <threadweaver/job.h>
+#include <threadweaver/queue.h>
+
+#include <algorithm>
+
+#include "debug_p.h"
+#include "generator.h"
+#include "page.h"
+#include "page_p.h"
+#include "textpage.h"
+
+#define INDEX_FILE_MAGIC 0x49544b4f // "OKTI"
+#define INDEX_FILE_VERSION 1
+
+using namespace Okular;
+
+class TextIndex::BuildJob : public ThreadWeaver::Job
+{
+    public:
+        explicit BuildJob( TextIndex *index )
+            : m_index( index )
+        {
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            m_index->load();
+        }
+
+    private:
+        TextIndex *m_index;
+};
+
+TextIndex::TextIndex()
+    : m_generator( 0 ), m_ready( false ), m_indexedPages( 0 ), m_queue( new ThreadWeaver::Queue )
+{
+    // the index is not urgent, don't compete with the rendering
+    m_queue->setMaximumNumberOfThreads( 1 );
+}
+
+TextIndex::~TextIndex()
+{
+    close();
+    delete m_queue;
+}
+
+void TextIndex::open( const QString &indexFileName, const QString &documentFileName, const QString &generatorName,
+                      Generator *generator, const QVector< Page * > &pages )
+{
+    close();
+
+    m_indexFileName = indexFileName;
+    m_documentFileName = documentFileName;
+    m_generatorName = generatorName;
+    m_generator = generator;
+    m_pages = pages;
+    m_indexedPages = 0;
+    m_cancelled.store( 0 );
+
+    m_queue->enqueue( ThreadWeaver::JobPointer( new BuildJob( this ) ) );
+}
+
+void TextIndex::close()
+{
+    m_cancelled.store( 1 );
+    m_queue->dequeue();
+    m_queue->finish();
+
+    QMutexLocker locker( &m_mutex );
+    m_generator = 0;
+    m_pages.clear();
+    m_terms.clear();
+    m_vocabulary.clear();
+    m_suffixes.clear();
+    m_ready = false;
+    m_indexedPages = 0;
+}
+
+bool TextIndex::isOpen() const
+{
+    return m_generator != 0;
+}
+
+void TextIndex::appendPages( const QVector< Page * > &pages )
+{
+    if ( !isOpen() || pages.isEmpty() )
+        return;
+
+    {
+        QMutexLocker locker( &m_mutex );
+        m_pages += pages;
+    }
+    m_queue->enqueue( ThreadWeaver::JobPointer( new BuildJob( this ) ) );
+}
+
+QBitArray TextIndex::candidatePages( const QStringList &words, bool matchAll ) const
+{
+    QMutexLocker locker( &m_mutex );
+    if ( !m_ready )
+        return QBitArray();
+
+    QBitArray pages( m_pages.count(), matchAll || words.isEmpty() );
+    foreach ( const QString &word, words )
+    {
+        if ( matchAll )
+            pages &= candidatePages( word );
+        else
+            pages |= candidatePages( word );
+    }
+
+    // nothing is known yet about the pages still to be indexed
+    if ( m_indexedPages < pages.size() )
+        pages.fill( true, m_indexedPages, pages.size() );
+    return pages;
+}
+
+QBitArray TextIndex::candidatePages( const QString &word ) const
+{
+    // a page can contain the word only if every term of the word is part
+    // of a term of the page
+    QBitArray pages( m_pages.count(), true );
+    foreach ( const QString &term, terms( word.normalized( QString::NormalizationForm_KC ) ) )
+    {
+        // the terms containing it are the ones with a suffix starting with it
+        QVector< Suffix >::const_iterator it = std::lower_bound( m_suffixes.constBegin(), m_suffixes.constEnd(), term,
+            [this]( const Suffix &suffix, const QString &str ) { return m_vocabulary.at( suffix.term ).midRef( suffix.start ) < str; } );
+
+        QBitArray matchingTerms( m_vocabulary.count() );
+        QBitArray termPages( m_pages.count() );
+        for ( ; it != m_suffixes.constEnd() && m_vocabulary.at( it->term ).midRef( it->start ).startsWith( term ); ++it )
+        {
+            if ( matchingTerms.testBit( it->term ) )
+                continue;
+            matchingTerms.setBit( it->term );
+
+            foreach ( const Posting &posting, m_terms.value( m_vocabulary.at( it->term ) ) )
+                termPages.setBit( posting.page );
+        }
+        pages &= termPages;
+    }
+    return pages;
+}
+
+void TextIndex::sortSuffixes( const Terms &terms, QStringList *vocabulary, QVector< Suffix > *suffixes )
+{
+    *vocabulary = terms.keys();
+    suffixes->clear();
+    for ( int i = 0; i < vocabulary->count(); ++i )
+    {
+        for ( int start = 0; start < vocabulary->at( i ).length(); ++start )
+        {
+            Suffix suffix;
+            suffix.term = i;
+            suffix.start = start;
+            suffixes->append( suffix );
+        }
+    }
+
+    const QStringList &words = *vocabulary;
+    std::sort( suffixes->begin(), suffixes->end(), [&words]( const Suffix &a, const Suffix &b ) {
+        return words.at( a.term ).midRef( a.start ) < words.at( b.term ).midRef( b.start );
+    } );
+}
+
+QStringList TextIndex::terms( const QString &text )
+{
+    QStringList result;
+    const QString folded = text.toCaseFolded();
+    int start = -1;
+    for ( int i = 0; i <= folded.length(); ++i )
+    {
+        const bool letter = i < folded.length() && folded.at( i ).isLetterOrNumber();
+        if ( letter && start == -1 )
+        {
+            start = i;
+        }
+        else if ( !letter && start != -1 )
+        {
+            result.append( folded.mid( start, i - start ) );
+            start = -1;
+        }
+    }
+    return result;
+}
+
+void TextIndex::load()
+{
+    int indexedPages, pageCount;
+    {
+        QMutexLocker locker( &m_mutex );
+        indexedPages = m_indexedPages;
+        pageCount = m_pages.count();
+    }
+
+    // the saved index is good only for all the pages at once
+    Terms terms;
+    if ( indexedPages > 0 || !read( &terms, pageCount ) )
+    {
+        build();
+        return;
+    }
+
+    QStringList vocabulary;
+    QVector< Suffix > suffixes;
+    sortSuffixes( terms, &vocabulary, &suffixes );
+
+    QMutexLocker locker( &m_mutex );
+    m_terms.swap( terms );
+    m_vocabulary.swap( vocabulary );
+    m_suffixes.swap( suffixes );
+    m_indexedPages = pageCount;
+    m_ready = true;
+}
+
+void TextIndex::build()
+{
+    QVector< Page * > pages;
+    int first;
+    {
+        QMutexLocker locker( &m_mutex );
+        pages = m_pages;
+        first = m_indexedPages;
+    }
+
+    Terms terms;
+    for ( int i = first; i < pages.count(); ++i )
+    {
+        if ( m_cancelled.load() )
+            return;
+
+        TextPage *textPage = m_generator->textPage( pages.at( i ) );
+        if ( !textPage )
+            continue;
+
+        // search in the same order TextPage does
+        PagePrivate::get( pages.at( i ) )->prepareTextPage( textPage );
+
+        QString text;
+        const TextEntity::List words = textPage->words( 0, TextPage::AnyPixelTextAreaInclusionBehaviour );
+        foreach ( TextEntity *word, words )
+        {
+            QString str = word->text();
+            if ( str.endsWith( QLatin1String( "-\n" ) ) )
+                str.chop( 2 );
+            else if ( str.endsWith( QLatin1Char( '-' ) ) )
+                str.chop( 1 );
+            text += str;
+        }
+        qDeleteAll( words );
+        delete textPage;
+
+        quint32 offset = 0;
+        foreach ( const QString &term, TextIndex::terms( text ) )
+        {
+            Posting posting;
+            posting.page = i;
+            posting.offset = offset++;
+            terms[ term ].append( posting );
+        }
+    }
+
+    // only this job changes the terms, the queries go on meanwhile
+    Terms allTerms;
+    if ( first == 0 )
+    {
+        allTerms.swap( terms );
+    }
+    else
+    {
+        m_mutex.lock();
+        allTerms = m_terms;
+        m_mutex.unlock();
+        for ( Terms::const_iterator it = terms.constBegin(), itEnd = terms.constEnd(); it != itEnd; ++it )
+            allTerms[ it.key() ] += it.value();
+    }
+
+    QStringList vocabulary;
+    QVector< Suffix > suffixes;
+    sortSuffixes( allTerms, &vocabulary, &suffixes );
+
+    {
+        QMutexLocker locker( &m_mutex );
+        m_terms = allTerms;
+        m_vocabulary.swap( vocabulary );
+        m_suffixes.swap( suffixes );
+        m_indexedPages = pages.count();
+        m_ready = true;
+    }
+
+    // the pages added meanwhile are indexed next, and saved with these
+    if ( m_queue->queueLength() == 0 )
+        write( allTerms, pages.count() );
+}
+
+bool TextIndex::read( Terms *terms, int pageCount ) const
+{
+    QFile file( m_indexFileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_5_0 );
+
+    quint32 magic, version, filePageCount, termCount;
+    qint64 size, lastModified;
+    QString generatorName;
+    stream >> magic >> version >> size >> lastModified >> generatorName >> filePageCount >> termCount;
+
+    const QFileInfo info( m_documentFileName );
+    if ( stream.status() != QDataStream::Ok || magic != INDEX_FILE_MAGIC || version != INDEX_FILE_VERSION ||
+         size != info.size() || lastModified != info.lastModified().toMSecsSinceEpoch() ||
+         generatorName != m_generatorName || filePageCount != (quint32)pageCount )
+        return false;
+
+    for ( quint32 i = 0; i < termCount && stream.status() == QDataStream::Ok; ++i )
+    {
+        QString term;
+        quint32 postingCount;
+        stream >> term >> postingCount;
+
+        QVector< Posting > &postings = (*terms)[ term ];
+        for ( quint32 j = 0; j < postingCount && stream.status() == QDataStream::Ok; ++j )
+        {
+            Posting posting;
+            stream >> posting.page >> posting.offset;
+            if ( posting.page >= filePageCount )
+                return false;
+            postings.append( posting );
+        }
+    }
+
+    if ( stream.status() != QDataStream::Ok )
+    {
+        qCDebug(OkularCoreDebug) << "Discarding the corrupted text index" << m_indexFileName;
+        return false;
+    }
+    return true;
+}
+
+void TextIndex::write( const Terms &terms, int pageCount ) const
+{
+    QSaveFile file( m_indexFileName );
+    if ( !file.open( QIODevice::WriteOnly ) )
+        return;
+
+    QDataStream stream( &file );
+    stream.setVersion( QDataStream::Qt_5_0 );
+
+    const QFileInfo info( m_documentFileName );
+    stream << (quint32)INDEX_FILE_MAGIC << (quint32)INDEX_FILE_VERSION
+           << info.size() << info.lastModified().toMSecsSinceEpoch()
+           << m_generatorName << (quint32)pageCount << (quint32)terms.count();
+
+    for ( Terms::const_iterator it = terms.constBegin(), itEnd = terms.constEnd(); it != itEnd; ++it )
+    {
+        stream << it.key() << (quint32)it.value().count();
+        foreach ( const Posting &posting, it.value() )
+            stream << posting.page << posting.offset;
+    }
+
+    if ( !file.commit() )
+        qCDebug(OkularCoreDebug) << "Could not save the text index" << m_indexFileName;
+}
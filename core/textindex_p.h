@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_TEXTINDEX_P_H_
+#define _OKULAR_TEXTINDEX_P_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QBitArray>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace ThreadWeaver {
+class Queue;
+}
+
+namespace Okular {
+
+class Generator;
+class Page;
+
+/**
+ * @short Inverted index of the words of a document.
+ *
+ * For every term of the document the index knows the pages it appears in,
+ * and where in the page (as the position of the term among the terms of
+ * the page). It is used to know in advance which pages can't contain the
+ * searched text, so their text does not need to be extracted and searched.
+ * The terms containing a searched term are found with a binary search among
+ * the sorted suffixes of all the terms.
+ *
+ * Terms are the case folded runs of letters and numbers of the text of the
+ * page, in the order TextPage searches it. Since the search matches words
+ * broken by a hyphen at the end of a line, hyphens ending a text entity are
+ * not considered separators.
+ *
+ * The index is built in the background by extracting the text of all the
+ * pages, then saved to disk, so the next time the document is opened it is
+ * just read back. Pages added later are indexed on their own and merged.
+ * The saved index is discarded when the document file has a different
+ * size or modification time, or the generator is not the same.
+ */
+class TextIndex
+{
+    public:
+        TextIndex();
+        ~TextIndex();
+
+        /**
+         * Loads the index of the document @p documentFileName saved in
+         * @p indexFileName, or builds it by extracting the text of @p pages
+         * with @p generator, which must support concurrent text extraction:
+         * the index is built while the text of other pages is extracted for
+         * the viewer or searched.
+         */
+        void open( const QString &indexFileName, const QString &documentFileName, const QString &generatorName,
+                   Generator *generator, const QVector< Page * > &pages );
+
+        /**
+         * Stops building the index, if it is still being built, and forgets
+         * it. Must be called before the pages are deleted.
+         */
+        void close();
+
+        bool isOpen() const;
+
+        /**
+         * Adds the text of @p pages, added at the end of the document, to
+         * the index. Until they are indexed they are always candidates.
+         */
+        void appendPages( const QVector< Page * > &pages );
+
+        /**
+         * Returns the pages that may contain @p words, either all of them or
+         * any of them depending on @p matchAll, or a null array if the index
+         * is not ready.
+         *
+         * Pages not in the result certainly do not contain the words; the
+         * pages in the result have to be searched to know whether they do.
+         */
+        QBitArray candidatePages( const QStringList &words, bool matchAll ) const;
+
+        /**
+         * Splits @p text in the terms the index is made of.
+         */
+        static QStringList terms( const QString &text );
+
+    private:
+        struct Posting
+        {
+            quint32 page;
+            quint32 offset;     ///< the position of the term in the page
+        };
+        typedef QHash< QString, QVector< Posting > > Terms;
+
+        // a suffix of a term, they are kept sorted to find with a binary
+        // search the terms containing a string
+        struct Suffix
+        {
+            quint32 term;       ///< the index of the term in the vocabulary
+            quint32 start;
+        };
+
+        class BuildJob;
+
+        void load();
+        void build();
+        bool read( Terms *terms, int pageCount ) const;
+        void write( const Terms &terms, int pageCount ) const;
+        QBitArray candidatePages( const QString &word ) const;
+        static void sortSuffixes( const Terms &terms, QStringList *vocabulary, QVector< Suffix > *suffixes );
+
+        QString m_indexFileName;
+        QString m_documentFileName;
+        QString m_generatorName;
+        Generator *m_generator;
+        QVector< Page * > m_pages;
+
+        QAtomicInt m_cancelled;
+        bool m_ready;
+        int m_indexedPages;     ///< the pages in the index, the first ones
+        Terms m_terms;
+        QStringList m_vocabulary;
+        QVector< Suffix > m_suffixes;
+        mutable QMutex m_mutex;
+
+        ThreadWeaver::Queue *m_queue;
+
+        Q_DISABLE_COPY( TextIndex )
+};
+
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include "textpage_p.h"
 
 #include <QtCore/QDebug>
+#include <QtCore/QMutexLocker>
 
 #include "area.h"
 #include "debug_p.h"
@@ -18,8 +19,13 @@
 #include "page.h"
 #include "page_p.h"
 
+#include <algorithm>
 #include <cstring>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <QtAlgorithms>
 #include <QVarLengthArray>
 
@@ -29,39 +35,27 @@ class SearchPoint
 {
     public:
         SearchPoint()
-            : offset_begin( -1 ), offset_end( -1 )
+            : it_begin( -1 ), it_end( -1 ), offset_begin( -1 ), offset_end( -1 )
         {
         }
 
-        /** The TinyTextEntity containing the first character of the match. */
-        TextList::ConstIterator it_begin;
+        /** The index of the entity containing the first character of the match. */
+        int it_begin;
 
-        /** The TinyTextEntity containing the last character of the match. */
-        TextList::ConstIterator it_end;
+        /** The index of the entity containing the last character of the match. */
+        int it_end;
 
-        /** The index of the first character of the match in (*it_begin)->text().
-         *  Satisfies 0 <= offset_begin < (*it_begin)->text().length().
+        /** The index of the first character of the match in the text of it_begin.
+         *  Satisfies 0 <= offset_begin < text length of it_begin.
          */
         int offset_begin;
 
-        /** One plus the index of the last character of the match in (*it_end)->text().
-         *  Satisfies 0 < offset_end <= (*it_end)->text().length().
+        /** One plus the index of the last character of the match in the text of it_end.
+         *  Satisfies 0 < offset_end <= text length of it_end.
          */
         int offset_end;
 };
 
-/* text comparison functions */
-
-static bool CaseInsensitiveCmpFn( const QStringRef & from, const QStringRef & to )
-{
-    return from.compare( to, Qt::CaseInsensitive ) == 0;
-}
-
-static bool CaseSensitiveCmpFn( const QStringRef & from, const QStringRef & to )
-{
-    return from.compare( to, Qt::CaseSensitive ) == 0;
-}
-
 
 /**
  * Returns true iff segments [@p left1, @p right1] and [@p left2, @p right2] on the real line
@@ -213,15 +207,54 @@ NormalizedRect TextEntity::transformedArea(const QTransform &matrix) const
 }
 
 
+void CompactTextList::append( const QString &text, const NormalizedRect &area )
+{
+    m_text += text;
+    m_offsets.append( m_text.length() );
+    m_left.append( area.left );
+    m_top.append( area.top );
+    m_right.append( area.right );
+    m_bottom.append( area.bottom );
+}
+
+void CompactTextList::clear()
+{
+    m_text.clear();
+    m_offsets.resize( 1 );
+    m_left.clear();
+    m_top.clear();
+    m_right.clear();
+    m_bottom.clear();
+}
+
+void CompactTextList::squeeze()
+{
+    m_text.squeeze();
+    m_offsets.squeeze();
+    m_left.squeeze();
+    m_top.squeeze();
+    m_right.squeeze();
+    m_bottom.squeeze();
+}
+
+TextList CompactTextList::toTextList() const
+{
+    TextList list;
+    list.reserve( count() );
+    for ( int i = 0; i < count(); ++i )
+        list.append( new TinyTextEntity( text( i ), area( i ) ) );
+    return list;
+}
+
+
 TextPagePrivate::TextPagePrivate()
-    : m_page( 0 )
+    : m_searchTextValid( false ), m_page( 0 )
 {
 }
 
 TextPagePrivate::~TextPagePrivate()
 {
     qDeleteAll( m_searchPoints );
-    qDeleteAll( m_words );
 }
 
 
@@ -238,9 +271,10 @@ TextPage::TextPage( const TextEntity::List &words )
     {
         TextEntity *e = *it;
         if ( !e->text().isEmpty() )
-            d->m_words.append( new TinyTextEntity( e->text(), *e->area() ) );
+            d->m_words.append( e->text(), *e->area() );
         delete e;
     }
+    d->m_words.squeeze();
 }
 
 TextPage::~TextPage()
@@ -251,7 +285,10 @@ TextPage::~TextPage()
 void TextPage::append( const QString &text, NormalizedRect *area )
 {
     if ( !text.isEmpty() )
-        d->m_words.append( new TinyTextEntity( text.normalized(QString::NormalizationForm_KC), *area ) );
+    {
+        d->m_words.append( text.normalized(QString::NormalizationForm_KC), *area );
+        d->invalidateSearchText();
+    }
     delete area;
 }
 
@@ -531,19 +568,18 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
         if(endC.y * scaleY < minY) endC.y = minY/scaleY;
     }
 
-    TextList::ConstIterator it = d->m_words.constBegin(), itEnd = d->m_words.constEnd();
-    TextList::ConstIterator start = it, end = itEnd, tmpIt = it; //, tmpItEnd = itEnd;
+    int it = 0, itEnd = d->m_words.count();
+    int start = it, end = itEnd, tmpIt = it; //, tmpItEnd = itEnd;
     const MergeSide side = d->m_page ? (MergeSide)d->m_page->m_page->totalOrientation() : MergeRight;
 
     NormalizedRect tmp;
     //case 2(a)
     for ( ; it != itEnd; ++it )
     {
-        tmp = (*it)->area;
-        if(tmp.contains(startC.x,startC.y)){
+        if(d->m_words.contains(it,startC.x,startC.y)){
             start = it;
         }
-        if(tmp.contains(endC.x,endC.y)){
+        if(d->m_words.contains(it,endC.x,endC.y)){
             end = it;
         }
     }
@@ -555,7 +591,7 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
         for ( ; it != itEnd; ++it )
         {
             // is there any text reactangle within the start_end rect
-            tmp = (*it)->area;
+            tmp = d->m_words.area(it);
             if(start_end.intersects(tmp))
                 break;
         }
@@ -581,7 +617,7 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
         {
             for ( ; it != itEnd; ++it )
             {
-                rect= (*it)->area;
+                rect= d->m_words.area(it);
                 rect.isBottom(startC) ? flagV = false: flagV = true;
 
                 if(flagV && rect.isRight(startC))
@@ -601,7 +637,7 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
 
             for ( ; it != itEnd; ++it )
             {
-                rect= (*it)->area;
+                rect= d->m_words.area(it);
 
                 if(rect.isBottomOrLevel(startC) && rect.isRight(startC))
                 {
@@ -638,7 +674,7 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
         {
             for ( ; itEnd >= it; itEnd-- )
             {
-                rect= (*itEnd)->area;
+                rect= d->m_words.area(itEnd);
                 rect.isTop(endC) ? flagV = false: flagV = true;
 
                 if(flagV && rect.isLeft(endC))
@@ -654,7 +690,7 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
             int distance = scaleX + scaleY + 100;
             for ( ; itEnd >= it; itEnd-- )
             {
-                rect= (*itEnd)->area;
+                rect= d->m_words.area(itEnd);
 
                 if(rect.isTopOrLevel(endC) && rect.isLeft(endC))
                 {
@@ -699,11 +735,11 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
     }
 
     // removes the possibility of crash, in case none of 1 to 3 is true
-    if(end == d->m_words.constEnd()) end--;
+    if(end == d->m_words.count()) end--;
 
     for( ;start <= end ; start++)
     {
-        ret->appendShape( (*start)->transformedArea( matrix ), side );
+        ret->appendShape( d->m_words.transformedArea( start, matrix ), side );
      }
 
 #endif
@@ -719,9 +755,10 @@ RegularAreaRect* TextPage::findText( int searchID, const QString &query, SearchD
     // invalid search request
     if ( d->m_words.isEmpty() || query.isEmpty() || ( area && area->isNull() ) )
         return 0;
-    TextList::ConstIterator start;
+    QMutexLocker locker( &d->m_searchPointsMutex );
+    int start;
     int start_offset = 0;
-    TextList::ConstIterator end;
+    int end;
     const QMap< int, SearchPoint* >::const_iterator sIt = d->m_searchPoints.constFind( searchID );
     if ( sIt == d->m_searchPoints.constEnd() )
     {
@@ -736,47 +773,36 @@ RegularAreaRect* TextPage::findText( int searchID, const QString &query, SearchD
     switch ( dir )
     {
         case FromTop:
-            start = d->m_words.constBegin();
+            start = 0;
             start_offset = 0;
-            end = d->m_words.constEnd();
+            end = d->m_words.count();
             break;
         case FromBottom:
-            start = d->m_words.constEnd();
+            start = d->m_words.count();
             start_offset = 0;
-            end = d->m_words.constBegin();
+            end = 0;
             forward = false;
             break;
         case NextResult:
             start = (*sIt)->it_end;
             start_offset = (*sIt)->offset_end;
-            end = d->m_words.constEnd();
+            end = d->m_words.count();
             break;
         case PreviousResult:
             start = (*sIt)->it_begin;
             start_offset = (*sIt)->offset_begin;
-            end = d->m_words.constBegin();
+            end = 0;
             forward = false;
             break;
     };
-    RegularAreaRect* ret = 0;
-    const TextComparisonFunction cmpFn = caseSensitivity == Qt::CaseSensitive
-                                       ? CaseSensitiveCmpFn : CaseInsensitiveCmpFn;
-    if ( forward )
-    {
-        ret = d->findTextInternalForward( searchID, query, cmpFn, start, start_offset, end );
-    }
-    else
-    {
-        ret = d->findTextInternalBackward( searchID, query, cmpFn, start, start_offset, end );
-    }
-    return ret;
+    return d->findTextInternal( searchID, query, caseSensitivity, forward, start, start_offset, end );
 }
 
 // hyphenated '-' must be at the end of a word, so hyphenation means
 // we have a '-' just followed by a '\n' character
 // check if the string contains a '-' character
 // if the '-' is the last entry
-static int stringLengthAdaptedWithHyphen(const QString &str, const TextList::ConstIterator &it, const TextList::ConstIterator &textListEnd)
+static int stringLengthAdaptedWithHyphen(const QString &str, const CompactTextList &words, int it)
 {
     int len = str.length();
     
@@ -787,10 +813,10 @@ static int stringLengthAdaptedWithHyphen(const QString &str, const TextList::Con
     if ( str.endsWith( QLatin1Char('-') ) )
     {
         // validity chek of it + 1
-        if ( ( it + 1 ) != textListEnd )
+        if ( ( it + 1 ) != words.count() )
         {
             // 1. if the next character is '\n'
-            const QString &lookahedStr = (*(it+1))->text();
+            const QString lookahedStr = words.text( it + 1 );
             if (lookahedStr.startsWith(QLatin1Char('\n')))
             {
                 len -= 1;
@@ -798,8 +824,8 @@ static int stringLengthAdaptedWithHyphen(const QString &str, const TextList::Con
             else
             {
                 // 2. if the next word is in a different line or not
-                const NormalizedRect& hyphenArea = (*it)->area;
-                const NormalizedRect& lookaheadArea = (*(it + 1))->area;
+                const NormalizedRect hyphenArea = words.area( it );
+                const NormalizedRect lookaheadArea = words.area( it + 1 );
 
                 // lookahead to check whether both the '-' rect and next character rect overlap
                 if( !doesConsumeY( hyphenArea, lookaheadArea, 70 ) )
@@ -823,10 +849,9 @@ RegularAreaRect* TextPagePrivate::searchPointToArea(const SearchPoint* sp)
     const QTransform matrix = m_page ? m_page->rotationMatrix() : QTransform();
     RegularAreaRect* ret=new RegularAreaRect;
 
-    for (TextList::ConstIterator it = sp->it_begin; ; it++)
+    for (int it = sp->it_begin; ; it++)
     {
-        const TinyTextEntity* curEntity = *it;
-        ret->append( curEntity->transformedArea( matrix ) );
+        ret->append( m_words.transformedArea( it, matrix ) );
 
         if (it == sp->it_end) {
             break;
@@ -837,232 +862,219 @@ RegularAreaRect* TextPagePrivate::searchPointToArea(const SearchPoint* sp)
     return ret;
 }
 
-RegularAreaRect* TextPagePrivate::findTextInternalForward( int searchID, const QString &_query,
-                                                             TextComparisonFunction comparer,
-                                                             const TextList::ConstIterator &start,
-                                                             int start_offset,
-                                                             const TextList::ConstIterator &end)
+/**
+ * Returns the case folded version of @p str, with the same length: each
+ * character is folded on its own, as QString::compare() does when it
+ * ignores the case.
+ */
+static QString caseFolded( const QString &str )
 {
-    // normalize query search all unicode (including glyphs)
-    const QString query = _query.normalized(QString::NormalizationForm_KC);
-
-    // j is the current position in our query
-    // len is the length of the string in TextEntity
-    // queryLeft is the length of the query we have left
-    int j=0, queryLeft=query.length();
-
-    TextList::ConstIterator it = start;
-    int offset = start_offset;
-
-    TextList::ConstIterator it_begin = TextList::ConstIterator();
-    int offset_begin = 0; //dummy initial value to suppress compiler warnings
-
-    while ( it != end )
+    const int length = str.length();
+    const ushort *src = reinterpret_cast< const ushort * >( str.constData() );
+    QString folded( length, Qt::Uninitialized );
+    ushort *dst = reinterpret_cast< ushort * >( folded.data() );
+    for ( int i = 0; i < length; ++i )
     {
-        const TinyTextEntity* curEntity = *it;
-        const QString& str = curEntity->text();
-        int len = stringLengthAdaptedWithHyphen(str, it, m_words.constEnd());
-
-        if (offset >= len)
-        {
-            it++;
-            offset = 0;
-            continue;
-        }
-
-        if ( it_begin == TextList::ConstIterator() )
-        {
-            it_begin = it;
-            offset_begin = offset;
-        }
-
-        int min=qMin(queryLeft,len-offset);
+        if ( QChar::isHighSurrogate( src[i] ) && i + 1 < length && QChar::isLowSurrogate( src[i + 1] ) )
         {
-#ifdef DEBUG_TEXTPAGE
-            qCDebug(OkularCoreDebug) << str.midRef(offset, min) << ":" << _query.midRef(j, min);
-#endif
-            // we have equal (or less than) area of the query left as the length of the current 
-            // entity
-
-            if ( !comparer( str.midRef( offset, min ), query.midRef( j, min ) ) )
+            const uint ucs4 = QChar::toCaseFolded( QChar::surrogateToUcs4( src[i], src[i + 1] ) );
+            if ( QChar::requiresSurrogates( ucs4 ) )
             {
-                    // we have not matched
-                    // this means we do not have a complete match
-                    // we need to get back to query start
-                    // and continue the search from this place
-#ifdef DEBUG_TEXTPAGE
-            qCDebug(OkularCoreDebug) << "\tnot matched";
-#endif
-                    j = 0;
-                    queryLeft=query.length();
-                    it = it_begin;
-                    offset = offset_begin+1;
-                    it_begin = TextList::ConstIterator();
+                dst[i] = QChar::highSurrogate( ucs4 );
+                dst[i + 1] = QChar::lowSurrogate( ucs4 );
             }
             else
             {
-                    // we have a match
-                    // move the current position in the query
-                    // to the position after the length of this string
-                    // we matched
-                    // subtract the length of the current entity from 
-                    // the left length of the query
-#ifdef DEBUG_TEXTPAGE
-            qCDebug(OkularCoreDebug) << "\tmatched";
-#endif
-                    j += min;
-                    queryLeft -= min;
-
-                    if (queryLeft==0)
-                    {
-                        // save or update the search point for the current searchID
-                        QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-                        if ( sIt == m_searchPoints.end() )
-                        {
-                            sIt = m_searchPoints.insert( searchID, new SearchPoint );
-                        }
-                        SearchPoint* sp = *sIt;
-                        sp->it_begin = it_begin;
-                        sp->it_end = it;
-                        sp->offset_begin = offset_begin;
-                        sp->offset_end = offset + min;
-                        return searchPointToArea(sp);
-                    }
-
-                    it++;
-                    offset = 0;
+                dst[i] = src[i];
+                dst[i + 1] = src[i + 1];
             }
+            ++i;
+        }
+        else
+        {
+            dst[i] = QChar::toCaseFolded( src[i] );
         }
     }
-    // end of loop - it means that we've ended the textentities
+    return folded;
+}
 
-    const QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-    if ( sIt != m_searchPoints.end() )
+/**
+ * Returns the position of the first occurrence of @p needle in @p haystack
+ * starting in [@p from, @p to - @p needleLength], or -1.
+ *
+ * Candidates are found by comparing the first character of the needle with
+ * eight characters of the haystack at once, then checked with memcmp().
+ */
+static int findFirst( const ushort *haystack, int from, int to, const ushort *needle, int needleLength )
+{
+    const int last = to - needleLength;
+    const ushort first = needle[0];
+    const size_t needleBytes = needleLength * sizeof( ushort );
+    int i = from;
+#ifdef __SSE2__
+    const __m128i firstChars = _mm_set1_epi16( first );
+    for ( ; i + 7 <= last; i += 8 )
     {
-        SearchPoint* sp = *sIt;
-        m_searchPoints.erase( sIt );
-        delete sp;
+        const __m128i chunk = _mm_loadu_si128( reinterpret_cast< const __m128i * >( haystack + i ) );
+        uint mask = _mm_movemask_epi8( _mm_cmpeq_epi16( chunk, firstChars ) );
+        while ( mask )
+        {
+            const int bit = qCountTrailingZeroBits( mask );
+            const int pos = i + bit / 2;
+            if ( std::memcmp( haystack + pos, needle, needleBytes ) == 0 )
+                return pos;
+            mask &= ~( 3u << bit );
+        }
+    }
+#endif
+    for ( ; i <= last; ++i )
+    {
+        if ( haystack[i] == first && std::memcmp( haystack + i, needle, needleBytes ) == 0 )
+            return i;
     }
-    return 0;
+    return -1;
 }
 
-RegularAreaRect* TextPagePrivate::findTextInternalBackward( int searchID, const QString &_query,
-                                                            TextComparisonFunction comparer,
-                                                            const TextList::ConstIterator &start,
-                                                            int start_offset,
-                                                            const TextList::ConstIterator &end)
+/**
+ * Returns the position of the last occurrence of @p needle in @p haystack
+ * starting in [@p from, @p to - @p needleLength], or -1.
+ */
+static int findLast( const ushort *haystack, int from, int to, const ushort *needle, int needleLength )
 {
-    // normalize query to search all unicode (including glyphs)
-    const QString query = _query.normalized(QString::NormalizationForm_KC);
-
-    // j is the current position in our query
-    // len is the length of the string in TextEntity
-    // queryLeft is the length of the query we have left
-    int j=query.length(), queryLeft=query.length();
-
-    TextList::ConstIterator it = start;
-    int offset = start_offset;
-
-    TextList::ConstIterator it_begin = TextList::ConstIterator();
-    int offset_begin = 0; //dummy initial value to suppress compiler warnings
-
-    while ( true )
+    const int last = to - needleLength;
+    const ushort first = needle[0];
+    const size_t needleBytes = needleLength * sizeof( ushort );
+    int i = last;
+#ifdef __SSE2__
+    const __m128i firstChars = _mm_set1_epi16( first );
+    for ( ; i - 7 >= from; i -= 8 )
     {
-        if (offset <= 0)
+        const __m128i chunk = _mm_loadu_si128( reinterpret_cast< const __m128i * >( haystack + i - 7 ) );
+        uint mask = _mm_movemask_epi8( _mm_cmpeq_epi16( chunk, firstChars ) );
+        while ( mask )
         {
-            if ( it == end )
-            {
-                break;
-            }
-            it--;
+            const int bit = 31 - qCountLeadingZeroBits( mask );
+            const int pos = i - 7 + bit / 2;
+            if ( std::memcmp( haystack + pos, needle, needleBytes ) == 0 )
+                return pos;
+            mask &= ~( 3u << ( bit - 1 ) );
         }
+    }
+#endif
+    for ( ; i >= from; --i )
+    {
+        if ( haystack[i] == first && std::memcmp( haystack + i, needle, needleBytes ) == 0 )
+            return i;
+    }
+    return -1;
+}
 
-        const TinyTextEntity* curEntity = *it;
-        const QString& str = curEntity->text();
-        int len = stringLengthAdaptedWithHyphen(str, it, m_words.constEnd());
-
-        if (offset <= 0)
-        {
-            offset = len;
-        }
+void TextPagePrivate::invalidateSearchText()
+{
+    m_searchTextValid = false;
+    m_searchText.clear();
+    m_foldedSearchText.clear();
+    m_searchOffsets.clear();
+}
 
-        if ( it_begin == TextList::ConstIterator() )
-        {
-            it_begin = it;
-            offset_begin = offset;
-        }
+void TextPagePrivate::buildSearchText()
+{
+    if ( m_searchTextValid )
+        return;
+
+    // the text is searched as if the hyphens breaking the words at the end
+    // of the lines were not there
+    const int count = m_words.count();
+    QVector< int > offsets( count + 1 );
+    offsets[0] = 0;
+    bool adapted = false;
+    for ( int i = 0; i < count; ++i )
+    {
+        const QString str = m_words.text( i );
+        const int len = stringLengthAdaptedWithHyphen( str, m_words, i );
+        adapted = adapted || len != str.length();
+        offsets[i + 1] = offsets.at( i ) + len;
+    }
 
-        int min=qMin(queryLeft,offset);
-        {
-#ifdef DEBUG_TEXTPAGE
-            qCDebug(OkularCoreDebug) << str.midRef(offset-min, min) << " : " << _query.midRef(j-min, min);
-#endif
-            // we have equal (or less than) area of the query left as the length of the current 
-            // entity
+    if ( adapted )
+    {
+        m_searchText.reserve( offsets.at( count ) );
+        for ( int i = 0; i < count; ++i )
+            m_searchText += m_words.text( i ).leftRef( offsets.at( i + 1 ) - offsets.at( i ) );
+        m_searchOffsets = offsets;
+    }
+    else
+    {
+        // nothing to leave out, share the storage of the entities
+        m_searchText = m_words.allText();
+        m_searchOffsets = m_words.offsets();
+    }
+    m_searchTextValid = true;
+}
 
-            // Note len is not str.length() so we can't use rightRef here
-            if ( !comparer( str.midRef(offset-min, min ), query.midRef( j - min, min ) ) )
-            {
-                    // we have not matched
-                    // this means we do not have a complete match
-                    // we need to get back to query start
-                    // and continue the search from this place
-#ifdef DEBUG_TEXTPAGE
-                    qCDebug(OkularCoreDebug) << "\tnot matched";
-#endif
+int TextPagePrivate::searchEntityAt( int position ) const
+{
+    // the last entity starting at or before position, which is the one
+    // containing it since entities of no length start where the next one does
+    return std::upper_bound( m_searchOffsets.constBegin(), m_searchOffsets.constEnd(), position ) - m_searchOffsets.constBegin() - 1;
+}
 
-                    j = query.length();
-                    queryLeft = query.length();
-                    it = it_begin;
-                    offset = offset_begin-1;
-                    it_begin = TextList::ConstIterator();
-            }
-            else
-            {
-                    // we have a match
-                    // move the current position in the query
-                    // to the position after the length of this string
-                    // we matched
-                    // subtract the length of the current entity from 
-                    // the left length of the query
-#ifdef DEBUG_TEXTPAGE
-                    qCDebug(OkularCoreDebug) << "\tmatched";
-#endif
-                    j -= min;
-                    queryLeft -= min;
+RegularAreaRect* TextPagePrivate::findTextInternal( int searchID, const QString &_query, Qt::CaseSensitivity caseSensitivity,
+                                                    bool forward, int start, int start_offset, int end )
+{
+    // normalize query search all unicode (including glyphs)
+    QString query = _query.normalized(QString::NormalizationForm_KC);
 
-                    if ( queryLeft == 0 )
-                    {
-                        // save or update the search point for the current searchID
-                        QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-                        if ( sIt == m_searchPoints.end() )
-                        {
-                            sIt = m_searchPoints.insert( searchID, new SearchPoint );
-                        }
-                        SearchPoint* sp = *sIt;
-                        sp->it_begin = it;
-                        sp->it_end = it_begin;
-                        sp->offset_begin = offset - min;
-                        sp->offset_end = offset_begin;
-                        return searchPointToArea(sp);
-                    }
+    buildSearchText();
+    const QString *text = &m_searchText;
+    if ( caseSensitivity == Qt::CaseInsensitive )
+    {
+        if ( m_foldedSearchText.isNull() )
+            m_foldedSearchText = caseFolded( m_searchText );
+        text = &m_foldedSearchText;
+        query = caseFolded( query );
+    }
 
-                    offset = 0;
-            }
+    // translate the entity positions to positions in the text
+    const int count = m_words.count();
+    int startPosition = m_searchOffsets.at( start ) + start_offset;
+    if ( start < count )
+        startPosition = qMin( startPosition, m_searchOffsets.at( start + 1 ) );
+    const int endPosition = m_searchOffsets.at( end );
+
+    const ushort *haystack = reinterpret_cast< const ushort * >( text->constData() );
+    const ushort *needle = reinterpret_cast< const ushort * >( query.constData() );
+    int position = -1;
+    if ( !query.isEmpty() )
+    {
+        position = forward ? findFirst( haystack, startPosition, endPosition, needle, query.length() )
+                           : findLast( haystack, endPosition, startPosition, needle, query.length() );
+    }
 
+    if ( position == -1 )
+    {
+        const QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
+        if ( sIt != m_searchPoints.end() )
+        {
+            SearchPoint* sp = *sIt;
+            m_searchPoints.erase( sIt );
+            delete sp;
         }
-
+        return 0;
     }
-    // end of loop - it means that we've ended the textentities
 
-    const QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-    if ( sIt != m_searchPoints.end() )
+    // save or update the search point for the current searchID
+    QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
+    if ( sIt == m_searchPoints.end() )
     {
-        SearchPoint* sp = *sIt;
-        m_searchPoints.erase( sIt );
-        delete sp;
+        sIt = m_searchPoints.insert( searchID, new SearchPoint );
     }
-    return 0;
+    SearchPoint* sp = *sIt;
+    sp->it_begin = searchEntityAt( position );
+    sp->offset_begin = position - m_searchOffsets.at( sp->it_begin );
+    sp->it_end = searchEntityAt( position + query.length() - 1 );
+    sp->offset_end = position + query.length() - m_searchOffsets.at( sp->it_end );
+    return searchPointToArea(sp);
 }
 
 QString TextPage::text(const RegularAreaRect *area) const
@@ -1075,7 +1087,7 @@ QString TextPage::text(const RegularAreaRect *area, TextAreaInclusionBehaviour b
     if ( area && area->isNull() )
         return QString();
 
-    TextList::ConstIterator it = d->m_words.constBegin(), itEnd = d->m_words.constEnd();
+    int it = 0, itEnd = d->m_words.count();
     QString ret;
     if ( area )
     {
@@ -1083,17 +1095,17 @@ QString TextPage::text(const RegularAreaRect *area, TextAreaInclusionBehaviour b
         {
             if (b == AnyPixelTextAreaInclusionBehaviour)
             {
-                if ( area->intersects( (*it)->area ) )
+                if ( area->intersects( d->m_words.area( it ) ) )
                 {
-                    ret += (*it)->text();
+                    ret += d->m_words.text( it );
                 }
             }
             else
             {
-                NormalizedPoint center = (*it)->area.center();
+                NormalizedPoint center = d->m_words.area( it ).center();
                 if ( area->contains( center.x, center.y ) )
                 {
-                    ret += (*it)->text();
+                    ret += d->m_words.text( it );
                 }
             }
         }
@@ -1101,7 +1113,7 @@ QString TextPage::text(const RegularAreaRect *area, TextAreaInclusionBehaviour b
     else
     {
         for ( ; it != itEnd; ++it )
-            ret += (*it)->text();
+            ret += d->m_words.text( it );
     }
     return ret;
 }
@@ -1123,12 +1135,18 @@ static bool compareTinyTextEntityY(const WordWithCharacters &first, const WordWi
 }
 
 /**
- * Sets a new world list. Deleting the contents of the old one
+ * Sets a new world list, replacing the old one. The contents of list are deleted
  */
 void TextPagePrivate::setWordList(const TextList &list)
 {
-    qDeleteAll(m_words);
-    m_words = list;
+    invalidateSearchText();
+    m_words.clear();
+    foreach(TinyTextEntity *entity, list)
+    {
+        m_words.append(entity->text(), entity->area);
+        delete entity;
+    }
+    m_words.squeeze();
 }
 
 /**
@@ -1883,7 +1901,9 @@ void TextPagePrivate::correctTextOrder()
     const int pageWidth  = (int) (scalingFactor * m_page->m_page->width() );
     const int pageHeight = (int) (scalingFactor * m_page->m_page->height());
 
-    TextList characters = m_words;
+    // the layout analysis works on a TextList of its own
+    const TextList originalCharacters = m_words.toTextList();
+    TextList characters = originalCharacters;
 
     /**
      * Remove spaces from the text
@@ -1914,6 +1934,7 @@ void TextPagePrivate::correctTextOrder()
         delete word.word;
         listOfCharacters.append(word.characters);
     }
+    qDeleteAll(originalCharacters);
     setWordList(listOfCharacters);
 }
 
@@ -1925,30 +1946,31 @@ TextEntity::List TextPage::words(const RegularAreaRect *area, TextAreaInclusionB
     TextEntity::List ret;
     if ( area )
     {
-        foreach (TinyTextEntity *te, d->m_words)
+        for ( int i = 0; i < d->m_words.count(); ++i )
         {
+            const NormalizedRect teArea = d->m_words.area( i );
             if (b == AnyPixelTextAreaInclusionBehaviour)
             {
-                if ( area->intersects( te->area ) )
+                if ( area->intersects( teArea ) )
                 {
-                    ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+                    ret.append( new TextEntity( d->m_words.text( i ), new Okular::NormalizedRect( teArea ) ) );
                 }
             }
             else
             {
-                const NormalizedPoint center = te->area.center();
+                const NormalizedPoint center = teArea.center();
                 if ( area->contains( center.x, center.y ) )
                 {
-                    ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+                    ret.append( new TextEntity( d->m_words.text( i ), new Okular::NormalizedRect( teArea ) ) );
                 }
             }
         }
     }
     else
     {
-        foreach (TinyTextEntity *te, d->m_words)
+        for ( int i = 0; i < d->m_words.count(); ++i )
         {
-            ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+            ret.append( new TextEntity( d->m_words.text( i ), new Okular::NormalizedRect( d->m_words.area( i ) ) ) );
         }
     }
     return ret;
@@ -1956,12 +1978,12 @@ TextEntity::List TextPage::words(const RegularAreaRect *area, TextAreaInclusionB
 
 RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) const
 {
-    TextList::ConstIterator itBegin = d->m_words.constBegin(), itEnd = d->m_words.constEnd();
-    TextList::ConstIterator it = itBegin;
-    TextList::ConstIterator posIt = itEnd;
+    int itBegin = 0, itEnd = d->m_words.count();
+    int it = itBegin;
+    int posIt = itEnd;
     for ( ; it != itEnd; ++it )
     {
-        if ( (*it)->area.contains( p.x, p.y ) )
+        if ( d->m_words.contains( it, p.x, p.y ) )
         {
             posIt = it;
             break;
@@ -1970,7 +1992,7 @@ RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) co
     QString text;
     if ( posIt != itEnd )
     {
-        if ( (*posIt)->text().simplified().isEmpty() )
+        if ( d->m_words.text( posIt ).simplified().isEmpty() )
         {
             return NULL;
         }
@@ -1978,7 +2000,7 @@ RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) co
         while ( posIt != itBegin )
         {
             --posIt;
-            const QString itText = (*posIt)->text();
+            const QString itText = d->m_words.text( posIt );
             if ( itText.right(1).at(0).isSpace() )
             {
                 if (itText.endsWith(QLatin1String("-\n")))
@@ -1991,7 +2013,7 @@ RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) co
                 if (itText == QLatin1String("\n") && posIt != itBegin )
                 {
                     --posIt;
-                    if ((*posIt)->text().endsWith(QLatin1String("-"))) {
+                    if (d->m_words.text( posIt ).endsWith(QLatin1String("-"))) {
                         // Is an hyphenated word
                         // continue searching the start of the word back
                         continue;
@@ -2006,14 +2028,14 @@ RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) co
         RegularAreaRect *ret = new RegularAreaRect();
         for ( ; posIt != itEnd; ++posIt )
         {
-            const QString itText = (*posIt)->text();
+            const QString itText = d->m_words.text( posIt );
             if ( itText.simplified().isEmpty() )
             {
                 break;
             }
             
-            ret->appendShape( (*posIt)->area );
-            text += (*posIt)->text();
+            ret->appendShape( d->m_words.area( posIt ) );
+            text += d->m_words.text( posIt );
             if (itText.right(1).at(0).isSpace())
             {
                 if (!text.endsWith(QLatin1String("-\n")))
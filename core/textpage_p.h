@@ -13,9 +13,14 @@
 
 #include <QtCore/QList>
 #include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QVector>
 #include <QtGui/QTransform>
 
+#include "area.h"
+
 class SearchPoint;
 class TinyTextEntity;
 class RegionText;
@@ -27,15 +32,110 @@ class PagePrivate;
 typedef QList< TinyTextEntity* > TextList;
 
 /**
- * Returns whether the two strings match.
- * Satisfies the condition that if two strings match then their lengths are equal.
+ * A list of RegionText. It keeps a bunch of TextList with their bounding rectangles
  */
-typedef bool ( *TextComparisonFunction )( const QStringRef & from, const QStringRef & to );
+typedef QList<RegionText> RegionTextList;
 
 /**
- * A list of RegionText. It keeps a bunch of TextList with their bounding rectangles
+ * The text entities of a page, stored compactly.
+ *
+ * A TextList holds every entity (usually a single character) in an object
+ * of its own, which is handy while the layout of the page is analyzed but
+ * wasteful to keep around: this list stores the text of all the entities
+ * in a single string, with the offsets where each of them starts, and
+ * their areas in four arrays of single precision coordinates.
+ *
+ * Entities are identified by their index, from 0 to count() - 1.
  */
-typedef QList<RegionText> RegionTextList;
+class CompactTextList
+{
+    public:
+        CompactTextList()
+        {
+            m_offsets.append( 0 );
+        }
+
+        inline int count() const
+        {
+            return m_left.count();
+        }
+
+        inline bool isEmpty() const
+        {
+            return m_left.isEmpty();
+        }
+
+        /**
+         * Returns the text of the entity @p i. The string refers to the
+         * storage of the list, so it is valid as long as the list is not
+         * changed.
+         */
+        inline QString text( int i ) const
+        {
+            return QString::fromRawData( m_text.constData() + m_offsets.at( i ), m_offsets.at( i + 1 ) - m_offsets.at( i ) );
+        }
+
+        inline NormalizedRect area( int i ) const
+        {
+            return NormalizedRect( m_left.at( i ), m_top.at( i ), m_right.at( i ), m_bottom.at( i ) );
+        }
+
+        inline NormalizedRect transformedArea( int i, const QTransform &matrix ) const
+        {
+            NormalizedRect transformed_area = area( i );
+            transformed_area.transform( matrix );
+            return transformed_area;
+        }
+
+        /**
+         * Returns whether the point (@p x, @p y) is in the area of the entity @p i.
+         */
+        inline bool contains( int i, double x, double y ) const
+        {
+            return x >= m_left.at( i ) && x <= m_right.at( i ) && y >= m_top.at( i ) && y <= m_bottom.at( i );
+        }
+
+        void append( const QString &text, const NormalizedRect &area );
+        void clear();
+
+        /**
+         * Releases the memory reserved while appending.
+         */
+        void squeeze();
+
+        /**
+         * Returns the text of all the entities.
+         */
+        inline QString allText() const
+        {
+            return m_text;
+        }
+
+        /**
+         * Returns where the text of each entity starts in allText(), followed
+         * by the length of allText().
+         */
+        inline QVector< int > offsets() const
+        {
+            return m_offsets;
+        }
+
+        /**
+         * Returns a copy of the entities as a TextList, to be deleted by
+         * the caller.
+         */
+        TextList toTextList() const;
+
+    private:
+        QString m_text;
+        // m_offsets[i] is where the text of the entity i starts in m_text,
+        // the last item is the length of m_text
+        QVector< int > m_offsets;
+        QVector< float > m_left;
+        QVector< float > m_top;
+        QVector< float > m_right;
+        QVector< float > m_bottom;
+};
 
 class TextPagePrivate
 {
@@ -43,19 +143,24 @@ class TextPagePrivate
         TextPagePrivate();
         ~TextPagePrivate();
 
-        RegularAreaRect * findTextInternalForward( int searchID, const QString &query,
-                                                   TextComparisonFunction comparer,
-                                                   const TextList::ConstIterator &start,
-                                                   int start_offset,
-                                                   const TextList::ConstIterator &end);
-        RegularAreaRect * findTextInternalBackward( int searchID, const QString &query,
-                                                    TextComparisonFunction comparer,
-                                                    const TextList::ConstIterator &start,
-                                                    int start_offset,
-                                                    const TextList::ConstIterator &end );
+        /**
+         * Looks for @p query from the character @p start_offset of the entity
+         * @p start towards the entity @p end, forward or backward.
+         */
+        RegularAreaRect * findTextInternal( int searchID, const QString &query,
+                                            Qt::CaseSensitivity caseSensitivity,
+                                            bool forward,
+                                            int start,
+                                            int start_offset,
+                                            int end );
+
+        /**
+         * Must be called whenever m_words changes.
+         */
+        void invalidateSearchText();
 
         /**
-         * Copy a TextList to m_words, the pointers of list are adopted
+         * Copy a TextList to m_words, the entities of list are deleted
          */
         void setWordList(const TextList &list);
 
@@ -66,12 +171,24 @@ class TextPagePrivate
         void correctTextOrder();
 
         // variables those can be accessed directly from TextPage
-        TextList m_words;
+        CompactTextList m_words;
+        // the text of m_words as it is searched, without the hyphens at the
+        // end of the lines, and where each entity starts in it; built with
+        // the first search, the case folded version with the first case
+        // insensitive one
+        bool m_searchTextValid;
+        QString m_searchText;
+        QString m_foldedSearchText;
+        QVector< int > m_searchOffsets;
         QMap< int, SearchPoint* > m_searchPoints;
+        // searches may run on worker threads, see ParallelSearch
+        QMutex m_searchPointsMutex;
         PagePrivate *m_page;
 
     private:
         RegularAreaRect * searchPointToArea(const SearchPoint* sp);
+        void buildSearchText();
+        int searchEntityAt( int position ) const;
 };
 
 }
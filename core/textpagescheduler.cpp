@@ -0,0 +1,190 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "textpagescheduler_p.h"
+
+#include <QtCore/QMutexLocker>
+
+#include <threadweaver/job.h>
+
+#include "generator.h"
+#include "page.h"
+#include "page_p.h"
+#include "textpage.h"
+
+// the most pages a job extracts before looking for more urgent requests
+#define TEXT_BATCH_SIZE 4
+
+using namespace Okular;
+
+class TextPageScheduler::BatchJob : public ThreadWeaver::Job
+{
+    public:
+        explicit BatchJob( TextPageScheduler *scheduler )
+            : m_scheduler( scheduler )
+        {
+        }
+
+    protected:
+        void run( ThreadWeaver::JobPointer, ThreadWeaver::Thread * ) override
+        {
+            QVector< Page * > batch = m_scheduler->takeBatch();
+            while ( !batch.isEmpty() )
+            {
+                m_scheduler->extract( batch );
+                batch = m_scheduler->takeBatch();
+            }
+        }
+
+    private:
+        TextPageScheduler *m_scheduler;
+};
+
+TextPageScheduler::TextPageScheduler( Generator *generator, int maxThreads )
+    : QObject(), m_generator( generator ), m_maxThreads( maxThreads ), m_nextOrder( 0 ), m_jobs( 0 )
+{
+    m_queue.setMaximumNumberOfThreads( maxThreads );
+}
+
+TextPageScheduler::~TextPageScheduler()
+{
+    m_cancelled.store( 1 );
+    m_mutex.lock();
+    m_requests.clear();
+    m_mutex.unlock();
+
+    m_queue.dequeue();
+    m_queue.finish();
+
+    qDeleteAll( m_textPages );
+}
+
+void TextPageScheduler::request( Page *page, Priority priority )
+{
+    QMutexLocker locker( &m_mutex );
+    const int number = page->number();
+    if ( m_runningPages.contains( number ) || m_textPages.contains( number ) )
+        return;
+
+    QHash< int, Request >::iterator it = m_requests.find( number );
+    if ( it != m_requests.end() )
+    {
+        if ( it->priority < priority )
+            it->priority = priority;
+        return;
+    }
+
+    Request request;
+    request.page = page;
+    request.priority = priority;
+    request.order = m_nextOrder++;
+    m_requests.insert( number, request );
+
+    // the jobs take the requests until there are none left
+    if ( m_jobs < m_maxThreads )
+    {
+        ++m_jobs;
+        m_queue.enqueue( ThreadWeaver::JobPointer( new BatchJob( this ) ) );
+    }
+}
+
+void TextPageScheduler::cancel( Priority priority )
+{
+    QMutexLocker locker( &m_mutex );
+    QHash< int, Request >::iterator it = m_requests.begin();
+    while ( it != m_requests.end() )
+    {
+        if ( it->priority == priority )
+            it = m_requests.erase( it );
+        else
+            ++it;
+    }
+}
+
+bool TextPageScheduler::isPending( int page ) const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_requests.contains( page ) || m_runningPages.contains( page );
+}
+
+TextPage *TextPageScheduler::takeTextPage( int page )
+{
+    QMutexLocker locker( &m_mutex );
+    return m_textPages.take( page );
+}
+
+TextPage *TextPageScheduler::waitForTextPage( int page )
+{
+    QMutexLocker locker( &m_mutex );
+    m_requests.remove( page );
+    while ( m_runningPages.contains( page ) )
+        m_extracted.wait( &m_mutex );
+    return m_textPages.take( page );
+}
+
+QVector< Page * > TextPageScheduler::takeBatch()
+{
+    QMutexLocker locker( &m_mutex );
+    if ( m_cancelled.load() || m_requests.isEmpty() )
+    {
+        --m_jobs;
+        return QVector< Page * >();
+    }
+
+    // there are only a few requests at a time, no need to keep them sorted;
+    // the oldest of the most urgent ones goes first
+    QHash< int, Request >::const_iterator first = m_requests.constBegin();
+    for ( QHash< int, Request >::const_iterator it = m_requests.constBegin(), itEnd = m_requests.constEnd(); it != itEnd; ++it )
+    {
+        if ( it->priority > first->priority || ( it->priority == first->priority && it->order < first->order ) )
+            first = it;
+    }
+
+    // followed by the next pages waiting with the same priority, which the
+    // generator is likely to read faster together
+    const Priority priority = first->priority;
+    QVector< Page * > batch;
+    for ( int number = first.key(); batch.count() < TEXT_BATCH_SIZE; ++number )
+    {
+        QHash< int, Request >::iterator it = m_requests.find( number );
+        if ( it == m_requests.end() || it->priority != priority )
+            break;
+
+        batch.append( it->page );
+        m_runningPages.insert( number );
+        m_requests.erase( it );
+    }
+    return batch;
+}
+
+void TextPageScheduler::extract( const QVector< Page * > &pages )
+{
+    foreach ( Page *page, pages )
+    {
+        TextPage *textPage = 0;
+        if ( !m_cancelled.load() )
+        {
+            textPage = m_generator->textPage( page );
+            if ( textPage )
+                PagePrivate::get( page )->prepareTextPage( textPage );
+        }
+
+        const int number = page->number();
+        m_mutex.lock();
+        m_runningPages.remove( number );
+        if ( textPage )
+            m_textPages.insert( number, textPage );
+        m_mutex.unlock();
+        m_extracted.wakeAll();
+
+        emit textPageReady( number );
+    }
+}
+
+#include "moc_textpagescheduler_p.cpp"
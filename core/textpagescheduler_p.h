@@ -0,0 +1,127 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_TEXTPAGESCHEDULER_P_H_
+#define _OKULAR_TEXTPAGESCHEDULER_P_H_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+#include <threadweaver/queue.h>
+
+namespace Okular {
+
+class Generator;
+class Page;
+class TextPage;
+
+/**
+ * @short Extracts the text pages of a threaded generator in the background.
+ *
+ * The pages are extracted on worker threads of their own, so the text of
+ * the visible pages doesn't wait for the pixmaps to be rendered and the
+ * main thread doesn't wait for the text. The pending page with the highest
+ * priority is extracted first, together with the pages following it at the
+ * same priority, up to a small batch.
+ *
+ * textPageReady() is emitted when the extraction of a page ended, and
+ * reaches the thread the scheduler was created in queued. The text page,
+ * if the generator had one, can then be taken with takeTextPage().
+ */
+class TextPageScheduler : public QObject
+{
+    Q_OBJECT
+
+    public:
+        enum Priority
+        {
+            BackgroundPriority, ///< preloaded pages
+            SearchPriority,     ///< pages a search is going to look at
+            VisiblePriority     ///< pages the user can select the text of
+        };
+
+        TextPageScheduler( Generator *generator, int maxThreads );
+
+        /**
+         * Cancels all the requests and waits for the pages being extracted.
+         */
+        ~TextPageScheduler();
+
+        /**
+         * Queues the extraction of the text page of @p page. A page already
+         * queued gets the higher of the two priorities.
+         */
+        void request( Page *page, Priority priority );
+
+        /**
+         * Forgets the requests with @p priority that didn't start yet.
+         */
+        void cancel( Priority priority );
+
+        /**
+         * Returns whether the text page of @p page is queued or being
+         * extracted.
+         */
+        bool isPending( int page ) const;
+
+        /**
+         * Returns the text page extracted for @p page, which is passed to the
+         * caller, or 0 if there is none. Its text order is already corrected.
+         */
+        TextPage *takeTextPage( int page );
+
+        /**
+         * Forgets the request for @p page if it didn't start yet, otherwise
+         * waits for its extraction to end. Returns the text page as
+         * takeTextPage() does.
+         */
+        TextPage *waitForTextPage( int page );
+
+    Q_SIGNALS:
+        void textPageReady( int page );
+
+    private:
+        class BatchJob;
+
+        struct Request
+        {
+            Page *page;
+            Priority priority;
+            quint64 order;
+        };
+
+        // takes the next pages to extract, or ends the job if there is none
+        QVector< Page * > takeBatch();
+        void extract( const QVector< Page * > &pages );
+
+        Generator *m_generator;
+        int m_maxThreads;
+
+        QAtomicInt m_cancelled;
+        // the requests not started yet, by page number
+        QHash< int, Request > m_requests;
+        quint64 m_nextOrder;
+        QSet< int > m_runningPages;
+        QHash< int, TextPage * > m_textPages;
+        // the jobs queued or running
+        int m_jobs;
+        mutable QMutex m_mutex;
+        QWaitCondition m_extracted;
+
+        ThreadWeaver::Queue m_queue;
+};
+
+}
+
+#endif
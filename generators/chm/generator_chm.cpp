@@ -12,6 +12,7 @@
 
 #include <QtCore/QEventLoop>
 #include <QtCore/QMutex>
+#include <QtCore/QTimer>
 #include <QtGui/QPainter>
 #include <QtXml/QDomElement>
 
@@ -29,6 +30,9 @@
 #include <core/textpage.h>
 #include <core/utils.h>
 
+// milliseconds between two updates of the page sizes in the document
+#define UPDATE_SIZES_INTERVAL 1000
+
 OKULAR_EXPORT_PLUGIN(CHMGenerator, "libokularGenerator_chmlib.json")
 
 static QString absolutePath( const QString &baseUrl, const QString &path )
@@ -56,10 +60,18 @@ CHMGenerator::CHMGenerator( QObject *parent, const QVariantList &args )
     m_syncGen=0;
     m_file=0;
     m_request = 0;
+
+    m_sizeProbe = 0;
+    m_probedPage = -1;
+    m_probeTimer = new QTimer( this );
+    m_probeTimer->setSingleShot( true );
+    m_probeTimer->setInterval( 0 );
+    connect( m_probeTimer, SIGNAL(timeout()), this, SLOT(probeNextPageSize()) );
 }
 
 CHMGenerator::~CHMGenerator()
 {
+    delete m_sizeProbe;
     delete m_syncGen;
 }
 
@@ -145,21 +157,58 @@ bool CHMGenerator::loadDocument( const QString & fileName, QVector< Okular::Page
     }
     disconnect( m_syncGen, 0, this, 0 );
 
+    if (!m_sizeProbe)
+    {
+        m_sizeProbe = new KHTMLPart();
+        connect( m_sizeProbe, SIGNAL(completed()), this, SLOT(slotPageSizeProbed()) );
+        connect( m_sizeProbe, &KParts::ReadOnlyPart::canceled, this, &CHMGenerator::slotPageSizeProbed );
+    }
+    m_probedPage = -1;
+
+    // laying out every page takes minutes on big files, so only the first
+    // one is laid out now; the others get its size until they are measured
+    // in the background, by the same part so they are all laid out alike
+    m_pageSizeKnown.fill(false, pagesVector.count());
+    m_estimatedSize = QSize();
+    if (!m_pageUrl.isEmpty())
+    {
+        QEventLoop loop;
+        connect( m_sizeProbe, SIGNAL(completed()), &loop, SLOT(quit()) );
+        connect( m_sizeProbe, &KParts::ReadOnlyPart::canceled, &loop, &QEventLoop::quit );
+        m_sizeProbe->openUrl(QUrl(QStringLiteral("ms-its:") + m_fileName + QStringLiteral("::") + m_pageUrl.at(0)));
+        // discard any user input, the document is not loaded yet
+        loop.exec( QEventLoop::ExcludeUserInputEvents );
+        m_estimatedSize = QSize( m_sizeProbe->view()->contentsWidth(), m_sizeProbe->view()->contentsHeight() );
+        m_sizeProbe->closeUrl();
+        m_pageSizeKnown.setBit(0);
+    }
+
     for (int i = 0; i < m_pageUrl.count(); ++i)
     {
-        preparePageForSyncOperation(m_pageUrl.at(i));
-        pagesVector[ i ] = new Okular::Page (i, m_syncGen->view()->contentsWidth(),
-            m_syncGen->view()->contentsHeight(), Okular::Rotation0 );
+        pagesVector[ i ] = new Okular::Page (i, m_estimatedSize.width(),
+            m_estimatedSize.height(), Okular::Rotation0 );
     }
 
     connect( m_syncGen, SIGNAL(completed()), this, SLOT(slotCompleted()) );
     connect( m_syncGen, &KParts::ReadOnlyPart::canceled, this, &CHMGenerator::slotCompleted );
 
+    m_lastSizeUpdate.invalidate();
+    m_probeTimer->start();
+
     return true;
 }
 
 bool CHMGenerator::doCloseDocument()
 {
+    m_probeTimer->stop();
+    m_probedPage = -1;
+    if (m_sizeProbe)
+    {
+        m_sizeProbe->closeUrl();
+    }
+    m_pageSizeKnown.clear();
+    m_pageSizes.clear();
+
     // delete the document information of the old document
     delete m_file;
     m_file=0;
@@ -192,6 +241,75 @@ void CHMGenerator::preparePageForSyncOperation(const QString & url)
     loop.exec( QEventLoop::ExcludeUserInputEvents );
 }
 
+void CHMGenerator::probeNextPageSize()
+{
+    // the pages around the current one are the first to be seen
+    const int currentPage = document() ? document()->currentPage() : 0;
+    const int count = m_pageSizeKnown.count();
+    int page = -1;
+    for (int distance = 0; page == -1 && distance < count; ++distance)
+    {
+        if (currentPage + distance < count && !m_pageSizeKnown.testBit(currentPage + distance))
+            page = currentPage + distance;
+        else if (currentPage - distance >= 0 && !m_pageSizeKnown.testBit(currentPage - distance))
+            page = currentPage - distance;
+    }
+
+    if (page == -1)
+    {
+        updateProbedPageSizes();
+        return;
+    }
+
+    // the page is laid out without blocking, slotPageSizeProbed() reads
+    // its size when it is done
+    m_probedPage = page;
+    QString pAddress= QStringLiteral("ms-its:") + m_fileName + QStringLiteral("::") + m_pageUrl.at(page);
+    m_sizeProbe->openUrl(QUrl(pAddress));
+}
+
+void CHMGenerator::slotPageSizeProbed()
+{
+    if (m_probedPage == -1)
+        return;
+
+    // the pages as big as the first one are fine already
+    const QSize size( m_sizeProbe->view()->contentsWidth(), m_sizeProbe->view()->contentsHeight() );
+    if (size != m_estimatedSize)
+        m_pageSizes.insert(m_probedPage, size);
+    m_pageSizeKnown.setBit(m_probedPage);
+    m_probedPage = -1;
+    m_sizeProbe->closeUrl();
+
+    // the views lay out all the pages again when their size changes, so
+    // don't do it too often
+    if (!m_lastSizeUpdate.isValid() || m_lastSizeUpdate.elapsed() >= UPDATE_SIZES_INTERVAL)
+    {
+        updateProbedPageSizes();
+        m_lastSizeUpdate.start();
+    }
+
+    // let the events in before the next page
+    m_probeTimer->start();
+}
+
+void CHMGenerator::updateProbedPageSizes()
+{
+    if (m_pageSizes.isEmpty())
+        return;
+
+    // the Document drops the text and the links of the resized pages, as
+    // they are normalized to the old size; get them again at the next paint
+    for (QHash<int, QSizeF>::const_iterator it = m_pageSizes.constBegin(); it != m_pageSizes.constEnd(); ++it)
+    {
+        m_textpageAddedList.clearBit(it.key());
+        m_rectsGenerated.clearBit(it.key());
+    }
+
+    updatePageSizes(m_pageSizes);
+    m_pageSizes.clear();
+}
+
 void CHMGenerator::slotCompleted()
 {
     if ( !m_request )
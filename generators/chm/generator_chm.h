@@ -17,8 +17,11 @@
 #include "lib/libchmfile.h"
 
 #include <qbitarray.h>
+#include <qelapsedtimer.h>
+#include <qhash.h>
 
 class KHTMLPart;
+class QTimer;
 
 namespace Okular {
 class TextPage;
@@ -48,6 +51,10 @@ class CHMGenerator : public Okular::Generator
     public Q_SLOTS:
         void slotCompleted();
 
+    private Q_SLOTS:
+        void probeNextPageSize();
+        void slotPageSizeProbed();
+
     protected:
         bool doCloseDocument() override;
         Okular::TextPage* textPage( Okular::Page *page ) override;
@@ -56,6 +63,7 @@ class CHMGenerator : public Okular::Generator
         void additionalRequestData();
         void recursiveExploreNodes( DOM::Node node, Okular::TextPage *tp );
         void preparePageForSyncOperation( const QString &url );
+        void updateProbedPageSizes();
         QMap<QString, int> m_urlPage;
         QVector<QString> m_pageUrl;
         Okular::DocumentSynopsis m_docSyn;
@@ -66,6 +74,15 @@ class CHMGenerator : public Okular::Generator
         Okular::PixmapRequest* m_request;
         QBitArray m_textpageAddedList;
         QBitArray m_rectsGenerated;
+
+        // lays out the pages in the background to get their real size
+        KHTMLPart *m_sizeProbe;
+        QTimer *m_probeTimer;
+        int m_probedPage;
+        QSize m_estimatedSize;      ///< the size of the first page, given to the others meanwhile
+        QBitArray m_pageSizeKnown;
+        QHash<int, QSizeF> m_pageSizes;
+        QElapsedTimer m_lastSizeUpdate;
 };
 
 #endif
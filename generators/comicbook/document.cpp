@@ -9,6 +9,9 @@
 
 #include "document.h"
 
+#include <QtCore/QBuffer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QScopedPointer>
 #include <QtGui/QImage>
 #include <QtGui/QImageReader>
@@ -19,6 +22,7 @@
 #include <kzip.h>
 #include <ktar.h>
 
+#include <climits>
 #include <memory>
 
 #include <core/page.h>
@@ -42,9 +46,85 @@ static void imagesInArchive( const QString &prefix, const KArchiveDirectory* dir
     }
 }
 
+static inline uint bigEndian16( const uchar *data ) { return data[0] << 8 | data[1]; }
+static inline uint bigEndian32( const uchar *data ) { return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3]; }
+static inline uint littleEndian16( const uchar *data ) { return data[1] << 8 | data[0]; }
+static inline uint littleEndian24( const uchar *data ) { return data[2] << 16 | data[1] << 8 | data[0]; }
+static inline uint littleEndian32( const uchar *data ) { return data[3] << 24 | data[2] << 16 | data[1] << 8 | data[0]; }
+
+// the size in the start of frame segment, which follows the metadata
+static QSize jpegSize( QIODevice *dev )
+{
+    if ( dev->read( 2 ).size() != 2 ) // start of image
+        return QSize();
+
+    while ( true ) {
+        char byte;
+        if ( !dev->getChar( &byte ) || (uchar)byte != 0xff )
+            return QSize();
+        // a marker can be preceded by any number of fill bytes
+        do {
+            if ( !dev->getChar( &byte ) )
+                return QSize();
+        } while ( (uchar)byte == 0xff );
+
+        const uchar marker = byte;
+        if ( marker == 0x01 || ( marker >= 0xd0 && marker <= 0xd8 ) ) // no data
+            continue;
+        if ( marker == 0xd9 || marker == 0xda ) // end of image or start of scan
+            return QSize();
+
+        const QByteArray length = dev->read( 2 );
+        if ( length.size() != 2 )
+            return QSize();
+        const int dataLength = bigEndian16( reinterpret_cast< const uchar * >( length.constData() ) ) - 2;
+
+        // start of frame markers, but not DHT, JPG and DAC
+        if ( marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc ) {
+            const QByteArray frame = dev->read( 5 );
+            if ( frame.size() != 5 )
+                return QSize();
+            const uchar *data = reinterpret_cast< const uchar * >( frame.constData() );
+            return QSize( bigEndian16( data + 3 ), bigEndian16( data + 1 ) );
+        }
+
+        if ( dataLength < 0 || dev->read( dataLength ).size() != dataLength )
+            return QSize();
+    }
+}
+
+/**
+ * Reads the size of JPEG, PNG and WebP images from their header, without
+ * decoding them or reading the rest of the file.
+ */
+static QSize imageHeaderSize( QIODevice *dev )
+{
+    const QByteArray header = dev->peek( 30 );
+    const uchar *data = reinterpret_cast< const uchar * >( header.constData() );
+
+    if ( header.startsWith( "\xff\xd8" ) )
+        return jpegSize( dev );
+
+    if ( header.size() >= 24 && header.startsWith( "\x89PNG\r\n\x1a\n" ) && header.mid( 12, 4 ) == "IHDR" )
+        return QSize( bigEndian32( data + 16 ), bigEndian32( data + 20 ) );
+
+    if ( header.size() >= 30 && header.startsWith( "RIFF" ) && header.mid( 8, 4 ) == "WEBP" ) {
+        const QByteArray chunk = header.mid( 12, 4 );
+        if ( chunk == "VP8 " && header.mid( 23, 3 ) == "\x9d\x01\x2a" ) {
+            return QSize( littleEndian16( data + 26 ) & 0x3fff, littleEndian16( data + 28 ) & 0x3fff );
+        } else if ( chunk == "VP8L" && data[20] == 0x2f ) {
+            const uint bits = littleEndian32( data + 21 );
+            return QSize( ( bits & 0x3fff ) + 1, ( ( bits >> 14 ) & 0x3fff ) + 1 );
+        } else if ( chunk == "VP8X" ) {
+            return QSize( littleEndian24( data + 24 ) + 1, littleEndian24( data + 27 ) + 1 );
+        }
+    }
+
+    return QSize();
+}
 
 Document::Document()
-    : mDirectory( 0 ), mUnrar( 0 ), mArchive( 0 )
+    : mDirectory( 0 ), mUnrar( 0 ), mArchive( 0 ), mPageImages( 0 )
 {
 }
 
@@ -136,6 +216,9 @@ void Document::close()
     mUnrar = 0;
     mPageMap.clear();
     mEntries.clear();
+    mPageSizes.clear();
+    mNewPageSizes.clear();
+    mPageImages.clear();
 }
 
 bool Document::processArchive() {
@@ -161,48 +244,153 @@ bool Document::processArchive() {
     return true;
 }
 
+QIODevice* Document::createDevice( const QString &file ) const
+{
+    if ( mArchive ) {
+        const KArchiveFile *entry = static_cast<const KArchiveFile*>( mArchiveDir->entry( file ) );
+        if ( entry ) {
+            return entry->createDevice();
+        }
+    } else if ( mDirectory ) {
+        return mDirectory->createDevice( file );
+    } else {
+        return mUnrar->createDevice( file );
+    }
+
+    return 0;
+}
+
+QIODevice* Document::createUnlockedDevice( const QString &file ) const
+{
+    if ( mArchive ) {
+        // the archive is used by other threads too, so take the compressed
+        // data under the lock and let the caller decode it without
+        QMutexLocker locker( &mMutex );
+        const KArchiveFile *entry = static_cast<const KArchiveFile*>( mArchiveDir->entry( file ) );
+        if ( !entry )
+            return 0;
+        QBuffer *buffer = new QBuffer();
+        buffer->setData( entry->data() );
+        return buffer;
+    }
+
+    // files in a directory, or extracted from a RAR archive: they are read
+    // straight from the disk
+    return createDevice( file );
+}
+
+QSize Document::readSize( const QString &file ) const
+{
+    {
+        // the header is at the start of the entry, that is quick to read
+        QMutexLocker locker( &mMutex );
+
+        QScopedPointer< QIODevice > dev( createDevice( file ) );
+        if ( dev.isNull() )
+            return QSize();
+
+        const QSize pageSize = imageHeaderSize( dev.data() );
+        if ( !pageSize.isEmpty() )
+            return pageSize;
+    }
+
+    // not a header we know, let QImageReader read it from the start, which
+    // may decode the whole image, without holding the lock
+    QScopedPointer< QIODevice > dev( createUnlockedDevice( file ) );
+    if ( dev.isNull() )
+        return QSize();
+
+    QImageReader reader( dev.data() );
+    if ( !reader.canRead() )
+        return QSize();
+
+    QSize pageSize = reader.size();
+    if ( !pageSize.isValid() ) {
+        const QImage i = reader.read();
+        if ( !i.isNull() )
+            pageSize = i.size();
+    }
+    return pageSize;
+}
+
 void Document::pages( QVector<Okular::Page*> * pagesVector )
 {
     qSort( mEntries.begin(), mEntries.end(), caseSensitiveNaturalOrderLessThen );
-    QScopedPointer< QIODevice > dev;
 
-    int count = 0;
+    // reading every entry of the archive takes long, so the files with the
+    // extension of an image are taken as pages without reading them, and
+    // they get the size of the first page until probeNearestPageSize()
+    const QList<QByteArray> imageFormats = QImageReader::supportedImageFormats();
+
     pagesVector->clear();
-    pagesVector->resize( mEntries.size() );
-    QImageReader reader;
+    mPageSizes.clear();
+    mNewPageSizes.clear();
+    mProvisionalSize = QSize();
     foreach(const QString &file, mEntries) {
-        if ( mArchive ) {
-            const KArchiveFile *entry = static_cast<const KArchiveFile*>( mArchiveDir->entry( file ) );
-            if ( entry ) {
-                dev.reset( entry->createDevice() );
+        QSize pageSize;
+        const bool isImage = imageFormats.contains( QFileInfo( file ).suffix().toLower().toLatin1() );
+        if ( !isImage || !mProvisionalSize.isValid() ) {
+            pageSize = readSize( file );
+            if ( !pageSize.isValid() ) {
+                if ( isImage )
+                    qCDebug(OkularComicbookDebug) << "Ignoring" << file << "doesn't seem to be an image even if it has the extension of one";
+                continue;
             }
-        } else if ( mDirectory ) {
-            dev.reset( mDirectory->createDevice( file ) );
-        } else {
-            dev.reset( mUnrar->createDevice( file ) );
+            if ( !mProvisionalSize.isValid() )
+                mProvisionalSize = pageSize;
         }
 
-        if ( ! dev.isNull() ) {
-            reader.setDevice( dev.data() );
-            if ( reader.canRead() )
-            {
-                QSize pageSize = reader.size();
-                if ( !pageSize.isValid() ) {
-                    const QImage i = reader.read();
-                    if ( !i.isNull() )
-                        pageSize = i.size();
-                }
-                if ( pageSize.isValid() ) {
-                    pagesVector->replace( count, new Okular::Page( count, pageSize.width(), pageSize.height(), Okular::Rotation0 ) );
-                    mPageMap.append(file);
-                    count++;
-                } else {
-                    qCDebug(OkularComicbookDebug) << "Ignoring" << file << "doesn't seem to be an image even if QImageReader::canRead returned true";
-                }
-            }
+        const QSize size = pageSize.isValid() ? pageSize : mProvisionalSize;
+        pagesVector->append( new Okular::Page( pagesVector->count(), size.width(), size.height(), Okular::Rotation0 ) );
+        mPageMap.append(file);
+        mPageSizes.append( pageSize );
+    }
+}
+
+bool Document::probeNearestPageSize( int page )
+{
+    const int count = mPageSizes.count();
+    for ( int distance = 0; page - distance >= 0 || page + distance < count; ++distance ) {
+        const int candidates[2] = { page - distance, page + distance };
+        for ( int i = 0; i < 2; ++i ) {
+            const int candidate = candidates[ i ];
+            if ( candidate < 0 || candidate >= count || mPageSizes.at( candidate ).isValid() )
+                continue;
+            // don't wait for unrar to get to the page
+            if ( mUnrar && mUnrar->isExtracting( mPageMap.at( candidate ) ) )
+                continue;
+
+            // a page that can't be read keeps the provisional size
+            QSize pageSize = readSize( mPageMap.at( candidate ) );
+            if ( !pageSize.isValid() )
+                pageSize = mProvisionalSize;
+            QMutexLocker locker( &mMutex );
+            mPageSizes[ candidate ] = pageSize;
+            if ( pageSize != mProvisionalSize )
+                mNewPageSizes.insert( candidate, pageSize );
+            return true;
         }
     }
-    pagesVector->resize( count );
+
+    return false;
+}
+
+bool Document::pageSizesKnown() const
+{
+    QMutexLocker locker( &mMutex );
+    foreach ( const QSize &pageSize, mPageSizes ) {
+        if ( !pageSize.isValid() )
+            return false;
+    }
+    return true;
+}
+
+QHash<int, QSizeF> Document::takePageSizes()
+{
+    QMutexLocker locker( &mMutex );
+    QHash<int, QSizeF> sizes;
+    sizes.swap( mNewPageSizes );
+    return sizes;
 }
 
 QStringList Document::pageTitles() const
@@ -210,19 +398,47 @@ QStringList Document::pageTitles() const
     return QStringList();
 }
 
-QImage Document::pageImage( int page ) const
+void Document::setCacheMemory( qulonglong bytes )
 {
-    if ( mArchive ) {
-        const KArchiveFile *entry = static_cast<const KArchiveFile*>( mArchiveDir->entry( mPageMap[ page ] ) );
-        if ( entry )
-            return QImage::fromData( entry->data() );
-    } else if ( mDirectory ) {
-        return QImage( mPageMap[ page ] );
-    } else {
-        return QImage::fromData( mUnrar->contentOf( mPageMap[ page ] ) );
+    QMutexLocker locker( &mMutex );
+    mPageImages.setMaxCost( (int)qMin( bytes / 1024, (qulonglong)INT_MAX ) );
+}
+
+QImage Document::pageImage( int page, const QSize &size ) const
+{
+    {
+        QMutexLocker locker( &mMutex );
+        const QImage *image = mPageImages.object( page );
+        if ( image && size.isValid() && image->size() == size )
+            return *image;
     }
 
-    return QImage();
+    // the size of the other pages is read from the archive meanwhile
+    QScopedPointer< QIODevice > dev( createUnlockedDevice( mPageMap[ page ] ) );
+    if ( dev.isNull() )
+        return QImage();
+
+    // decode the image at the size it is shown at, which lets the decoders
+    // skip most of the work, JPEG in particular
+    QImageReader reader( dev.data() );
+    const QSize imageSize = reader.size();
+    if ( size.isValid() && imageSize.isValid() && size.width() < imageSize.width() && size.height() < imageSize.height() )
+        reader.setScaledSize( size );
+
+    QImage image = reader.read();
+    if ( image.isNull() )
+        return QImage();
+
+    if ( size.isValid() && image.size() != size )
+        image = image.scaled( size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+
+    // the image at the previous size of the page is not shown anymore; the
+    // ones at their own size are printed, not shown
+    if ( size.isValid() ) {
+        QMutexLocker locker( &mMutex );
+        mPageImages.insert( page, new QImage( image ), image.byteCount() / 1024 + 1 );
+    }
+    return image;
 }
 
 QString Document::lastErrorString() const
@@ -10,12 +10,17 @@
 #ifndef COMICBOOK_DOCUMENT_H
 #define COMICBOOK_DOCUMENT_H
 
+#include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
 #include <QtCore/QStringList>
+#include <QtCore/QVector>
 
 class KArchiveDirectory;
 class KArchive;
 class QImage;
-class QSize;
+class QIODevice;
 class Unrar;
 class Directory;
 
@@ -37,12 +42,46 @@ class Document
         void pages( QVector<Okular::Page*> * pagesVector );
         QStringList pageTitles() const;
 
-        QImage pageImage( int page ) const;
+        /**
+         * Returns the image of the @p page, decoded at the given @p size
+         * or at its own one if @p size is not valid.
+         */
+        QImage pageImage( int page, const QSize &size = QSize() ) const;
+
+        /**
+         * Sets how many @p bytes the last decoded pages can take, none
+         * until it is called.
+         */
+        void setCacheMemory( qulonglong bytes );
+
+        /**
+         * Reads the size of the page nearest to @p page among the ones
+         * created with the provisional size that can be read without
+         * waiting. Returns false if there is none.
+         *
+         * It can be called from a thread other than the one that opened
+         * the document, as long as it is the only one probing sizes.
+         */
+        bool probeNearestPageSize( int page );
+
+        /**
+         * Returns whether the size of all the pages has been read.
+         */
+        bool pageSizesKnown() const;
+
+        /**
+         * Returns the sizes read since the last call that are different
+         * from the provisional one, indexed by page number.
+         */
+        QHash<int, QSizeF> takePageSizes();
 
         QString lastErrorString() const;
 
     private:
         bool processArchive();
+        QIODevice* createDevice( const QString &file ) const;
+        QIODevice* createUnlockedDevice( const QString &file ) const;
+        QSize readSize( const QString &file ) const;
 
         QStringList mPageMap;
         Directory *mDirectory;
@@ -51,6 +90,19 @@ class Document
         KArchiveDirectory *mArchiveDir;
         QString mLastErrorString;
         QStringList mEntries;
+
+        /**
+         * Only the first page is read when opening the document, the others
+         * get its size until probeNearestPageSize() reads their own.
+         */
+        QSize mProvisionalSize;
+        QVector<QSize> mPageSizes;          ///< invalid for the pages not read yet
+        QHash<int, QSizeF> mNewPageSizes;
+        mutable QMutex mMutex;              ///< the archive and the sizes are used by other threads too
+
+        // the last pages decoded, at the size they were last asked at, by
+        // page number, costing their KiB
+        mutable QCache< int, QImage > mPageImages;
 };
 
 }
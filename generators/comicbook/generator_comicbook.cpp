@@ -9,6 +9,9 @@
 
 #include "generator_comicbook.h"
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
 #include <QtGui/QPainter>
 #include <QtPrintSupport/QPrinter>
 
@@ -21,6 +24,62 @@
 
 #include "debug_comicbook.h"
 
+// milliseconds between two updates of the page sizes in the document
+#define UPDATE_SIZES_INTERVAL 1000
+// milliseconds to wait for unrar to extract more pages
+#define EXTRACTION_WAIT 100
+
+/**
+ * Reads the size of the pages nearest to a given one out of the GUI thread,
+ * for up to UPDATE_SIZES_INTERVAL, then lets the generator know with a
+ * queued call to pageSizesProbed().
+ */
+class PageSizeThread : public QThread
+{
+    public:
+        PageSizeThread( ComicBookGenerator *generator, ComicBook::Document *document )
+            : QThread( generator ), mGenerator( generator ), mDocument( document ), mPage( 0 )
+        {
+        }
+
+        void probe( int page )
+        {
+            mPage = page;
+            mStop.store( 0 );
+            start( QThread::LowPriority );
+        }
+
+        void stop()
+        {
+            mStop.store( 1 );
+            wait();
+        }
+
+    protected:
+        void run() override
+        {
+            QElapsedTimer elapsed;
+            elapsed.start();
+            while ( !mStop.load() && elapsed.elapsed() < UPDATE_SIZES_INTERVAL ) {
+                if ( mDocument->probeNearestPageSize( mPage ) )
+                    continue;
+                if ( mDocument->pageSizesKnown() )
+                    break;
+                // the pages left are still being extracted from a RAR archive
+                msleep( EXTRACTION_WAIT );
+            }
+
+            if ( !mStop.load() )
+                QMetaObject::invokeMethod( mGenerator, "pageSizesProbed", Qt::QueuedConnection );
+        }
+
+    private:
+        ComicBookGenerator *mGenerator;
+        ComicBook::Document *mDocument;
+        int mPage;
+        QAtomicInt mStop;
+};
+
 OKULAR_EXPORT_PLUGIN(ComicBookGenerator, "libokularGenerator_comicbook.json")
 
 ComicBookGenerator::ComicBookGenerator( QObject *parent, const QVariantList &args )
@@ -29,10 +88,13 @@ ComicBookGenerator::ComicBookGenerator( QObject *parent, const QVariantList &arg
     setFeature( Threaded );
     setFeature( PrintNative );
     setFeature( PrintToFile );
+
+    mProbeThread = new PageSizeThread( this, &mDocument );
 }
 
 ComicBookGenerator::~ComicBookGenerator()
 {
+    mProbeThread->stop();
 }
 
 bool ComicBookGenerator::loadDocument( const QString & fileName, QVector<Okular::Page*> & pagesVector )
@@ -46,24 +108,47 @@ bool ComicBookGenerator::loadDocument( const QString & fileName, QVector<Okular:
     }
 
     mDocument.pages( &pagesVector );
+
+    // the size of the other pages is read in a thread, starting from the
+    // first one
+    mProbeThread->probe( 0 );
     return true;
 }
 
 bool ComicBookGenerator::doCloseDocument()
 {
+    mProbeThread->stop();
     mDocument.close();
 
     return true;
 }
 
-QImage ComicBookGenerator::image( Okular::PixmapRequest * request )
+void ComicBookGenerator::generatePixmap( Okular::PixmapRequest * request )
 {
-    int width = request->width();
-    int height = request->height();
+    // the memory available changes while reading, and the pages are
+    // decoded in another thread
+    mDocument.setCacheMemory( cacheMemory() );
+    Generator::generatePixmap( request );
+}
 
-    QImage image = mDocument.pageImage( request->pageNumber() );
+QImage ComicBookGenerator::image( Okular::PixmapRequest * request )
+{
+    return mDocument.pageImage( request->pageNumber(), QSize( request->width(), request->height() ) );
+}
 
-    return image.scaled( width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+void ComicBookGenerator::pageSizesProbed()
+{
+    // the views lay out all the pages again when their size changes, so
+    // they are updated at most once every UPDATE_SIZES_INTERVAL
+    const QHash<int, QSizeF> sizes = mDocument.takePageSizes();
+    if ( !sizes.isEmpty() )
+        updatePageSizes( sizes );
+
+    // carry on from the page being read now; a call left over from a
+    // document closed meanwhile finds the sizes of the next one known or
+    // the thread already running
+    if ( !mDocument.pageSizesKnown() && !mProbeThread->isRunning() )
+        mProbeThread->probe( document() ? document()->currentPage() : 0 );
 }
 
 bool ComicBookGenerator::print( QPrinter& printer )
@@ -14,6 +14,8 @@
 
 #include "document.h"
 
+class PageSizeThread;
+
 class ComicBookGenerator : public Okular::Generator
 {
     Q_OBJECT
@@ -31,10 +33,15 @@ class ComicBookGenerator : public Okular::Generator
 
     protected:
         bool doCloseDocument() override;
+        void generatePixmap( Okular::PixmapRequest * request ) override;
         QImage image( Okular::PixmapRequest * request ) override;
 
+    private Q_SLOTS:
+        void pageSizesProbed();
+
     private:
       ComicBook::Document mDocument;
+      PageSizeThread *mProbeThread;
 };
 
 #endif
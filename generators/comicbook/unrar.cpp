@@ -14,6 +14,7 @@
 #include <QtCore/QFileInfo>
 #include <QtCore/QRegExp>
 #include <QtCore/QGlobalStatic>
+#include <QtCore/QThread>
 #include <QTemporaryDir>
 
 #include <QtCore/qloggingcategory.h>
@@ -92,13 +93,20 @@ UnrarHelper::~UnrarHelper()
 }
 
 
+// milliseconds between two checks of the files extracted so far
+#define EXTRACTION_POLL_INTERVAL 20
+
 Unrar::Unrar()
-    : QObject( 0 ), mLoop( 0 ), mTempDir( 0 )
+    : QObject( 0 ), mProcess( 0 ), mLoop( 0 ), mTempDir( 0 ), mExtracted( 1 )
 {
 }
 
 Unrar::~Unrar()
 {
+    if ( mProcess ) {
+        mProcess->kill();
+        mProcess->waitForFinished( -1 );
+    }
     delete mTempDir;
 }
 
@@ -112,44 +120,41 @@ bool Unrar::open( const QString &fileName )
 
     mFileName = fileName;
 
-    /**
-     * Extract the archive to a temporary directory
-     */
     mStdOutData.clear();
     mStdErrData.clear();
 
-    int ret = startSyncProcess( QStringList() << QStringLiteral("e") << mFileName << mTempDir->path() +  QLatin1Char('/') );
-    bool ok = ret == 0;
+    if ( startSyncProcess( QStringList() << QStringLiteral("lb") << mFileName ) != 0 )
+        return false;
 
-    return ok;
-}
+    // Extract all the files to mTempDir regardless of their path inside the archive
+    // This will break if ever an arvhice with two files with the same name in different subfolders
+    mEntries.clear();
+    const QStringList listFiles = helper->kind->processListing( QString::fromLocal8Bit( mStdOutData ).split( QLatin1Char('\n'), QString::SkipEmptyParts ) );
+    Q_FOREACH ( const QString &f, listFiles ) {
+        mEntries.append( QFileInfo( f ).fileName() );
+    }
 
-QStringList Unrar::list()
-{
+    /**
+     * Extract the archive to a temporary directory in the background:
+     * the files can be read as soon as they are extracted
+     */
     mStdOutData.clear();
     mStdErrData.clear();
 
-    if ( !isSuitableVersionAvailable() )
-        return QStringList();
+    mExtracted.store( 0 );
+    startProcess( QStringList() << QStringLiteral("e") << mFileName << mTempDir->path() +  QLatin1Char('/') );
 
-    startSyncProcess( QStringList() << QStringLiteral("lb") << mFileName );
+    return true;
+}
 
-    const QStringList listFiles = helper->kind->processListing( QString::fromLocal8Bit( mStdOutData ).split( QLatin1Char('\n'), QString::SkipEmptyParts ) );
-    QStringList newList;
-    Q_FOREACH ( const QString &f, listFiles ) {
-        // Extract all the files to mTempDir regardless of their path inside the archive
-        // This will break if ever an arvhice with two files with the same name in different subfolders
-        QFileInfo fi( f );
-        if ( QFile::exists( mTempDir->path() + QLatin1Char('/') + fi.fileName() ) ) {
-            newList.append( fi.fileName() );
-        }
-    }
-    return newList;
+QStringList Unrar::list()
+{
+    return mEntries;
 }
 
 QByteArray Unrar::contentOf( const QString &fileName ) const
 {
-    if ( !isSuitableVersionAvailable() )
+    if ( !isSuitableVersionAvailable() || !waitForFile( fileName ) )
         return QByteArray();
 
     QFile file( mTempDir->path() + QLatin1Char('/') + fileName );
@@ -161,7 +166,7 @@ QByteArray Unrar::contentOf( const QString &fileName ) const
 
 QIODevice* Unrar::createDevice( const QString &fileName ) const
 {
-    if ( !isSuitableVersionAvailable() )
+    if ( !isSuitableVersionAvailable() || !waitForFile( fileName ) )
         return 0;
 
     std::unique_ptr< QFile> file( new QFile( mTempDir->path() + QLatin1Char('/') + fileName ) );
@@ -212,17 +217,44 @@ void Unrar::finished( int exitCode, QProcess::ExitStatus exitStatus )
     {
         mLoop->exit( exitStatus == QProcess::CrashExit ? 1 : 0 );
     }
+    else if ( mProcess && !mExtracted.load() )
+    {
+        // the extraction is over
+        mProcess->deleteLater();
+        mProcess = 0;
+        mExtracted.store( 1 );
+    }
 }
 
-int Unrar::startSyncProcess( const QStringList &args )
+void Unrar::processError( QProcess::ProcessError error )
+{
+    // finished() is emitted for the other errors
+    if ( error != QProcess::FailedToStart )
+        return;
+
+    qCDebug(OkularComicbookDebug) << "Could not start" << helper->unrarPath;
+    if ( mLoop )
+    {
+        mLoop->exit( 1 );
+    }
+    else if ( mProcess && !mExtracted.load() )
+    {
+        // nothing will be extracted, don't let waitForFile() wait for it
+        mProcess->deleteLater();
+        mProcess = 0;
+        mExtracted.store( 1 );
+    }
+}
+
+void Unrar::startProcess( const QStringList &args )
 {
-    int ret = 0;
 
 #if defined(Q_OS_WIN)
     mProcess = new QProcess( this );    
     connect(mProcess, &QProcess::readyReadStandardOutput, this, &Unrar::readFromStdout);
     connect(mProcess, &QProcess::readyReadStandardError, this, &Unrar::readFromStderr);
     connect(mProcess, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), this, &Unrar::finished);
+    connect(mProcess, &QProcess::errorOccurred, this, &Unrar::processError);
 
 #else
     mProcess = new KPtyProcess( this );
@@ -230,16 +262,28 @@ int Unrar::startSyncProcess( const QStringList &args )
     connect(mProcess, &KPtyProcess::readyReadStandardOutput, this, &Unrar::readFromStdout);
     connect(mProcess, &KPtyProcess::readyReadStandardError, this, &Unrar::readFromStderr);
     connect(mProcess, static_cast<void (KPtyProcess::*)(int, QProcess::ExitStatus)>(&KPtyProcess::finished), this, &Unrar::finished);
+    connect(mProcess, &KPtyProcess::errorOccurred, this, &Unrar::processError);
 
 #endif
 
 #if defined(Q_OS_WIN)
     mProcess->start( helper->unrarPath, args, QIODevice::ReadWrite | QIODevice::Unbuffered );
-    ret = mProcess->waitForFinished( -1 ) ? 0 : 1;
 #else
     mProcess->setProgram( helper->unrarPath, args );
     mProcess->setNextOpenMode( QIODevice::ReadWrite | QIODevice::Unbuffered );
     mProcess->start();
+#endif
+}
+
+int Unrar::startSyncProcess( const QStringList &args )
+{
+    int ret = 0;
+
+    startProcess( args );
+
+#if defined(Q_OS_WIN)
+    ret = mProcess->waitForFinished( -1 ) ? 0 : 1;
+#else
     QEventLoop loop;
     mLoop = &loop;
     ret = loop.exec( QEventLoop::WaitForMoreEvents | QEventLoop::ExcludeUserInputEvents );
@@ -252,6 +296,41 @@ int Unrar::startSyncProcess( const QStringList &args )
     return ret;
 }
 
+bool Unrar::isExtracting( const QString &fileName ) const
+{
+    if ( mExtracted.load() )
+        return false;
+
+    // unrar extracts the files one after the other in the order of the
+    // listing, so a file is complete once one of the following ones exists
+    const QString path = mTempDir->path() + QLatin1Char('/');
+    const int index = mEntries.indexOf( fileName );
+    for ( int i = index + 1; index != -1 && i < mEntries.count(); ++i ) {
+        if ( QFile::exists( path + mEntries.at( i ) ) )
+            return false;
+    }
+    return true;
+}
+
+bool Unrar::waitForFile( const QString &fileName ) const
+{
+    while ( isExtracting( fileName ) ) {
+        if ( QThread::currentThread() == thread() ) {
+            // the output of unrar is read in this thread, keep reading it;
+            // finished() or processError() are called from here when it
+            // exits or fails to start, and stop the loop
+            if ( mProcess && mProcess->state() != QProcess::NotRunning )
+                mProcess->waitForFinished( EXTRACTION_POLL_INTERVAL );
+            else
+                QThread::msleep( EXTRACTION_POLL_INTERVAL );
+        } else {
+            QThread::msleep( EXTRACTION_POLL_INTERVAL );
+        }
+    }
+
+    return QFile::exists( mTempDir->path() + QLatin1Char('/') + fileName );
+}
+
 void Unrar::writeToProcess( const QByteArray &data )
 {
     if ( !mProcess || data.isNull() )
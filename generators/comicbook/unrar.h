@@ -10,6 +10,7 @@
 #ifndef UNRAR_H
 #define UNRAR_H
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QObject>
 #include <QtCore/QProcess>
 #include <QtCore/QStringList>
@@ -34,25 +35,32 @@ class Unrar : public QObject
         ~Unrar();
 
         /**
-         * Opens given rar archive.
+         * Opens given rar archive, and starts extracting it in the background.
          */
         bool open( const QString &fileName );
 
         /**
-         * Returns the list of files from the archive.
+         * Returns the list of files from the archive, in the order they are extracted.
          */
         QStringList list();
 
         /**
-         * Returns the content of the file with the given name.
+         * Returns the content of the file with the given name, waiting for
+         * it to be extracted.
          */
         QByteArray contentOf( const QString &fileName ) const;
 
         /**
-         * Returns a new device for reading the file with the given name.
+         * Returns a new device for reading the file with the given name,
+         * waiting for it to be extracted.
          */
         QIODevice* createDevice( const QString &fileName ) const;
 
+        /**
+         * Returns whether the file with the given name is still to be extracted.
+         */
+        bool isExtracting( const QString &fileName ) const;
+
         static bool isAvailable();
         static bool isSuitableVersionAvailable();
 
@@ -60,10 +68,13 @@ class Unrar : public QObject
         void readFromStdout();
         void readFromStderr();
         void finished( int exitCode, QProcess::ExitStatus exitStatus );
+        void processError( QProcess::ProcessError error );
 
     private:
+        void startProcess( const QStringList &args );
         int startSyncProcess( const QStringList &args );
         void writeToProcess( const QByteArray &data );
+        bool waitForFile( const QString &fileName ) const;
 
 #if defined(Q_OS_WIN)
         QProcess *mProcess;
@@ -75,6 +86,8 @@ class Unrar : public QObject
         QByteArray mStdOutData;
         QByteArray mStdErrData;
         QTemporaryDir *mTempDir;
+        QStringList mEntries;
+        QAtomicInt mExtracted;  ///< whether the extraction is over, successfully or not
 };
 
 #endif
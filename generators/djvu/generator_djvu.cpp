@@ -74,12 +74,14 @@ DjVuGenerator::DjVuGenerator( QObject *parent, const QVariantList &args )
 {
     setFeature( TextExtraction );
     setFeature( Threaded );
+    // the text entities are read with the user mutex locked
+    setFeature( ConcurrentTextExtraction );
+    setFeature( TiledRendering );
     setFeature( PrintPostscript );
     if ( Okular::FilePrinter::ps2pdfAvailable() )
         setFeature( PrintToFile );
 
     m_djvu = new KDjVu();
-    m_djvu->setCacheEnabled( false );
 }
 
 DjVuGenerator::~DjVuGenerator()
@@ -115,7 +117,12 @@ bool DjVuGenerator::doCloseDocument()
 QImage DjVuGenerator::image( Okular::PixmapRequest *request )
 {
     userMutex()->lock();
-    QImage img = m_djvu->image( request->pageNumber(), request->width(), request->height(), request->page()->rotation() );
+    // follow the memory level, which can change at any time; about 4 MiB
+    // for every decoded page kept
+    const int cacheSize = cacheMemory() / 1024;
+    m_djvu->setCacheLimits( cacheSize, qMax( 1, cacheSize / 4096 ) );
+    const QRect rect = request->isTile() ? request->normalizedRect().geometry( request->width(), request->height() ) : QRect();
+    QImage img = m_djvu->image( request->pageNumber(), request->width(), request->height(), request->page()->rotation(), rect );
     userMutex()->unlock();
     return img;
 }
@@ -10,6 +10,7 @@
 #include "kdjvu.h"
 
 #include <qbytearray.h>
+#include <qcache.h>
 #include <qdom.h>
 #include <qfile.h>
 #include <qhash.h>
@@ -25,6 +26,7 @@
 #include <libdjvu/miniexp.h>
 
 #include <stdio.h>
+#include <string.h>
 
 QDebug &operator<<( QDebug & s, const ddjvu_rect_t &r )
 {
@@ -143,20 +145,100 @@ static bool find_replace_or_add_second_in_pair( miniexp_t theexp, const char* wh
     return false;
 }
 
-// ImageCacheItem
+// ImageCacheKey
 
-class ImageCacheItem
+struct ImageCacheKey
 {
-    public:
-        ImageCacheItem( int p, int w, int h, const QImage& i )
-          : page( p ), width( w ), height( h ), img( i ) { }
-
-        int page;
-        int width;
-        int height;
-        QImage img;
+    int page;
+    int width;
+    int height;
+    int rotation;
 };
 
+static inline bool operator==( const ImageCacheKey &a, const ImageCacheKey &b )
+{
+    return a.page == b.page && a.width == b.width && a.height == b.height && a.rotation == b.rotation;
+}
+
+static inline uint qHash( const ImageCacheKey &key )
+{
+    return ::qHash( key.page ) ^ ::qHash( ( key.width << 16 ) ^ key.height ) ^ ( key.rotation << 30 );
+}
+
+// KiB of rendered images, and decoded pages, kept by default
+#define IMAGE_CACHE_SIZE 32768
+#define PAGE_CACHE_SIZE 8
+
+// the largest part of a page rendered at once, as djvulibre renders it
+// in a temporary pixmap first
+#define RENDER_PART_SIZE 1500
+
+static unsigned int s_formatmask[4] = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 };
+
+// the format of the rendered images, as QImage::Format_RGB32
+static ddjvu_format_t *createFormat()
+{
+#if DDJVUAPI_VERSION >= 18
+    ddjvu_format_t *format = ddjvu_format_create( DDJVU_FORMAT_RGBMASK32, 4, s_formatmask );
+#else
+    ddjvu_format_t *format = ddjvu_format_create( DDJVU_FORMAT_RGBMASK32, 3, s_formatmask );
+#endif
+    ddjvu_format_set_row_order( format, 1 );
+    ddjvu_format_set_y_direction( format, 1 );
+    return format;
+}
+
+/**
+ * Renders the \p rect part of \p djvupage scaled to \p width x \p height
+ * in \p buffer, which has lines of \p bytesPerLine bytes. The parts that
+ * can't be rendered are left white. Returns whether all the parts were
+ * rendered.
+ */
+static bool renderRect( ddjvu_context_t *ctx, ddjvu_page_t *djvupage, ddjvu_format_t *format,
+                        int width, int height, const QRect &rect, uchar *buffer, int bytesPerLine )
+{
+    ddjvu_rect_t pagerect;
+    pagerect.x = 0;
+    pagerect.y = 0;
+    pagerect.w = width;
+    pagerect.h = height;
+
+    bool ok = true;
+    for ( int y = rect.top(); y <= rect.bottom(); y += RENDER_PART_SIZE )
+    {
+        for ( int x = rect.left(); x <= rect.right(); x += RENDER_PART_SIZE )
+        {
+            ddjvu_rect_t renderrect;
+            renderrect.x = x;
+            renderrect.y = y;
+            renderrect.w = qMin( rect.right() + 1 - x, RENDER_PART_SIZE );
+            renderrect.h = qMin( rect.bottom() + 1 - y, RENDER_PART_SIZE );
+#ifdef KDJVU_DEBUG
+            qDebug() << "renderrect:" << renderrect;
+#endif
+            uchar *part = buffer + ( y - rect.top() ) * bytesPerLine + ( x - rect.left() ) * 4;
+
+            handle_ddjvu_messages( ctx, false );
+            // the following line workarounds a rare crash in djvulibre;
+            // it should be fixed with >= 3.5.21
+            ddjvu_page_get_width( djvupage );
+            const int res = ddjvu_page_render( djvupage, DDJVU_RENDER_COLOR,
+                          &pagerect, &renderrect, format, bytesPerLine, (char *)part );
+            if ( !res )
+            {
+                for ( unsigned int row = 0; row < renderrect.h; ++row )
+                    memset( part + row * bytesPerLine, 0xff, renderrect.w * 4 );
+                ok = false;
+            }
+#ifdef KDJVU_DEBUG
+            qDebug() << "rendering result:" << res;
+#endif
+            handle_ddjvu_messages( ctx, false );
+        }
+    }
+    return ok;
+}
+
 
 // KdjVu::Page
 
@@ -429,13 +511,15 @@ class KDjVu::Private
 {
     public:
         Private()
-          : m_djvu_cxt( 0 ), m_djvu_document( 0 ), m_format( 0 ), m_docBookmarks( 0 ),
-            m_cacheEnabled( true )
+          : m_djvu_cxt( 0 ), m_djvu_document( 0 ), m_format( 0 ), m_imageCache( IMAGE_CACHE_SIZE ),
+            m_pageCacheSize( PAGE_CACHE_SIZE ), m_docBookmarks( 0 ), m_cacheEnabled( true )
         {
         }
 
-        QImage generateImageTile( ddjvu_page_t *djvupage, int& res,
-            int width, int row, int xdelta, int height, int col, int ydelta );
+        ddjvu_page_t *djvuPage( int pageno );
+        void trimPageCache( int pageno );
+
+        bool render( int pageno, int width, int height, const QRect &rect, QImage *image );
 
         void readBookmarks();
         void fillBookmarksRecurse( QDomDocument& maindoc, QDomNode& curnode,
@@ -451,8 +535,10 @@ class KDjVu::Private
 
         QVector<KDjVu::Page*> m_pages;
         QVector<ddjvu_page_t *> m_pages_cache;
+        QList<int> m_cachedPages;   // the pages in m_pages_cache
 
-        QList<ImageCacheItem*> mImgCache;
+        QCache<ImageCacheKey, QImage> m_imageCache;
+        int m_pageCacheSize;
 
         QHash<QString, QVariant> m_metaData;
         QDomDocument * m_docBookmarks;
@@ -460,50 +546,47 @@ class KDjVu::Private
         QHash<QString, int> m_pageNamesCache;
 
         bool m_cacheEnabled;
-
-        static unsigned int s_formatmask[4];
 };
 
-unsigned int KDjVu::Private::s_formatmask[4] = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 };
+ddjvu_page_t *KDjVu::Private::djvuPage( int pageno )
+{
+    if ( !m_pages_cache.at( pageno ) )
+    {
+        ddjvu_page_t *newpage = ddjvu_page_create_by_pageno( m_djvu_document, pageno );
+        // wait for the new page to be loaded
+        ddjvu_status_t sts;
+        while ( ( sts = ddjvu_page_decoding_status( newpage ) ) < DDJVU_JOB_OK )
+            handle_ddjvu_messages( m_djvu_cxt, true );
+        m_pages_cache[pageno] = newpage;
+        m_cachedPages.append( pageno );
+        trimPageCache( pageno );
+    }
+    return m_pages_cache.at( pageno );
+}
 
-QImage KDjVu::Private::generateImageTile( ddjvu_page_t *djvupage, int& res,
-    int width, int row, int xdelta, int height, int col, int ydelta )
+void KDjVu::Private::trimPageCache( int pageno )
 {
-    ddjvu_rect_t renderrect;
-    renderrect.x = row * xdelta;
-    renderrect.y = col * ydelta;
-    int realwidth = qMin( width - renderrect.x, xdelta );
-    int realheight = qMin( height - renderrect.y, ydelta );
-    renderrect.w = realwidth;
-    renderrect.h = realheight;
-#ifdef KDJVU_DEBUG
-    qDebug() << "renderrect:" << renderrect;
-#endif
-    ddjvu_rect_t pagerect;
-    pagerect.x = 0;
-    pagerect.y = 0;
-    pagerect.w = width;
-    pagerect.h = height;
-#ifdef KDJVU_DEBUG
-    qDebug() << "pagerect:" << pagerect;
-#endif
-    handle_ddjvu_messages( m_djvu_cxt, false );
-    QImage res_img( realwidth, realheight, QImage::Format_RGB32 );
-    // the following line workarounds a rare crash in djvulibre;
-    // it should be fixed with >= 3.5.21
-    ddjvu_page_get_width( djvupage );
-    res = ddjvu_page_render( djvupage, DDJVU_RENDER_COLOR,
-                  &pagerect, &renderrect, m_format, res_img.bytesPerLine(), (char *)res_img.bits() );
-    if (!res)
+    // release the decoded pages farthest from the current one, the next
+    // ones to be rendered are likely its neighbours
+    while ( m_cachedPages.count() > qMax( 1, m_pageCacheSize ) )
     {
-        res_img.fill(Qt::white);
+        int farthest = 0;
+        for ( int i = 1; i < m_cachedPages.count(); ++i )
+        {
+            if ( qAbs( m_cachedPages.at( i ) - pageno ) > qAbs( m_cachedPages.at( farthest ) - pageno ) )
+                farthest = i;
+        }
+        const int page = m_cachedPages.takeAt( farthest );
+        ddjvu_page_release( m_pages_cache.at( page ) );
+        m_pages_cache[page] = 0;
     }
-#ifdef KDJVU_DEBUG
-    qDebug() << "rendering result:" << res;
-#endif
-    handle_ddjvu_messages( m_djvu_cxt, false );
+}
 
-    return res_img;
+bool KDjVu::Private::render( int pageno, int width, int height, const QRect &rect, QImage *image )
+{
+    // rendered in place in the lines of the image; djvulibre doesn't let
+    // several threads use the same context or decoded page at once
+    return renderRect( m_djvu_cxt, djvuPage( pageno ), m_format, width, height, rect, image->bits(), image->bytesPerLine() );
 }
 
 void KDjVu::Private::readBookmarks()
@@ -644,13 +727,7 @@ KDjVu::KDjVu() : d( new Private )
     // creating the djvu context
     d->m_djvu_cxt = ddjvu_context_create( "KDjVu" );
     // creating the rendering format
-#if DDJVUAPI_VERSION >= 18
-    d->m_format = ddjvu_format_create( DDJVU_FORMAT_RGBMASK32, 4, Private::s_formatmask );
-#else
-    d->m_format = ddjvu_format_create( DDJVU_FORMAT_RGBMASK32, 3, Private::s_formatmask );
-#endif
-    ddjvu_format_set_row_order( d->m_format, 1 );
-    ddjvu_format_set_y_direction( d->m_format, 1 );
+    d->m_format = createFormat();
 }
 
 
@@ -762,9 +839,9 @@ void KDjVu::closeFile()
     for ( ; it != itEnd; ++it )
         ddjvu_page_release( *it );
     d->m_pages_cache.clear();
+    d->m_cachedPages.clear();
     // clearing the image cache
-    qDeleteAll( d->mImgCache );
-    d->mImgCache.clear();
+    d->m_imageCache.clear();
     // clearing the old metadata
     d->m_metaData.clear();
     // cleaing the page names mapping
@@ -909,43 +986,16 @@ const QVector<KDjVu::Page*> &KDjVu::pages() const
     return d->m_pages;
 }
 
-QImage KDjVu::image( int page, int width, int height, int rotation )
+QImage KDjVu::image( int page, int width, int height, int rotation, const QRect &rect )
 {
-    if ( d->m_cacheEnabled )
+    // only the whole pages are cached, the tiles are kept by Okular
+    const bool cache = d->m_cacheEnabled && rect.isNull();
+    const ImageCacheKey key = { page, width, height, rotation };
+    if ( cache )
     {
-        bool found = false;
-        QList<ImageCacheItem*>::Iterator it = d->mImgCache.begin(), itEnd = d->mImgCache.end();
-        for ( ; ( it != itEnd ) && !found; ++it )
-        {
-            ImageCacheItem* cur = *it;
-            if ( ( cur->page == page ) &&
-                ( rotation % 2 == 0
-                ? cur->width == width && cur->height == height
-                : cur->width == height && cur->height == width ) )
-                found = true;
-        }
-        if ( found )
-        {
-            // taking the element and pushing to the top of the list
-            --it;
-            ImageCacheItem* cur2 = *it;
-            d->mImgCache.erase( it );
-            d->mImgCache.push_front( cur2 );
-
-            return cur2->img;
-        }
-    }
-
-    if ( !d->m_pages_cache.at( page ) )
-    {
-        ddjvu_page_t *newpage = ddjvu_page_create_by_pageno( d->m_djvu_document, page );
-        // wait for the new page to be loaded
-        ddjvu_status_t sts;
-        while ( ( sts = ddjvu_page_decoding_status( newpage ) ) < DDJVU_JOB_OK )
-            handle_ddjvu_messages( d->m_djvu_cxt, true );
-        d->m_pages_cache[page] = newpage;
+        if ( const QImage *img = d->m_imageCache.object( key ) )
+            return *img;
     }
-    ddjvu_page_t *djvupage = d->m_pages_cache[page];
 
 /*
     if ( ddjvu_page_get_rotation( djvupage ) != flipRotation( rotation ) )
@@ -956,75 +1006,15 @@ QImage KDjVu::image( int page, int width, int height, int rotation )
     }
 */
 
-    static const int xdelta = 1500;
-    static const int ydelta = 1500;
+    const QRect renderRect = rect.isNull() ? QRect( 0, 0, width, height ) : rect & QRect( 0, 0, width, height );
+    if ( renderRect.isEmpty() )
+        return QImage();
 
-    int xparts = width / xdelta + 1;
-    int yparts = height / ydelta + 1;
+    QImage newimg( renderRect.size(), QImage::Format_RGB32 );
+    const bool res = d->render( page, width, height, renderRect, &newimg );
 
-    QImage newimg;
-
-    int res = 10000;
-    if ( ( xparts == 1 ) && ( yparts == 1 ) )
-    {
-         // only one part -- render at once with no need to auxiliary image
-         newimg = d->generateImageTile( djvupage, res,
-                 width, 0, xdelta, height, 0, ydelta );
-    }
-    else
-    {
-        // more than one part -- need to render piece-by-piece and to compose
-        // the results
-        newimg = QImage( width, height, QImage::Format_RGB32 );
-        QPainter p;
-        p.begin( &newimg );
-        int parts = xparts * yparts;
-        for ( int i = 0; i < parts; ++i )
-        {
-            int row = i % xparts;
-            int col = i / xparts;
-            int tmpres = 0;
-            QImage tempp = d->generateImageTile( djvupage, tmpres,
-                    width, row, xdelta, height, col, ydelta );
-            if ( tmpres )
-            {
-                p.drawImage( row * xdelta, col * ydelta, tempp );
-            }
-            res = qMin( tmpres, res );
-        }
-        p.end();
-    }
-
-    if ( res && d->m_cacheEnabled )
-    {
-        // delete all the cached pixmaps for the current page with a size that
-        // differs no more than 35% of the new pixmap size
-        int imgsize = newimg.width() * newimg.height();
-        if ( imgsize > 0 )
-        {
-            for( int i = 0; i < d->mImgCache.count(); )
-            {
-                ImageCacheItem* cur = d->mImgCache.at(i);
-                if ( ( cur->page == page ) &&
-                     ( abs( cur->img.width() * cur->img.height() - imgsize ) < imgsize * 0.35 ) )
-                {
-                    d->mImgCache.removeAt( i );
-                    delete cur;
-                }
-                else
-                    ++i;
-            }
-        }
-
-        // the image cache has too many elements, remove the last
-        if ( d->mImgCache.size() >= 10 )
-        {
-            delete d->mImgCache.last();
-            d->mImgCache.removeLast();
-        }
-        ImageCacheItem* ich = new ImageCacheItem( page, width, height, newimg );
-        d->mImgCache.push_front( ich );
-    }
+    if ( res && cache )
+        d->m_imageCache.insert( key, new QImage( newimg ), newimg.byteCount() / 1024 + 1 );
 
     return newimg;
 }
@@ -1143,8 +1133,7 @@ void KDjVu::setCacheEnabled( bool enable )
     d->m_cacheEnabled = enable;
     if ( !d->m_cacheEnabled )
     {
-        qDeleteAll( d->mImgCache );
-        d->mImgCache.clear();
+        d->m_imageCache.clear();
     }
 }
 
@@ -1153,6 +1142,14 @@ bool KDjVu::isCacheEnabled() const
     return d->m_cacheEnabled;
 }
 
+void KDjVu::setCacheLimits( int imageCacheSize, int pageCacheSize )
+{
+    d->m_imageCache.setMaxCost( imageCacheSize );
+    d->m_pageCacheSize = pageCacheSize;
+    if ( !d->m_cachedPages.isEmpty() )
+        d->trimPageCache( d->m_cachedPages.last() );
+}
+
 int KDjVu::pageNumber( const QString & name ) const
 {
     if ( !d->m_djvu_document )
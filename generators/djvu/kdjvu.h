@@ -254,8 +254,10 @@ class KDjVu
          * Check if the image for the specified \p page with the specified
          * \p width, \p height and \p rotation is already in cache, and returns
          * it. If not, a null image is returned.
+         * If \p rect is not null, only that part of the page scaled at
+         * \p width x \p height is rendered, and it is not cached.
          */
-        QImage image( int page, int width, int height, int rotation );
+        QImage image( int page, int width, int height, int rotation, const QRect &rect = QRect() );
 
         /**
          * Export the currently open document as PostScript file \p fileName.
@@ -284,6 +286,13 @@ class KDjVu
          */
         bool isCacheEnabled() const;
 
+        /**
+         * Set the limits of the internal caches: the rendered pages take at
+         * most \p imageCacheSize KiB, and at most \p pageCacheSize decoded
+         * pages are kept, the nearest to the last rendered one.
+         */
+        void setCacheLimits( int imageCacheSize, int pageCacheSize );
+
         /**
          * Return the page number of the page whose title is \p name.
          */
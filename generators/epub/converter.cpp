@@ -346,14 +346,15 @@ QTextDocument* Converter::convert( const QString &fileName )
 
       _handle_anchors(before, link);
 
-      const int page = mTextDocument->pageCount();
+      // start the next section in a new page; a page break doesn't need the
+      // document to be laid out, unlike counting its pages
+      QTextBlockFormat pageBreak;
+      pageBreak.setPageBreakPolicy(QTextFormat::PageBreak_AlwaysAfter);
+      _cursor->insertBlock(pageBreak);
 
       // it will clear the previous format
       // useful when the last line had a bullet
       _cursor->insertBlock(QTextBlockFormat());
-
-      while(mTextDocument->pageCount() == page)
-        _cursor->insertText(QStringLiteral("\n"));
     }
   } while (epub_it_get_next(it));
 
@@ -398,9 +399,10 @@ QTextDocument* Converter::convert( const QString &fileName )
             }
 
             // Start new file in a new page
-            int page = mTextDocument->pageCount();
-            while(mTextDocument->pageCount() == page)
-              _cursor->insertText(QStringLiteral("\n"));
+            QTextBlockFormat pageBreak;
+            pageBreak.setPageBreakPolicy(QTextFormat::PageBreak_AlwaysAfter);
+            _cursor->insertBlock(pageBreak);
+            _cursor->insertBlock(QTextBlockFormat());
           }
 
           free(data);
@@ -24,6 +24,8 @@ FaxGenerator::FaxGenerator( QObject *parent, const QVariantList &args )
     : Generator( parent, args )
 {
     setFeature( Threaded );
+    // image() only reads the decoded m_img, so requests can be rendered in parallel
+    setFeature( ConcurrentRendering );
     setFeature( PrintNative );
     setFeature( PrintToFile );
 }
@@ -14,6 +14,7 @@
 #include <QBuffer>
 #include <QFile>
 #include <QImageReader>
+#include <QMutexLocker>
 #include <QPainter>
 #include <QPrinter>
 #include <QMimeType>
@@ -26,9 +27,14 @@
 #include <KLocalizedString>
 
 #include <kexiv2/kexiv2.h>
+#include <kexiv2/rotationmatrix.h>
 
 #include <core/page.h>
 
+// the biggest level, in pixels, kept decoded for the images that can be
+// decoded a region at a time
+#define LEVEL_MAX_PIXELS ( 4096 * 4096 )
+
 OKULAR_EXPORT_PLUGIN(KIMGIOGenerator, "libokularGenerator_kimgio.json")
 
 KIMGIOGenerator::KIMGIOGenerator( QObject *parent, const QVariantList &args )
@@ -36,6 +42,9 @@ KIMGIOGenerator::KIMGIOGenerator( QObject *parent, const QVariantList &args )
 {
     setFeature( ReadRawData );
     setFeature( Threaded );
+    // image() decodes from a buffer of its own and locks the levels, so
+    // requests can be rendered in parallel
+    setFeature( ConcurrentRendering );
     setFeature( TiledRendering );
     setFeature( PrintNative );
     setFeature( PrintToFile );
@@ -68,23 +77,48 @@ bool KIMGIOGenerator::loadDocumentInternal(const QByteArray & fileData, const QS
 
     QImageReader reader( &buffer, QImageReader::imageFormat( &buffer ) );
     reader.setAutoDetectImageFormat( true );
-    if ( !reader.read( &m_img ) ) {
+    if ( !reader.canRead() ) {
         emit error( i18n( "Unable to load document: %1", reader.errorString() ), -1 );
         return false;
     }
+
+    // only the header is read, unless the format can't tell the size otherwise
+    QSize size = reader.size();
+    if ( !size.isValid() ) {
+        QImage img;
+        if ( !reader.read( &img ) ) {
+            emit error( i18n( "Unable to load document: %1", reader.errorString() ), -1 );
+            return false;
+        }
+        size = img.size();
+    }
+    m_format = reader.format();
+    m_canClip = reader.supportsOption( QImageIOHandler::ClipRect );
+    m_data = fileData;
+
     QMimeDatabase db;
     auto mime = db.mimeTypeForFileNameAndData( fileName, fileData );
     docInfo.set( Okular::DocumentInfo::MimeType, mime.name() );
 
-    // Apply transformations dictated by Exif metadata
+    // Apply transformations dictated by Exif metadata, the same way
+    // KExiv2::rotateExifQImage() does
+    QTransform orientation;
     KExiv2Iface::KExiv2 exifMetadata;
     if ( exifMetadata.loadFromData( fileData ) ) {
-        exifMetadata.rotateExifQImage(m_img, exifMetadata.getImageOrientation());
+        orientation = QTransform( KExiv2Iface::RotationMatrix::toMatrix( exifMetadata.getImageOrientation() ) );
     }
+    m_orientation = QImage::trueMatrix( orientation, size.width(), size.height() );
+    m_unorientation = m_orientation.inverted();
+    m_size = m_orientation.mapRect( QRectF( QPointF( 0, 0 ), QSizeF( size ) ) ).size().toSize();
+
+    int levels = 1;
+    while ( ( m_size.width() >> levels ) > 0 && ( m_size.height() >> levels ) > 0 )
+        ++levels;
+    m_levels.resize( levels );
 
     pagesVector.resize( 1 );
 
-    Okular::Page * page = new Okular::Page( 0, m_img.width(), m_img.height(), Okular::Rotation0 );
+    Okular::Page * page = new Okular::Page( 0, m_size.width(), m_size.height(), Okular::Rotation0 );
     pagesVector[0] = page;
 
     return true;
@@ -92,7 +126,9 @@ bool KIMGIOGenerator::loadDocumentInternal(const QByteArray & fileData, const QS
 
 bool KIMGIOGenerator::doCloseDocument()
 {
-    m_img = QImage();
+    m_data.clear();
+    m_format.clear();
+    m_levels.clear();
 
     return true;
 }
@@ -102,41 +138,114 @@ QImage KIMGIOGenerator::image( Okular::PixmapRequest * request )
     // perform a smooth scaled generation
     if ( request->isTile() )
     {
-        const QRect srcRect = request->normalizedRect().geometry( m_img.width(), m_img.height() );
+        const QRect srcRect = request->normalizedRect().geometry( m_size.width(), m_size.height() );
         const QRect destRect = request->normalizedRect().geometry( request->width(), request->height() );
 
         QImage destImg( destRect.size(), QImage::Format_RGB32 );
         destImg.fill( Qt::white );
 
         QPainter p( &destImg );
-        p.setRenderHint( QPainter::SmoothPixmapTransform );
-        p.drawImage( destImg.rect(), m_img, srcRect );
+        p.drawImage( 0, 0, region( srcRect, destRect.size() ) );
 
         return destImg;
     }
     else
     {
-        int width = request->width();
-        int height = request->height();
-        if ( request->page()->rotation() % 2 == 1 )
-            qSwap( width, height );
+        return region( QRect( QPoint( 0, 0 ), m_size ), QSize( request->width(), request->height() ) );
+    }
+}
+
+QImage KIMGIOGenerator::region( const QRect & rect, const QSize & size )
+{
+    if ( rect.isEmpty() || size.isEmpty() )
+        return QImage();
+
+    // the smallest level still as big as the request
+    const double scale = qMax( (double)size.width() / rect.width(), (double)size.height() / rect.height() );
+    int index = 0;
+    while ( index + 1 < m_levels.count() && ( m_size.width() >> ( index + 1 ) ) >= scale * m_size.width()
+            && ( m_size.height() >> ( index + 1 ) ) >= scale * m_size.height() )
+        ++index;
+
+    // a region can be decoded on its own, and scaled down by the decoder,
+    // for less than what keeping the bigger levels would cost
+    const qint64 levelPixels = (qint64)( m_size.width() >> index ) * ( m_size.height() >> index );
+    if ( m_canClip && ( index == 0 || levelPixels > LEVEL_MAX_PIXELS ) )
+        return decode( rect, size );
+
+    QImage image;
+    {
+        QMutexLocker locker( &m_levelsMutex );
+        image = level( index );
+    }
+
+    const QRectF levelRect( rect.x() * (double)image.width() / m_size.width(), rect.y() * (double)image.height() / m_size.height(),
+                            rect.width() * (double)image.width() / m_size.width(), rect.height() * (double)image.height() / m_size.height() );
+    if ( levelRect == QRectF( image.rect() ) && size == image.size() )
+        return image;
+
+    // less than halving the level, a smooth transformation doesn't skip pixels
+    QImage result( size, QImage::Format_ARGB32_Premultiplied );
+    result.fill( Qt::transparent );
+    QPainter p( &result );
+    p.setRenderHint( QPainter::SmoothPixmapTransform );
+    p.drawImage( QRectF( result.rect() ), image, levelRect );
+    return result;
+}
+
+QImage KIMGIOGenerator::level( int index )
+{
+    if ( m_levels[index].isNull() )
+    {
+        const QSize size( m_size.width() >> index, m_size.height() >> index );
+
+        // shrink the closest bigger level already decoded, if any
+        int bigger = index - 1;
+        while ( bigger >= 0 && m_levels[bigger].isNull() )
+            --bigger;
 
-        return m_img.scaled( width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+        if ( bigger >= 0 )
+            m_levels[index] = m_levels[bigger].scaled( size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+        else
+            m_levels[index] = decode( QRect( QPoint( 0, 0 ), m_size ), size );
     }
+    return m_levels[index];
+}
+
+QImage KIMGIOGenerator::decode( const QRect & rect, const QSize & size ) const
+{
+    QBuffer buffer;
+    buffer.setData( m_data );
+    buffer.open( QIODevice::ReadOnly );
+
+    QImageReader reader( &buffer, m_format );
+
+    // the reader works on the image as stored; it scales the region itself,
+    // or decodes the whole image and scales it when it can't
+    if ( rect != QRect( QPoint( 0, 0 ), m_size ) )
+        reader.setClipRect( m_unorientation.mapRect( QRectF( rect ) ).toRect() );
+    reader.setScaledSize( m_unorientation.mapRect( QRectF( QPointF( 0, 0 ), QSizeF( size ) ) ).size().toSize() );
+
+    QImage image;
+    if ( !reader.read( &image ) )
+        return QImage();
+
+    if ( !m_orientation.isIdentity() )
+        image = image.transformed( m_orientation );
+    return image;
 }
 
 bool KIMGIOGenerator::print( QPrinter& printer )
 {
     QPainter p( &printer );
 
-    QImage image( m_img );
+    QSize size = m_size;
 
-    if ( ( image.width() > printer.width() ) || ( image.height() > printer.height() ) )
+    if ( ( size.width() > printer.width() ) || ( size.height() > printer.height() ) )
 
-        image = image.scaled( printer.width(), printer.height(),
-                              Qt::KeepAspectRatio, Qt::SmoothTransformation );
+        size.scale( printer.width(), printer.height(), Qt::KeepAspectRatio );
 
-    p.drawImage( 0, 0, image );
+    p.drawImage( 0, 0, region( QRect( QPoint( 0, 0 ), m_size ), size ) );
 
     return true;
 }
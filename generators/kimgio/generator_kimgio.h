@@ -13,7 +13,10 @@
 #include <core/generator.h>
 #include <core/document.h>
 
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
 #include <QtGui/QImage>
+#include <QtGui/QTransform>
 
 class KIMGIOGenerator : public Okular::Generator
 {
@@ -41,8 +44,26 @@ class KIMGIOGenerator : public Okular::Generator
     private:
         bool loadDocumentInternal(const QByteArray & fileData, const QString & fileName,
                                   QVector<Okular::Page*> & pagesVector );
+        // the @p rect of the image, as shown, scaled to @p size
+        QImage region( const QRect & rect, const QSize & size );
+        QImage level( int index );
+        QImage decode( const QRect & rect, const QSize & size ) const;
+
     private:
-        QImage m_img;
+        // the image is decoded from its data for every request, so only
+        // what is shown is kept in memory
+        QByteArray m_data;
+        QByteArray m_format;
+        bool m_canClip;
+        // the size of the image as shown, once the Exif orientation is applied
+        QSize m_size;
+        // maps the decoded image to the one shown, and back
+        QTransform m_orientation;
+        QTransform m_unorientation;
+        // the image shown at half the size of the previous one, starting from
+        // the full one; decoded when first needed
+        QVector<QImage> m_levels;
+        QMutex m_levelsMutex;
         Okular::DocumentInfo docInfo;
 };
 
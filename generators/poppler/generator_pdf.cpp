@@ -512,6 +512,8 @@ PDFGenerator::PDFGenerator( QObject *parent, const QVariantList &args )
         setFeature( PrintToFile );
     setFeature( ReadRawData );
     setFeature( TiledRendering );
+    // poppler is only asked for the text boxes with the user mutex locked
+    setFeature( ConcurrentTextExtraction );
 
     // You only need to do it once not for each of the documents but it is cheap enough
     // so doing it all the time won't hurt either
@@ -15,6 +15,7 @@
 #include <qfileinfo.h>
 #include <qimage.h>
 #include <qlist.h>
+#include <qmath.h>
 #include <qpainter.h>
 #include <QtPrintSupport/QPrinter>
 
@@ -32,6 +33,9 @@
 
 #define TiffDebug 4714
 
+// the most pixels decoded at once while reading a region scaled down
+#define BAND_PIXELS ( 4 * 1024 * 1024 )
+
 tsize_t okular_tiffReadProc( thandle_t handle, tdata_t buf, tsize_t size )
 {
     QIODevice * device = static_cast< QIODevice * >( handle );
@@ -91,9 +95,19 @@ class TIFFGenerator::Private
         Private()
           : tiff( 0 ), dev( 0 ) {}
 
+        // an image of a page, at full or at reduced resolution
+        struct Level
+        {
+            toff_t offset;  // of its directory
+            uint32 width;
+            uint32 height;
+        };
+
         TIFF* tiff;
         QByteArray data;
         QIODevice* dev;
+        // the images of each page, the full resolution one first
+        QVector< QVector< Level > > levels;
 };
 
 static QDateTime convertTIFFDateTime( const char* tiffdate )
@@ -157,6 +171,136 @@ static Okular::Rotation readTiffRotation( TIFF *tiff )
     return ret;
 }
 
+// an image read by libtiff is ABGR, we need ARGB, so swap red and blue
+static void swapRedBlue( uint32 *data, uint32 size )
+{
+    for ( uint32 i = 0; i < size; ++i )
+    {
+        uint32 red = ( data[i] & 0x00FF0000 ) >> 16;
+        uint32 blue = ( data[i] & 0x000000FF ) << 16;
+        data[i] = ( data[i] & 0xFF00FF00 ) + red + blue;
+    }
+}
+
+/**
+ * Reads the @p window of the image of @p rgba scaled down to @p size.
+ *
+ * The window is decoded a band of rows at a time, and each pixel of the
+ * result is the average of the pixels it covers, so that the memory used
+ * depends on the result and not on the window.
+ */
+static QImage readRegionScaled( TIFF *tiff, TIFFRGBAImage *rgba, const QRect &window, const QSize &size )
+{
+    // decode whole strips or rows of tiles at a time, libtiff decodes
+    // them from their start on every read
+    uint32 unit = 0;
+    if ( TIFFIsTiled( tiff ) )
+        TIFFGetField( tiff, TIFFTAG_TILELENGTH, &unit );
+    else
+        TIFFGetFieldDefaulted( tiff, TIFFTAG_ROWSPERSTRIP, &unit );
+    int bandRows = window.height();
+    if ( unit > 0 && unit < (uint32)window.height() )
+        bandRows = qMax( 1, BAND_PIXELS / window.width() / (int)unit ) * unit;
+
+    QVector< uint32 > band( window.width() * bandRows );
+
+    // the first column of the window each column of the result starts at
+    QVector< int > columns( size.width() + 1 );
+    for ( int x = 0; x <= size.width(); ++x )
+        columns[ x ] = (qint64)x * window.width() / size.width();
+
+    QImage result( size, QImage::Format_RGB32 );
+    QVector< quint64 > sums( size.width() * 3, 0 );
+    int resultRow = 0;
+    int firstRow = window.top();
+    int endRow = window.top() + window.height() / size.height();
+
+    int y = window.top();
+    while ( y <= window.bottom() )
+    {
+        const int bandEnd = bandRows == window.height() ? window.bottom() + 1 : qMin( window.bottom() + 1, ( y / bandRows + 1 ) * bandRows );
+        const int rows = bandEnd - y;
+        rgba->row_offset = y;
+        if ( !TIFFRGBAImageGet( rgba, band.data(), window.width(), rows ) )
+            return QImage();
+
+        for ( int row = 0; row < rows; ++row, ++y )
+        {
+            const uint32 *pixels = band.constData() + row * window.width();
+            quint64 *sum = sums.data();
+            for ( int x = 0; x < size.width(); ++x, sum += 3 )
+            {
+                for ( int i = columns.at( x ); i < columns.at( x + 1 ); ++i )
+                {
+                    sum[0] += TIFFGetR( pixels[i] );
+                    sum[1] += TIFFGetG( pixels[i] );
+                    sum[2] += TIFFGetB( pixels[i] );
+                }
+            }
+
+            if ( y + 1 < endRow )
+                continue;
+
+            // the last row of the window this row of the result covers
+            QRgb *line = reinterpret_cast< QRgb * >( result.scanLine( resultRow ) );
+            sum = sums.data();
+            for ( int x = 0; x < size.width(); ++x, sum += 3 )
+            {
+                const quint64 area = (quint64)( columns.at( x + 1 ) - columns.at( x ) ) * ( endRow - firstRow );
+                line[x] = qRgb( sum[0] / area, sum[1] / area, sum[2] / area );
+            }
+            sums.fill( 0 );
+
+            ++resultRow;
+            firstRow = endRow;
+            endRow = window.top() + (qint64)( resultRow + 1 ) * window.height() / size.height();
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Reads the @p window of the current directory of @p tiff, in the
+ * orientation its pixels are stored in, at @p size.
+ */
+static QImage readRegion( TIFF *tiff, const QRect &window, const QSize &size )
+{
+    char emsg[1024];
+    TIFFRGBAImage rgba;
+    if ( !TIFFRGBAImageOK( tiff, emsg ) || !TIFFRGBAImageBegin( &rgba, tiff, 0, emsg ) )
+    {
+        qCDebug(OkularTiffDebug) << "Cannot read the image:" << emsg;
+        return QImage();
+    }
+
+    rgba.req_orientation = rgba.orientation;
+    rgba.col_offset = window.left();
+
+    QImage result;
+    if ( size.width() < window.width() && size.height() < window.height() )
+    {
+        result = readRegionScaled( tiff, &rgba, window, size );
+    }
+    else
+    {
+        // the window is not bigger than the result, read it all
+        QImage image( window.size(), QImage::Format_RGB32 );
+        rgba.row_offset = window.top();
+        if ( TIFFRGBAImageGet( &rgba, (uint32 *)image.bits(), window.width(), window.height() ) )
+        {
+            swapRedBlue( (uint32 *)image.bits(), window.width() * window.height() );
+            if ( image.size() == size )
+                result = image;
+            else
+                result = image.scaled( size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+        }
+    }
+
+    TIFFRGBAImageEnd( &rgba );
+    return result;
+}
+
 OKULAR_EXPORT_PLUGIN(TIFFGenerator, "libokularGenerator_tiff.json")
 
 TIFFGenerator::TIFFGenerator( QObject *parent, const QVariantList &args )
@@ -164,6 +308,7 @@ TIFFGenerator::TIFFGenerator( QObject *parent, const QVariantList &args )
       d( new Private )
 {
     setFeature( Threaded );
+    setFeature( TiledRendering );
     setFeature( PrintNative );
     setFeature( PrintToFile );
     setFeature( ReadRawData );
@@ -227,6 +372,7 @@ bool TIFFGenerator::doCloseDocument()
         delete d->dev;
         d->dev = 0;
         d->data.clear();
+        d->levels.clear();
         m_pageMapping.clear();
     }
 
@@ -235,49 +381,40 @@ bool TIFFGenerator::doCloseDocument()
 
 QImage TIFFGenerator::image( Okular::PixmapRequest * request )
 {
-    bool generated = false;
+    const int pageNumber = request->page()->number();
+    const QRect rect = request->isTile() ? request->normalizedRect().geometry( request->width(), request->height() ) : QRect( 0, 0, request->width(), request->height() );
     QImage img;
 
-    if ( TIFFSetDirectory( d->tiff, mapPage( request->page()->number() ) ) )
+    if ( pageNumber < d->levels.count() && !d->levels.at( pageNumber ).isEmpty() )
     {
-        int rotation = request->page()->rotation();
-        uint32 width = 1;
-        uint32 height = 1;
-        uint32 orientation = 0;
-        TIFFGetField( d->tiff, TIFFTAG_IMAGEWIDTH, &width );
-        TIFFGetField( d->tiff, TIFFTAG_IMAGELENGTH, &height );
-
-        if ( !TIFFGetField( d->tiff, TIFFTAG_ORIENTATION, &orientation ) )
-            orientation = ORIENTATION_TOPLEFT;
-
-        QImage image( width, height, QImage::Format_RGB32 );
-        uint32 * data = (uint32 *)image.bits();
-
-        // read data
-        if ( TIFFReadRGBAImageOriented( d->tiff, width, height, data, orientation ) != 0 )
+        // the smallest image of the page at least as big as requested
+        const QVector< Private::Level > &levels = d->levels.at( pageNumber );
+        Private::Level level = levels.first();
+        foreach ( const Private::Level &candidate, levels )
         {
-            // an image read by ReadRGBAImage is ABGR, we need ARGB, so swap red and blue
-            uint32 size = width * height;
-            for ( uint32 i = 0; i < size; ++i )
-            {
-                uint32 red = ( data[i] & 0x00FF0000 ) >> 16;
-                uint32 blue = ( data[i] & 0x000000FF ) << 16;
-                data[i] = ( data[i] & 0xFF00FF00 ) + red + blue;
-            }
-
-            int reqwidth = request->width();
-            int reqheight = request->height();
-            if ( rotation % 2 == 1 )
-                qSwap( reqwidth, reqheight );
-            img = image.scaled( reqwidth, reqheight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
+            if ( candidate.width >= (uint32)request->width() && candidate.height >= (uint32)request->height() && candidate.width < level.width )
+                level = candidate;
+        }
 
-            generated = true;
+        if ( TIFFSetSubDirectory( d->tiff, level.offset ) )
+        {
+            // the pixels of the image under the requested rect
+            const double scaleX = (double)level.width / request->width();
+            const double scaleY = (double)level.height / request->height();
+            const int left = qFloor( rect.left() * scaleX );
+            const int top = qFloor( rect.top() * scaleY );
+            const int right = qCeil( ( rect.right() + 1 ) * scaleX );
+            const int bottom = qCeil( ( rect.bottom() + 1 ) * scaleY );
+            const QRect window = QRect( left, top, right - left, bottom - top ) & QRect( 0, 0, level.width, level.height );
+
+            if ( !window.isEmpty() )
+                img = readRegion( d->tiff, window, rect.size() );
         }
     }
 
-    if ( !generated )
+    if ( img.isNull() )
     {
-        img = QImage( request->width(), request->height(), QImage::Format_RGB32 );
+        img = QImage( rect.size(), QImage::Format_RGB32 );
         img.fill( qRgb( 255, 255, 255 ) );
     }
 
@@ -339,6 +476,7 @@ void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
 
     tdir_t dirs = TIFFNumberOfDirectories( d->tiff );
     pagesVector.resize( dirs );
+    d->levels.resize( dirs );
     tdir_t realdirs = 0;
 
     uint32 width = 0;
@@ -354,6 +492,21 @@ void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
              TIFFGetField( d->tiff, TIFFTAG_IMAGELENGTH, &height ) != 1 )
             continue;
 
+        Private::Level level;
+        level.offset = TIFFCurrentDirOffset( d->tiff );
+        level.width = width;
+        level.height = height;
+
+        // a reduced resolution version of the previous page is not a page
+        uint32 subfileType = 0;
+        TIFFGetField( d->tiff, TIFFTAG_SUBFILETYPE, &subfileType );
+        if ( ( subfileType & FILETYPE_REDUCEDIMAGE ) && realdirs > 0 )
+        {
+            d->levels[ realdirs - 1 ].append( level );
+            continue;
+        }
+        d->levels[ realdirs ].append( level );
+
         adaptSizeToResolution( d->tiff, TIFFTAG_XRESOLUTION, dpi.width(), &width );
         adaptSizeToResolution( d->tiff, TIFFTAG_YRESOLUTION, dpi.height(), &height );
 
@@ -362,10 +515,34 @@ void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
 
         m_pageMapping[ realdirs ] = i;
 
+        // the reduced resolution versions stored as its subdirectories
+        uint16 subIfdCount = 0;
+        toff_t *subIfdOffsets = 0;
+        if ( TIFFGetField( d->tiff, TIFFTAG_SUBIFD, &subIfdCount, &subIfdOffsets ) )
+        {
+            // the offsets go away with the directory
+            QVector< toff_t > offsets( subIfdCount );
+            for ( int j = 0; j < subIfdCount; ++j )
+                offsets[ j ] = subIfdOffsets[ j ];
+            foreach ( toff_t offset, offsets )
+            {
+                uint32 subfileType = 0;
+                if ( !TIFFSetSubDirectory( d->tiff, offset ) ||
+                     !TIFFGetField( d->tiff, TIFFTAG_SUBFILETYPE, &subfileType ) || !( subfileType & FILETYPE_REDUCEDIMAGE ) ||
+                     TIFFGetField( d->tiff, TIFFTAG_IMAGEWIDTH, &level.width ) != 1 ||
+                     TIFFGetField( d->tiff, TIFFTAG_IMAGELENGTH, &level.height ) != 1 )
+                    continue;
+
+                level.offset = offset;
+                d->levels[ realdirs ].append( level );
+            }
+        }
+
         ++realdirs;
     }
 
     pagesVector.resize( realdirs );
+    d->levels.resize( realdirs );
 }
 
 bool TIFFGenerator::print( QPrinter& printer )
@@ -393,16 +570,7 @@ bool TIFFGenerator::print( QPrinter& printer )
 
         // read data
         if ( TIFFReadRGBAImageOriented( d->tiff, width, height, data, ORIENTATION_TOPLEFT ) != 0 )
-        {
-            // an image read by ReadRGBAImage is ABGR, we need ARGB, so swap red and blue
-            uint32 size = width * height;
-            for ( uint32 i = 0; i < size; ++i )
-            {
-                uint32 red = ( data[i] & 0x00FF0000 ) >> 16;
-                uint32 blue = ( data[i] & 0x000000FF ) << 16;
-                data[i] = ( data[i] & 0xFF00FF00 ) + red + blue;
-            }
-        }
+            swapRedBlue( data, width * height );
 
         if ( i != 0 )
             printer.newPage();
@@ -30,6 +30,7 @@
 #include <QBuffer>
 #include <QImageReader>
 #include <QMutex>
+#include <QScopedPointer>
 
 #include <core/document.h>
 #include <core/page.h>
@@ -38,6 +39,11 @@
 
 OKULAR_EXPORT_PLUGIN(XpsGenerator, "libokularGenerator_xps.json")
 
+// how much the parsed pages can take, in kilobytes
+#define SCENE_CACHE_COST ( 32 * 1024 )
+// how much the decoded images can take, in kilobytes
+#define IMAGE_CACHE_COST ( 64 * 1024 )
+
 Q_DECLARE_METATYPE( QGradient* )
 Q_DECLARE_METATYPE( XpsPathFigure* )
 Q_DECLARE_METATYPE( XpsPathGeometry* )
@@ -523,6 +529,51 @@ static QByteArray readFileOrDirectoryParts( const KArchiveEntry *entry, QString
     return data;
 }
 
+/**
+   Read the size of the FixedPage in \p entry, in the same cases of
+   readFileOrDirectoryParts(). Only the data up to the FixedPage element is
+   decompressed.
+*/
+static QSizeF readFixedPageSize( const KArchiveEntry *entry )
+{
+    QList<const KZipFileEntry *> files;
+    if ( entry->isDirectory() ) {
+        const KArchiveDirectory* relDir = static_cast<const KArchiveDirectory *>( entry );
+        QStringList entries = relDir->entries();
+        qSort( entries );
+        Q_FOREACH ( const QString &entry, entries ) {
+            const KArchiveEntry* relSubEntry = relDir->entry( entry );
+            if ( relSubEntry->isFile() )
+                files.append( static_cast<const KZipFileEntry *>( relSubEntry ) );
+        }
+    } else {
+        files.append( static_cast<const KZipFileEntry *>( entry ) );
+    }
+
+    QXmlStreamReader xml;
+    Q_FOREACH ( const KZipFileEntry *file, files ) {
+        QScopedPointer<QIODevice> device( file->createDevice() );
+        while ( !device->atEnd() ) {
+            xml.addData( device->read( 4096 ) );
+            while ( !xml.atEnd() ) {
+                xml.readNext();
+                if ( xml.isStartElement() && ( xml.name() == QStringLiteral("FixedPage") ) ) {
+                    QXmlStreamAttributes attributes = xml.attributes();
+                    return QSizeF( attributes.value( QStringLiteral("Width") ).toString().toDouble(),
+                                   attributes.value( QStringLiteral("Height") ).toString().toDouble() );
+                }
+            }
+            if ( xml.error() != QXmlStreamReader::PrematureEndOfDocumentError ) {
+                if ( xml.hasError() ) {
+                    qCWarning(OkularXpsDebug) << "Could not parse XPS page:" << xml.errorString();
+                }
+                return QSizeF();
+            }
+        }
+    }
+    return QSizeF();
+}
+
 /**
    Load the resource \p fileName from the specified \p archive using the case sensitivity \p cs
 */
@@ -562,7 +613,7 @@ static const KArchiveEntry* loadEntry( KZip *archive, const QString &fileName, Q
 static const KZipFileEntry* loadFile( KZip *archive, const QString &fileName, Qt::CaseSensitivity cs )
 {
     const KArchiveEntry *entry = loadEntry( archive, fileName, cs );
-    return entry->isFile() ? static_cast< const KZipFileEntry * >( entry ) : 0;
+    return entry && entry->isFile() ? static_cast< const KZipFileEntry * >( entry ) : 0;
 }
 
 /**
@@ -719,10 +770,219 @@ static QString unicodeString( const QString &raw )
     return ret;
 }
 
+XpsPageScene::XpsPageScene()
+    : m_cost( 0 )
+{
+}
+
+void XpsPageScene::appendStep( Operation operation, int index )
+{
+    Step step;
+    step.operation = operation;
+    step.index = index;
+    m_steps.append( step );
+    m_cost += sizeof( Step );
+}
+
+void XpsPageScene::save()
+{
+    appendStep( SaveOperation, -1 );
+}
+
+void XpsPageScene::restore()
+{
+    appendStep( RestoreOperation, -1 );
+}
+
+void XpsPageScene::transform( const QTransform &transform )
+{
+    appendStep( TransformOperation, m_transforms.count() );
+    m_transforms.append( transform );
+    m_cost += sizeof( QTransform );
+}
+
+void XpsPageScene::multiplyOpacity( double opacity )
+{
+    appendStep( OpacityOperation, m_opacities.count() );
+    m_opacities.append( opacity );
+    m_cost += sizeof( double );
+}
+
+void XpsPageScene::addPath( const XpsPathItem &path )
+{
+    appendStep( PathOperation, m_paths.count() );
+    m_paths.append( path );
+    m_cost += sizeof( XpsPathItem );
+    Q_FOREACH ( const XpsPathFigure &figure, path.figures ) {
+        m_cost += figure.path.elementCount() * sizeof( QPainterPath::Element );
+    }
+    addImageCost( path.brush );
+    addImageCost( path.pen.brush() );
+}
+
+void XpsPageScene::addGlyphs( const XpsGlyphsItem &glyphs )
+{
+    appendStep( GlyphsOperation, m_glyphs.count() );
+    m_glyphs.append( glyphs );
+    m_cost += sizeof( XpsGlyphsItem ) + glyphs.text.size() * ( sizeof( QChar ) + sizeof( qreal ) );
+    addImageCost( glyphs.brush );
+}
+
+void XpsPageScene::addImageCost( const QBrush &brush )
+{
+    // the images are shared with the other scenes using them, and with the
+    // image cache of the file; they count once here as this scene keeps them
+    if ( brush.style() != Qt::TexturePattern ) {
+        return;
+    }
+    const QImage image = brush.textureImage();
+    if ( !image.isNull() && !m_images.contains( image.cacheKey() ) ) {
+        m_images.insert( image.cacheKey() );
+        m_cost += image.byteCount();
+    }
+}
+
+int XpsPageScene::cost() const
+{
+    return m_cost / 1024 + 1;
+}
+
+void XpsPageScene::paint( QPainter *painter ) const
+{
+    Q_FOREACH ( const Step &step, m_steps ) {
+        switch ( step.operation ) {
+            case SaveOperation:
+                painter->save();
+                break;
+            case RestoreOperation:
+                painter->restore();
+                break;
+            case TransformOperation:
+                painter->setWorldTransform( m_transforms.at( step.index ), true );
+                break;
+            case OpacityOperation:
+                painter->setOpacity( painter->opacity() * m_opacities.at( step.index ) );
+                break;
+            case PathOperation: {
+                const XpsPathItem &path = m_paths.at( step.index );
+                painter->save();
+                painter->setPen( path.pen );
+                if ( path.opacity >= 0.0 ) {
+                    painter->setOpacity( path.opacity );
+                }
+                if ( !path.transform.isIdentity() ) {
+                    painter->setWorldTransform( path.transform, true );
+                }
+                Q_FOREACH ( const XpsPathFigure &figure, path.figures ) {
+                    painter->setBrush( figure.isFilled ? path.brush : QBrush() );
+                    painter->drawPath( figure.path );
+                }
+                painter->restore();
+                break;
+            }
+            case GlyphsOperation: {
+                const XpsGlyphsItem &glyphs = m_glyphs.at( step.index );
+                if ( !glyphs.visible ) {
+                    break;
+                }
+                painter->save();
+                painter->setFont( glyphs.font );
+                painter->setBrush( glyphs.brush );
+                painter->setPen( QPen( glyphs.brush, 0 ) );
+                if ( glyphs.opacity >= 0.0 ) {
+                    painter->setOpacity( glyphs.opacity );
+                }
+                if ( !glyphs.transform.isIdentity() ) {
+                    painter->setWorldTransform( glyphs.transform, true );
+                }
+                if ( !glyphs.clip.isEmpty() ) {
+                    painter->setClipPath( glyphs.clip );
+                }
+                painter->setLayoutDirection( glyphs.direction );
+
+                QPointF originAdvance(0, 0);
+                QFontMetrics metrics = painter->fontMetrics();
+                for ( int i = 0; i < glyphs.text.size(); ++i ) {
+                    QChar thisChar = glyphs.text.at( i );
+                    painter->drawText( glyphs.origin + originAdvance, QString( thisChar ) );
+                    const qreal advanceWidth = glyphs.advanceWidths.value( i, qreal(-1.0) );
+                    if ( advanceWidth > 0.0 ) {
+                        originAdvance.rx() += advanceWidth;
+                    } else {
+                        originAdvance.rx() += metrics.width( thisChar );
+                    }
+                }
+                painter->restore();
+                break;
+            }
+        }
+    }
+}
+
+Okular::TextPage* XpsPageScene::textPage( XpsFile *file, const QSizeF &pageSize ) const
+{
+    Okular::TextPage* textPage = new Okular::TextPage();
+
+    QTransform matrix = QTransform();
+    QStack<QTransform> matrices;
+
+    Q_FOREACH ( const Step &step, m_steps ) {
+        if ( step.operation == SaveOperation ) {
+            matrices.push( matrix );
+        } else if ( step.operation == RestoreOperation ) {
+            if ( !matrices.isEmpty() ) {
+                matrix = matrices.pop();
+            }
+        } else if ( step.operation == TransformOperation ) {
+            matrix = m_transforms.at( step.index ) * matrix;
+        } else if ( step.operation == GlyphsOperation ) {
+            const XpsGlyphsItem &glyphs = m_glyphs.at( step.index );
+            const QTransform glyphsMatrix = glyphs.transform * matrix;
+
+            // Get font (doesn't work well because qt doesn't allow to load font from file)
+            QFont font = file->getFontByName( glyphs.fontUri, glyphs.fontSize * 72 / 96 );
+            QFontMetrics metrics = QFontMetrics( font );
+
+            int lastWidth = 0;
+            for (int i = 0; i < glyphs.text.length(); i++) {
+                int width = metrics.width( glyphs.text, i + 1 );
+
+                Okular::NormalizedRect * rect = new Okular::NormalizedRect( (glyphs.origin.x() + lastWidth) / pageSize.width(),
+                                                                            (glyphs.origin.y() - metrics.height()) / pageSize.height(),
+                                                                            (glyphs.origin.x() + width) / pageSize.width(),
+                                                                            glyphs.origin.y() / pageSize.height() );
+                rect->transform( glyphsMatrix );
+                textPage->append( glyphs.text.mid(i, 1), rect );
+
+                lastWidth = width;
+            }
+        }
+    }
+
+    return textPage;
+}
+
+/**
+   \return The transform of an element, given either by its RenderTransform
+   attribute or by its \p childName child element
+*/
+static QTransform renderTransform( XpsRenderNode &node, const QString &childName )
+{
+    QTransform transform;
+    QVariant data = node.getChildData( childName );
+    if ( data.canConvert<QTransform>() ) {
+        transform = data.value<QTransform>();
+    }
+    const QString att = node.attributes.value( QStringLiteral("RenderTransform") );
+    if ( !att.isEmpty() ) {
+        transform = parseRscRefMatrix( att ) * transform;
+    }
+    return transform;
+}
 
 XpsHandler::XpsHandler(XpsPage *page): m_page(page)
 {
-    m_painter = NULL;
+    m_scene = NULL;
 }
 
 XpsHandler::~XpsHandler()
@@ -782,22 +1042,30 @@ void XpsHandler::processGlyph( XpsRenderNode &node )
     //TODO Currently ignored attributes: CaretStops, DeviceFontName, IsSideways, OpacityMask, Name, FixedPage.NavigateURI, xml:lang, x:key
     //TODO Indices is only partially implemented
     //TODO Currently ignored child elements: Clip, OpacityMask
-    //Handled separately: RenderTransform
 
     QString att;
+    XpsGlyphsItem glyphs;
 
-    m_painter->save();
+    // The text is kept even when it isn't painted, for the text extraction
+    glyphs.fontUri = node.attributes.value(QStringLiteral("FontUri"));
+    glyphs.fontSize = node.attributes.value(QStringLiteral("FontRenderingEmSize")).toFloat();
+    glyphs.text = unicodeString( node.attributes.value( QStringLiteral("UnicodeString") ) );
+
+    //Origin
+    glyphs.origin = QPointF( node.attributes.value(QStringLiteral("OriginX")).toDouble(), node.attributes.value(QStringLiteral("OriginY")).toDouble() );
+
+    //RenderTransform
+    glyphs.transform = renderTransform( node, QStringLiteral("Glyphs.RenderTransform") );
 
     // Get font (doesn't work well because qt doesn't allow to load font from file)
     // This works despite the fact that font size isn't specified in points as required by qt. It's because I set point size to be equal to drawing unit.
-    float fontSize = node.attributes.value(QStringLiteral("FontRenderingEmSize")).toFloat();
-    // qCWarning(OkularXpsDebug) << "Font Rendering EmSize:" << fontSize;
+    // qCWarning(OkularXpsDebug) << "Font Rendering EmSize:" << glyphs.fontSize;
     // a value of 0.0 means the text is not visible (see XPS specs, chapter 12, "Glyphs")
-    if ( fontSize < 0.1 ) {
-        m_painter->restore();
+    if ( glyphs.fontSize < 0.1 ) {
+        m_scene->addGlyphs( glyphs );
         return;
     }
-    QFont font = m_page->m_file->getFontByName( node.attributes.value(QStringLiteral("FontUri")), fontSize );
+    QFont font = m_page->m_file->getFontByName( glyphs.fontUri, glyphs.fontSize );
     att = node.attributes.value( QStringLiteral("StyleSimulations") );
     if  ( !att.isEmpty() ) {
         if ( att == QLatin1String( "ItalicSimulation" ) ) {
@@ -809,10 +1077,7 @@ void XpsHandler::processGlyph( XpsRenderNode &node )
             font.setBold( true );
         }
     }
-    m_painter->setFont(font);
-
-    //Origin
-    QPointF origin( node.attributes.value(QStringLiteral("OriginX")).toDouble(), node.attributes.value(QStringLiteral("OriginY")).toDouble() );
+    glyphs.font = font;
 
     //Fill
     QBrush brush;
@@ -824,19 +1089,18 @@ void XpsHandler::processGlyph( XpsRenderNode &node )
         } else {
             // no "Fill" attribute and no "Glyphs.Fill" child, so show nothing
             // (see XPS specs, 5.10)
-            m_painter->restore();
+            m_scene->addGlyphs( glyphs );
             return;
         }
     } else {
         brush = parseRscRefColorForBrush( att );
         if ( brush.style() > Qt::NoBrush && brush.style() < Qt::LinearGradientPattern
              && brush.color().alpha() == 0 ) {
-            m_painter->restore();
+            m_scene->addGlyphs( glyphs );
             return;
         }
     }
-    m_painter->setBrush( brush );
-    m_painter->setPen( QPen( brush, 0 ) );
+    glyphs.brush = brush;
 
     // Opacity
     att = node.attributes.value(QStringLiteral("Opacity"));
@@ -844,41 +1108,30 @@ void XpsHandler::processGlyph( XpsRenderNode &node )
         bool ok = true;
         double value = att.toDouble( &ok );
         if ( ok && value >= 0.1 ) {
-            m_painter->setOpacity( value );
+            glyphs.opacity = value;
         } else {
-            m_painter->restore();
+            m_scene->addGlyphs( glyphs );
             return;
         }
     }
 
-    //RenderTransform
-    att = node.attributes.value(QStringLiteral("RenderTransform"));
-    if (!att.isEmpty()) {
-        m_painter->setWorldTransform( parseRscRefMatrix( att ), true);
-    }
-
     // Clip
     att = node.attributes.value( QStringLiteral("Clip") );
     if ( !att.isEmpty() ) {
-        QPainterPath clipPath = parseRscRefPath( att );
-        if ( !clipPath.isEmpty() ) {
-            m_painter->setClipPath( clipPath );
-        }
+        glyphs.clip = parseRscRefPath( att );
     }
 
     // BiDiLevel - default Left-to-Right
-    m_painter->setLayoutDirection( Qt::LeftToRight );
     att = node.attributes.value( QStringLiteral("BiDiLevel") );
     if ( !att.isEmpty() ) {
         if ( (att.toInt() % 2) == 1 ) {
             // odd BiDiLevel, so Right-to-Left
-            m_painter->setLayoutDirection( Qt::RightToLeft );
+            glyphs.direction = Qt::RightToLeft;
         }
     }
 
     // Indices - partial handling only
     att = node.attributes.value( QStringLiteral("Indices") );
-    QList<qreal> advanceWidths;
     if ( ! att.isEmpty() ) {
         QStringList indicesElements = att.split( QLatin1Char(';') );
         for( int i = 0; i < indicesElements.size(); ++i ) {
@@ -886,43 +1139,30 @@ void XpsHandler::processGlyph( XpsRenderNode &node )
                 QStringList parts = indicesElements.at(i).split( QLatin1Char(',') );
                 if (parts.size() == 2 ) {
                     // regular advance case, no offsets
-                    advanceWidths.append( parts.at(1).toDouble() * fontSize / 100.0 );
+                    glyphs.advanceWidths.append( parts.at(1).toDouble() * glyphs.fontSize / 100.0 );
                 } else if (parts.size() == 3 ) {
                     // regular advance case, with uOffset
-                    qreal AdvanceWidth = parts.at(1).toDouble() * fontSize / 100.0 ;
+                    qreal AdvanceWidth = parts.at(1).toDouble() * glyphs.fontSize / 100.0 ;
                     qreal uOffset = parts.at(2).toDouble() / 100.0;
-                    advanceWidths.append( AdvanceWidth + uOffset );
+                    glyphs.advanceWidths.append( AdvanceWidth + uOffset );
                 } else {
                     // has vertical offset, but don't know how to handle that yet
                     qCWarning(OkularXpsDebug) << "Unhandled Indices element: " << indicesElements.at(i);
-                    advanceWidths.append( -1.0 );
+                    glyphs.advanceWidths.append( -1.0 );
                 }
             } else {
                 // no special advance case
-                advanceWidths.append( -1.0 );
+                glyphs.advanceWidths.append( -1.0 );
             }
         }
     }
 
-    // UnicodeString
-    QString stringToDraw( unicodeString( node.attributes.value( QStringLiteral("UnicodeString") ) ) );
-    QPointF originAdvance(0, 0);
-    QFontMetrics metrics = m_painter->fontMetrics();
-    for ( int i = 0; i < stringToDraw.size(); ++i ) {
-        QChar thisChar = stringToDraw.at( i );
-        m_painter->drawText( origin + originAdvance, QString( thisChar ) );
-	const qreal advanceWidth = advanceWidths.value( i, qreal(-1.0) );
-        if ( advanceWidth > 0.0 ) {
-            originAdvance.rx() += advanceWidth;
-        } else {
-            originAdvance.rx() += metrics.width( thisChar );
-        }
-    }
     // qCWarning(OkularXpsDebug) << "Glyphs: " << atts.value("Fill") << ", " << atts.value("FontUri");
     // qCWarning(OkularXpsDebug) << "    Origin: " << atts.value("OriginX") << "," << atts.value("OriginY");
     // qCWarning(OkularXpsDebug) << "    Unicode: " << atts.value("UnicodeString");
 
-    m_painter->restore();
+    glyphs.visible = true;
+    m_scene->addGlyphs( glyphs );
 }
 
 void XpsHandler::processFill( XpsRenderNode &node )
@@ -988,12 +1228,11 @@ void XpsHandler::processImageBrush( XpsRenderNode &node )
 void XpsHandler::processPath( XpsRenderNode &node )
 {
     //TODO Ignored attributes: Clip, OpacityMask, StrokeEndLineCap, StorkeStartLineCap, Name, FixedPage.NavigateURI, xml:lang, x:key, AutomationProperties.Name, AutomationProperties.HelpText, SnapsToDevicePixels
-    //TODO Ignored child elements: RenderTransform, Clip, OpacityMask
-    // Handled separately: RenderTransform
-    m_painter->save();
+    //TODO Ignored child elements: Clip, OpacityMask
 
     QString att;
     QVariant data;
+    XpsPathItem item;
 
     // Get path
     XpsPathGeometry * pathdata = node.getChildData( QStringLiteral("Path.Data") ).value< XpsPathGeometry * >();
@@ -1006,7 +1245,6 @@ void XpsHandler::processPath( XpsRenderNode &node )
     }
     if ( !pathdata ) {
         // nothing to draw
-        m_painter->restore();
         return;
     }
 
@@ -1021,7 +1259,7 @@ void XpsHandler::processPath( XpsRenderNode &node )
             brush = data.value<QBrush>();
         }
     }
-    m_painter->setBrush( brush );
+    item.brush = brush;
 
     // Stroke (pen)
     att = node.attributes.value( QStringLiteral("Stroke") );
@@ -1100,31 +1338,24 @@ void XpsHandler::processPath( XpsRenderNode &node )
             pen.setMiterLimit( limit / 2 );
         }
     }
-    m_painter->setPen( pen );
+    item.pen = pen;
 
     // Opacity
     att = node.attributes.value(QStringLiteral("Opacity"));
     if (! att.isEmpty()) {
-        m_painter->setOpacity(att.toDouble());
+        item.opacity = qMax( att.toDouble(), 0.0 );
     }
 
     // RenderTransform
-    att = node.attributes.value( QStringLiteral("RenderTransform") );
-    if (! att.isEmpty() ) {
-        m_painter->setWorldTransform( parseRscRefMatrix( att ), true );
-    }
-    if ( !pathdata->transform.isIdentity() ) {
-        m_painter->setWorldTransform( pathdata->transform, true );
-    }
+    item.transform = pathdata->transform * renderTransform( node, QStringLiteral("Path.RenderTransform") );
 
     Q_FOREACH ( XpsPathFigure *figure, pathdata->paths ) {
-        m_painter->setBrush( figure->isFilled ? brush : QBrush() );
-        m_painter->drawPath( figure->path );
+        item.figures.append( *figure );
     }
 
     delete pathdata;
 
-    m_painter->restore();
+    m_scene->addPath( item );
 }
 
 void XpsHandler::processPathData( XpsRenderNode &node )
@@ -1265,20 +1496,20 @@ void XpsHandler::processPathFigure( XpsRenderNode &node )
 void XpsHandler::processStartElement( XpsRenderNode &node )
 {
     if (node.name == QLatin1String("Canvas")) {
-        m_painter->save();
+        m_scene->save();
         QString att = node.attributes.value( QStringLiteral("RenderTransform") );
         if ( !att.isEmpty() ) {
-            m_painter->setWorldTransform( parseRscRefMatrix( att ), true );
+            m_scene->transform( parseRscRefMatrix( att ) );
         }
         att = node.attributes.value( QStringLiteral("Opacity") );
         if ( !att.isEmpty() ) {
             double value = att.toDouble();
             if ( value > 0.0 && value <= 1.0 ) {
-                m_painter->setOpacity( m_painter->opacity() * value );
+                m_scene->multiplyOpacity( value );
             } else {
                 // setting manually to 0 is necessary to "disable"
                 // all the stuff inside
-                m_painter->setOpacity( 0.0 );
+                m_scene->multiplyOpacity( 0.0 );
             }
         }
     }
@@ -1293,13 +1524,16 @@ void XpsHandler::processEndElement( XpsRenderNode &node )
     } else if (node.name == QLatin1String("MatrixTransform")) {
         //TODO Ignoring x:key
         node.data = qVariantFromValue( QTransform( attsToMatrix( node.attributes.value( QStringLiteral("Matrix") ) ) ) );
-    } else if ((node.name == QLatin1String("Canvas.RenderTransform")) || (node.name == QLatin1String("Glyphs.RenderTransform")) || (node.name == QLatin1String("Path.RenderTransform")))  {
+    } else if (node.name == QLatin1String("Canvas.RenderTransform")) {
         QVariant data = node.getRequiredChildData( QStringLiteral("MatrixTransform") );
         if (data.canConvert<QTransform>()) {
-            m_painter->setWorldTransform( data.value<QTransform>(), true );
+            m_scene->transform( data.value<QTransform>() );
         }
+    } else if ((node.name == QLatin1String("Glyphs.RenderTransform")) || (node.name == QLatin1String("Path.RenderTransform"))) {
+        // used by the Glyphs or the Path only, see renderTransform()
+        node.data = node.getRequiredChildData( QStringLiteral("MatrixTransform") );
     } else if (node.name == QLatin1String("Canvas")) {
-        m_painter->restore();
+        m_scene->restore();
     } else if ((node.name == QLatin1String("Path.Fill")) || (node.name == QLatin1String("Glyphs.Fill"))) {
         processFill( node );
     } else if (node.name == QLatin1String("Path.Stroke")) {
@@ -1377,78 +1611,74 @@ void XpsHandler::processEndElement( XpsRenderNode &node )
 }
 
 XpsPage::XpsPage(XpsFile *file, const QString &fileName): m_file( file ),
-    m_fileName( fileName ), m_pageIsRendered(false)
+    m_fileName( fileName )
 {
-    m_pageImage = NULL;
-
     // qCWarning(OkularXpsDebug) << "page file name: " << fileName;
 
-    const KZipFileEntry* pageFile = static_cast<const KZipFileEntry *>(m_file->xpsArchive()->directory()->entry( fileName ));
-
-    QXmlStreamReader xml;
-    xml.addData( readFileOrDirectoryParts( pageFile ) );
-    while ( !xml.atEnd() )
-    {
-        xml.readNext();
-        if ( xml.isStartElement() && ( xml.name() == QStringLiteral("FixedPage") ) )
-        {
-            QXmlStreamAttributes attributes = xml.attributes();
-            m_pageSize.setWidth( attributes.value( QStringLiteral("Width") ).toString().toDouble() );
-            m_pageSize.setHeight( attributes.value( QStringLiteral("Height") ).toString().toDouble() );
-            break;
-        }
-    }
-    if ( xml.error() )
-    {
-        qCWarning(OkularXpsDebug) << "Could not parse XPS page:" << xml.errorString();
+    // only the start of the page is needed for its size, the rest is read
+    // when the page is shown
+    const KArchiveEntry* pageEntry = m_file->xpsArchive()->directory()->entry( fileName );
+    if ( pageEntry ) {
+        m_pageSize = readFixedPageSize( pageEntry );
     }
 }
 
 XpsPage::~XpsPage()
 {
-    delete m_pageImage;
 }
 
 bool XpsPage::renderToImage( QImage *p )
 {
+    // Set one point = one drawing unit. Useful for fonts, because xps specifies font size using drawing units, not points as usual
+    p->setDotsPerMeterX( 2835 );
+    p->setDotsPerMeterY( 2835 );
+    p->fill( qRgba( 255, 255, 255, 255 ) );
 
-    if ((m_pageImage == NULL) || (m_pageImage->size() != p->size())) {
-        delete m_pageImage;
-        m_pageImage = new QImage( p->size(), QImage::Format_ARGB32 );
-        // Set one point = one drawing unit. Useful for fonts, because xps specifies font size using drawing units, not points as usual
-        m_pageImage->setDotsPerMeterX( 2835 );
-        m_pageImage->setDotsPerMeterY( 2835 );
+    QPainter painter( p );
+    renderToPainter( &painter );
 
-        m_pageIsRendered = false;
-    }
-    if (! m_pageIsRendered) {
-        m_pageImage->fill( qRgba( 255, 255, 255, 255 ) );
-        QPainter painter( m_pageImage );
-        renderToPainter( &painter );
-        m_pageIsRendered = true;
-    }
+    return true;
+}
 
-    *p = *m_pageImage;
+bool XpsPage::renderToPainter( QPainter *painter )
+{
+    painter->setWorldTransform(QTransform().scale((qreal)painter->device()->width() / size().width(), (qreal)painter->device()->height() / size().height()));
+    scene()->paint( painter );
 
     return true;
 }
 
-bool XpsPage::renderToPainter( QPainter *painter )
+XpsPageScene *XpsPage::scene()
 {
+    XpsPageScene *scene = m_file->m_scenes.object( this );
+    if ( !scene ) {
+        scene = parseScene();
+        // a scene bigger than the whole budget is still kept until the next one
+        m_file->m_scenes.insert( this, scene, qMin( scene->cost(), m_file->m_scenes.maxCost() ) );
+    }
+    return scene;
+}
+
+XpsPageScene *XpsPage::parseScene()
+{
+    XpsPageScene *scene = new XpsPageScene();
+
     XpsHandler handler( this );
-    handler.m_painter = painter;
-    handler.m_painter->setWorldTransform(QTransform().scale((qreal)painter->device()->width() / size().width(), (qreal)painter->device()->height() / size().height()));
+    handler.m_scene = scene;
     QXmlSimpleReader parser;
     parser.setContentHandler( &handler );
     parser.setErrorHandler( &handler );
-    const KZipFileEntry* pageFile = static_cast<const KZipFileEntry *>(m_file->xpsArchive()->directory()->entry( m_fileName ));
+    const KArchiveEntry* pageFile = m_file->xpsArchive()->directory()->entry( m_fileName );
+    if ( !pageFile ) {
+        return scene;
+    }
     QByteArray data = readFileOrDirectoryParts( pageFile );
     QBuffer buffer( &data );
     QXmlInputSource source( &buffer );
     bool ok = parser.parse( source );
     qCWarning(OkularXpsDebug) << "Parse result: " << ok;
 
-    return true;
+    return scene;
 }
 
 QSizeF XpsPage::size() const
@@ -1460,6 +1690,13 @@ QFont XpsFile::getFontByName( const QString &fileName, float size )
 {
     // qCWarning(OkularXpsDebug) << "trying to get font: " << fileName << ", size: " << size;
 
+    // every glyph run asks for its font, but a page uses only a few of them
+    const QPair<QString, int> fontKey( fileName, qRound(size) );
+    QHash< QPair<QString, int>, QFont >::const_iterator it = m_fonts.constFind( fontKey );
+    if ( it != m_fonts.constEnd() ) {
+        return it.value();
+    }
+
     int index = m_fontCache.value(fileName, -1);
     if (index == -1)
     {
@@ -1468,22 +1705,27 @@ QFont XpsFile::getFontByName( const QString &fileName, float size )
     }
     if ( index == -1 ) {
         qCWarning(OkularXpsDebug) << "Requesting uknown font:" << fileName;
+        m_fonts.insert( fontKey, QFont() );
         return QFont();
     }
 
     const QStringList fontFamilies = m_fontDatabase.applicationFontFamilies( index );
     if ( fontFamilies.isEmpty() ) {
       qCWarning(OkularXpsDebug) << "The unexpected has happened. No font family for a known font:" << fileName << index;
+      m_fonts.insert( fontKey, QFont() );
       return QFont();
     }
     const QString fontFamily = fontFamilies[0];
     const QStringList fontStyles = m_fontDatabase.styles( fontFamily );
     if ( fontStyles.isEmpty() ) {
       qCWarning(OkularXpsDebug) << "The unexpected has happened. No font style for a known font family:" << fileName << index << fontFamily ;
+      m_fonts.insert( fontKey, QFont() );
       return QFont();
     }
     const QString fontStyle =  fontStyles[0];
-    return m_fontDatabase.font(fontFamily, fontStyle, qRound(size));
+    const QFont font = m_fontDatabase.font(fontFamily, fontStyle, qRound(size));
+    m_fonts.insert( fontKey, font );
+    return font;
 }
 
 int XpsFile::loadFontByName( const QString &fileName )
@@ -1546,8 +1788,18 @@ QImage XpsPage::loadImageFromFile( const QString &fileName )
         return QImage();
     }
 
-    QString absoluteFileName = absolutePath( entryPath( m_fileName ), fileName );
-    const KZipFileEntry* imageFile = loadFile( m_file->xpsArchive(), absoluteFileName, Qt::CaseInsensitive );
+    return m_file->loadImage( absolutePath( entryPath( m_fileName ), fileName ) );
+}
+
+QImage XpsFile::loadImage( const QString &fileName )
+{
+    // the pages often share images, like the logo of every page of a report
+    QImage *cachedImage = m_imageCache.object( fileName );
+    if ( cachedImage ) {
+        return *cachedImage;
+    }
+
+    const KZipFileEntry* imageFile = loadFile( m_xpsArchive, fileName, Qt::CaseInsensitive );
     if ( !imageFile ) {
         // image not found
         return QImage();
@@ -1557,8 +1809,10 @@ QImage XpsPage::loadImageFromFile( const QString &fileName )
         XPS standard requires to use 96dpi for images which doesn't have dpi specified (in file). When Qt loads such an image,
         it sets its dpi to qt_defaultDpi and doesn't allow to find out that it happend.
 
-        To workaround this I used this procedure: load image, set its dpi to 96, load image again. When dpi isn't set in file,
-        dpi set by me stays unchanged.
+        To workaround this the image is decoded into an image of the right size and format whose dpi is already 96. The
+        readers reuse such an image, so when dpi isn't set in file, dpi set by me stays unchanged.
+        When the size or the format can't be read from the header, the image is decoded twice: first to get one, then
+        again into it.
 
         Trolltech task ID: 159527.
 
@@ -1571,14 +1825,24 @@ QImage XpsPage::loadImageFromFile( const QString &fileName )
     buffer.open(QBuffer::ReadOnly);
 
     QImageReader reader(&buffer);
-    image = reader.read();
+    const QSize size = reader.size();
+    const QImage::Format format = reader.imageFormat();
+    if ( size.isValid() && format != QImage::Format_Invalid ) {
+        image = QImage( size, format );
+    } else {
+        image = reader.read();
+        buffer.seek(0);
+        reader.setDevice(&buffer);
+    }
 
     image.setDotsPerMeterX(qRound(96 / 0.0254));
     image.setDotsPerMeterY(qRound(96 / 0.0254));
-  
-    buffer.seek(0);
-    reader.setDevice(&buffer);
-    reader.read(&image);
+
+    if ( !reader.read(&image) ) {
+        image = QImage();
+    }
+
+    m_imageCache.insert( fileName, new QImage( image ), qMin( image.byteCount() / 1024 + 1, m_imageCache.maxCost() ) );
 
     return image;
 }
@@ -1587,103 +1851,7 @@ Okular::TextPage* XpsPage::textPage()
 {
     // qCWarning(OkularXpsDebug) << "Parsing XpsPage, text extraction";
 
-    Okular::TextPage* textPage = new Okular::TextPage();
-
-    const KZipFileEntry* pageFile = static_cast<const KZipFileEntry *>(m_file->xpsArchive()->directory()->entry( m_fileName ));
-    QXmlStreamReader xml;
-    xml.addData( readFileOrDirectoryParts( pageFile ) );
-
-    QTransform matrix = QTransform();
-    QStack<QTransform> matrices;
-    matrices.push( QTransform() );
-    bool useMatrix = false;
-    QXmlStreamAttributes glyphsAtts;
-
-    while ( ! xml.atEnd() ) {
-        xml.readNext();
-        if ( xml.isStartElement() ) {
-            if ( xml.name() == QStringLiteral("Canvas")) {
-                matrices.push(matrix);
-
-                QString att = xml.attributes().value( QStringLiteral("RenderTransform") ).toString();
-                if (!att.isEmpty()) {
-                    matrix = parseRscRefMatrix( att ) * matrix;
-                }
-            } else if ((xml.name() == QStringLiteral("Canvas.RenderTransform")) || (xml.name() == QStringLiteral("Glyphs.RenderTransform"))) {
-                useMatrix = true;
-            } else if (xml.name() == QStringLiteral("MatrixTransform")) {
-                if (useMatrix) {
-                    matrix = attsToMatrix( xml.attributes().value(QStringLiteral("Matrix")).toString() ) * matrix;
-                }
-            } else if (xml.name() == QStringLiteral("Glyphs")) {
-                matrices.push( matrix );
-                glyphsAtts = xml.attributes();
-            } else if ( (xml.name() == QStringLiteral("Path")) || (xml.name() == QStringLiteral("Path.Fill")) || (xml.name() == QStringLiteral("SolidColorBrush"))
-                        || (xml.name() == QStringLiteral("ImageBrush")) ||  (xml.name() == QStringLiteral("ImageBrush.Transform"))
-                        || (xml.name() == QStringLiteral("Path.OpacityMask")) || (xml.name() == QStringLiteral("Path.Data"))
-                        || (xml.name() == QStringLiteral("PathGeometry")) || (xml.name() == QStringLiteral("PathFigure"))
-                        || (xml.name() == QStringLiteral("PolyLineSegment")) ) {
-                // those are only graphical - no use in text handling
-            } else if ( (xml.name() == QStringLiteral("FixedPage")) || (xml.name() == QStringLiteral("FixedPage.Resources")) ) {
-                // not useful for text extraction
-            } else {
-                qCWarning(OkularXpsDebug) << "Unhandled element in Text Extraction start: " << xml.name().toString();
-            }
-        } else if (xml.isEndElement() ) {
-            if (xml.name() == QStringLiteral("Canvas")) {
-                matrix = matrices.pop();
-            } else if ((xml.name() == QStringLiteral("Canvas.RenderTransform")) || (xml.name() == QStringLiteral("Glyphs.RenderTransform"))) {
-                useMatrix = false;
-            } else if (xml.name() == QStringLiteral("MatrixTransform")) {
-                // not clear if we need to do anything here yet.
-            } else if (xml.name() == QStringLiteral("Glyphs")) {
-                QString att = glyphsAtts.value( QStringLiteral("RenderTransform") ).toString();
-                if (!att.isEmpty()) {
-                    matrix = parseRscRefMatrix( att ) * matrix;
-                }
-                QString text = unicodeString( glyphsAtts.value( QStringLiteral("UnicodeString") ).toString() );
-
-                // Get font (doesn't work well because qt doesn't allow to load font from file)
-                QFont font = m_file->getFontByName( glyphsAtts.value( QStringLiteral("FontUri") ).toString(),
-                                                    glyphsAtts.value(QStringLiteral("FontRenderingEmSize")).toString().toFloat() * 72 / 96 );
-                QFontMetrics metrics = QFontMetrics( font );
-                // Origin
-                QPointF origin( glyphsAtts.value(QStringLiteral("OriginX")).toString().toDouble(),
-                                glyphsAtts.value(QStringLiteral("OriginY")).toString().toDouble() );
-
-
-                int lastWidth = 0;
-                for (int i = 0; i < text.length(); i++) {
-                    int width = metrics.width( text, i + 1 );
-
-                    Okular::NormalizedRect * rect = new Okular::NormalizedRect( (origin.x() + lastWidth) / m_pageSize.width(),
-                                                                                (origin.y() - metrics.height()) / m_pageSize.height(),
-                                                                                (origin.x() + width) / m_pageSize.width(),
-                                                                                origin.y() / m_pageSize.height() );
-                    rect->transform( matrix );
-                    textPage->append( text.mid(i, 1), rect );
-
-                    lastWidth = width;
-                }
-
-                matrix = matrices.pop();
-            } else if ( (xml.name() == QStringLiteral("Path")) || (xml.name() == QStringLiteral("Path.Fill")) || (xml.name() == QStringLiteral("SolidColorBrush"))
-                        || (xml.name() == QStringLiteral("ImageBrush")) ||  (xml.name() == QStringLiteral("ImageBrush.Transform"))
-                        || (xml.name() == QStringLiteral("Path.OpacityMask")) || (xml.name() == QStringLiteral("Path.Data"))
-                        || (xml.name() == QStringLiteral("PathGeometry")) || (xml.name() == QStringLiteral("PathFigure"))
-                        || (xml.name() == QStringLiteral("PolyLineSegment")) ) {
-                // those are only graphical - no use in text handling
-            } else if ( (xml.name() == QStringLiteral("FixedPage")) || (xml.name() == QStringLiteral("FixedPage.Resources")) ) {
-                // not useful for text extraction
-            } else {
-                qCWarning(OkularXpsDebug) << "Unhandled element in Text Extraction end: " << xml.name().toString();
-            }
-        }
-    }
-    if ( xml.error() ) {
-        qCWarning(OkularXpsDebug) << "Error parsing XpsPage text: " << xml.errorString();
-    }
-    return textPage;
+    return scene()->textPage( m_file, m_pageSize );
 }
 
 void XpsDocument::parseDocumentStructure( const QString &documentStructureFileName )
@@ -1870,6 +2038,8 @@ XpsPage* XpsDocument::page(int pageNum) const
 
 XpsFile::XpsFile()
 {
+    m_scenes.setMaxCost( SCENE_CACHE_COST );
+    m_imageCache.setMaxCost( IMAGE_CACHE_COST );
 }
 
 
@@ -2028,6 +2198,9 @@ Okular::DocumentInfo XpsFile::generateDocumentInfo() const
 
 bool XpsFile::closeDocument()
 {
+    m_scenes.clear();
+    m_imageCache.clear();
+
     qDeleteAll( m_documents );
     m_documents.clear();
 
@@ -2067,7 +2240,11 @@ XpsGenerator::XpsGenerator( QObject *parent, const QVariantList &args )
     // 2) Qt >= 4.4.0 (see Trolltech task ID: 169502)
     // 3) Qt >= 4.4.2 (see Trolltech task ID: 215090)
     if ( QFontDatabase::supportsThreadedFontRendering() )
+    {
         setFeature( Threaded );
+        // the text pages are extracted with the user mutex locked
+        setFeature( ConcurrentTextExtraction );
+    }
     userMutex();
 }
 
@@ -2160,6 +2337,9 @@ Okular::ExportFormat::List XpsGenerator::exportFormats() const
 bool XpsGenerator::exportTo( const QString &fileName, const Okular::ExportFormat &format )
 {
     if ( format.mimeType().inherits( QStringLiteral( "text/plain" ) ) ) {
+        // the parsed pages are shared with the rendering threads
+        QMutexLocker lock( userMutex() );
+
         QFile f( fileName );
         if ( !f.open( QIODevice::WriteOnly ) )
             return false;
@@ -2187,6 +2367,7 @@ bool XpsGenerator::print( QPrinter &printer )
                                                          document()->currentPage() + 1,
                                                          document()->bookmarkedPageList() );
 
+    QMutexLocker lock( userMutex() );
     QPainter painter( &printer );
 
     for ( int i = 0; i < pageList.count(); ++i )
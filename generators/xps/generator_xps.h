@@ -23,12 +23,16 @@
 #include <core/generator.h>
 #include <core/textpage.h>
 
+#include <QCache>
 #include <QColor>
 #include <QDomDocument>
 #include <QFontDatabase>
 #include <QImage>
+#include <QPainterPath>
+#include <QPen>
 #include <QXmlStreamReader>
 #include <QXmlDefaultHandler>
+#include <QSet>
 #include <QStack>
 #include <QVariant>
 #include <QtCore/qloggingcategory.h>
@@ -107,6 +111,98 @@ struct XpsPathGeometry
 class XpsPage;
 class XpsFile;
 
+/**
+    A Path element of a page, ready to be painted
+*/
+struct XpsPathItem
+{
+    XpsPathItem()
+        : pen( Qt::transparent ), opacity( -1.0 )
+    {}
+
+    QList< XpsPathFigure > figures;
+    QBrush brush;
+    QPen pen;
+    // negative when the element doesn't set it
+    double opacity;
+    QTransform transform;
+};
+
+/**
+    A Glyphs element of a page, ready to be painted. The ones that are not
+    painted are kept too, for their text.
+*/
+struct XpsGlyphsItem
+{
+    XpsGlyphsItem()
+        : visible( false ), fontSize( 0.0 ), opacity( -1.0 ), direction( Qt::LeftToRight )
+    {}
+
+    bool visible;
+    QString fontUri;
+    float fontSize;
+    QFont font;
+    QBrush brush;
+    // negative when the element doesn't set it
+    double opacity;
+    QTransform transform;
+    QPainterPath clip;
+    Qt::LayoutDirection direction;
+    QPointF origin;
+    QString text;
+    // negative where the advance of the font is used
+    QList<qreal> advanceWidths;
+};
+
+/**
+    The contents of a FixedPage, parsed once and then painted at any size
+    or read for the text as many times as needed.
+
+    It is a list of painter state changes and of items to paint, in the
+    order they appear in the page.
+*/
+class XpsPageScene
+{
+public:
+    XpsPageScene();
+
+    void save();
+    void restore();
+    void transform( const QTransform &transform );
+    void multiplyOpacity( double opacity );
+    void addPath( const XpsPathItem &path );
+    void addGlyphs( const XpsGlyphsItem &glyphs );
+
+    void paint( QPainter *painter ) const;
+    Okular::TextPage* textPage( XpsFile *file, const QSizeF &pageSize ) const;
+
+    /**
+       An estimate of the memory used, in kilobytes
+    */
+    int cost() const;
+
+private:
+    enum Operation { SaveOperation, RestoreOperation, TransformOperation, OpacityOperation, PathOperation, GlyphsOperation };
+
+    struct Step
+    {
+        Operation operation;
+        // in the list of the operation, if it has any
+        int index;
+    };
+
+    void appendStep( Operation operation, int index );
+    void addImageCost( const QBrush &brush );
+
+    QVector<Step> m_steps;
+    QVector<QTransform> m_transforms;
+    QVector<double> m_opacities;
+    QVector<XpsPathItem> m_paths;
+    QVector<XpsGlyphsItem> m_glyphs;
+    QSet<qint64> m_images;
+    qint64 m_cost;
+};
+
 class XpsHandler: public QXmlDefaultHandler
 {
 public:
@@ -138,9 +234,7 @@ protected:
     void processPathGeometry( XpsRenderNode &node );
     void processPathFigure( XpsRenderNode &node );
 
-    QPainter *m_painter;
-
-    QImage m_image;
+    XpsPageScene *m_scene;
 
     QStack<XpsRenderNode> m_nodes;
 
@@ -161,6 +255,10 @@ public:
     QImage loadImageFromFile( const QString &filename );
 
 private:
+    // the parsed page, which the file keeps as long as its budget allows
+    XpsPageScene *scene();
+    XpsPageScene *parseScene();
+
     XpsFile *m_file;
     const QString m_fileName;
 
@@ -172,9 +270,6 @@ private:
     QImage m_thumbnail;
     bool m_thumbnailIsLoaded;
 
-    QImage *m_pageImage;
-    bool m_pageIsRendered;
-
     friend class XpsHandler;
     friend class XpsTextExtractionHandler;
 };
@@ -273,6 +368,12 @@ public:
 
     QFont getFontByName( const QString &fontName, float size );
 
+    /**
+       the image in the part \p fileName, decoded once for all the pages
+       using it, as long as it fits in the cache
+    */
+    QImage loadImage( const QString &fileName );
+
     KZip* xpsArchive();
 
 
@@ -294,7 +395,15 @@ private:
     KZip * m_xpsArchive;
 
     QMap<QString, int> m_fontCache;
+    QHash< QPair<QString, int>, QFont > m_fonts;
     QFontDatabase m_fontDatabase;
+
+    QCache<QString, QImage> m_imageCache;
+
+    // the scenes of the pages parsed last
+    QCache<const XpsPage *, XpsPageScene> m_scenes;
+
+    friend class XpsPage;
 };
 
 
@@ -108,7 +108,18 @@ AnnotationModelPrivate::~AnnotationModelPrivate()
 void AnnotationModelPrivate::notifySetup( const QVector< Okular::Page * > &pages, int setupFlags )
 {
     if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) )
+    {
+        // add the annotations the generator put on the new pages
+        if ( setupFlags & Okular::DocumentObserver::PagesAppended )
+        {
+            for ( int i = 0; i < pages.count(); ++i )
+            {
+                if ( !pages.at( i )->annotations().isEmpty() && !findItem( i, 0 ) )
+                    notifyPageChanged( i, Okular::DocumentObserver::Annotations );
+            }
+        }
         return;
+    }
 
     q->beginResetModel();
     qDeleteAll( root->children );
@@ -0,0 +1,205 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "imageoperations.h"
+
+#include <QtCore/QRect>
+#include <QtCore/QVarLengthArray>
+#include <QtGui/QColor>
+#include <QtGui/QImage>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// x / 255 rounded, for x up to 255 * 255 (from Arthur - qt4)
+static inline unsigned int div255Round( unsigned int x ) { return ( x + ( x >> 8 ) + 0x80 ) >> 8; }
+
+// x / 255 truncated, for x up to 255 * 255
+static inline unsigned int div255( unsigned int x ) { return ( x + 1 + ( x >> 8 ) ) >> 8; }
+
+#ifdef __SSE2__
+// the gray values of 4 pixels, in 4 ints
+static inline __m128i grayValues( __m128i pixels )
+{
+    // weights of qGray(), in the memory order of the channels: blue, green, red, alpha
+    const __m128i weights = _mm_setr_epi16( 5, 16, 11, 0, 5, 16, 11, 0 );
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 low = _mm_castsi128_ps( _mm_madd_epi16( _mm_unpacklo_epi8( pixels, zero ), weights ) );
+    const __m128 high = _mm_castsi128_ps( _mm_madd_epi16( _mm_unpackhi_epi8( pixels, zero ), weights ) );
+    // add the blue + green and the red + alpha sums of each pixel
+    const __m128i even = _mm_castps_si128( _mm_shuffle_ps( low, high, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+    const __m128i odd = _mm_castps_si128( _mm_shuffle_ps( low, high, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+    return _mm_srli_epi32( _mm_add_epi32( even, odd ), 5 );
+}
+
+// multiplies the channels of 2 pixels, unpacked in 8 shorts, by the factors truncating the result
+static inline __m128i multiplyChannels( __m128i channels, __m128i factors )
+{
+    const __m128i product = _mm_mullo_epi16( channels, factors );
+    return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( product, _mm_set1_epi16( 1 ) ), _mm_srli_epi16( product, 8 ) ), 8 );
+}
+#endif
+
+void ImageOperations::mapGray( QImage & image, const QRgb * table, bool keepAlpha )
+{
+    const QRgb alphaMask = keepAlpha ? 0xff000000 : 0;
+    const QRgb tableMask = keepAlpha ? 0x00ffffff : 0xffffffff;
+    const int width = image.width();
+    for ( int y = 0; y < image.height(); ++y )
+    {
+        QRgb * pixels = reinterpret_cast< QRgb * >( image.scanLine( y ) );
+        int x = 0;
+#ifdef __SSE2__
+        for ( ; x + 4 <= width; x += 4 )
+        {
+            const __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pixels + x ) );
+            int grays[4];
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( grays ), grayValues( values ) );
+            pixels[x] = ( table[ grays[0] ] & tableMask ) | ( pixels[x] & alphaMask );
+            pixels[x + 1] = ( table[ grays[1] ] & tableMask ) | ( pixels[x + 1] & alphaMask );
+            pixels[x + 2] = ( table[ grays[2] ] & tableMask ) | ( pixels[x + 2] & alphaMask );
+            pixels[x + 3] = ( table[ grays[3] ] & tableMask ) | ( pixels[x + 3] & alphaMask );
+        }
+#endif
+        for ( ; x < width; ++x )
+            pixels[x] = ( table[ qGray( pixels[x] ) ] & tableMask ) | ( pixels[x] & alphaMask );
+    }
+}
+
+void ImageOperations::recolor( QImage & image, const QColor & foreground, const QColor & background )
+{
+    const float scaleRed = background.redF() - foreground.redF();
+    const float scaleGreen = background.greenF() - foreground.greenF();
+    const float scaleBlue = background.blueF() - foreground.blueF();
+
+    // the color only depends on the lightness of the pixel
+    QRgb table[256];
+    for ( int lightness = 0; lightness < 256; ++lightness )
+    {
+        table[ lightness ] = qRgba( scaleRed * lightness + foreground.red(),
+                                    scaleGreen * lightness + foreground.green(),
+                                    scaleBlue * lightness + foreground.blue(),
+                                    0 );
+    }
+    mapGray( image, table, true );
+}
+
+void ImageOperations::blackWhite( QImage & image, int contrast, int threshold )
+{
+    QRgb table[256];
+    for ( int gray = 0; gray < 256; ++gray )
+    {
+        int val = gray;
+        if ( val > threshold )
+            val = 128 + (127 * (val - threshold)) / (255 - threshold);
+        else if ( val < threshold )
+            val = (128 * val) / threshold;
+        if ( contrast > 2 )
+        {
+            val = contrast * ( val - threshold ) / 2 + threshold;
+            if ( val > 255 )
+                val = 255;
+            else if ( val < 0 )
+                val = 0;
+        }
+        table[ gray ] = qRgba( val, val, val, 255 );
+    }
+    mapGray( image, table, false );
+}
+
+void ImageOperations::multiply( QImage & image, const QRect & rect, const QColor & color, bool blackIsWhite )
+{
+    const QRect r = rect & image.rect();
+    const unsigned int red = color.red(), green = color.green(), blue = color.blue();
+    for ( int y = r.top(); y <= r.bottom(); ++y )
+    {
+        QRgb * pixels = reinterpret_cast< QRgb * >( image.scanLine( y ) );
+        int x = r.left();
+#ifdef __SSE2__
+        const __m128i factors = _mm_setr_epi16( blue, green, red, 0, blue, green, red, 0 );
+        const __m128i colorMask = _mm_set1_epi32( 0x00ffffff );
+        const __m128i opaque = _mm_set1_epi32( 0xff000000 );
+        const __m128i zero = _mm_setzero_si128();
+        for ( ; x + 4 <= r.right() + 1; x += 4 )
+        {
+            __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pixels + x ) );
+            if ( blackIsWhite )
+            {
+                const __m128i black = _mm_cmpeq_epi32( _mm_and_si128( values, colorMask ), zero );
+                values = _mm_or_si128( values, _mm_and_si128( black, colorMask ) );
+            }
+            const __m128i low = multiplyChannels( _mm_unpacklo_epi8( values, zero ), factors );
+            const __m128i high = multiplyChannels( _mm_unpackhi_epi8( values, zero ), factors );
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( pixels + x ), _mm_or_si128( _mm_packus_epi16( low, high ), opaque ) );
+        }
+#endif
+        for ( ; x <= r.right(); ++x )
+        {
+            unsigned int pixelRed = qRed( pixels[x] ), pixelGreen = qGreen( pixels[x] ), pixelBlue = qBlue( pixels[x] );
+            if ( blackIsWhite && pixelRed == 0 && pixelGreen == 0 && pixelBlue == 0 )
+                pixelRed = pixelGreen = pixelBlue = 255;
+            pixels[x] = qRgba( div255( pixelRed * red ), div255( pixelGreen * green ), div255( pixelBlue * blue ), 255 );
+        }
+    }
+}
+
+void ImageOperations::scaleAlpha( QImage & image, unsigned int alpha )
+{
+    const int width = image.width();
+    for ( int y = 0; y < image.height(); ++y )
+    {
+        QRgb * pixels = reinterpret_cast< QRgb * >( image.scanLine( y ) );
+        int x = 0;
+#ifdef __SSE2__
+        const __m128i factor = _mm_set1_epi32( alpha );
+        const __m128i colorMask = _mm_set1_epi32( 0x00ffffff );
+        for ( ; x + 4 <= width; x += 4 )
+        {
+            const __m128i values = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pixels + x ) );
+            // the products fit in the low 16 bits of each int
+            const __m128i product = _mm_mullo_epi16( _mm_srli_epi32( values, 24 ), factor );
+            const __m128i rounded = _mm_add_epi32( _mm_add_epi32( product, _mm_srli_epi32( product, 8 ) ), _mm_set1_epi32( 0x80 ) );
+            const __m128i newAlpha = _mm_slli_epi32( _mm_srli_epi32( rounded, 8 ), 24 );
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( pixels + x ), _mm_or_si128( _mm_and_si128( values, colorMask ), newAlpha ) );
+        }
+#endif
+        for ( ; x < width; ++x )
+            pixels[x] = ( pixels[x] & 0x00ffffff ) | ( div255Round( alpha * qAlpha( pixels[x] ) ) << 24 );
+    }
+}
+
+void ImageOperations::scaleNearest( QImage & dest, const QImage & src, int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format )
+{
+    // {source, destination, scaling} params
+    const int srcWidth = src.width(),
+        srcHeight = src.height(),
+        destLeft = cropRect.left(),
+        destTop = cropRect.top(),
+        destWidth = cropRect.width(),
+        destHeight = cropRect.height();
+
+    // destination image (same geometry as the pageLimits rect)
+    dest = QImage( destWidth, destHeight, format );
+
+    // precalc the x correspondancy conversion in a lookup table
+    QVarLengthArray< int > xOffset( destWidth );
+    for ( int x = 0; x < destWidth; x++ )
+        xOffset[ x ] = ((x + destLeft) * srcWidth) / scaledWidth;
+
+    // for each pixel of the destination image apply the color of the
+    // corresponsing pixel on the source image (note: keep parenthesis)
+    for ( int y = 0; y < destHeight; y++ )
+    {
+        const QRgb * srcLine = reinterpret_cast< const QRgb * >( src.constScanLine( ((destTop + y) * srcHeight) / scaledHeight ) );
+        QRgb * destLine = reinterpret_cast< QRgb * >( dest.scanLine( y ) );
+        for ( int x = 0; x < destWidth; x++ )
+            destLine[ x ] = srcLine[ xOffset[ x ] ];
+    }
+}
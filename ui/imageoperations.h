@@ -0,0 +1,57 @@
+/***************************************************************************
+ *   Copyright (C) 2017 by the Okular developers                           *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef OKULAR_IMAGEOPERATIONS_H
+#define OKULAR_IMAGEOPERATIONS_H
+
+#include <QtGui/QImage>
+
+class QColor;
+class QRect;
+
+/**
+ * Per pixel operations on the 32 bit images painted by PagePainter.
+ *
+ * They give the same results of the plain loops they replace, but process
+ * several pixels at once with SSE2 when it is available.
+ */
+namespace ImageOperations
+{
+    /**
+     * Replaces every pixel of @p image with the entry of @p table for its
+     * gray value (as qGray() computes it). The alpha of the pixel is kept
+     * if @p keepAlpha, otherwise the one of the table is used.
+     */
+    void mapGray( QImage & image, const QRgb * table, bool keepAlpha );
+
+    // turn black into @p foreground and white into @p background, keeping alpha
+    void recolor( QImage & image, const QColor & foreground, const QColor & background );
+
+    // make the image gray, with the given contrast around the given threshold
+    void blackWhite( QImage & image, int contrast, int threshold );
+
+    /**
+     * Multiplies the pixels of @p image inside @p rect by @p color, making them
+     * opaque. If @p blackIsWhite, black pixels are considered white, to
+     * highlight the transparent pixels of the pages that have them.
+     */
+    void multiply( QImage & image, const QRect & rect, const QColor & color, bool blackIsWhite );
+
+    // multiply the alpha of every pixel by @p alpha / 255
+    void scaleAlpha( QImage & image, unsigned int alpha );
+
+    /**
+     * Sets @p dest to the @p cropRect portion of @p src scaled to @p scaledWidth
+     * by @p scaledHeight pixels, taking the nearest pixel. @p src must be a
+     * 32 bit image whose pixels are valid in the @p format of @p dest.
+     */
+    void scaleNearest( QImage & dest, const QImage & src, int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format );
+}
+
+#endif
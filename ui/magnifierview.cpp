@@ -44,6 +44,9 @@ MagnifierView::~MagnifierView()
 void MagnifierView::notifySetup(const QVector< Okular::Page* >& pages, int setupFlags)
 {
   if (!(setupFlags & Okular::DocumentObserver::DocumentChanged)) {
+    if (setupFlags & Okular::DocumentObserver::PagesAppended) {
+      m_pages = pages;
+    }
     return;
   }
 
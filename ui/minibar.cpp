@@ -72,8 +72,8 @@ int MiniBarLogic::currentPage() const
 
 void MiniBarLogic::notifySetup( const QVector< Okular::Page * > & pageVector, int setupFlags )
 {
-    // only process data when document changes
-    if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) )
+    // only process data when document changes, or gets more pages
+    if ( !( setupFlags & ( Okular::DocumentObserver::DocumentChanged | Okular::DocumentObserver::PagesAppended ) ) )
         return;
 
     // if document is closed or has no pages, hide widget
@@ -120,6 +120,10 @@ void MiniBarLogic::notifySetup( const QVector< Okular::Page * > & pageVector, in
 
         miniBar->setEnabled( true );
     }
+
+    // the current page stays the same
+    if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) )
+        notifyCurrentPageChanged( -1, m_document->currentPage() );
 }
 
 void MiniBarLogic::notifyCurrentPageChanged( int previousPage, int currentPage )
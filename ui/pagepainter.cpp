@@ -14,6 +14,7 @@
 #include <qpainter.h>
 #include <qpalette.h>
 #include <qpixmap.h>
+#include <qcache.h>
 #include <qvarlengtharray.h>
 #include <kiconloader.h>
 #include <QtCore/QDebug>
@@ -29,6 +30,7 @@
 #include "core/annotations.h"
 #include "core/utils.h"
 #include "guiutils.h"
+#include "imageoperations.h"
 #include "settings.h"
 #include "core/observer.h"
 #include "core/tile.h"
@@ -39,6 +41,40 @@ Q_GLOBAL_STATIC_WITH_ARGS( QPixmap, busyPixmap, ( KIconLoader::global()->loadIco
 
 #define TEXTANNOTATION_ICONSIZE 24
 
+// the recolored pixmaps are kept until they take this many KiB, or as
+// many as the budget of the page pixmaps if that is lower
+#define ACCESSIBILITY_CACHE_SIZE 131072
+// but always this many KiB, enough for the visible pages even when the page
+// pixmaps get no budget at all, so they aren't recolored on every paint
+#define ACCESSIBILITY_CACHE_MIN_SIZE 16384
+
+// page and tile pixmaps recolored following the accessibility settings,
+// by QPixmap::cacheKey() of the original pixmap
+struct AccessibilityCache
+{
+    AccessibilityCache()
+        : renderMode( -1 ), foreground( 0 ), background( 0 ), contrast( 0 ), threshold( 0 ),
+          paper( 0 ), accessiblePaper( 0 ), hasPaper( false ),
+          limit( ACCESSIBILITY_CACHE_SIZE ), pixmaps( ACCESSIBILITY_CACHE_SIZE ) {}
+
+    // the settings the pixmaps were recolored with
+    int renderMode;
+    QRgb foreground;
+    QRgb background;
+    int contrast;
+    int threshold;
+
+    // the last paper color recolored
+    QRgb paper;
+    QRgb accessiblePaper;
+    bool hasPaper;
+
+    // in KiB, see PagePainter::setAccessibilityCacheLimit()
+    int limit;
+    QCache< qint64, QPixmap > pixmaps;
+};
+Q_GLOBAL_STATIC( AccessibilityCache, accessibilityCache )
+
 inline QPen buildPen( const Okular::Annotation *ann, double width, const QColor &color )
 {
     QPen p(
@@ -235,8 +271,18 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
     }
 
     /** 3 - ENABLE BACKBUFFERING IF DIRECT IMAGE MANIPULATION IS NEEDED **/
-    bool bufferAccessibility = (flags & Accessibility) && Okular::SettingsCore::changeColors() && (Okular::SettingsCore::renderMode() != Okular::SettingsCore::EnumRenderMode::Paper);
-    bool useBackBuffer = bufferAccessibility || bufferedHighlights || bufferedAnnotations || viewPortPoint;
+    // the accessibility colors are applied once to the whole pixmaps, that
+    // are then painted like the original ones
+    bool accessibility = (flags & Accessibility) && Okular::SettingsCore::changeColors() && (Okular::SettingsCore::renderMode() != Okular::SettingsCore::EnumRenderMode::Paper);
+    QPixmap accessiblePagePixmap;
+    if ( accessibility )
+        updateAccessibilityCache();
+    if ( accessibility && pixmap )
+    {
+        accessiblePagePixmap = accessiblePixmap( *pixmap );
+        pixmap = &accessiblePagePixmap;
+    }
+    bool useBackBuffer = bufferedHighlights || bufferedAnnotations || viewPortPoint;
     QPixmap * backPixmap = 0;
     QPainter * mixedPainter = 0;
     QRect limitsInPixmap = limits.translated( scaledCrop.topLeft() );
@@ -257,11 +303,12 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
                 QRect limitsInTile = limits & tileRect;
                 if ( !limitsInTile.isEmpty() )
                 {
-                    if ( tile.pixmap()->width() == tileRect.width() && tile.pixmap()->height() == tileRect.height() )
-                        destPainter->drawPixmap( limitsInTile.topLeft(), *(tile.pixmap()),
+                    const QPixmap tilePixmap = accessibility ? accessiblePixmap( *tile.pixmap() ) : *tile.pixmap();
+                    if ( tilePixmap.width() == tileRect.width() && tilePixmap.height() == tileRect.height() )
+                        destPainter->drawPixmap( limitsInTile.topLeft(), tilePixmap,
                                 limitsInTile.translated( -tileRect.topLeft() ) );
                     else
-                        destPainter->drawPixmap( tileRect, *(tile.pixmap()) );
+                        destPainter->drawPixmap( tileRect, tilePixmap );
                 }
                 tIt++;
             }
@@ -300,7 +347,7 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
         if ( hasTilesManager )
         {
             backImage = QImage( limits.width(), limits.height(), QImage::Format_ARGB32_Premultiplied );
-            backImage.fill( paperColor.rgb() );
+            backImage.fill( accessibility ? accessibleColor( paperColor.rgb() ) : paperColor.rgb() );
             QPainter p( &backImage );
             const Okular::NormalizedRect normalizedLimits( limitsInPixmap, scaledWidth, scaledHeight );
             const QList<Okular::Tile> tiles = page->tilesAt( observer, normalizedLimits );
@@ -312,20 +359,21 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
                 QRect limitsInTile = limits & tileRect;
                 if ( !limitsInTile.isEmpty() )
                 {
-                    if ( !tile.pixmap()->hasAlpha() )
+                    const QPixmap tilePixmap = accessibility ? accessiblePixmap( *tile.pixmap() ) : *tile.pixmap();
+                    if ( !tilePixmap.hasAlpha() )
                         has_alpha = false;
 
-                    if ( tile.pixmap()->width() == tileRect.width() && tile.pixmap()->height() == tileRect.height() )
+                    if ( tilePixmap.width() == tileRect.width() && tilePixmap.height() == tileRect.height() )
                     {
-                        p.drawPixmap( limitsInTile.translated( -limits.topLeft() ).topLeft(), *(tile.pixmap()),
+                        p.drawPixmap( limitsInTile.translated( -limits.topLeft() ).topLeft(), tilePixmap,
                                 limitsInTile.translated( -tileRect.topLeft() ) );
                     }
                     else
                     {
-                        double xScale = tile.pixmap()->width() / (double)tileRect.width();
-                        double yScale = tile.pixmap()->height() / (double)tileRect.height();
+                        double xScale = tilePixmap.width() / (double)tileRect.width();
+                        double yScale = tilePixmap.height() / (double)tileRect.height();
                         QTransform transform( xScale, 0, 0, yScale, 0, 0 );
-                        p.drawPixmap( limitsInTile.translated( -limits.topLeft() ), *(tile.pixmap()),
+                        p.drawPixmap( limitsInTile.translated( -limits.topLeft() ), tilePixmap,
                                 transform.mapRect( limitsInTile ).translated( -transform.mapRect( tileRect ).topLeft() ) );
                     }
                 }
@@ -342,44 +390,7 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
                 scalePixmapOnImage( backImage, pixmap, scaledWidth, scaledHeight, limitsInPixmap );
         }
 
-        // 4B.2. modify pixmap following accessibility settings
-        if ( bufferAccessibility )
-        {
-            switch ( Okular::SettingsCore::renderMode() )
-            {
-                case Okular::SettingsCore::EnumRenderMode::Inverted:
-                    // Invert image pixels using QImage internal function
-                    backImage.invertPixels(QImage::InvertRgb);
-                    break;
-                case Okular::SettingsCore::EnumRenderMode::Recolor:
-                    recolor(&backImage, Okular::Settings::recolorForeground(), Okular::Settings::recolorBackground());
-                    break;
-                case Okular::SettingsCore::EnumRenderMode::BlackWhite:
-                    // Manual Gray and Contrast
-                    unsigned int * data = (unsigned int *)backImage.bits();
-                    int val, pixels = backImage.width() * backImage.height(),
-                        con = Okular::Settings::bWContrast(), thr = 255 - Okular::Settings::bWThreshold();
-                    for( int i = 0; i < pixels; ++i )
-                    {
-                        val = qGray( data[i] );
-                        if ( val > thr )
-                            val = 128 + (127 * (val - thr)) / (255 - thr);
-                        else if ( val < thr )
-                            val = (128 * val) / thr;
-                        if ( con > 2 )
-                        {
-                            val = con * ( val - thr ) / 2 + thr;
-                            if ( val > 255 )
-                                val = 255;
-                            else if ( val < 0 )
-                                val = 0;
-                        }
-                        data[i] = qRgba( val, val, val, 255 );
-                    }
-                    break;
-            }
-        }
-        // 4B.3. highlight rects in page
+        // 4B.2. highlight rects in page
         if ( bufferedHighlights )
         {
             // draw highlights that are inside the 'limits' paint region
@@ -392,44 +403,11 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
                 highlightRect.translate( -limits.left(), -limits.top() );
 
                 // highlight composition (product: highlight color * destcolor)
-                unsigned int * data = (unsigned int *)backImage.bits();
-                int val, newR, newG, newB,
-                    rh = (*hIt).first.red(),
-                    gh = (*hIt).first.green(),
-                    bh = (*hIt).first.blue(),
-                    offset = highlightRect.top() * backImage.width();
-                for( int y = highlightRect.top(); y <= highlightRect.bottom(); ++y )
-                {
-                    for( int x = highlightRect.left(); x <= highlightRect.right(); ++x )
-                    {
-                        val = data[ x + offset ];
-                        //for odt or epub
-                        if(has_alpha)
-                        {
-                            newR = qRed(val);
-                            newG = qGreen(val);
-                            newB = qBlue(val);
-
-                            if(newR == newG && newG == newB && newR == 0)
-                                newR = newG = newB = 255;
-
-                            newR = (newR * rh) / 255;
-                            newG = (newG * gh) / 255;
-                            newB = (newB * bh) / 255;
-                        }
-                        else
-                        {
-                            newR = (qRed(val) * rh) / 255;
-                            newG = (qGreen(val) * gh) / 255;
-                            newB = (qBlue(val) * bh) / 255;
-                        }
-                        data[ x + offset ] = qRgba( newR, newG, newB, 255 );
-                    }
-                    offset += backImage.width();
-                }
+                // pages with alpha (odt or epub) have transparent pixels that are black
+                ImageOperations::multiply( backImage, highlightRect, (*hIt).first, has_alpha );
             }
         }
-        // 4B.4. paint annotations [COMPOSITED ONES]
+        // 4B.3. paint annotations [COMPOSITED ONES]
         if ( bufferedAnnotations )
         {
             // Albert: This is quite "heavy" but all the backImage that reach here are QImage::Format_ARGB32_Premultiplied
@@ -649,10 +627,10 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
 */
         }
 
-        // 4B.5. create the back pixmap converting from the local image
+        // 4B.4. create the back pixmap converting from the local image
         backPixmap = new QPixmap( QPixmap::fromImage( backImage ) );
 
-        // 4B.6. create a painter over the pixmap and set it as the active one
+        // 4B.5. create a painter over the pixmap and set it as the active one
         mixedPainter = new QPainter( backPixmap );
         mixedPainter->translate( -limits.left(), -limits.top() );
     }
@@ -891,83 +869,110 @@ void PagePainter::recolor(QImage *image, const QColor &foreground, const QColor
 
     Q_ASSERT(image->format() == QImage::Format_ARGB32_Premultiplied);
 
-    const float scaleRed = background.redF() - foreground.redF();
-    const float scaleGreen = background.greenF() - foreground.greenF();
-    const float scaleBlue = background.blueF() - foreground.blueF();
+    ImageOperations::recolor(*image, foreground, background);
+}
 
-    for (int y=0; y<image->height(); y++) {
-        QRgb *pixels = reinterpret_cast<QRgb*>(image->scanLine(y));
+void PagePainter::changeImageColors( QImage & image )
+{
+    switch ( Okular::SettingsCore::renderMode() )
+    {
+        case Okular::SettingsCore::EnumRenderMode::Inverted:
+            // Invert image pixels using QImage internal function
+            image.invertPixels(QImage::InvertRgb);
+            break;
+        case Okular::SettingsCore::EnumRenderMode::Recolor:
+            recolor(&image, Okular::Settings::recolorForeground(), Okular::Settings::recolorBackground());
+            break;
+        case Okular::SettingsCore::EnumRenderMode::BlackWhite:
+            // Manual Gray and Contrast
+            ImageOperations::blackWhite( image, Okular::Settings::bWContrast(), 255 - Okular::Settings::bWThreshold() );
+            break;
+        default: ;
+    }
+}
 
-        for (int x=0; x<image->width(); x++) {
-            const int lightness = qGray(pixels[x]);
-            pixels[x] = qRgba(scaleRed * lightness + foreground.red(),
-                           scaleGreen * lightness + foreground.green(),
-                           scaleBlue * lightness + foreground.blue(),
-                           qAlpha(pixels[x]));
-        }
+void PagePainter::setAccessibilityCacheLimit( qulonglong pixmapBudget )
+{
+    accessibilityCache()->limit = (int)qBound( (qulonglong)ACCESSIBILITY_CACHE_MIN_SIZE, pixmapBudget / 1024, (qulonglong)ACCESSIBILITY_CACHE_SIZE );
+}
+
+void PagePainter::updateAccessibilityCache()
+{
+    AccessibilityCache *cache = accessibilityCache();
+
+    // forget the pixmaps recolored with different settings
+    const int renderMode = Okular::SettingsCore::renderMode();
+    const QRgb foreground = Okular::Settings::recolorForeground().rgba();
+    const QRgb background = Okular::Settings::recolorBackground().rgba();
+    const int contrast = Okular::Settings::bWContrast();
+    const int threshold = Okular::Settings::bWThreshold();
+    if ( renderMode != cache->renderMode || foreground != cache->foreground || background != cache->background ||
+         contrast != cache->contrast || threshold != cache->threshold )
+    {
+        cache->pixmaps.clear();
+        cache->hasPaper = false;
+        cache->renderMode = renderMode;
+        cache->foreground = foreground;
+        cache->background = background;
+        cache->contrast = contrast;
+        cache->threshold = threshold;
     }
+
+    if ( cache->limit != cache->pixmaps.maxCost() )
+        cache->pixmaps.setMaxCost( cache->limit );
 }
 
-void PagePainter::scalePixmapOnImage ( QImage & dest, const QPixmap * src,
-    int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format )
+QRgb PagePainter::accessibleColor( QRgb color )
 {
-    // {source, destination, scaling} params
-    int srcWidth = src->width(),
-        srcHeight = src->height(),
-        destLeft = cropRect.left(),
-        destTop = cropRect.top(),
-        destWidth = cropRect.width(),
-        destHeight = cropRect.height();
-
-    // destination image (same geometry as the pageLimits rect)
-    dest = QImage( destWidth, destHeight, format );
-    unsigned int * destData = (unsigned int *)dest.bits();
-
-    // source image (1:1 conversion from pixmap)
-    QImage srcImage = src->toImage().convertToFormat(format);
-    unsigned int * srcData = (unsigned int *)srcImage.bits();
-
-    // precalc the x correspondancy conversion in a lookup table
-    QVarLengthArray<unsigned int> xOffset( destWidth );
-    for ( int x = 0; x < destWidth; x++ )
-        xOffset[ x ] = ((x + destLeft) * srcWidth) / scaledWidth;
-
-    // for each pixel of the destination image apply the color of the
-    // corresponsing pixel on the source image (note: keep parenthesis)
-    for ( int y = 0; y < destHeight; y++ )
+    AccessibilityCache *cache = accessibilityCache();
+
+    if ( !cache->hasPaper || cache->paper != color )
     {
-        unsigned int srcOffset = srcWidth * (((destTop + y) * srcHeight) / scaledHeight);
-        for ( int x = 0; x < destWidth; x++ )
-            (*destData++) = srcData[ srcOffset + xOffset[x] ];
+        QImage image( 1, 1, QImage::Format_ARGB32_Premultiplied );
+        image.fill( color );
+        changeImageColors( image );
+        cache->paper = color;
+        cache->accessiblePaper = image.pixel( 0, 0 );
+        cache->hasPaper = true;
     }
+    return cache->accessiblePaper;
 }
 
-/** Private Helpers :: Image Drawing **/
-// from Arthur - qt4
-static inline int qt_div_255(int x) { return (x + (x>>8) + 0x80) >> 8; }
+QPixmap PagePainter::accessiblePixmap( const QPixmap & pixmap )
+{
+    AccessibilityCache *cache = accessibilityCache();
+
+    if ( const QPixmap *cached = cache->pixmaps.object( pixmap.cacheKey() ) )
+        return *cached;
+
+    // keep the format of the original pixmap, the painting depends on its alpha
+    QImage image = pixmap.toImage().convertToFormat( QImage::Format_ARGB32_Premultiplied );
+    changeImageColors( image );
+    const QPixmap result = QPixmap::fromImage( image.convertToFormat( pixmap.hasAlpha() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32 ) );
+
+    cache->pixmaps.insert( pixmap.cacheKey(), new QPixmap( result ), qMax( 1, result.width() * result.height() * result.depth() / 8 / 1024 ) );
+    return result;
+}
 
+void PagePainter::scalePixmapOnImage ( QImage & dest, const QPixmap * src,
+    int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format )
+{
+    QImage srcImage = src->toImage();
+
+    // the opaque pixels are the same in all the 32 bit formats, the page
+    // pixmaps don't need to be converted
+    if ( srcImage.format() != format &&
+         !( srcImage.format() == QImage::Format_RGB32 && ( format == QImage::Format_ARGB32 || format == QImage::Format_ARGB32_Premultiplied ) ) )
+        srcImage = srcImage.convertToFormat( format );
+
+    ImageOperations::scaleNearest( dest, srcImage, scaledWidth, scaledHeight, cropRect, format );
+}
+
+/** Private Helpers :: Image Drawing **/
 void PagePainter::changeImageAlpha( QImage & image, unsigned int destAlpha )
 {
-    // iterate over all pixels changing the alpha component value
-    unsigned int * data = (unsigned int *)image.bits();
-    unsigned int pixels = image.width() * image.height();
-
-    int source, sourceAlpha;
-    for( unsigned int i = 0; i < pixels; ++i )
-    {   // optimize this loop keeping byte order into account
-        source = data[i];
-        if ( (sourceAlpha = qAlpha( source )) == 255 )
-        {
-            // use destAlpha
-            data[i] = qRgba( qRed(source), qGreen(source), qBlue(source), destAlpha );
-        }
-        else
-        {
-            // use destAlpha * sourceAlpha product
-            sourceAlpha = qt_div_255( destAlpha * sourceAlpha );
-            data[i] = qRgba( qRed(source), qGreen(source), qBlue(source), sourceAlpha );
-        }
-    }
+    // multiply the alpha component of all the pixels by destAlpha
+    ImageOperations::scaleAlpha( image, destAlpha );
 }
 
 void PagePainter::drawShapeOnImage(
@@ -52,10 +52,29 @@ class Q_DECL_EXPORT PagePainter
             int flags, int scaledWidth, int scaledHeight, const QRect & pageLimits,
             const Okular::NormalizedRect & crop, Okular::NormalizedPoint *viewPortPoint );
 
+        // keep the pixmaps recolored for accessibility within the memory
+        // 'pixmapBudget' of the page pixmaps they are made from
+        static void setAccessibilityCacheLimit( qulonglong pixmapBudget );
+
     private:
         static void cropPixmapOnImage( QImage & dest, const QPixmap * src, const QRect & r );
         static void recolor(QImage *image, const QColor &foreground, const QColor &background);
 
+        // change the colors of the image following the accessibility settings
+        static void changeImageColors( QImage & image );
+
+        // check the accessibility settings and the memory limit once per
+        // paint, before accessiblePixmap() is called
+        static void updateAccessibilityCache();
+
+        // the paper 'color' with the accessibility colors, computed once for
+        // every color and settings
+        static QRgb accessibleColor( QRgb color );
+
+        // the pixmap with the accessibility colors, computed once for every
+        // pixmap and settings
+        static QPixmap accessiblePixmap( const QPixmap & pixmap );
+
         // create an image taking the 'cropRect' portion of an image scaled
         // to 'scaledWidth' by 'scaledHeight' pixels. cropRect must be inside
         // the QRect(0,0, scaledWidth,scaledHeight)
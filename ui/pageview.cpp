@@ -958,24 +958,36 @@ void PageView::notifySetup( const QVector< Okular::Page * > & pageSet, int setup
             return;
     }
 
-    // mouseAnnotation must not access our PageViewItem widgets any longer
-    d->mouseAnnotation->reset();
+    // when pages are added at the end the widgets of the others are kept
+    const bool pagesAppended = ( setupFlags & Okular::DocumentObserver::PagesAppended ) && !documentChanged &&
+                               !( setupFlags & Okular::DocumentObserver::NewLayoutForPages ) && pageSet.count() > d->items.count();
 
-    // delete all widgets (one for each page in pageSet)
-    QVector< PageViewItem * >::const_iterator dIt = d->items.constBegin(), dEnd = d->items.constEnd();
-    for ( ; dIt != dEnd; ++dIt )
-        delete *dIt;
-    d->items.clear();
-    d->visibleItems.clear();
-    d->pagesWithTextSelection.clear();
-    toggleFormWidgets( false );
-    if ( d->formsWidgetController )
-        d->formsWidgetController->dropRadioButtons();
+    bool hasformwidgets = false;
+    if ( pagesAppended )
+    {
+        foreach ( PageViewItem * item, d->items )
+            hasformwidgets = hasformwidgets || !item->formWidgets().isEmpty();
+    }
+    else
+    {
+        // mouseAnnotation must not access our PageViewItem widgets any longer
+        d->mouseAnnotation->reset();
+
+        // delete all widgets (one for each page in pageSet)
+        QVector< PageViewItem * >::const_iterator dIt = d->items.constBegin(), dEnd = d->items.constEnd();
+        for ( ; dIt != dEnd; ++dIt )
+            delete *dIt;
+        d->items.clear();
+        d->visibleItems.clear();
+        d->pagesWithTextSelection.clear();
+        toggleFormWidgets( false );
+        if ( d->formsWidgetController )
+            d->formsWidgetController->dropRadioButtons();
+    }
 
     bool haspages = !pageSet.isEmpty();
-    bool hasformwidgets = false;
     // create children widgets
-    QVector< Okular::Page * >::const_iterator setIt = pageSet.constBegin(), setEnd = pageSet.constEnd();
+    QVector< Okular::Page * >::const_iterator setIt = pageSet.constBegin() + d->items.count(), setEnd = pageSet.constEnd();
     for ( ; setIt != setEnd; ++setIt )
     {
         PageViewItem * item = new PageViewItem( *setIt );
@@ -999,6 +1011,8 @@ void PageView::notifySetup( const QVector< Okular::Page * > & pageSet, int setup
                 hasformwidgets = true;
             }
         }
+        if ( pagesAppended && d->m_formsVisible )
+            item->setFormWidgetsVisible( true );
         const QLinkedList< Okular::Annotation * > annotations = (*setIt)->annotations();
         QLinkedList< Okular::Annotation * >::const_iterator aIt = annotations.constBegin(), aEnd = annotations.constEnd();
         for ( ; aIt != aEnd; ++aIt )
@@ -1064,6 +1078,10 @@ void PageView::notifySetup( const QVector< Okular::Page * > & pageSet, int setup
 
     updateActionState( haspages, documentChanged, hasformwidgets );
 
+    // the annotation windows and the selection are still on the same pages
+    if ( pagesAppended )
+        return;
+
     // We need to assign it to a different list otherwise slotAnnotationWindowDestroyed
     // will bite us and clear d->m_annowindows
     QHash< Okular::Annotation *, AnnotWindow * > annowindows = d->m_annowindows;
@@ -1390,7 +1408,8 @@ void PageView::notifyZoom( int factor )
 bool PageView::canUnloadPixmap( int pageNumber ) const
 {
     if ( Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Low ||
-         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Normal )
+         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Normal ||
+         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Adaptive )
     {
         // if the item is visible, forbid unloading
         QLinkedList< PageViewItem * >::const_iterator vIt = d->visibleItems.constBegin(), vEnd = d->visibleItems.constEnd();
@@ -3427,6 +3446,10 @@ void PageView::drawDocumentOnPainter( const QRect & contentsRect, QPainter * p )
     // create a region from which we'll subtract painted rects
     QRegion remainingArea( contentsRect );
 
+    // the recolored copies can't take more memory than the page pixmaps
+    // they are made from are allowed to
+    PagePainter::setAccessibilityCacheLimit( d->document->pixmapCacheBudget() );
+
     // iterate over all items painting the ones intersecting contentsRect
     QVector< PageViewItem * >::const_iterator iIt = d->items.constBegin(), iEnd = d->items.constEnd();
     for ( ; iIt != iEnd; ++iIt )
@@ -311,21 +311,28 @@ PresentationWidget::~PresentationWidget()
 
 void PresentationWidget::notifySetup( const QVector< Okular::Page * > & pageSet, int setupFlags )
 {
+    // pages added at the end of the document get their frames too
+    const bool pagesAppended = !( setupFlags & Okular::DocumentObserver::DocumentChanged ) &&
+                               ( setupFlags & Okular::DocumentObserver::PagesAppended ) && pageSet.count() > m_frames.count();
+
     // same document, nothing to change - here we assume the document sets up
     // us with the whole document set as first notifySetup()
-    if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) )
+    if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) && !pagesAppended )
         return;
 
-    // delete previous frames (if any (shouldn't be))
-    QVector< PresentationFrame * >::iterator fIt = m_frames.begin(), fEnd = m_frames.end();
-    for ( ; fIt != fEnd; ++fIt )
-        delete *fIt;
-    if ( !m_frames.isEmpty() )
-        qCWarning(OkularUiDebug) << "Frames setup changed while a Presentation is in progress.";
-    m_frames.clear();
+    if ( !pagesAppended )
+    {
+        // delete previous frames (if any (shouldn't be))
+        QVector< PresentationFrame * >::iterator fIt = m_frames.begin(), fEnd = m_frames.end();
+        for ( ; fIt != fEnd; ++fIt )
+            delete *fIt;
+        if ( !m_frames.isEmpty() )
+            qCWarning(OkularUiDebug) << "Frames setup changed while a Presentation is in progress.";
+        m_frames.clear();
+    }
 
     // create the new frames
-    QVector< Okular::Page * >::const_iterator setIt = pageSet.begin(), setEnd = pageSet.end();
+    QVector< Okular::Page * >::const_iterator setIt = pageSet.begin() + m_frames.count(), setEnd = pageSet.end();
     float screenRatio = (float)m_height / (float)m_width;
     for ( ; setIt != setEnd; ++setIt )
     {
@@ -379,6 +386,13 @@ void PresentationWidget::notifySetup( const QVector< Okular::Page * > & pageSet,
     m_metaStrings += i18n( "Pages: %1", m_document->pages() );
     m_metaStrings += i18n( "Click to begin" );
 
+    // the new pages can be typed in the top bar
+    if ( pagesAppended && m_pagesEdit )
+    {
+        if ( QIntValidator *validator = m_pagesEdit->findChild< QIntValidator * >() )
+            validator->setTop( m_document->pages() );
+    }
+
     m_isSetup = true;
 }
 
@@ -488,7 +502,8 @@ void PresentationWidget::notifyCurrentPageChanged( int previousPage, int current
 bool PresentationWidget::canUnloadPixmap( int pageNumber ) const
 {
     if ( Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Low ||
-         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Normal )
+         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Normal ||
+         Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Adaptive )
     {
         // can unload all pixmaps except for the currently visible one
         return pageNumber != m_frameIndex;
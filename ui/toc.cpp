@@ -61,7 +61,12 @@ TOC::~TOC()
 void TOC::notifySetup( const QVector< Okular::Page * > & /*pages*/, int setupFlags )
 {
     if ( !( setupFlags & Okular::DocumentObserver::DocumentChanged ) )
-        return;
+    {
+        // documents laid out progressively have a synopsis only when
+        // their last pages are added
+        if ( !m_model->isEmpty() || !m_document->documentSynopsis() )
+            return;
+    }
 
     // clear contents
     m_model->clear();